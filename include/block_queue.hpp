@@ -17,9 +17,12 @@ class block_queue {
   void waiting_empty();
   bool full();
   void push_back(T&& item);
+  // false instead of blocking when the queue is full
+  bool try_push_back(T&& item);
   void push_front(T&& item);
   bool pop(T& item);
   bool pop(T& item, int timeout);
+  bool pop(T& item, std::chrono::milliseconds timeout);
   void clear();
   bool front(T& value);
   bool back(T& value);
@@ -64,6 +67,18 @@ void block_queue<T>::push_back(T&& item) {
   s_full_.release();
 }
 
+template <class T>
+bool block_queue<T>::try_push_back(T&& item) {
+  if (!s_empty_.try_acquire()) {
+    return false;
+  }
+  std::unique_lock u_lock_(s_mutex_);
+  deq_.push_back(std::forward<T>(item));
+  u_lock_.unlock();
+  s_full_.release();
+  return true;
+}
+
 template <class T>
 void block_queue<T>::push_front(T&& item) {
   s_empty_.acquire();
@@ -86,7 +101,12 @@ bool block_queue<T>::pop(T& item) {
 
 template <class T>
 bool block_queue<T>::pop(T& item, int timeout) {
-  if (s_full_.try_acquire_for(std::chrono::seconds(timeout))) {
+  return pop(item, std::chrono::seconds(timeout));
+}
+
+template <class T>
+bool block_queue<T>::pop(T& item, std::chrono::milliseconds timeout) {
+  if (s_full_.try_acquire_for(timeout)) {
     std::unique_lock u_lock_(s_mutex_);
     item = std::move(deq_.front());
     deq_.pop_front();
@@ -21,6 +21,9 @@ class buffer {
 
   ~buffer() = default;
 
+  // capacity of buffers created from now on
+  static void set_initial_size(size_t size) { initial_size_ = size; }
+
   buffer &operator=(buffer &&other) {
     buffer_ = std::move(other.buffer_);
     read_index_ = other.read_index_;
@@ -75,6 +78,16 @@ class buffer {
   void append(const char *data, size_t len);
   void append(const std::string &str);
 
+  // for writers that format straight into the buffer: ensure_writeable(),
+  // fill begin_write(), then has_written()
+  char *begin_write() { return write_begin_(); }
+  void has_written(size_t len) { has_writen(len); }
+  // takes back the last len bytes appended
+  void unwrite(size_t len) {
+    assert(len <= readable_bytes());
+    write_index_ -= len;
+  }
+
   void shrink_(size_t reserve);
   size_t internal_capacity_() const { return buffer_.capacity(); }
 
@@ -87,7 +100,7 @@ class buffer {
 
  private:
   static const size_t prepend_ = 8;
-  static const size_t initial_size_ = 1024;
+  static size_t initial_size_;
   std::vector<char> buffer_;
   size_t read_index_;
   size_t write_index_;
@@ -0,0 +1,176 @@
+#ifndef CONFIG_H
+#define CONFIG_H
+
+#include <cstddef>
+#include <string>
+#include <utility>
+#include <vector>
+
+/*
+  config:
+    every tunable of the server, read from a "key = value" file and then
+    overridden by --key=value on the command line. settings marked live
+    are re-read on SIGHUP and applied without a restart; the rest take
+    effect on the next start (or hot restart)
+*/
+
+struct server_config {
+  // listening
+  int port = 1316;
+  int tls_port = 0;
+  std::string cert_file;
+  std::string key_file;
+  int trig_mode = 3;
+  bool opt_linger = false;
+  int backlog = 1024;
+  // socket tuning, set on the listeners and inherited by every accepted
+  // socket: Nagle off, head and file body corked together, accept only
+  // once a request's first bytes arrived (seconds, 0: at once), the TCP
+  // Fast Open queue (0: off), buffer sizes (0: autotuned) and busy
+  // polling (us, 0: off)
+  bool tcp_nodelay = true;
+  bool tcp_cork = true;
+  int defer_accept_s = 0;
+  int fastopen_queue = 0;
+  int rcvbuf = 0;
+  int sndbuf = 0;
+  int busy_poll_us = 0;
+  // connections taken per wakeup of a level-triggered listener; an edge
+  // triggered one is always drained
+  int accept_batch = 64;
+
+  // mysql
+  std::string sql_host = "0.0.0.0";
+  int sql_port = 3306;
+  std::string sql_user = "root";
+  std::string sql_pwd = "1";
+  std::string db_name = "webserver";
+  int sql_pool = 12;
+  int sql_wait_ms = 500;  // live
+  // threads running queries, 0 runs them on the request workers
+  int db_threads = 12;
+
+  // threads and queues. the request workers grow from threads up to
+  // threads_max (live; 0 means one per cpu) while tasks wait
+  int threads = 6;
+  int threads_max = 0;
+  int task_queue = 1024;
+  // pins the event loop to its cpu and each worker to a cpu of the same
+  // NUMA node
+  bool cpu_affinity = false;
+  // threads reading cold files into the page cache
+  int io_threads = 4;
+  // starting size of connection buffers
+  size_t buffer_size = 1024;
+
+  // logging
+  bool open_log = true;
+  int log_level = 1;  // live
+  int log_queue = 1024;
+
+  // limits, all live. timeout_ms closes idle connections, drain_ms bounds
+  // a graceful shutdown
+  int timeout_ms = 10000;
+  int drain_ms = 10000;
+  // accepting pauses at max_conn and resumes below 90% of it
+  int max_conn = 65536 - 1024;
+  int max_conn_per_ip = 256;
+  // new requests are shed once a task waits this long for a worker, or
+  // the worker queue is three quarters full
+  int queue_delay_max_ms = 200;
+  // per client address: requests/s and response bytes/s, with bursts
+  int rate_requests = 1000;
+  int rate_request_burst = 2000;
+  int rate_bytes = 64 << 20;
+  int rate_byte_burst = 128 << 20;
+
+  // login sessions: idle lifetime (0 turns them off) and how many are kept
+  int session_ttl_s = 1800;
+  int max_sessions = 1 << 20;
+  // password hashing threads (0 hashes on the request workers), how many
+  // hashes may wait for them before logins get 503, and the PBKDF2 cost
+  // of new hashes (live)
+  int hash_threads = 2;
+  int hash_queue = 64;
+  int hash_iterations = 100000;
+  // registrations are written in batches of up to register_batch_rows
+  // (0 writes each on its own), collected for register_batch_ms (live)
+  int register_batch_ms = 2;
+  int register_batch_rows = 64;
+  // the outcome of a login or register post is kept for micro_cache_ms
+  // (0: not kept), then served stale for micro_cache_stale_ms more while
+  // it is worked out again; for up to micro_cache_entries posts. all live
+  int micro_cache_ms = 0;
+  int micro_cache_stale_ms = 1000;
+  size_t micro_cache_entries = 4096;
+
+  // reverse proxy routes, "/prefix=host:port,host:port;/other=host:port"
+  // (empty: none). each backend keeps up to proxy_idle idle keep-alive
+  // connections and is probed with GET proxy_health_path every
+  // proxy_health_ms (0: only failed connects mark it down)
+  std::string proxy;
+  int proxy_idle = 32;
+  std::string proxy_health_path = "/";
+  int proxy_health_ms = 2000;
+
+  // websockets are pinged every ws_ping_ms (0: never) and dropped when
+  // the last ping went unanswered; a message from a client may be up to
+  // ws_max_message, and a client more than ws_queue_max behind on its
+  // frames is dropped. all live
+  int ws_ping_ms = 5000;
+  size_t ws_max_message = 64 * 1024;
+  size_t ws_queue_max = 1 << 20;
+
+  // files up to preload_max are kept in memory, preload_budget in total;
+  // live, applied by rebuilding the resource index
+  size_t preload_max = 64 * 1024;
+  size_t preload_budget = 64 << 20;
+  // request paths whose canonical form is kept, live (0: none)
+  size_t path_cache = 8192;
+  // a bundle made by pack_resources, served in place of the resource tree
+  // (empty: the tree). renaming a new bundle over it swaps it in
+  std::string bundle;
+
+  // POST/PUT /upload saves files into upload_dir (empty: no uploads), up
+  // to upload_max a request, streamed to disk as they arrive
+  std::string upload_dir;
+  size_t upload_max = 64 << 20;
+};
+
+class config {
+ public:
+  // a setting that differs between two loads
+  struct change {
+    const char *key;
+    bool live;
+    std::string value;
+  };
+
+  // -c/--config FILE, --key=value or --key value, -h/--help. false on a
+  // bad option, with the reason on stderr
+  bool parse_args(int argc, char *argv[]);
+  // defaults, then the file, then the command line; false on any error
+  bool load(server_config &cfg) const;
+  bool wants_help() const { return help_; }
+  static void print_help(const char *prog);
+
+  // copies the live settings of next into cur and lists every setting
+  // that differs, live or not
+  static std::vector<change> merge_live(server_config &cur,
+                                        const server_config &next);
+
+  // without -c, this file is read if it exists
+  static constexpr const char *DEFAULT_PATH = "./webserver.conf";
+
+ private:
+  static bool set_(server_config &cfg, const std::string &key,
+                   const std::string &value, const std::string &where);
+  static bool check_(const server_config &cfg);
+
+  std::string path_ = DEFAULT_PATH;
+  bool path_given_ = false;
+  bool help_ = false;
+  std::vector<std::pair<std::string, std::string>> overrides_;
+};
+
+#endif
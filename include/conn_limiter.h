@@ -0,0 +1,49 @@
+#ifndef CONN_LIMITER_H
+#define CONN_LIMITER_H
+
+#include <netinet/in.h>
+
+#include <array>
+#include <atomic>
+#include <mutex>
+#include <unordered_map>
+
+/*
+  conn_limiter:
+    open connections per client address. the event loop takes a slot when
+    it accepts a connection and the connection hands it back when it
+    closes, on whichever thread that happens
+*/
+
+class conn_limiter {
+ public:
+  static conn_limiter *instance();
+
+  // 0 turns the limit off; may change while connections come and go
+  void init(int max_per_ip) { max_per_ip_ = max_per_ip; }
+
+  // false when ip is already at the limit
+  bool acquire(in_addr_t ip);
+  void release(in_addr_t ip);
+
+ private:
+  conn_limiter() = default;
+  ~conn_limiter() = default;
+
+  struct shard {
+    std::mutex mtx;
+    std::unordered_map<in_addr_t, int> conns;
+  };
+
+  static const size_t SHARDS_ = 16;
+
+  // s_addr is in network order, so mix it before picking a shard
+  shard &shard_(in_addr_t ip) {
+    return shards_[(ip * 2654435761u) >> 28 & (SHARDS_ - 1)];
+  }
+
+  std::atomic<int> max_per_ip_{0};
+  std::array<shard, SHARDS_> shards_;
+};
+
+#endif
@@ -0,0 +1,26 @@
+#ifndef CPU_TOPOLOGY_H
+#define CPU_TOPOLOGY_H
+
+#include <string>
+#include <vector>
+
+/*
+  cpu_topology:
+    which cpus this process may use and which NUMA node each sits on, read
+    from sched_getaffinity and /sys. without /sys everything is node 0
+*/
+
+class cpu_topology {
+ public:
+  // cpus in the process's affinity mask
+  static std::vector<int> allowed();
+  static int node_of(int cpu);
+  // the allowed cpus on the same node as cpu, cpu included
+  static std::vector<int> same_node(int cpu);
+  // binds the calling thread to one cpu
+  static bool pin_self(int cpu);
+  // parses a kernel cpu list such as "0-3,8,10-11"
+  static std::vector<int> parse_list(const std::string &list);
+};
+
+#endif
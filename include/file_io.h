@@ -0,0 +1,59 @@
+#ifndef FILE_IO_H
+#define FILE_IO_H
+
+#include <array>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+
+#include "threadpool.h"
+
+/*
+  file_io:
+    a small thread group of its own that pulls cold files into the page
+    cache (open, fstat, posix_fadvise, readahead), so request workers only
+    ever stat/mmap files that are already resident. a file counts as warm
+    for WARM_SECONDS_ after it was last loaded or served; so does a path
+    found missing, whose lookup is then cached by the kernel too
+*/
+
+class file_io {
+ public:
+  static file_io *instance();
+
+  void init(int threads_num);
+  bool is_open() const { return pool_ != nullptr; }
+
+  // true if the file was touched lately; refreshes the mark
+  bool is_warm(const std::string &path);
+  // runs on an I/O thread; done is called there once the data is cached.
+  // never blocks: false if the I/O queue is full and nothing was started
+  bool prefetch(const std::string &path, std::function<void()> done);
+
+ private:
+  file_io() = default;
+  ~file_io() = default;
+
+  void load_(const std::string &path);
+  void mark_(const std::string &path, long now);
+  static long now_();
+
+  struct shard {
+    std::mutex mtx;
+    std::unordered_map<std::string, long> seen;
+  };
+
+  static const size_t SHARDS_ = 16;
+  static const long WARM_SECONDS_ = 30;
+  // missing paths are the client's to choose; a full shard starts over
+  static const size_t MAX_PER_SHARD_ = 4096;
+  // large files are streamed, only their head is read ahead
+  static const size_t READAHEAD_MAX_ = 4 << 20;
+
+  std::array<shard, SHARDS_> shards_;
+  std::unique_ptr<threadpool> pool_;
+};
+
+#endif
@@ -0,0 +1,96 @@
+#ifndef FILE_UPLOAD_H
+#define FILE_UPLOAD_H
+
+#include <sys/types.h>
+
+#include <atomic>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+#include "multipart_parser.h"
+
+/*
+  file_upload:
+    one request body written to files in a directory as it arrives. a
+    multipart/form-data body has its file parts saved and its plain fields
+    kept in memory; any other body is saved whole as one file, and on a
+    plain socket can be moved there with splice, never passing through
+    user space. files are written under a ".part" name and renamed when
+    complete, and an upload that never completes removes what it wrote
+*/
+
+class file_upload {
+ public:
+  struct file {
+    // the form field, empty for a whole-body upload
+    std::string field;
+    // as the client named it
+    std::string filename;
+    std::string type;
+    // where it was saved
+    std::string path;
+    size_t size = 0;
+  };
+
+  // max_size bounds the body: files and fields together
+  file_upload(std::string dir, size_t max_size);
+  ~file_upload();
+
+  // content_disposition may name a whole-body upload. false with error()
+  // set if the body can't be taken
+  bool begin(std::string_view content_type,
+             std::string_view content_disposition = {});
+  // body bytes in order; false with error() set on failure
+  bool write(const char *data, size_t len);
+  // a whole-body upload only: up to len bytes from the socket fd to the
+  // file through a pipe. -1 with save_errno on a socket error, or with
+  // error() set when the file can't take them
+  ssize_t splice_from(int fd, size_t len, int &save_errno);
+  bool can_splice() const { return !parser_ && error_ == 0; }
+  // the body is all in; false with error() set if it was cut short
+  bool finish();
+
+  // an HTTP status for the failure, 0 if none
+  int error() const { return error_; }
+  bool is_complete() const { return complete_; }
+  const std::vector<file> &files() const { return files_; }
+  const std::unordered_map<std::string, std::string> &fields() const {
+    return fields_;
+  }
+  size_t size() const { return size_; }
+
+  // form fields are held in memory, up to this much in all
+  static constexpr size_t MAX_FIELDS_SIZE = 64 * 1024;
+
+ private:
+  bool open_(const multipart_parser::part &part);
+  bool append_(const char *data, size_t len);
+  bool close_();
+  bool fail_(int code);
+  bool charge_(size_t len);
+
+  std::string dir_;
+  size_t max_size_;
+  size_t size_ = 0;
+  int error_ = 0;
+  bool complete_ = false;
+
+  std::unique_ptr<multipart_parser> parser_;
+  // the file being written, and the field being read when it is not one
+  int fd_ = -1;
+  std::string part_path_;
+  std::string field_;
+  bool in_field_ = false;
+  size_t fields_size_ = 0;
+  int pipe_[2] = {-1, -1};
+
+  std::vector<file> files_;
+  std::unordered_map<std::string, std::string> fields_;
+
+  static std::atomic<uint64_t> seq_;
+};
+
+#endif
@@ -0,0 +1,111 @@
+#ifndef H2_SESSION_H
+#define H2_SESSION_H
+
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <map>
+#include <memory>
+#include <string>
+
+#include "buffer.h"
+#include "hpack.h"
+#include "http_request.h"
+
+class http_conn;
+
+/*
+  h2_session:
+    cleartext http/2 (h2c) on one connection. every stream is served by an
+    http_conn of its own, fed a rebuilt http/1.1 request, so routing and file
+    serving stay in http_request/http_response; this class only does the
+    framing, hpack and flow control
+*/
+
+class h2_session {
+ public:
+  // admit is asked for every new stream; a stream it turns down is
+  // answered 429 without being served
+  explicit h2_session(std::function<bool()> admit = nullptr);
+  ~h2_session();
+
+  // 1: the client preface, 0: could still be one, -1: plain http/1.1
+  static int check_preface(const buffer &in);
+  static bool is_upgrade(const http_request &request);
+
+  // server preface, must be the first thing sent
+  void start(buffer &out);
+  // h2c upgrade: the http/1.1 request becomes stream 1
+  bool upgrade(const http_request &request, buffer &out);
+
+  void on_read(buffer &in, buffer &out);
+  // frames pending data into out, as far as the flow control windows allow
+  void flush(buffer &out);
+  bool is_closed() const {
+    return closed_ || (peer_goaway_ && streams_.empty());
+  }
+  // no stream in flight
+  bool is_idle() const { return streams_.empty(); }
+
+ private:
+  struct stream {
+    hpack::header_list headers;
+    std::string header_block;
+    std::string body;
+    bool end_stream = false;
+    bool dispatched = false;
+    bool too_large = false;
+    bool limited = false;
+    int64_t send_window = 0;
+    std::unique_ptr<http_conn> conn;
+  };
+
+  void on_frame_(uint8_t type, uint8_t flags, uint32_t id, const uint8_t *data,
+                 size_t len, buffer &out);
+  void on_headers_(uint8_t flags, uint32_t id, const uint8_t *data, size_t len,
+                   buffer &out);
+  void on_continuation_(uint8_t flags, uint32_t id, const uint8_t *data,
+                        size_t len, buffer &out);
+  void on_data_(uint8_t flags, uint32_t id, const uint8_t *data, size_t len,
+                buffer &out);
+  void on_settings_(uint8_t flags, const uint8_t *data, size_t len,
+                    buffer &out);
+  void on_window_update_(uint32_t id, const uint8_t *data, size_t len,
+                         buffer &out);
+  void on_header_block_end_(uint32_t id, buffer &out);
+
+  void dispatch_(uint32_t id, buffer &out);
+  bool send_response_(uint32_t id, stream &s, buffer &out);
+
+  void write_frame_(buffer &out, uint8_t type, uint8_t flags, uint32_t id,
+                    const char *data, size_t len);
+  void write_window_update_(buffer &out, uint32_t id, uint32_t increment);
+  void reset_stream_(buffer &out, uint32_t id, uint32_t code);
+  void goaway_(buffer &out, uint32_t code);
+
+  std::function<bool()> admit_;
+  hpack decoder_;
+  std::map<uint32_t, stream> streams_;
+  // streams with response data left, served round-robin
+  std::deque<uint32_t> ready_;
+
+  bool preface_ = false;
+  bool closed_ = false;
+  bool peer_goaway_ = false;
+  uint32_t last_stream_id_ = 0;
+  uint32_t continuation_id_ = 0;
+
+  int64_t conn_send_window_ = DEFAULT_WINDOW_;
+  int64_t peer_initial_window_ = DEFAULT_WINDOW_;
+  size_t peer_max_frame_ = MAX_FRAME_;
+
+  static constexpr int64_t DEFAULT_WINDOW_ = 65535;
+  static constexpr int64_t MAX_WINDOW_ = 0x7fffffff;
+  static constexpr size_t MAX_FRAME_ = 16384;
+  static constexpr size_t MAX_STREAMS_ = 100;
+  static constexpr size_t MAX_HEADER_BLOCK_ = 65536;
+  // stop framing once this much is queued for the socket
+  static constexpr size_t FLUSH_BUDGET_ = 256 * 1024;
+};
+
+#endif
\ No newline at end of file
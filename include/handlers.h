@@ -0,0 +1,170 @@
+#ifndef HANDLERS_H
+#define HANDLERS_H
+
+#include <functional>
+#include <memory>
+#include <string>
+#include <string_view>
+
+#include "file_upload.h"
+#include "micro_cache.hpp"
+#include "router.h"
+#include "upstream.h"
+#include "ws_session.h"
+
+/*
+  handlers:
+    the built-in endpoints. webserver registers the site routes; health and
+    status are there for main() to mount where it likes
+*/
+
+// files under http_conn::src_dir; with a target, that one file for the route
+class static_file_handler : public http_handler {
+ public:
+  static_file_handler() = default;
+  explicit static_file_handler(std::string target)
+      : target_(std::move(target)) {}
+
+  void handle(http_conn &conn) const override;
+  // extra_header: a whole header line such as Set-Cookie, CRLF included
+  static void serve(http_conn &conn, const std::string &path,
+                    std::string_view extra_header = {});
+
+ private:
+  // held in memory by the resource index, no disk access needed
+  static bool is_preloaded_(const std::string &path);
+
+  std::string target_;
+};
+
+// the login and register forms; other methods get the form page itself.
+// success starts a session, and a login with a live session skips the form.
+// passwords are hashed by password_hasher, and a request that finds its
+// queue full gets 503. with the micro-cache on, the outcome of a form post
+// is kept briefly by method, path, Content-Type and a hash of the body, so
+// a burst of the same post costs one query and one hash
+class user_handler : public http_handler {
+ public:
+  user_handler(bool is_login, std::string page)
+      : is_login_(is_login), page_(std::move(page)) {}
+
+  void handle(http_conn &conn) const override;
+
+  // ttl_ms 0 turns the micro-cache off; may be called again to retune
+  static void set_cache(int ttl_ms, int stale_ms, size_t max_entries) {
+    cache_.init(ttl_ms, stale_ms, max_entries);
+  }
+
+ private:
+  enum class RESULT { OK, DENIED, BUSY };
+  using result_cache = micro_cache<RESULT>;
+
+  // both steps on the calling thread, for requests that can't suspend
+  static RESULT login_(const std::string &name, const std::string &pwd);
+  static RESULT register_(const std::string &name, const std::string &pwd);
+  // both steps on the database and hashing threads; done gets the result
+  static void compute_(bool is_login, const std::string &name,
+                       const std::string &pwd,
+                       std::function<void(RESULT)> done);
+  // keeps a result; a new user clears what was kept about logins
+  static void remember_(bool is_login, const std::string &key, RESULT result);
+  static std::string cache_key_(const http_request &request);
+  // on a database thread when there are any, else right here
+  static void run_query_(std::function<void()> task);
+  static bool lookup_(const std::string &name, std::string *stored);
+  static bool insert_(const std::string &name, const std::string &stored);
+  static void finish_(http_conn &conn, RESULT result, const std::string &name);
+
+  bool is_login_;
+  std::string page_;
+
+  static result_cache cache_;
+};
+
+// ends the session of the request's cookie and shows the login form
+class logout_handler : public http_handler {
+ public:
+  void handle(http_conn &conn) const override;
+};
+
+// forwards the requests of its route to an upstream group over pooled
+// keep-alive connections. the worker doesn't wait on the backend: the
+// request is parked until the response head is in, and the body is relayed
+// as the client takes it. a backend that can't be reached or answers with
+// garbage gets the client a 502
+class proxy_handler : public http_handler {
+ public:
+  explicit proxy_handler(std::shared_ptr<upstream> group)
+      : group_(std::move(group)) {}
+
+  void handle(http_conn &conn) const override;
+
+ private:
+  // h2 streams read the whole response on the worker, for at most this
+  static const int FETCH_TIMEOUT_MS_ = 30000;
+
+  std::string make_request_(const http_conn &conn) const;
+  static void finish_(http_conn &conn);
+  static void fail_(http_conn &conn, int code);
+
+  std::shared_ptr<upstream> group_;
+};
+
+// upgrades http/1.1 requests under prefix to websockets, subscribed to
+// the channel named by the rest of the path. what a client sends is
+// published to everyone on its channel, unless on_message says otherwise
+class websocket_handler : public http_handler {
+ public:
+  explicit websocket_handler(std::string prefix,
+                             ws_session::message_callback on_message = nullptr)
+      : prefix_(std::move(prefix)), on_message_(std::move(on_message)) {}
+
+  void handle(http_conn &conn) const override;
+
+ private:
+  static void refuse_(http_conn &conn, int code, const char *why);
+
+  std::string prefix_;
+  ws_session::message_callback on_message_;
+};
+
+// takes uploads into dir, up to max_size a request. a multipart/form-data
+// body has its file parts written out as they arrive, never held whole in
+// memory; any other body is saved as one file. with sessions on, only a
+// logged-in client may upload. on_upload answers once the files are on
+// disk; by default they are listed as JSON
+class upload_handler : public http_handler {
+ public:
+  using callback = std::function<void(http_conn &, const file_upload &)>;
+
+  upload_handler(std::string dir, size_t max_size,
+                 callback on_upload = nullptr)
+      : dir_(std::move(dir)),
+        max_size_(max_size),
+        on_upload_(std::move(on_upload)) {}
+
+  void handle(http_conn &conn) const override;
+  int on_body(http_conn &conn, http_request &request) const override;
+
+ private:
+  // the status to refuse the request with, 0 to take it
+  int check_(const http_request &request) const;
+  static void list_(http_conn &conn, const file_upload &upload);
+
+  std::string dir_;
+  size_t max_size_;
+  callback on_upload_;
+};
+
+class health_handler : public http_handler {
+ public:
+  void handle(http_conn &conn) const override;
+};
+
+// server counters as JSON
+class status_handler : public http_handler {
+ public:
+  void handle(http_conn &conn) const override;
+};
+
+#endif
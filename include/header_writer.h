@@ -0,0 +1,57 @@
+#ifndef HEADER_WRITER_H
+#define HEADER_WRITER_H
+
+#include <atomic>
+#include <cstdint>
+#include <ctime>
+#include <string_view>
+
+#include "buffer.h"
+
+/*
+  header_writer:
+    writes a response head into a buffer. fixed text goes in as pre-rendered
+    fragments, numbers are formatted in place with std::to_chars, and the
+    Date header comes from a copy the event loop refreshes every second
+*/
+
+class header_writer {
+ public:
+  explicit header_writer(buffer &buff) : buff_(buff) {}
+
+  // whole lines, CRLF included
+  header_writer &line(std::string_view text) {
+    buff_.append(text.data(), text.size());
+    return *this;
+  }
+  // name is the rendered "Name: " prefix
+  header_writer &field(std::string_view name, std::string_view value);
+  header_writer &field(std::string_view name, uint64_t value);
+  // "Content-Range: bytes first-last/size", or "bytes */size" when first
+  // is past last
+  header_writer &content_range(uint64_t first, uint64_t last, uint64_t size);
+  header_writer &date();
+  void end() { buff_.append("\r\n", 2); }
+
+  // called by the event loop; t is the current time
+  static void update_date(time_t t);
+  // RFC 7231 IMF-fixdate, out needs HTTP_DATE_LEN bytes
+  static size_t format_date(time_t t, char *out);
+
+  static constexpr size_t HTTP_DATE_LEN = 29;
+
+ private:
+  char *reserve_(size_t len);
+  static char *put_(char *p, std::string_view text);
+  static char *put_(char *p, uint64_t value);
+
+  buffer &buff_;
+
+  // readers copy the slot published last while the loop fills the next one
+  static constexpr size_t DATE_SLOTS_ = 4;
+  static constexpr std::string_view DATE_NAME_ = "Date: ";
+  static char date_[DATE_SLOTS_][HTTP_DATE_LEN];
+  static std::atomic<size_t> date_idx_;
+};
+
+#endif
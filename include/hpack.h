@@ -0,0 +1,53 @@
+#ifndef HPACK_H
+#define HPACK_H
+
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <string>
+#include <utility>
+#include <vector>
+
+/*
+  hpack:
+    http/2 header compression (RFC 7541). decode() keeps the peer's dynamic
+    table; encode() only refers to the static table and sends plain
+    literals, which every decoder has to accept
+*/
+
+class hpack {
+ public:
+  using header_field = std::pair<std::string, std::string>;
+  using header_list = std::vector<header_field>;
+
+  hpack() = default;
+  ~hpack() = default;
+
+  bool decode(const uint8_t *data, size_t len, header_list &headers);
+  static void encode(const header_list &headers, std::string &out);
+
+ private:
+  bool lookup_(uint64_t idx, header_field &field) const;
+  void insert_(const header_field &field);
+  void evict_(size_t max_size);
+
+  static bool decode_int_(const uint8_t *&p, const uint8_t *end, int prefix,
+                          uint64_t &value);
+  static bool decode_string_(const uint8_t *&p, const uint8_t *end,
+                             std::string &str);
+  static bool huffman_decode_(const uint8_t *p, size_t len, std::string &str);
+  static void encode_int_(std::string &out, uint8_t first, int prefix,
+                          uint64_t value);
+  static void encode_string_(std::string &out, const std::string &str);
+
+  std::deque<header_field> dynamic_;
+  size_t dynamic_size_ = 0;
+  size_t max_size_ = SETTINGS_TABLE_SIZE_;
+
+  // the decoder table size we allow, the protocol default
+  static const size_t SETTINGS_TABLE_SIZE_ = 4096;
+  static const size_t ENTRY_OVERHEAD_ = 32;
+  static const size_t MAX_STRING_ = 16384;
+};
+
+#endif
\ No newline at end of file
@@ -3,21 +3,40 @@
 
 #include <arpa/inet.h>
 #include <netinet/in.h>
+#include <openssl/ssl.h>
+#include <sys/sendfile.h>
 #include <sys/socket.h>
 #include <sys/uio.h>
 
 #include <atomic>
+#include <functional>
+#include <memory>
+#include <mutex>
 
 #include "buffer.h"
+#include "file_upload.h"
 #include "http_request.h"
 #include "http_response.h"
+#include "proxy_exchange.h"
+#include "ws_session.h"
+
+class h2_session;
 
 class http_conn {
  public:
-  http_conn() = default;
+  http_conn();
   ~http_conn();
 
-  void init(int sock_fd, const sockaddr_in &addr);
+  // ssl is owned by the connection from here on, nullptr for plain http
+  void init(int sock_fd, const sockaddr_in &addr, SSL *ssl = nullptr);
+
+  // 1: done, 0: wait for EPOLLOUT if want_write() else EPOLLIN, -1: failed
+  int handshake();
+  bool is_handshaked() const { return !ssl_ || handshaked_; }
+  bool is_tls() const { return ssl_ != nullptr; }
+  bool is_h2() const { return h2_ != nullptr; }
+  ws_session *websocket() const { return ws_.get(); }
+  bool want_write() const { return want_write_; }
 
   ssize_t read(int &save_errno);
   ssize_t write(int &save_errno);
@@ -28,15 +47,82 @@ class http_conn {
   const char *ip() const { return inet_ntoa(addr_.sin_addr); }
   sockaddr_in addr() const { return addr_; }
   bool process();
-
-  size_t bytes() const { return write_buff_.readable_bytes() + mm_file_len; }
-  bool is_keep_alive() const { return request_.is_keep_alive(); }
+  // waiting for the next request with nothing in flight. set before the fd
+  // is re-armed for reading and cleared by the event loop when it fires, so
+  // a draining server may shut such a connection down
+  bool is_idle() const { return idle_; }
+  void set_idle(bool idle) { idle_ = idle; }
+  bool has_requests_in_flight() const;
+
+  size_t bytes() const {
+    return write_buff_.readable_bytes() + mm_file_len + file_len +
+           (proxy_ ? proxy_->body_left() : 0) +
+           (ws_ ? ws_->queued_bytes() : 0);
+  }
+  bool is_keep_alive() const;
+  // for a response that can only end by closing the connection
+  void close_after_response() { keep_alive_ = false; }
+
+  // handlers write their response through these; h2_session also runs
+  // each stream through an http_conn of its own with no socket behind it
+  buffer &read_buff() { return read_buff_; }
+  buffer &write_buff() { return write_buff_; }
+  const http_request &request() const { return request_; }
+  http_response &response() { return response_; }
+
+  // a handler waiting on slow work parks the request: next finishes it,
+  // start kicks off the work once the worker is done with this connection,
+  // and the work calls resume(generation()) from any thread when ready.
+  // start returns false if the work could not be started; next then runs
+  // on this worker straight away
+  using continuation = std::function<void(http_conn &)>;
+  bool can_suspend() const { return fd_ >= 0 && on_resume; }
+  void suspend(continuation next, std::function<bool()> start);
+  // false if next is to run now
+  bool start_pending();
+  void resume(uint64_t generation);
+  bool is_pending() const { return pending_; }
+  uint64_t generation() const { return generation_; }
+  // a proxied request; its response body is relayed by write() after the
+  // head in write_buff(), and the exchange lives until the next request
+  void set_proxy(std::unique_ptr<proxy_exchange> proxy) {
+    proxy_ = std::move(proxy);
+  }
+  proxy_exchange *proxy() const { return proxy_.get(); }
+  // the upload a handler's on_body() set up for the request's body; it
+  // lives until the next request
+  void set_upload(std::unique_ptr<file_upload> upload) {
+    upload_ = std::move(upload);
+  }
+  file_upload *upload() const { return upload_.get(); }
+  // the last write() stopped on the upstream, not on this socket
+  bool wants_upstream() const { return proxy_ && proxy_->wants_upstream(); }
+  // the connection speaks websocket once the 101 in write_buff() is out
+  void upgrade_websocket(std::shared_ptr<ws_session> session) {
+    ws_ = std::move(session);
+  }
+  // serializes the workers of a websocket, which frames from other
+  // threads may wake for writing while one is still reading
+  std::unique_lock<std::mutex> lock_io() {
+    return ws_ ? ws_->lock_io() : std::unique_lock<std::mutex>();
+  }
+  // copies out pending response bytes: buffered head, mapped file, then fd
+  size_t read_output(char *dest, size_t len);
 
   void close_();
 
   static bool ET;
+  // TCP_CORK around a head and its sendfile body
+  static bool cork;
   static const char *src_dir;
   static std::atomic<int> user_count;
+  // set on shutdown: http/1 responses go out with Connection: close
+  static std::atomic<bool> draining;
+  // set by webserver, puts a resumed connection back on a worker
+  static std::function<void(http_conn *)> on_resume;
+  // set by webserver, asked once for every request before it is handled:
+  // each http/1.1 request line and each new h2 stream. false answers 429
+  static std::function<bool(const http_conn &)> admit;
 
  private:
   int fd_ = -1;
@@ -44,14 +130,64 @@ class http_conn {
 
   bool is_close_ = true;
 
-  char *mm_file;
-  size_t mm_file_len;
+  SSL *ssl_ = nullptr;
+  bool handshaked_ = false;
+  bool want_write_ = false;
+  bool ktls_send_ = false;
+  bool corked_ = false;
+
+  ssize_t tls_read_(int &save_errno);
+  ssize_t tls_write_(int &save_errno);
+  ssize_t h2_write_(int &save_errno);
+  void cork_head_();
+  void uncork_();
+  bool window_full_() const;
+  ssize_t splice_body_(int &save_errno);
+  int start_body_(http_request &request);
+  bool dispatch_();
+  void take_file_();
+  bool admit_() const { return !admit || admit(*this); }
+  void close_websocket_();
+
+  char *mm_file = nullptr;
+  size_t mm_file_len = 0;
+
+  int file_fd = -1;
+  off_t file_offset = 0;
+  size_t file_len = 0;
+
+  // the most of a file one write task sends before the fd is re-armed,
+  // keeps one viewer from hogging a worker on a huge file
+  static constexpr size_t SENDFILE_WINDOW_ = 1 << 20;
+  // without kTLS a file is pushed through SSL_write one record at a time
+  static constexpr size_t TLS_RECORD_ = 16384;
+  // a read stops once this much waits to be parsed, so a body streamed
+  // to a handler costs no more memory than this however large it is
+  static constexpr size_t READ_WINDOW_ = 256 * 1024;
 
   buffer read_buff_;
   buffer write_buff_;
 
   http_request request_;
   http_response response_;
+  // where the response to the current request starts in write_buff_
+  size_t response_start_ = 0;
+  bool keep_alive_ = false;
+  // admit was asked about the request being parsed
+  bool admitted_ = false;
+
+  std::unique_ptr<h2_session> h2_;
+  std::unique_ptr<proxy_exchange> proxy_;
+  std::unique_ptr<file_upload> upload_;
+  std::shared_ptr<ws_session> ws_;
+
+  continuation next_;
+  std::function<bool()> start_;
+  bool pending_ = false;
+  // bumped on init and close, so a late resume() for an earlier client of
+  // the same slot is dropped
+  std::atomic<uint64_t> generation_{0};
+  std::atomic<bool> idle_{false};
 };
 
 #endif
\ No newline at end of file
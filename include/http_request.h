@@ -1,52 +1,105 @@
 #ifndef HTTP_REQUEST_H
 #define HTTP_REQUEST_H
 
+#include <functional>
 #include <string>
 #include <unordered_map>
-#include <unordered_set>
 
 #include "buffer.h"
 
 class http_request {
  public:
-  enum class PARSE_STATE { REQUEST_LINE, HEADERS, BODY, FINISH };
+  enum class PARSE_STATE {
+    REQUEST_LINE,
+    HEADERS,
+    BODY,
+    CHUNK_SIZE,
+    CHUNK_DATA,
+    CHUNK_CRLF,
+    CHUNK_TRAILER,
+    FINISH
+  };
+
+  // receives the body as it arrives; return false to reject the request
+  using body_callback = std::function<bool(const char *data, size_t len)>;
+  // runs when the head is in and a body follows, before any of it is
+  // read: the place to set a body callback. a nonzero return refuses the
+  // request with that status
+  using head_callback = std::function<int(http_request &)>;
 
   http_request() {}
   ~http_request() = default;
 
+  // the head callback is kept
   void init();
+  // false: need more data, or the request is bad when error_code() != 0
   bool parse(buffer &buff);
 
-  std::string path() const;
-  std::string &path();
+  PARSE_STATE state() const { return state_; }
+  int error_code() const { return error_code_; }
+  // without a callback the body is kept in memory up to max_body_size
+  void set_body_callback(body_callback cb) { body_cb_ = std::move(cb); }
+  void set_head_callback(head_callback cb) { head_cb_ = std::move(cb); }
+  // from a callback: the request fails with code
+  void reject(int code);
+  // of a Content-Length body; the read side may take it off the socket
+  // itself and report it with skip_body()
+  size_t body_left() const {
+    return state_ == PARSE_STATE::BODY ? body_remaining_ : 0;
+  }
+  void skip_body(size_t len);
+
+  // canonical, see path_resolver; the query is in target()
+  const std::string &path() const { return path_; }
+  std::string &path() { return path_; }
+  // as sent in the request line
+  const std::string &target() const { return target_; }
   std::string method() const;
   std::string version() const;
+  std::string header(const std::string &key) const;
+  const std::unordered_map<std::string, std::string> &headers() const {
+    return header_;
+  }
+  // empty when a body callback took it
+  const std::string &body() const { return body_; }
   std::string get_post(const std::string &key) const;
   std::string get_post(const char *key) const;
 
   bool is_keep_alive() const;
 
+  static size_t max_body_size;
+
  private:
   bool parse_request_line_(const std::string &line);
   void parse_header_(const std::string &line);
-  void parse_body_(const std::string &line);
+  void parse_headers_end_();
+  bool begin_body_();
+  bool parse_body_(buffer &buff);
+  bool parse_chunk_size_(buffer &buff);
+  bool parse_chunk_data_(buffer &buff);
+  bool parse_chunk_crlf_(buffer &buff);
+  bool parse_chunk_trailer_(buffer &buff);
+  bool consume_body_(const char *data, size_t len);
+  void finish_body_();
+  void set_error_(int code);
 
-  void parse_path_();
   void parse_post_();
   void parse_from_url_();
 
-  static bool user_verify(const std::string &name, const std::string &pwd,
-                          bool is_login);
-
   static int conver_hex(char ch);
 
-  PARSE_STATE state_;
-  std::string method_, path_, version_, body_;
+  PARSE_STATE state_ = PARSE_STATE::REQUEST_LINE;
+  int error_code_ = 0;
+  std::string method_, target_, path_, version_, body_;
+  size_t body_remaining_ = 0;
+  size_t body_size_ = 0;
+  body_callback body_cb_;
+  head_callback head_cb_;
+  // keys are lower-cased, header() lookups are case-insensitive
   std::unordered_map<std::string, std::string> header_;
   std::unordered_map<std::string, std::string> post_;
 
-  static const std::unordered_set<std::string> DEFAULT_HTML;
-  static const std::unordered_map<std::string, int> DEFAULT_HTML_TAG;
+  static const size_t MAX_LINE_ = 8192;
 };
 
 #endif
@@ -4,48 +4,127 @@
 #include <sys/mman.h>
 #include <sys/stat.h>
 
+#include <memory>
 #include <string>
+#include <string_view>
 #include <unordered_map>
 
 #include "buffer.h"
+#include "resource_index.h"
 
 class http_response {
  public:
   http_response() = default;
-  ~http_response() { unmap_file(); }
+  ~http_response() {
+    unmap_file();
+    close_file_();
+  }
 
   void init(const std::string &dir, const std::string &path,
             bool is_keep_alive = false, int code = -1);
+  // drops the file of the previous response
+  void reset();
+  void set_condition(const std::string &if_none_match,
+                     const std::string &if_modified_since);
+  void set_range(const std::string &range, const std::string &if_range);
+  // the request's Accept-Encoding; files from a bundle may have a
+  // compressed copy to send instead
+  void set_encoding(const std::string &accept_encoding) {
+    accept_encoding_ = accept_encoding;
+  }
+  // a whole header line, CRLF included, for the response after init()
+  void add_header(std::string_view line) { extra_headers_.append(line); }
   void make_response(buffer &buff);
   char *mm_file() const { return mm_file_; }
-  size_t mm_file_len() const { return mm_file_stat_.st_size; }
+  size_t mm_file_len() const { return mm_len_; }
+  // files past MMAP_THRESHOLD_ and byte ranges are streamed with sendfile
+  int file_fd() const { return file_fd_; }
+  off_t file_offset() const { return file_offset_; }
+  size_t file_len() const { return file_len_; }
   int code() const { return code_; }
 
+  static std::string_view mime_type(std::string_view path);
+  // tag must hold ETAG_LEN bytes
+  static std::string_view make_etag(time_t mtime, off_t size, char *tag);
+  static constexpr size_t ETAG_LEN = 48;
+
+  // a complete response for handlers that build their body in memory
+  static void make_body_response(buffer &buff, int code, bool is_keep_alive,
+                                 std::string_view type, std::string_view body);
+
+  // pattern: ".css" for a suffix, "/images/" for a path prefix, or an exact
+  // path; exact path > longest prefix > suffix
+  static void set_cache_control(const std::string &pattern,
+                                const std::string &value);
+
  private:
   void unmap_file();
+  void close_file_();
 
   void add_response_status_line_(buffer &buff);
   void add_response_header_(buffer &buff);
   void add_response_content_(buffer &buff);
 
-  void error_content(buffer &buff, std::string message);
+  void error_content(buffer &buff, std::string_view message);
   void error_html();
+  void make_error_response_(buffer &buff);
+
+  std::string_view file_type_() const;
+  std::string_view etag_(char *tag) const {
+    if (encoding_) {
+      return encoding_->body->etag;
+    }
+    return make_etag(mm_file_stat_.st_mtime, mm_file_stat_.st_size, tag);
+  }
+  bool stat_file_();
+  std::string_view cache_control_() const;
+  bool is_not_modified_() const;
+  bool is_range_fresh_() const;
+  void check_range_();
+  void choose_encoding_();
+  // whether an Accept-Encoding value takes coding, q=0 meaning no
+  static bool accepts_(std::string_view accept, std::string_view coding);
 
-  std::string file_type_();
+  static time_t parse_http_date_(const std::string &date);
 
   std::string path_;
   std::string dir_;
-  const std::string real_path() { return dir_ + path_; }
+  // dir_ + path_, put together once per response
+  std::string real_path_;
 
   int code_ = -1;
   bool is_keep_alive_;
 
-  char *mm_file_;
+  std::string if_none_match_;
+  std::string if_modified_since_;
+  std::string range_;
+  std::string if_range_;
+  off_t range_start_ = 0;
+  size_t range_len_ = 0;
+  std::string extra_headers_;
+  std::string accept_encoding_;
+
+  char *mm_file_ = nullptr;
+  size_t mm_len_ = 0;
+  // false when mm_file_ points into preloaded memory of the index
+  bool mapped_ = false;
   struct stat mm_file_stat_;
 
-  static const std::unordered_map<std::string, std::string> SUFFIX_TYPE_;
-  static const std::unordered_map<int, std::string> CODE_STATUS_;
-  static const std::unordered_map<int, std::string> CODE_PATH_;
+  // the index snapshot entry_ and preloaded bodies live in
+  std::shared_ptr<const resource_index::snapshot> snapshot_;
+  const resource_index::resource *entry_ = nullptr;
+  // the compressed copy of entry_ being sent, if any
+  const resource_index::resource::encoding *encoding_ = nullptr;
+
+  int file_fd_ = -1;
+  off_t file_offset_ = 0;
+  size_t file_len_ = 0;
+  // false when file_fd_ is the bundle's, which the snapshot keeps open
+  bool file_owned_ = true;
+
+  static constexpr size_t MMAP_THRESHOLD_ = 256 * 1024;
+
+  static std::unordered_map<std::string, std::string> cache_control_map_;
 
   // static const std::string CRLF;
 };
@@ -1,6 +1,7 @@
 #ifndef LOG_H
 #define LOG_H
 
+#include <atomic>
 #include <memory>
 #include <mutex>
 #include <string>
@@ -19,6 +20,9 @@ class log {
 
   void write(int level, const char *format, ...);
   void flush();
+  // writes out everything queued and stops the writer thread; later lines
+  // go straight to the file
+  void close();
 
   bool is_open() { return is_open_; }
 
@@ -46,7 +50,7 @@ class log {
   bool is_open_;
 
   buffer buff_;
-  size_t level_;
+  std::atomic<int> level_;
   bool is_async;
 
   FILE *m_fp_;
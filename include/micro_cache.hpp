@@ -0,0 +1,207 @@
+#ifndef MICRO_CACHE_HPP
+#define MICRO_CACHE_HPP
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+/*
+  micro_cache:
+    what an expensive request computed, kept for a moment under a key made
+    from the request, so a burst of identical requests computes it once.
+    the first miss becomes the leader and the others wait for its result
+    instead of computing it again (single-flight). a value is fresh for
+    ttl_ms, then served stale for up to stale_ms more while one caller
+    refreshes it. split into shards with a lock each like session_store;
+    waiters are called on the thread that fills, outside the lock
+*/
+
+template <class V>
+class micro_cache {
+ public:
+  enum class LOOKUP {
+    // value is good to use
+    HIT,
+    // value is good to use, and the caller is to refresh it with fill()
+    STALE,
+    // nothing to use; the caller computes it and calls fill()
+    MISS,
+    // another caller is computing it, and wait will get it
+    WAIT
+  };
+  using waiter = std::function<void(const V &)>;
+
+  // ttl_ms 0 turns the cache off; may be called again to retune
+  void init(int ttl_ms, int stale_ms, size_t max_entries);
+  bool is_open() const { return ttl_ms_ > 0; }
+
+  // a fresh value only, and never makes the caller a leader
+  bool peek(const std::string &key, V *value);
+  // without a waiter WAIT comes back as MISS
+  LOOKUP lookup(const std::string &key, V *value, waiter wait = nullptr);
+  // the result for key, handed to its waiters and kept if keep
+  void fill(const std::string &key, const V &value, bool keep = true);
+  // forgets every value; results being computed now won't be kept
+  void clear();
+
+ private:
+  struct entry {
+    V value{};
+    bool has_value = false;
+    // a leader is computing it
+    bool computing = false;
+    // cleared while computing: its result goes to the waiters only
+    bool discard = false;
+    int64_t fresh_until = 0;
+    int64_t stale_until = 0;
+    std::vector<waiter> waiters;
+  };
+  struct shard {
+    std::mutex mtx;
+    std::unordered_map<std::string, entry> entries;
+  };
+
+  static const size_t SHARDS_ = 16;
+
+  static int64_t now_ms_() {
+    return std::chrono::duration_cast<std::chrono::milliseconds>(
+               std::chrono::steady_clock::now().time_since_epoch())
+        .count();
+  }
+  shard &shard_(const std::string &key) {
+    return shards_[std::hash<std::string>()(key) % SHARDS_];
+  }
+  // drops what has gone stale; false if the shard is still full
+  bool evict_(shard &s, int64_t now);
+
+  std::atomic<int> ttl_ms_{0};
+  std::atomic<int> stale_ms_{0};
+  std::atomic<size_t> max_per_shard_{0};
+  std::array<shard, SHARDS_> shards_;
+};
+
+template <class V>
+void micro_cache<V>::init(int ttl_ms, int stale_ms, size_t max_entries) {
+  ttl_ms_ = std::max(ttl_ms, 0);
+  stale_ms_ = std::max(stale_ms, 0);
+  max_per_shard_ = std::max<size_t>(max_entries / SHARDS_, 1);
+  if (ttl_ms_ == 0) {
+    clear();
+  }
+}
+
+template <class V>
+bool micro_cache<V>::peek(const std::string &key, V *value) {
+  shard &s = shard_(key);
+  std::lock_guard<std::mutex> locker(s.mtx);
+  auto iter = s.entries.find(key);
+  if (iter == s.entries.end() || !iter->second.has_value ||
+      now_ms_() >= iter->second.fresh_until) {
+    return false;
+  }
+  *value = iter->second.value;
+  return true;
+}
+
+template <class V>
+typename micro_cache<V>::LOOKUP micro_cache<V>::lookup(const std::string &key,
+                                                        V *value,
+                                                        waiter wait) {
+  int64_t now = now_ms_();
+  shard &s = shard_(key);
+  std::lock_guard<std::mutex> locker(s.mtx);
+  auto iter = s.entries.find(key);
+  if (iter == s.entries.end()) {
+    // a full shard still answers, only without the single-flight
+    if (s.entries.size() >= max_per_shard_ && !evict_(s, now)) {
+      return LOOKUP::MISS;
+    }
+    iter = s.entries.try_emplace(key).first;
+  }
+  entry &e = iter->second;
+  if (e.has_value && now < e.fresh_until) {
+    *value = e.value;
+    return LOOKUP::HIT;
+  }
+  if (e.has_value && now < e.stale_until) {
+    *value = e.value;
+    if (e.computing) {
+      return LOOKUP::HIT;
+    }
+    e.computing = true;
+    return LOOKUP::STALE;
+  }
+  if (!e.computing) {
+    e.computing = true;
+    return LOOKUP::MISS;
+  }
+  if (!wait) {
+    return LOOKUP::MISS;
+  }
+  e.waiters.push_back(std::move(wait));
+  return LOOKUP::WAIT;
+}
+
+template <class V>
+void micro_cache<V>::fill(const std::string &key, const V &value, bool keep) {
+  std::vector<waiter> waiters;
+  {
+    shard &s = shard_(key);
+    std::lock_guard<std::mutex> locker(s.mtx);
+    auto iter = s.entries.find(key);
+    if (iter != s.entries.end()) {
+      entry &e = iter->second;
+      waiters.swap(e.waiters);
+      e.computing = false;
+      if (keep && !e.discard && is_open()) {
+        int64_t now = now_ms_();
+        e.value = value;
+        e.has_value = true;
+        e.fresh_until = now + ttl_ms_;
+        e.stale_until = e.fresh_until + stale_ms_;
+      }
+      e.discard = false;
+      if (!e.has_value) {
+        s.entries.erase(iter);
+      }
+    }
+  }
+  for (waiter &wait : waiters) {
+    wait(value);
+  }
+}
+
+template <class V>
+void micro_cache<V>::clear() {
+  for (shard &s : shards_) {
+    std::lock_guard<std::mutex> locker(s.mtx);
+    // entries with a leader keep their waiters, who still need the result
+    for (auto iter = s.entries.begin(); iter != s.entries.end();) {
+      entry &e = iter->second;
+      if (!e.computing) {
+        iter = s.entries.erase(iter);
+        continue;
+      }
+      e.has_value = false;
+      e.discard = true;
+      ++iter;
+    }
+  }
+}
+
+template <class V>
+bool micro_cache<V>::evict_(shard &s, int64_t now) {
+  std::erase_if(s.entries, [now](const auto &item) {
+    return !item.second.computing && now >= item.second.stale_until;
+  });
+  return s.entries.size() < max_per_shard_;
+}
+
+#endif
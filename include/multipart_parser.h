@@ -0,0 +1,66 @@
+#ifndef MULTIPART_PARSER_H
+#define MULTIPART_PARSER_H
+
+#include <functional>
+#include <string>
+#include <string_view>
+
+/*
+  multipart_parser:
+    a multipart/form-data body (RFC 7578) fed in pieces as they come off
+    the socket. part data is handed on as it is found, straight out of the
+    caller's bytes; only a tail that may be the start of a boundary, or an
+    unfinished header line, is held back until the next piece
+*/
+
+class multipart_parser {
+ public:
+  struct part {
+    std::string name;
+    // empty for a plain form field
+    std::string filename;
+    std::string type;
+  };
+
+  // each returns false to stop the parse
+  struct callbacks {
+    std::function<bool(const part &)> on_part;
+    std::function<bool(const char *data, size_t len)> on_data;
+    std::function<bool()> on_part_end;
+  };
+
+  multipart_parser(std::string_view boundary, callbacks cbs);
+
+  // the boundary parameter of a multipart/form-data Content-Type, empty if
+  // it is not one or has no usable boundary
+  static std::string boundary_of(std::string_view content_type);
+  // a parameter of a header value such as Content-Disposition, unquoted;
+  // empty if it is not there
+  static std::string param(std::string_view value, std::string_view name);
+
+  // false on a malformed body or when a callback stopped the parse
+  bool feed(const char *data, size_t len);
+  // the closing boundary has been seen
+  bool is_done() const { return state_ == STATE::DONE; }
+
+ private:
+  enum class STATE { DATA, BOUNDARY_END, HEADERS, DONE };
+
+  // how much of data was used; the rest waits for more
+  size_t parse_(const char *data, size_t len);
+  bool header_line_(std::string_view line);
+
+  // the CRLF before a boundary belongs to it, not to the part
+  std::string delimiter_;
+  callbacks cbs_;
+  STATE state_ = STATE::DATA;
+  bool in_part_ = false;
+  bool failed_ = false;
+  part part_;
+  size_t header_bytes_ = 0;
+  std::string carry_;
+
+  static const size_t MAX_HEADERS_ = 8192;
+};
+
+#endif
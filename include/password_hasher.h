@@ -0,0 +1,66 @@
+#ifndef PASSWORD_HASHER_H
+#define PASSWORD_HASHER_H
+
+#include <atomic>
+#include <functional>
+#include <memory>
+#include <string>
+#include <string_view>
+
+#include "threadpool.h"
+
+/*
+  password_hasher:
+    PBKDF2-HMAC-SHA256 for stored passwords, run on a fixed thread group
+    of its own with a short queue. a hash costs tens of milliseconds of
+    cpu by design, so a login burst fills this queue and gets turned away
+    with 503 instead of taking the request workers from everyone else,
+    and the threads run at a lower priority than the workers.
+    stored form: pbkdf2_sha256$<iterations>$<salt hex>$<key hex>
+*/
+
+class password_hasher {
+ public:
+  static password_hasher *instance();
+
+  // threads_num 0 hashes on the caller's thread; queue_size bounds the
+  // hashes waiting for a thread
+  void init(int threads_num, int queue_size, int iterations);
+  bool is_open() const { return pool_ != nullptr; }
+  // finishes the queued hashes and joins the threads
+  void stop() { pool_.reset(); }
+  // applies to new hashes; stored ones keep the count they were made with
+  void set_iterations(int iterations) { iterations_ = iterations; }
+
+  // runs task on a hashing thread, or right here when closed. false, and
+  // task dropped, when the queue is full
+  bool submit(std::function<void()> task);
+  // the queue is full, a submit now would fail
+  bool is_saturated();
+
+  // a new stored form for pwd, with a fresh salt; empty on failure
+  std::string hash(std::string_view pwd) const;
+  // whether pwd matches a stored form. rows from before hashing hold the
+  // plain password and are compared as such
+  static bool check(std::string_view pwd, std::string_view stored);
+
+  static constexpr std::string_view SCHEME = "pbkdf2_sha256";
+
+ private:
+  password_hasher() = default;
+  ~password_hasher() = default;
+
+  static std::string derive_(std::string_view pwd, std::string_view salt,
+                             int iterations);
+
+  // hashing threads run this much nicer than the rest of the process, so
+  // where they share cpus with the request workers the workers go first
+  static const int NICE_ = 10;
+  static const int SALT_LEN_ = 16;
+  static const int KEY_LEN_ = 32;
+
+  std::atomic<int> iterations_{100000};
+  std::unique_ptr<threadpool> pool_;
+};
+
+#endif
@@ -0,0 +1,73 @@
+#ifndef PATH_RESOLVER_H
+#define PATH_RESOLVER_H
+
+#include <array>
+#include <atomic>
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+
+/*
+  path_resolver:
+    turns a request target into the canonical path of a resource: the
+    query cut off, %XX escapes decoded, empty and "." segments dropped and
+    ".." taken back, never above the resource dir, neither by ".." nor by
+    a symlink leading out of it. results are cached by raw path in shards,
+    so a path seen before costs one hash probe instead of the decoding and
+    a realpath(); the cache is dropped whenever the resource tree changes
+*/
+
+class path_resolver {
+ public:
+  static path_resolver *instance();
+
+  // dir: the resource dir, for the symlink check (empty: no check).
+  // max_entries 0 caches nothing
+  void init(const std::string &dir, size_t max_entries);
+  void set_max(size_t max_entries);
+
+  // target as it came in the request line. 0 with the canonical path in
+  // path, or the status to refuse the request with
+  int resolve(std::string_view target, std::string *path);
+  // forgets every result; for when the tree changed
+  void clear();
+
+  // false if path is malformed or climbs above "/". a decoded "%2F"
+  // separates segments like "/" does
+  static bool canonicalize(std::string_view path, std::string *out);
+
+ private:
+  path_resolver() = default;
+  ~path_resolver() = default;
+
+  int resolve_(std::string_view path, std::string *out) const;
+
+  struct path_hash {
+    using is_transparent = void;
+    size_t operator()(std::string_view path) const {
+      return std::hash<std::string_view>()(path);
+    }
+  };
+  struct entry {
+    int code;
+    std::string path;
+  };
+  struct shard {
+    std::mutex mtx;
+    std::unordered_map<std::string, entry, path_hash, std::equal_to<>>
+        entries;
+  };
+
+  static const size_t SHARDS_ = 16;
+
+  // realpath of the resource dir, with a trailing slash
+  std::string root_;
+  std::atomic<size_t> max_per_shard_{0};
+  // bumped by clear(), so a result worked out before it isn't kept after
+  std::atomic<uint64_t> generation_{0};
+  std::array<shard, SHARDS_> shards_;
+};
+
+#endif
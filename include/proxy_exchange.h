@@ -0,0 +1,153 @@
+#ifndef PROXY_EXCHANGE_H
+#define PROXY_EXCHANGE_H
+
+#include <sys/types.h>
+
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <string>
+
+#include "buffer.h"
+#include "upstream.h"
+
+/*
+  proxy_exchange:
+    one request forwarded to an upstream group. the upstream socket is
+    non-blocking and watched by the server's epoller on behalf of the
+    client: start() takes a pooled connection or opens one, sends the
+    request and reads the response head, then calls done. the body is
+    relayed as the client takes it, spliced through a pipe when its length
+    is known and the client is plain http, so it never passes through user
+    space. a connection whose response was read to the end goes back to
+    the pool. only one thread drives an exchange at a time: every wait
+    arms a one-shot event and is the last thing a step does
+*/
+
+class proxy_exchange {
+ public:
+  // set by webserver: one-shot watch of an upstream fd for the client on
+  // owner_fd, whose events bring the client back; events 0 stops watching
+  static std::function<void(int fd, int owner_fd, uint32_t events)> watch;
+
+  // request is the whole HTTP/1.1 request as sent upstream. retryable: it
+  // may go out again when a pooled connection turns out to be dead
+  proxy_exchange(std::shared_ptr<upstream> group, std::string request,
+                 bool retryable, bool head_only);
+  ~proxy_exchange();
+
+  // done runs on whichever thread finishes the head, or fails
+  void start(int owner_fd, std::function<void()> done);
+  // the watched upstream socket has an event
+  void on_ready();
+  // the response head isn't in yet
+  bool is_pending() const { return state_ < STATE::BODY && !error_; }
+  // 502 when no backend gave a proper response, 504 when fetch() ran out
+  // of time; 0 otherwise
+  int error() const { return error_; }
+
+  // the response head, with this hop's framing and Connection headers,
+  // and whatever body came in with it
+  void write_head(buffer &out, bool keep_alive);
+  // the body runs until the backend closes, so the client connection has
+  // to close after it too
+  bool ends_at_close() const { return framing_ == FRAMING::CLOSE; }
+  // body bytes still to relay; just nonzero when the length isn't known
+  size_t body_left() const;
+  // the last relay() stopped because the backend had sent nothing more
+  bool wants_upstream() const { return wants_upstream_; }
+  // arms the upstream socket for the rest of the body
+  void wait_upstream();
+  // moves body toward the client: spliced straight to client_fd when
+  // can_splice, otherwise read into out. -1 with save_errno on EAGAIN from
+  // either side (see wants_upstream()) and on errors; a body cut short by
+  // the backend is EIO
+  ssize_t relay(int client_fd, buffer &out, bool can_splice, int &save_errno);
+
+  // the whole exchange on the calling thread, for requests with no socket
+  // to relay to: the response goes into out with the body de-chunked.
+  // false on error()
+  bool fetch(buffer &out, bool keep_alive, int timeout_ms);
+
+ private:
+  enum class STATE { CONNECTING, SENDING, READING_HEAD, BODY, DONE };
+  enum class FRAMING { LENGTH, CHUNKED, CLOSE };
+
+  // follows chunked framing as it passes, to find where the body ends
+  struct chunk_scanner {
+    enum class AT { SIZE, EXT, DATA, DATA_END, TRAILER, END, BAD };
+    AT at = AT::SIZE;
+    size_t left = 0;
+    int digits = 0;
+    size_t line_len = 0;
+
+    // bytes of data that belong to the body, the chunk payloads appended
+    // to payload when given
+    size_t scan(const char *data, size_t len, std::string *payload);
+    bool done() const { return at == AT::END; }
+    bool bad() const { return at == AT::BAD; }
+  };
+
+  // a pooled or new connection to a backend; false, and failed, once
+  // MAX_ATTEMPTS_ are used up
+  bool open_();
+  // drives the request out and the head in until it has to wait
+  void step_();
+  // a pooled connection failed before any response; false when the
+  // exchange has failed instead of starting over
+  bool retry_();
+  // 1: head complete, 0: needs more, -1: not a usable response
+  int parse_head_();
+  // accounts for body bytes from the backend; returns how many belong to
+  // this response, de-chunked into payload when given
+  size_t take_(const char *data, size_t len, std::string *payload);
+  ssize_t splice_(int client_fd, int &save_errno);
+  void end_body_();
+  void fail_(int code);
+  // the connection leaves the exchange: pooled when reusable, else closed
+  void release_(bool reusable);
+  void arm_(uint32_t events);
+  void notify_();
+
+  static const int MAX_ATTEMPTS_ = 3;
+  static const size_t HEAD_MAX_ = 64 * 1024;
+  // bodies shorter than this are copied, a splice costs two calls
+  static const size_t SPLICE_MIN_ = 16 * 1024;
+  static const size_t RELAY_CHUNK_ = 64 * 1024;
+
+  std::shared_ptr<upstream> group_;
+  std::string request_;
+  bool retryable_;
+  bool head_only_;
+
+  upstream::backend *be_ = nullptr;
+  int fd_ = -1;
+  int owner_ = -1;
+  bool reused_ = false;
+  bool watched_ = false;
+  int attempts_ = 0;
+  std::function<void()> done_;
+  // fetch() polls instead of arming, for want_
+  bool blocking_ = false;
+  uint32_t want_ = 0;
+
+  STATE state_ = STATE::CONNECTING;
+  FRAMING framing_ = FRAMING::LENGTH;
+  int error_ = 0;
+  size_t sent_ = 0;
+  // the head as it comes in, then any body read along with it
+  std::string in_;
+  // status line and end-to-end headers, CRLF each
+  std::string head_;
+  // the backend keeps the connection open after this response
+  bool reusable_ = true;
+  size_t left_ = 0;
+  chunk_scanner chunks_;
+  bool wants_upstream_ = false;
+
+  // body in flight from the upstream socket to the client
+  int pipe_[2] = {-1, -1};
+  size_t piped_ = 0;
+};
+
+#endif
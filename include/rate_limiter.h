@@ -0,0 +1,88 @@
+#ifndef RATE_LIMITER_H
+#define RATE_LIMITER_H
+
+#include <netinet/in.h>
+
+#include <array>
+#include <atomic>
+#include <cstdint>
+#include <memory>
+
+/*
+  rate_limiter:
+    two token buckets per client address, one for requests and one for
+    response bytes. entries live in a fixed table, one block of slots per
+    shard, and are claimed and updated with compare-and-swap, so checks on
+    the event loop and on workers never wait on each other. an address
+    probes PROBE_ slots; when they are all taken, the one used longest ago
+    is recycled, which drops idle clients first. a recycled or missing
+    entry is simply a full bucket, so eviction never lets anyone past the
+    limit for longer than one burst
+*/
+
+class rate_limiter {
+ public:
+  static rate_limiter *instance();
+
+  // per second rates and bucket sizes; a zero rate turns that bucket off.
+  // calling it again retunes the limiter in place
+  void init(uint32_t req_rate, uint32_t req_burst, uint32_t byte_rate,
+            uint32_t byte_burst);
+  bool is_open() const { return req_.rate || bytes_.rate; }
+
+  // at accept: whether ip has anything left, without taking from it
+  bool allow_conn(in_addr_t ip);
+  // takes one request; false once ip is over either rate
+  bool allow_request(in_addr_t ip);
+  // charges bytes sent; the byte bucket may go into debt, which then holds
+  // off the next requests until it is paid back
+  void charge_bytes(in_addr_t ip, size_t bytes);
+
+ private:
+  rate_limiter() = default;
+  ~rate_limiter() = default;
+
+  // init() may run again while checks are going on, hence the atomics
+  struct bucket_cfg {
+    explicit bucket_cfg(int64_t scale) : scale(scale) {}
+    // refill per second and the cap, both in units of 1/scale token
+    std::atomic<uint64_t> rate{0};
+    std::atomic<int64_t> burst{0};
+    const int64_t scale;
+  };
+
+  // bucket state: tokens (signed) in the high half, the ms stamp of the
+  // last refill in the low half
+  struct entry {
+    std::atomic<uint32_t> ip{0};
+    std::atomic<uint32_t> used{0};
+    std::atomic<uint64_t> req{0};
+    std::atomic<uint64_t> bytes{0};
+  };
+
+  static const size_t SHARDS_ = 16;
+  static const size_t SLOTS_ = 1024;
+  static const size_t PROBE_ = 8;
+
+  struct shard {
+    std::array<entry, SLOTS_> slots;
+  };
+
+  static uint32_t now_ms_();
+  static uint64_t pack_(int64_t tokens, uint32_t stamp);
+  // refills state and takes cost; with debt the take always succeeds and
+  // the result says whether tokens were left before it
+  static bool take_(std::atomic<uint64_t> &state, const bucket_cfg &cfg,
+                    uint32_t now, int64_t cost, bool debt);
+  static int64_t peek_(const std::atomic<uint64_t> &state,
+                       const bucket_cfg &cfg, uint32_t now);
+
+  entry &find_(in_addr_t ip, uint32_t now);
+
+  // requests are counted in thousandths so slow rates still refill every ms
+  bucket_cfg req_{1000};
+  bucket_cfg bytes_{1};
+  std::unique_ptr<std::array<shard, SHARDS_>> shards_;
+};
+
+#endif
@@ -0,0 +1,66 @@
+#ifndef REGISTER_WRITER_H
+#define REGISTER_WRITER_H
+
+#include <atomic>
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+/*
+  register_writer:
+    group commit for new users. one thread collects the registrations
+    that arrive within window_ms of the first, or until max_rows are
+    waiting, and writes them with one SELECT for the names already taken
+    and one multi-row INSERT for the rest, one round trip and one commit
+    each instead of two per user. rows that arrive while a batch is
+    being written form the next one. every row gets its own result: a
+    name taken in the table, or earlier in the same batch, fails alone
+*/
+
+class register_writer {
+ public:
+  // true if the user was added; called on the writer thread
+  using callback = std::function<void(bool)>;
+
+  static register_writer *instance();
+
+  // max_rows 0 leaves the writer closed
+  void init(int window_ms, int max_rows);
+  bool is_open() const { return thread_.joinable(); }
+  void set_window_ms(int window_ms) { window_ms_ = window_ms; }
+  // writes what is queued and joins the thread
+  void stop();
+
+  // stored is the hashed password. false, without calling done, when too
+  // many rows are already waiting
+  bool add(std::string name, std::string stored, callback done);
+
+ private:
+  register_writer() = default;
+  ~register_writer() { stop(); }
+
+  struct row {
+    std::string name;
+    std::string stored;
+    callback done;
+  };
+
+  // rows waiting, as a multiple of max_rows, before add() refuses more
+  static const int QUEUE_BATCHES_ = 16;
+
+  void run_();
+  void write_(std::vector<row> &batch);
+
+  std::atomic<int> window_ms_{2};
+  size_t max_rows_ = 0;
+  bool is_close_ = false;
+  std::mutex mtx_;
+  std::condition_variable cond_;
+  std::vector<row> queue_;
+  std::thread thread_;
+};
+
+#endif
@@ -0,0 +1,82 @@
+#ifndef RESOURCE_BUNDLE_H
+#define RESOURCE_BUNDLE_H
+
+#include <sys/types.h>
+
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <vector>
+
+/*
+  resource_bundle:
+    the resource tree packed into one file by pack_resources, and mapped
+    whole by the server. each file is stored as-is and, when that is
+    smaller, gzip and brotli compressed; bodies of a page or more start on
+    a page, for sendfile straight from the bundle. the validator
+    header lines are rendered at pack time. a deploy writes a new bundle
+    next to the old one and renames it over, which the server picks up as
+    one atomic change.
+
+    layout, native byte order:
+      file_header | file_entry[count] | strings | bodies
+*/
+
+class resource_bundle {
+ public:
+  enum ENCODING { IDENTITY = 0, GZIP, BROTLI, ENCODINGS };
+
+  struct body {
+    const char *data = nullptr;
+    size_t size = 0;
+    // of data in the bundle file
+    off_t offset = 0;
+    std::string_view etag;
+    // ETag, Last-Modified, Content-Encoding and Vary lines, CRLFs included
+    std::string_view head;
+  };
+
+  struct entry {
+    std::string_view path;
+    std::string_view type;
+    std::string_view last_modified;
+    time_t mtime = 0;
+    // the identity body always exists; the others have a null data
+    // when compressing didn't pay
+    body bodies[ENCODINGS];
+  };
+
+  ~resource_bundle();
+
+  // nullptr when path can't be mapped or is not a valid bundle
+  static std::shared_ptr<resource_bundle> open(const std::string &path);
+  // packs the regular, world-readable files under dir into path, through
+  // a temporary file renamed over it
+  static bool pack(const std::string &dir, const std::string &path,
+                   std::string *error = nullptr);
+
+  static std::string_view encoding_name(ENCODING encoding);
+
+  const std::vector<entry> &entries() const { return entries_; }
+  // for sendfile; open as long as the bundle is
+  int fd() const { return fd_; }
+  size_t size() const { return size_; }
+
+  static constexpr size_t ALIGN = 4096;
+
+ private:
+  resource_bundle() = default;
+
+  struct file_header;
+  struct file_entry;
+
+  bool parse_();
+
+  int fd_ = -1;
+  char *map_ = nullptr;
+  size_t size_ = 0;
+  std::vector<entry> entries_;
+};
+
+#endif
@@ -0,0 +1,117 @@
+#ifndef RESOURCE_INDEX_H
+#define RESOURCE_INDEX_H
+
+#include <sys/types.h>
+
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+#include "resource_bundle.h"
+
+/*
+  resource_index:
+    an immutable snapshot of the resource tree, built at startup: size,
+    mtime, MIME type, ETag and Last-Modified for every readable file, plus
+    the contents of small files. readers take the current snapshot and keep
+    it alive for as long as they use it; changes reported by inotify build a
+    new snapshot that is swapped in atomically (read-copy-update).
+    with a bundle the snapshot comes from its one mapping instead, every
+    file in memory, and is rebuilt when a new bundle is renamed over it
+*/
+
+class resource_index {
+ public:
+  struct resource {
+    size_t size;
+    time_t mtime;
+    std::string_view type;
+    std::string etag;
+    std::string last_modified;
+    // preloaded contents, nullptr when the file is served from disk
+    const char *data = nullptr;
+
+    // the rest is set for files of a bundle: the bundle's fd with data's
+    // offset in it, the header lines rendered by the packer, and the
+    // compressed copies in the order they are preferred
+    int fd = -1;
+    off_t offset = 0;
+    std::string_view head;
+    struct encoding {
+      std::string_view name;
+      const resource_bundle::body *body;
+    };
+    std::vector<encoding> encodings;
+  };
+
+  // lets find() look up a string_view without building a std::string
+  struct path_hash {
+    using is_transparent = void;
+    size_t operator()(std::string_view path) const {
+      return std::hash<std::string_view>()(path);
+    }
+  };
+
+  struct snapshot {
+    // the resource dir as passed to init()
+    std::string root;
+    std::unordered_map<std::string, resource, path_hash, std::equal_to<>>
+        files;
+    std::unique_ptr<char[]> arena;
+    size_t arena_size = 0;
+    bool locked = false;
+    std::shared_ptr<const resource_bundle> bundle;
+    ~snapshot();
+  };
+
+  static resource_index *instance();
+
+  // preload_max: largest file kept in memory, budget: the total, lock: mlock
+  // the preloaded bytes. with a bundle file, dir is only read for files the
+  // bundle doesn't have
+  void init(const std::string &dir, size_t preload_max, size_t budget,
+            bool lock, const std::string &bundle = "");
+  bool is_open() const { return snapshot_.load() != nullptr; }
+
+  std::shared_ptr<const snapshot> current() const { return snapshot_.load(); }
+  // path relative to the resource dir, e.g. "/css/style.css"
+  static const resource *find(const snapshot &snap, std::string_view path);
+
+  // inotify fd for the event loop, -1 if watching is unavailable
+  int watch_fd() const { return inotify_fd_; }
+  // drains pending inotify events; true when the tree changed
+  bool drain();
+  // rebuilds and swaps the snapshot
+  void reload();
+  // new preload limits, used from the next reload() on
+  void set_preload(size_t preload_max, size_t budget);
+
+ private:
+  resource_index() = default;
+  ~resource_index();
+
+  std::shared_ptr<snapshot> build_();
+  // nullptr when the bundle can't be opened
+  std::shared_ptr<snapshot> load_bundle_();
+  void watch_tree_();
+
+  std::string root_;
+  // root_ without the trailing slash
+  std::string dir_;
+  size_t preload_max_ = 0;
+  size_t budget_ = 0;
+  bool lock_ = false;
+  std::string bundle_;
+  // the bundle's directory is watched, for events about this name
+  std::string bundle_name_;
+
+  int inotify_fd_ = -1;
+  std::mutex reload_mtx_;
+  std::atomic<std::shared_ptr<const snapshot>> snapshot_;
+};
+
+#endif
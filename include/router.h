@@ -0,0 +1,77 @@
+#ifndef ROUTER_H
+#define ROUTER_H
+
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+class http_conn;
+class http_request;
+
+/*
+  http_handler:
+    one endpoint. handle() runs on a worker once the request is parsed and
+    writes the whole response into conn.write_buff(), or hands a file to
+    conn.response() the way static_file_handler does
+*/
+
+class http_handler {
+ public:
+  virtual ~http_handler() = default;
+  virtual void handle(http_conn &conn) const = 0;
+  // runs when the head of a request with a body is in, before any of the
+  // body is read. a handler that takes bodies as they arrive sets a body
+  // callback on request here; a nonzero return refuses the request with
+  // that status, and its body is never read
+  virtual int on_body(http_conn &conn, http_request &request) const {
+    return 0;
+  }
+};
+
+/*
+  router:
+    maps request paths to handlers through a byte trie. exact routes win over
+    prefix routes, and the longest prefix wins among those. routes are added
+    before the server starts; after that the trie is only read, so lookups
+    take no lock
+*/
+
+class router {
+ public:
+  enum class MATCH { EXACT, PREFIX };
+
+  static router *instance();
+
+  // a later route for the same path and kind replaces the earlier one
+  void add(std::string_view path, MATCH match,
+           std::shared_ptr<const http_handler> handler);
+  // used when nothing matches
+  void set_fallback(std::shared_ptr<const http_handler> handler) {
+    fallback_ = std::move(handler);
+  }
+
+  const http_handler *route(std::string_view path) const;
+
+ private:
+  router();
+  ~router() = default;
+
+  struct node {
+    // sorted by byte
+    std::vector<std::pair<char, uint32_t>> children;
+    const http_handler *exact = nullptr;
+    const http_handler *prefix = nullptr;
+  };
+
+  uint32_t child_(uint32_t idx, char c) const;
+
+  std::vector<node> nodes_;
+  // keeps the handlers alive; nodes only hold raw pointers
+  std::vector<std::shared_ptr<const http_handler>> handlers_;
+  std::shared_ptr<const http_handler> fallback_;
+};
+
+#endif
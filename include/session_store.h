@@ -0,0 +1,82 @@
+#ifndef SESSION_STORE_H
+#define SESSION_STORE_H
+
+#include <atomic>
+#include <cstdint>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+
+/*
+  session_store:
+    login sessions in memory, keyed by a random 128-bit token that goes
+    out as the sid cookie. the table is split into SHARDS_ shards with a
+    lock each, picked by the token's own random bits, so a lookup is one
+    hash probe under one uncontended lock and never touches the database.
+    sessions expire ttl seconds after their last use; expire(), run from
+    the server's timer, drops them in deadline order, and find() refuses
+    an expired one even before the sweep gets to it
+*/
+
+class session_store {
+ public:
+  static session_store *instance();
+
+  // ttl_s 0 turns sessions off; may be called again to retune
+  void init(int ttl_s, size_t max_sessions);
+  bool is_open() const { return ttl_ms_ > 0; }
+  int ttl_s() const { return ttl_ms_ / 1000; }
+
+  // a new session for user, returns its token
+  std::string create(const std::string &user);
+  // the user of a live session, renewing it; false if unknown or expired
+  bool find(std::string_view token, std::string *user = nullptr);
+  void remove(std::string_view token);
+  // drops expired sessions; returns how many
+  size_t expire();
+  size_t size();
+
+  // the sid value in a Cookie header, empty if there is none
+  static std::string_view token_of(std::string_view cookie);
+  static constexpr std::string_view COOKIE_NAME = "sid";
+  static constexpr size_t TOKEN_LEN = 32;
+
+ private:
+  session_store() = default;
+  ~session_store() = default;
+
+  struct key {
+    uint64_t hi;
+    uint64_t lo;
+    bool operator==(const key &other) const = default;
+  };
+  // tokens are random, their bits are a good hash already
+  struct key_hash {
+    size_t operator()(const key &k) const { return k.lo; }
+  };
+  struct session {
+    std::string user;
+    int64_t expires_ms;
+  };
+  struct shard {
+    std::mutex mtx;
+    std::unordered_map<key, session, key_hash> sessions;
+    // (token, deadline) in the order deadlines were set; renewed sessions
+    // are found out and re-queued when their old entry comes up
+    std::deque<std::pair<key, int64_t>> deadlines;
+  };
+
+  static const size_t SHARDS_ = 64;
+
+  static int64_t now_ms_();
+  static bool parse_(std::string_view token, key *out);
+  shard &shard_(const key &k) { return shards_[k.hi % SHARDS_]; }
+
+  std::atomic<int64_t> ttl_ms_{0};
+  std::atomic<size_t> max_per_shard_{0};
+  shard shards_[SHARDS_];
+};
+
+#endif
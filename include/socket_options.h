@@ -0,0 +1,29 @@
+#ifndef SOCKET_OPTIONS_H
+#define SOCKET_OPTIONS_H
+
+#include <string>
+
+#include "config.h"
+
+/*
+  socket_options:
+    the TCP tuning of the listeners. linux copies a listener's options to
+    every socket accept() returns, so setting them once here costs nothing
+    per connection. an option the kernel refuses is logged and skipped,
+    none of them is needed to serve
+*/
+
+class socket_options {
+ public:
+  // TCP_NODELAY, TCP_DEFER_ACCEPT, TCP_FASTOPEN, SO_RCVBUF, SO_SNDBUF and
+  // SO_BUSY_POLL as configured; before listen(), so the buffer sizes also
+  // shape the window scale offered to clients
+  static void tune_listener(int fd, const server_config &cfg);
+  // TCP_CORK: while on, partial segments are held back, so a head and the
+  // body that follows in another call share full segments
+  static void cork(int fd, bool on);
+  // the tuning in effect, for the startup log
+  static std::string describe(const server_config &cfg);
+};
+
+#endif
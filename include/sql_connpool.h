@@ -5,10 +5,14 @@
 #include <mysql/mysql.h>
 
 #include <atomic>
+#include <functional>
 #include <memory>
 #include <semaphore>
+#include <string>
+#include <string_view>
 
 #include "block_queue.hpp"
+#include "threadpool.h"
 
 using mysql = struct MYSQL_WARRPER {
   MYSQL* mysql_conn_;
@@ -19,18 +23,40 @@ using mysql = struct MYSQL_WARRPER {
 class sql_connpool {
  public:
   static sql_connpool* instance();
-  std::unique_ptr<mysql> get_conn();
+  // nullptr once timeout_ms passes with every connection in use
+  std::unique_ptr<mysql> get_conn(int timeout_ms);
+  std::unique_ptr<mysql> get_conn() { return get_conn(wait_ms_); }
   void free_conn(std::unique_ptr<mysql>);
   int get_free_conn_count();
 
   void init(const char* host, int port, const char* user, const char* pwd,
             const char* db_name, int conn_size = 10);
+  void set_wait_ms(int wait_ms) { wait_ms_ = wait_ms; }
+
+  // queries block on the network, so they get threads of their own and a
+  // slow database can't tie up the request workers. grows up to
+  // threads_num, which is best kept at the connection count
+  void start_workers(int threads_num);
+  // finishes the queued queries and joins the threads
+  void stop_workers() { workers_.reset(); }
+  bool is_async() const { return workers_ != nullptr; }
+  void run(std::function<void()> task) { workers_->add_task(std::move(task)); }
+
+  // appends 'value', escaped for the connection's character set; every
+  // string that goes into a query goes through here
+  static void append_quoted(MYSQL* sql, std::string& out,
+                            std::string_view value);
 
  private:
   // static void sql_deleter_(MYSQL* conn) { mysql_close(conn); }
   // using sql_d_ = decltype(sql_deleter_);
   sql_connpool() = default;
   ~sql_connpool() { mysql_library_end(); }
+  // a query worker gives up on the pool after this long instead of holding
+  // its thread while requests pile up behind it
+  std::atomic<int> wait_ms_{500};
+  static constexpr int MIN_WORKERS_ = 2;
+  std::unique_ptr<threadpool> workers_;
   int max_conn_;
   block_queue<std::unique_ptr<mysql>> conn_que_;
 };
@@ -41,7 +67,8 @@ struct sql_RAII {
   sql_RAII(MYSQL** sql, sql_connpool* pool) {
     assert(pool);
     sql_conn_ = pool->get_conn();
-    *sql = sql_conn_.get()->mysql_conn_;
+    // callers check *sql: nullptr when the pool timed out
+    *sql = sql_conn_ ? sql_conn_->mysql_conn_ : nullptr;
     sql_pool_ = pool;
   }
   ~sql_RAII() {
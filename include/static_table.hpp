@@ -0,0 +1,90 @@
+#ifndef STATIC_TABLE_HPP
+#define STATIC_TABLE_HPP
+
+#include <array>
+#include <bit>
+#include <cstddef>
+#include <cstdint>
+#include <string_view>
+#include <utility>
+
+/*
+  static_table:
+    read-only map built at compile time. the constructor searches for a seed
+    under which every key gets a slot of its own (a perfect hash), so find()
+    is one hash, one probe and one key compare, with no allocation
+*/
+
+constexpr uint32_t static_hash(std::string_view key, uint32_t seed) {
+  uint32_t h = 2166136261u ^ seed;
+  for (char c : key) {
+    h ^= static_cast<uint8_t>(c);
+    h *= 16777619u;
+  }
+  return h ^ (h >> 15);
+}
+
+constexpr uint32_t static_hash(int key, uint32_t seed) {
+  uint32_t h = (static_cast<uint32_t>(key) ^ seed) * 2654435761u;
+  return h ^ (h >> 16);
+}
+
+template <class K, class V, size_t N>
+class static_table {
+ public:
+  consteval explicit static_table(const std::pair<K, V> (&entries)[N]) {
+    for (size_t i = 0; i < N; ++i) {
+      entries_[i] = entries[i];
+    }
+    while (!try_seed_()) {
+      ++seed_;
+    }
+  }
+
+  constexpr const V *find(K key) const {
+    uint16_t idx = slots_[static_hash(key, seed_) & (SLOTS_ - 1)];
+    if (idx && entries_[idx - 1].first == key) {
+      return &entries_[idx - 1].second;
+    }
+    return nullptr;
+  }
+  constexpr bool contains(K key) const { return find(key) != nullptr; }
+  constexpr V get(K key, V fallback) const {
+    const V *value = find(key);
+    return value ? *value : fallback;
+  }
+
+  constexpr size_t size() const { return N; }
+  constexpr auto begin() const { return entries_.begin(); }
+  constexpr auto end() const { return entries_.end(); }
+
+ private:
+  constexpr bool try_seed_() {
+    slots_.fill(0);
+    for (size_t i = 0; i < N; ++i) {
+      uint16_t &slot = slots_[static_hash(entries_[i].first, seed_) &
+                              (SLOTS_ - 1)];
+      if (slot) {
+        return false;
+      }
+      slot = i + 1;
+    }
+    return true;
+  }
+
+  // twice the keys keeps the seed search short
+  static constexpr size_t SLOTS_ = std::bit_ceil(N * 2);
+  static_assert(N < UINT16_MAX);
+
+  std::array<std::pair<K, V>, N> entries_{};
+  std::array<uint16_t, SLOTS_> slots_{};
+  uint32_t seed_ = 0;
+};
+
+// N is deduced from the braced list
+template <class K, class V, size_t N>
+consteval auto make_static_table(const std::pair<K, V> (&entries)[N]) {
+  return static_table<K, V, N>(entries);
+}
+
+#endif
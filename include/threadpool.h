@@ -1,36 +1,92 @@
 #ifndef THREAD_POOL_HPP
 #define THREAD_POOL_HPP
 
-#include <array>
+#include <sched.h>
+
 #include <atomic>
+#include <chrono>
 #include <functional>
 #include <memory>
+#include <mutex>
 #include <thread>
 #include <vector>
 
 #include "block_queue.hpp"
 
+/*
+  threadpool:
+    keeps threads_num workers and grows up to max_threads when tasks start
+    waiting: no worker idle and either the average wait above GROW_DELAY_
+    or nothing popped for that long (every worker blocked). workers above
+    threads_num exit after IDLE_EXIT_ without work. with cpus, worker i is
+    pinned to cpus[i % size]; otherwise workers keep the affinity the
+    process had when the pool was made
+*/
+
 class threadpool {
  public:
-  threadpool(int threads_num, int max_queue_size = 1024, int timeout = 1)
-      : threads_array_(threads_num), tasks_(max_queue_size), timeout_(timeout) {
-    init_array_();
-  }
+  threadpool(int threads_num, int max_queue_size = 1024, int max_threads = 0,
+             std::vector<int> cpus = {});
 
   ~threadpool();
 
   void add_task(std::function<void()> task) {
-    tasks_.push_back(std::move(task));
+    tasks_.push_back({std::move(task), std::chrono::steady_clock::now()});
+    maybe_grow_();
   }
+  // never blocks: false when the queue is full and the task was dropped
+  bool try_add_task(std::function<void()> task) {
+    if (!tasks_.try_push_back(
+            {std::move(task), std::chrono::steady_clock::now()})) {
+      return false;
+    }
+    maybe_grow_();
+    return true;
+  }
+
+  size_t queue_size() { return tasks_.size(); }
+  size_t queue_capacity() { return tasks_.capacity(); }
+  // moving average of the time a task waits before a worker picks it up
+  int64_t queue_delay_us() const { return queue_delay_us_.load(); }
+  int thread_count() const { return threads_.load(); }
+  // below the current count, extra workers leave as they go idle
+  void set_max_threads(int max_threads);
 
  private:
-  block_queue<std::function<void()>> tasks_;
-  // TODO: CHANGE ATOMIC
-  std::atomic<bool> is_close_;
-  int timeout_;
+  struct task_item {
+    std::function<void()> fn;
+    std::chrono::steady_clock::time_point queued;
+  };
+
+  static constexpr auto GROW_DELAY_ = std::chrono::milliseconds(2);
+  static constexpr auto IDLE_EXIT_ = std::chrono::seconds(30);
+  // how long an idle worker waits in pop() before checking IDLE_EXIT_
+  static constexpr auto POP_WAIT_ = std::chrono::seconds(1);
+
+  static int64_t now_us_();
+  void maybe_grow_();
+  void spawn_();
+  void worker_(size_t index);
+  bool retire_();
+
+  block_queue<task_item> tasks_;
+  std::atomic<bool> is_close_{false};
+  std::atomic<int64_t> queue_delay_us_{0};
+  std::atomic<int64_t> last_pop_us_;
+  std::atomic<int64_t> last_grow_us_{0};
+  std::atomic<int> threads_{0};
+  std::atomic<int> idle_{0};
+  int min_threads_;
+  std::atomic<int> max_threads_;
+
+  std::vector<int> cpus_;
+  cpu_set_t inherited_;
+
+  std::mutex threads_mtx_;
+  size_t next_index_ = 0;
   std::vector<std::unique_ptr<std::thread>> threads_array_;
-  // std::array<std::unique_ptr<std::thread>, N> threads_array_;
-  void init_array_();
+  // workers that retired and are waiting to be joined
+  std::vector<std::thread::id> exited_;
 };
 
-#endif
\ No newline at end of file
+#endif
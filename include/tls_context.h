@@ -0,0 +1,31 @@
+#ifndef TLS_CONTEXT_H
+#define TLS_CONTEXT_H
+
+#include <openssl/ssl.h>
+
+/*
+  tls_context:
+    one SSL_CTX shared by every https connection, with the server session
+    cache, session tickets and kernel TLS offload switched on
+*/
+
+class tls_context {
+ public:
+  static tls_context *instance();
+
+  bool init(const char *cert_file, const char *key_file);
+  bool is_open() const { return ctx_ != nullptr; }
+
+  SSL *new_ssl(int fd);
+
+ private:
+  tls_context() = default;
+  ~tls_context();
+
+  SSL_CTX *ctx_ = nullptr;
+
+  static const int SESSION_CACHE_SIZE_ = 20480;
+  static const int SESSION_TIMEOUT_ = 300;
+};
+
+#endif
\ No newline at end of file
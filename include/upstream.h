@@ -0,0 +1,74 @@
+#ifndef UPSTREAM_H
+#define UPSTREAM_H
+
+#include <netinet/in.h>
+
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+/*
+  upstream:
+    the backends behind one proxy route. each backend keeps up to idle_max
+    keep-alive connections for reuse; a request goes to the healthy backend
+    with the fewest requests in flight. a backend is marked down when a
+    connect to it fails and by check_health(), which also brings it back.
+    backends are set up before the server starts and never change
+*/
+
+class upstream {
+ public:
+  struct backend {
+    sockaddr_in addr;
+    std::string name;
+    // requests in flight, for least-connections
+    std::atomic<int> active{0};
+    std::atomic<bool> healthy{true};
+
+    std::mutex mtx;
+    // idle keep-alive connections and when each was parked, newest last
+    std::vector<std::pair<int, int64_t>> idle;
+  };
+
+  ~upstream();
+
+  // "host:port,host:port"; false on an address that doesn't parse
+  bool init(const std::string &backends, size_t idle_max);
+  const std::string &spec() const { return spec_; }
+  // the first backend, as a Host for requests that came without one
+  const std::string &host() const { return backends_.front()->name; }
+
+  // the healthy backend with the fewest requests in flight, or of all of
+  // them when every one is down; counted as one more until release()
+  backend *pick();
+  // a parked connection (reused set) or a new non-blocking socket with its
+  // connect started; -1 if the socket could not be made
+  int connect(backend *be, bool *reused);
+  // ends the request; the connection is parked for the next one when
+  // reusable and there is room, otherwise closed. fd may be -1
+  void release(backend *be, int fd, bool reusable);
+  void mark_down(backend *be);
+
+  // probes every backend with GET path, blocking up to timeout_ms each;
+  // any answer below 500 counts as healthy
+  void check_health(const std::string &path, int timeout_ms);
+
+ private:
+  // parked connections older than this are closed instead of reused, well
+  // inside the keep-alive timeout of common backends
+  static const int64_t IDLE_MS_ = 30000;
+
+  static int64_t now_ms_();
+  static bool probe_(const backend &be, const std::string &path,
+                     int timeout_ms);
+
+  std::string spec_;
+  size_t idle_max_ = 0;
+  std::atomic<uint32_t> next_{0};
+  std::vector<std::unique_ptr<backend>> backends_;
+};
+
+#endif
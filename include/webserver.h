@@ -1,50 +1,141 @@
 #ifndef WEBSERVER_H
 #define WEBSERVER_H
 
+#include <atomic>
+#include <chrono>
+#include <functional>
 #include <memory>
 #include <unordered_map>
+#include <vector>
 
+#include "config.h"
 #include "epoller.h"
 #include "heap_timer.h"
 #include "http_conn.h"
 #include "threadpool.h"
+#include "upstream.h"
 
 class webserver {
  public:
-  webserver(int port, int trig_mode, int timeout_ms, bool opt_linger,
-            int sql_port, const char *sql_user, const char *sql_pwd,
-            const char *db_name, int connect_pool_num, int threads_num,
-            bool open_log, int log_level, int log_que_size);
+  // conf is kept to read the settings again on SIGHUP
+  webserver(const config &conf, const server_config &cfg);
   ~webserver();
 
   void start();
 
  private:
   bool init_socket_();
+  int init_listen_fd_(int port);
   void init_event_mode_(int trig_mode);
-  void add_client_(int fd, sockaddr_in addr);
+  void init_routes_();
+  // adds a proxy route for each "/prefix=backends" of the proxy setting
+  bool init_proxy_();
+  int threads_max_() const;
+  std::vector<int> worker_cpus_();
+  void add_client_(int fd, sockaddr_in addr, bool is_tls);
 
-  void deal_listen_();
+  void deal_listen_(int listen_fd);
   void deal_write_(http_conn *client);
   void deal_read_(http_conn *client);
+  // an upstream socket of a proxied request of client is ready
+  void deal_upstream_(http_conn *client);
+  void watch_upstream_(int fd, int owner_fd, uint32_t events);
 
   void send_error_(int fd, const char *info);
+  void reject_(int fd, bool is_tls, const char *response);
+  void refuse_(http_conn *client, const char *response);
+  bool is_overloaded_();
+  // hands task to the workers without ever blocking the loop; a full queue
+  // keeps it for the next turn of the loop
+  void submit_(std::function<void()> task);
+  void run_deferred_();
+  void pause_accept_();
+  void resume_accept_();
   void extent_time_(http_conn *client);
   void close_conn_(http_conn *client);
 
+  void handshake_(http_conn *client);
   void read_(http_conn *client);
   void write_(http_conn *client);
   void process_(http_conn *client);
+  // one-shot arm for the next request; a websocket decides itself whether
+  // frames are waiting to go out first
+  void arm_read_(http_conn *client);
+  void arm_write_(http_conn *client);
+
+  void refresh_date_();
+  void expire_sessions_();
+  void check_upstreams_();
+  void ping_websockets_();
+  void apply_ws_limits_();
+  void deal_index_change_();
+
+  bool init_signals_();
+  void deal_signal_();
+  // SIGHUP: loads the config again and applies the live settings
+  void reload_config_();
+  // graceful shutdown: stop accepting, let in-flight requests finish and
+  // close idle connections, give up at DRAIN_MS_
+  void drain_();
+  void sweep_idle_();
+  // SIGUSR2: exec a fresh copy of the binary, hand it the listening
+  // sockets over a unix socket (SCM_RIGHTS) and drain once it is up
+  void hot_restart_();
+  void deal_handoff_();
+  bool send_listeners_(int sock);
+  bool recv_listeners_(int sock);
+  static void on_signal_(int sig);
 
   static const int MAX_FD_ = 65536;
+  // timer ids past MAX_FD_ are not connections
+  static const int DATE_TIMER_ = MAX_FD_;
+  // rebuilds the resource index once the tree has been quiet this long
+  static const int INDEX_TIMER_ = MAX_FD_ + 1;
+  static const int INDEX_DELAY_MS_ = 200;
+  // while accepting is paused, checks this often whether load has dropped
+  static const int ADMIT_TIMER_ = MAX_FD_ + 2;
+  static const int ADMIT_CHECK_MS_ = 100;
+  // while draining, idle connections are swept this often until none are
+  // left or drain_ms runs out
+  static const int DRAIN_TIMER_ = MAX_FD_ + 3;
+  static const int DRAIN_CHECK_MS_ = 100;
+  static const int SHUTDOWN_TIMER_ = MAX_FD_ + 4;
+  // busy keep-alive clients get Connection: close on their next response;
+  // only connections still idle after this are shut down, so the sweep
+  // doesn't race a request already on the wire
+  static constexpr int DRAIN_IDLE_GRACE_MS_ = 1000;
+  // expired login sessions are swept out this often
+  static const int SESSION_TIMER_ = MAX_FD_ + 5;
+  static const int SESSION_SWEEP_MS_ = 1000;
+  // health checks of the proxy backends
+  static const int PROXY_TIMER_ = MAX_FD_ + 6;
+  // a probe waits at most this, it holds a worker meanwhile
+  static constexpr int PROXY_PROBE_MS_ = 1000;
+  // websocket pings
+  static const int WS_TIMER_ = MAX_FD_ + 7;
+  // while tasks wait in deferred_, the loop wakes this often to retry them
+  static const int DEFERRED_RETRY_MS_ = 1;
+  // tells a hot-restarted process which fd carries the listeners
+  static constexpr const char *HANDOFF_ENV_ = "WEBSERVER_HANDOFF_FD";
 
   static int setnonblock(int fd);
 
-  int port_;
-  bool open_linger_;
-  int timeout_ms_;
+  config conf_;
+  // only the event loop reads these, so reloads need no locking
+  server_config cfg_;
   bool is_close_;
-  int listen_fd_;
+  int listen_fd_ = -1;
+  int tls_listen_fd_ = -1;
+  int index_fd_ = -1;
+  bool accept_paused_ = false;
+  // set with cpu_affinity
+  int reactor_cpu_ = -1;
+  // read end of the signal self-pipe
+  int signal_fd_ = -1;
+  static int signal_write_fd_;
+  // socket to the other process during a hot restart
+  int handoff_fd_ = -1;
+  std::chrono::steady_clock::time_point drain_start_;
   char *src_dir_;
 
   uint32_t listen_event_;
@@ -52,8 +143,16 @@ class webserver {
 
   std::unique_ptr<heap_timer> timer_;
   std::unique_ptr<threadpool> threadpool_;
+  // tasks the workers' queue had no room for, oldest first
+  std::vector<std::function<void()>> deferred_;
   std::unique_ptr<epoller> epoller_;
   std::unordered_map<int, http_conn> users_;
+
+  std::vector<std::shared_ptr<upstream>> upstreams_;
+  // for each watched upstream fd, the client fd it serves plus one
+  std::unique_ptr<std::atomic<int>[]> upstream_owner_;
+  // a round of health checks is still running
+  std::atomic<bool> checking_upstreams_{false};
 };
 
 #endif
\ No newline at end of file
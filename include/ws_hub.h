@@ -0,0 +1,46 @@
+#ifndef WS_HUB_H
+#define WS_HUB_H
+
+#include <memory>
+#include <shared_mutex>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+#include "ws_session.h"
+
+/*
+  ws_hub:
+    the open websockets and the channels they are subscribed to. publish()
+    frames a message once and hands the same buffer to every subscriber's
+    queue, under a shared lock so publishers on different workers don't
+    wait on each other; only subscribing and leaving take it exclusively
+*/
+
+class ws_hub {
+ public:
+  static ws_hub *instance();
+
+  void subscribe(const std::string &channel,
+                 const std::shared_ptr<ws_session> &session);
+  // takes session out of every channel, once its connection is closed
+  void remove(ws_session *session);
+  // the number of subscribers the message was queued for
+  size_t publish(const std::string &channel, std::string_view payload,
+                 bool binary = false);
+  // pings every session, dropping those that didn't answer the last one
+  void ping_all();
+  size_t size();
+
+ private:
+  ws_hub() = default;
+  ~ws_hub() = default;
+
+  std::shared_mutex mtx_;
+  std::unordered_map<std::string, std::vector<std::shared_ptr<ws_session>>>
+      channels_;
+  std::unordered_map<ws_session *, std::shared_ptr<ws_session>> sessions_;
+};
+
+#endif
@@ -0,0 +1,146 @@
+#ifndef WS_SESSION_H
+#define WS_SESSION_H
+
+#include <sys/types.h>
+
+#include <atomic>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "buffer.h"
+
+/*
+  ws_session:
+    a websocket (RFC 6455) on an upgraded http/1.1 connection. frames from
+    the client are parsed and unmasked out of the read buffer; outgoing
+    frames wait in a queue of shared, immutable buffers, so a broadcast
+    is framed once and only referenced by every subscriber's queue, and
+    reaches the socket with writev straight from the shared copy.
+    frames may be queued from any thread: a connection parked waiting for
+    the client is armed for writing by the first one, every other arming
+    goes through park() under the same lock so none is lost
+*/
+
+class ws_session {
+ public:
+  enum OPCODE : uint8_t {
+    CONTINUATION = 0x0,
+    TEXT = 0x1,
+    BINARY = 0x2,
+    CLOSE = 0x8,
+    PING = 0x9,
+    PONG = 0xa
+  };
+
+  using frame = std::shared_ptr<const std::string>;
+  // a whole message from the client, on the worker reading it
+  using message_callback =
+      std::function<void(ws_session &session, std::string_view data,
+                         bool binary)>;
+
+  // set by webserver: one-shot arm of fd for reading, and for writing too
+  static std::function<void(int fd, bool write)> arm;
+  // longest message accepted from a client, fragments included
+  static std::atomic<size_t> max_message;
+  // unsent bytes a session may hold before it is dropped as too slow
+  static std::atomic<size_t> max_queued;
+
+  ws_session(int fd, message_callback on_message);
+
+  // the Sec-WebSocket-Accept value for a Sec-WebSocket-Key
+  static std::string accept_key(std::string_view key);
+  // an unmasked server frame
+  static frame make_frame(OPCODE opcode, std::string_view payload);
+  // data ^= the 4-byte key, repeated from its first byte
+  static void unmask(char *data, size_t len, const uint8_t key[4]);
+
+  // parses the frames in in; control frames are answered through the
+  // queue. false once the connection is to close after what is queued
+  bool on_read(buffer &in);
+  // queues f; false if the session is closed or was too slow to keep
+  bool send(frame f);
+  bool send_text(std::string_view text) {
+    return send(make_frame(TEXT, text));
+  }
+
+  size_t queued_bytes() const { return queued_; }
+  // writev of queued frames to fd; -1 with save_errno, EAGAIN included
+  ssize_t write_fd(int fd, int &save_errno);
+  // copies up to len queued bytes into out, for TLS
+  size_t take(buffer &out, size_t len);
+
+  // the worker is done: armed for writing when frames are waiting, else
+  // for reading with a later send() arming it for writing
+  void park();
+  // stops taking frames; the connection is going away
+  void close();
+  // shuts the socket down, the event loop then closes the connection
+  void drop();
+  // on the event loop, shedding load: a 1013 (try again later) close
+  // straight to the socket, unless a worker is writing or a frame is half
+  // sent. the connection is closed right after
+  void refuse();
+  bool is_closing() const { return closing_; }
+  // held while a worker reads or writes the connection
+  std::unique_lock<std::mutex> lock_io() {
+    return std::unique_lock<std::mutex>(io_mtx_);
+  }
+
+  // queues a ping; false when nothing came from the client since the
+  // last one, and the connection should be dropped
+  bool ping(const frame &ping_frame);
+  // channels this session is subscribed to, kept by ws_hub
+  std::vector<std::string> &channels() { return channels_; }
+
+ private:
+  // the size of the frame header at the front of in, parsed into the
+  // members below; 0 while it is incomplete
+  size_t parse_header_(const buffer &in);
+  // a control frame; false once the connection is to close
+  bool on_frame_(uint8_t opcode, std::string_view payload);
+  bool fail_(uint16_t status);
+  void send_close_(uint16_t status);
+  // with mtx_ held
+  void drop_();
+
+  int fd_;
+  message_callback on_message_;
+
+  // one frame's header, as parsed by parse_header_()
+  uint8_t opcode_ = 0;
+  bool fin_ = false;
+  // RSV bits, no extension is negotiated so they must be 0
+  uint8_t rsv_ = 0;
+  bool masked_ = false;
+  uint64_t payload_len_ = 0;
+  uint8_t key_[4] = {0};
+
+  // the fragments of a message so far, and its type
+  std::string message_;
+  uint8_t message_opcode_ = 0;
+  std::atomic<bool> closing_{false};
+  std::atomic<bool> heard_{true};
+
+  std::mutex io_mtx_;
+  // guards the queue, parked_ and closed_
+  std::mutex mtx_;
+  std::deque<frame> queue_;
+  // sent bytes of the front frame
+  size_t offset_ = 0;
+  std::atomic<size_t> queued_{0};
+  bool parked_ = false;
+  bool closed_ = false;
+
+  std::vector<std::string> channels_;
+
+  // frames per writev
+  static const int IOV_MAX_ = 64;
+};
+
+#endif
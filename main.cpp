@@ -1,8 +1,33 @@
+#include "config.h"
+#include "handlers.h"
 #include "webserver.h"
 
-int main() {
-  webserver(1316, 3, 10000, false, 3306, "root", "1", "webserver", 12, 6, true,
-            1, 1024)
-      .start();
+int main(int argc, char *argv[]) {
+  config conf;
+  server_config cfg;
+  if (!conf.parse_args(argc, argv)) {
+    config::print_help(argv[0]);
+    return 1;
+  }
+  if (conf.wants_help()) {
+    config::print_help(argv[0]);
+    return 0;
+  }
+  if (!conf.load(cfg)) {
+    return 1;
+  }
+  http_response::set_cache_control("/", "no-cache");
+  http_response::set_cache_control("/css/", "public, max-age=86400");
+  http_response::set_cache_control("/js/", "public, max-age=86400");
+  http_response::set_cache_control("/fonts/", "public, max-age=604800");
+  http_response::set_cache_control("/images/", "public, max-age=604800");
+  webserver server(conf, cfg);
+  router::instance()->add("/health", router::MATCH::EXACT,
+                          std::make_shared<health_handler>());
+  router::instance()->add("/api/status", router::MATCH::EXACT,
+                          std::make_shared<status_handler>());
+  router::instance()->add("/ws/", router::MATCH::PREFIX,
+                          std::make_shared<websocket_handler>("/ws/"));
+  server.start();
   return 0;
 }
\ No newline at end of file
@@ -6,6 +6,8 @@
 #include <algorithm>
 #include <cstring>
 
+size_t buffer::initial_size_ = 1024;
+
 buffer::buffer()
     : buffer_(prepend_ + initial_size_),
       read_index_(prepend_),
@@ -0,0 +1,352 @@
+#include "config.h"
+
+#include <errno.h>
+
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <limits>
+#include <type_traits>
+#include <variant>
+
+namespace {
+
+using field = std::variant<int server_config::*, size_t server_config::*,
+                           bool server_config::*,
+                           std::string server_config::*>;
+
+struct option {
+  const char *key;
+  field ptr;
+  bool live;
+};
+
+const option OPTIONS[] = {
+    {"port", &server_config::port, false},
+    {"tls_port", &server_config::tls_port, false},
+    {"cert_file", &server_config::cert_file, false},
+    {"key_file", &server_config::key_file, false},
+    {"trig_mode", &server_config::trig_mode, false},
+    {"opt_linger", &server_config::opt_linger, false},
+    {"backlog", &server_config::backlog, false},
+    {"tcp_nodelay", &server_config::tcp_nodelay, false},
+    {"tcp_cork", &server_config::tcp_cork, false},
+    {"defer_accept_s", &server_config::defer_accept_s, false},
+    {"fastopen_queue", &server_config::fastopen_queue, false},
+    {"rcvbuf", &server_config::rcvbuf, false},
+    {"sndbuf", &server_config::sndbuf, false},
+    {"busy_poll_us", &server_config::busy_poll_us, false},
+    {"accept_batch", &server_config::accept_batch, false},
+    {"sql_host", &server_config::sql_host, false},
+    {"sql_port", &server_config::sql_port, false},
+    {"sql_user", &server_config::sql_user, false},
+    {"sql_pwd", &server_config::sql_pwd, false},
+    {"db_name", &server_config::db_name, false},
+    {"sql_pool", &server_config::sql_pool, false},
+    {"sql_wait_ms", &server_config::sql_wait_ms, true},
+    {"db_threads", &server_config::db_threads, false},
+    {"threads", &server_config::threads, false},
+    {"threads_max", &server_config::threads_max, true},
+    {"cpu_affinity", &server_config::cpu_affinity, false},
+    {"task_queue", &server_config::task_queue, false},
+    {"io_threads", &server_config::io_threads, false},
+    {"buffer_size", &server_config::buffer_size, false},
+    {"open_log", &server_config::open_log, false},
+    {"log_level", &server_config::log_level, true},
+    {"log_queue", &server_config::log_queue, false},
+    {"timeout_ms", &server_config::timeout_ms, true},
+    {"drain_ms", &server_config::drain_ms, true},
+    {"max_conn", &server_config::max_conn, true},
+    {"max_conn_per_ip", &server_config::max_conn_per_ip, true},
+    {"queue_delay_max_ms", &server_config::queue_delay_max_ms, true},
+    {"rate_requests", &server_config::rate_requests, true},
+    {"rate_request_burst", &server_config::rate_request_burst, true},
+    {"rate_bytes", &server_config::rate_bytes, true},
+    {"rate_byte_burst", &server_config::rate_byte_burst, true},
+    {"session_ttl_s", &server_config::session_ttl_s, true},
+    {"max_sessions", &server_config::max_sessions, true},
+    {"hash_threads", &server_config::hash_threads, false},
+    {"hash_queue", &server_config::hash_queue, false},
+    {"hash_iterations", &server_config::hash_iterations, true},
+    {"register_batch_ms", &server_config::register_batch_ms, true},
+    {"register_batch_rows", &server_config::register_batch_rows, false},
+    {"micro_cache_ms", &server_config::micro_cache_ms, true},
+    {"micro_cache_stale_ms", &server_config::micro_cache_stale_ms, true},
+    {"micro_cache_entries", &server_config::micro_cache_entries, true},
+    {"proxy", &server_config::proxy, false},
+    {"proxy_idle", &server_config::proxy_idle, false},
+    {"proxy_health_path", &server_config::proxy_health_path, false},
+    {"proxy_health_ms", &server_config::proxy_health_ms, false},
+    {"ws_ping_ms", &server_config::ws_ping_ms, true},
+    {"ws_max_message", &server_config::ws_max_message, true},
+    {"ws_queue_max", &server_config::ws_queue_max, true},
+    {"preload_max", &server_config::preload_max, true},
+    {"preload_budget", &server_config::preload_budget, true},
+    {"path_cache", &server_config::path_cache, true},
+    {"bundle", &server_config::bundle, false},
+    {"upload_dir", &server_config::upload_dir, false},
+    {"upload_max", &server_config::upload_max, false},
+};
+
+const option *find_option(const std::string &key) {
+  for (const option &opt : OPTIONS) {
+    if (key == opt.key) {
+      return &opt;
+    }
+  }
+  return nullptr;
+}
+
+// plain number with an optional k/m/g suffix (powers of 1024)
+bool parse_number(const std::string &text, long long max, long long &out) {
+  errno = 0;
+  char *end = nullptr;
+  long long value = strtoll(text.c_str(), &end, 10);
+  if (end == text.c_str() || errno) {
+    return false;
+  }
+  int shift = 0;
+  switch (*end) {
+    case 'k':
+    case 'K':
+      shift = 10;
+      break;
+    case 'm':
+    case 'M':
+      shift = 20;
+      break;
+    case 'g':
+    case 'G':
+      shift = 30;
+      break;
+  }
+  if (shift) {
+    ++end;
+  }
+  if (*end || value < 0 || value > (max >> shift)) {
+    return false;
+  }
+  out = value << shift;
+  return true;
+}
+
+bool parse_bool(const std::string &text, bool &out) {
+  if (text == "1" || text == "true" || text == "yes" || text == "on") {
+    out = true;
+  } else if (text == "0" || text == "false" || text == "no" ||
+             text == "off") {
+    out = false;
+  } else {
+    return false;
+  }
+  return true;
+}
+
+std::string trim(const std::string &text) {
+  size_t begin = text.find_first_not_of(" \t\r");
+  if (begin == std::string::npos) {
+    return "";
+  }
+  size_t end = text.find_last_not_of(" \t\r");
+  return text.substr(begin, end - begin + 1);
+}
+
+std::string to_string(const server_config &cfg, const field &ptr) {
+  return std::visit(
+      [&cfg](auto member) -> std::string {
+        using type = std::decay_t<decltype(cfg.*member)>;
+        if constexpr (std::is_same_v<type, std::string>) {
+          return cfg.*member;
+        } else if constexpr (std::is_same_v<type, bool>) {
+          return cfg.*member ? "true" : "false";
+        } else {
+          return std::to_string(cfg.*member);
+        }
+      },
+      ptr);
+}
+
+}  // namespace
+
+bool config::parse_args(int argc, char *argv[]) {
+  for (int i = 1; i < argc; ++i) {
+    std::string arg = argv[i];
+    if (arg == "-h" || arg == "--help") {
+      help_ = true;
+      continue;
+    }
+    if (arg == "-c") {
+      arg = "--config";
+    }
+    if (arg.compare(0, 2, "--") != 0) {
+      fprintf(stderr, "unexpected argument: %s\n", arg.c_str());
+      return false;
+    }
+    std::string key = arg.substr(2);
+    std::string value;
+    size_t eq = key.find('=');
+    if (eq != std::string::npos) {
+      value = key.substr(eq + 1);
+      key.resize(eq);
+    } else if (i + 1 < argc) {
+      value = argv[++i];
+    } else {
+      fprintf(stderr, "missing value for %s\n", arg.c_str());
+      return false;
+    }
+    for (char &c : key) {
+      if (c == '-') {
+        c = '_';
+      }
+    }
+    if (key == "config") {
+      path_ = value;
+      path_given_ = true;
+    } else if (!find_option(key)) {
+      fprintf(stderr, "unknown option: --%s\n", key.c_str());
+      return false;
+    } else {
+      overrides_.emplace_back(key, value);
+    }
+  }
+  return true;
+}
+
+bool config::load(server_config &cfg) const {
+  server_config next;
+  std::ifstream file(path_);
+  if (!file && path_given_) {
+    fprintf(stderr, "can't open config %s\n", path_.c_str());
+    return false;
+  }
+  std::string line;
+  for (int line_no = 1; std::getline(file, line); ++line_no) {
+    size_t hash = line.find('#');
+    if (hash != std::string::npos) {
+      line.resize(hash);
+    }
+    line = trim(line);
+    if (line.empty()) {
+      continue;
+    }
+    size_t eq = line.find('=');
+    std::string where = path_ + ":" + std::to_string(line_no);
+    if (eq == std::string::npos) {
+      fprintf(stderr, "%s: expected key = value\n", where.c_str());
+      return false;
+    }
+    if (!set_(next, trim(line.substr(0, eq)), trim(line.substr(eq + 1)),
+              where)) {
+      return false;
+    }
+  }
+  for (auto &[key, value] : overrides_) {
+    if (!set_(next, key, value, "command line")) {
+      return false;
+    }
+  }
+  if (!check_(next)) {
+    return false;
+  }
+  cfg = std::move(next);
+  return true;
+}
+
+bool config::set_(server_config &cfg, const std::string &key,
+                  const std::string &value, const std::string &where) {
+  const option *opt = find_option(key);
+  if (!opt) {
+    fprintf(stderr, "%s: unknown setting %s\n", where.c_str(), key.c_str());
+    return false;
+  }
+  bool ok = std::visit(
+      [&cfg, &value](auto member) {
+        using type = std::decay_t<decltype(cfg.*member)>;
+        if constexpr (std::is_same_v<type, std::string>) {
+          cfg.*member = value;
+          return true;
+        } else if constexpr (std::is_same_v<type, bool>) {
+          return parse_bool(value, cfg.*member);
+        } else {
+          long long number;
+          if (!parse_number(value,
+                            std::min<unsigned long long>(
+                                std::numeric_limits<type>::max(),
+                                std::numeric_limits<long long>::max()),
+                            number)) {
+            return false;
+          }
+          cfg.*member = number;
+          return true;
+        }
+      },
+      opt->ptr);
+  if (!ok) {
+    fprintf(stderr, "%s: bad value for %s: %s\n", where.c_str(), key.c_str(),
+            value.c_str());
+  }
+  return ok;
+}
+
+bool config::check_(const server_config &cfg) {
+  const char *error = nullptr;
+  if (cfg.port <= 0 || cfg.port > 65535 || cfg.tls_port > 65535) {
+    error = "ports must be within 1-65535";
+  } else if (cfg.tls_port && (cfg.cert_file.empty() || cfg.key_file.empty())) {
+    error = "tls_port needs cert_file and key_file";
+  } else if (cfg.trig_mode > 3) {
+    error = "trig_mode must be 0-3";
+  } else if (cfg.log_level > 3) {
+    error = "log_level must be 0-3";
+  } else if (!cfg.backlog || !cfg.accept_batch || !cfg.sql_pool ||
+             !cfg.threads || !cfg.task_queue || !cfg.io_threads ||
+             !cfg.log_queue) {
+    error = "backlog, accept_batch, pool, thread and queue sizes must be at "
+            "least 1";
+  } else if (cfg.buffer_size < 64) {
+    error = "buffer_size must be at least 64";
+  } else if (!cfg.hash_queue || cfg.hash_iterations < 1000) {
+    error = "hash_queue must be at least 1, hash_iterations 1000";
+  } else if (cfg.micro_cache_ms && cfg.micro_cache_ms < 100) {
+    error = "micro_cache_ms must be 0 or at least 100";
+  } else if (!cfg.proxy_health_path.starts_with('/')) {
+    error = "proxy_health_path must start with /";
+  } else if (cfg.ws_ping_ms && cfg.timeout_ms &&
+             cfg.ws_ping_ms >= cfg.timeout_ms) {
+    // pongs are what keeps a quiet websocket from timing out
+    error = "ws_ping_ms must be below timeout_ms";
+  }
+  if (error) {
+    fprintf(stderr, "config: %s\n", error);
+    return false;
+  }
+  return true;
+}
+
+std::vector<config::change> config::merge_live(server_config &cur,
+                                               const server_config &next) {
+  std::vector<change> changes;
+  for (const option &opt : OPTIONS) {
+    std::string value = to_string(next, opt.ptr);
+    if (value == to_string(cur, opt.ptr)) {
+      continue;
+    }
+    if (opt.live) {
+      std::visit([&cur, &next](auto member) { cur.*member = next.*member; },
+                 opt.ptr);
+    }
+    changes.push_back({opt.key, opt.live, std::move(value)});
+  }
+  return changes;
+}
+
+void config::print_help(const char *prog) {
+  server_config defaults;
+  printf("usage: %s [-c FILE] [--key=value ...]\n\n", prog);
+  printf("settings (default, * = reloaded on SIGHUP):\n");
+  for (const option &opt : OPTIONS) {
+    printf("  --%-20s %s%s\n", opt.key, to_string(defaults, opt.ptr).c_str(),
+           opt.live ? " *" : "");
+  }
+}
@@ -0,0 +1,31 @@
+#include "conn_limiter.h"
+
+conn_limiter *conn_limiter::instance() {
+  static conn_limiter inst;
+  return &inst;
+}
+
+bool conn_limiter::acquire(in_addr_t ip) {
+  if (max_per_ip_ <= 0) {
+    return true;
+  }
+  shard &s = shard_(ip);
+  std::lock_guard<std::mutex> locker(s.mtx);
+  int &conns = s.conns[ip];
+  if (conns >= max_per_ip_) {
+    return false;
+  }
+  ++conns;
+  return true;
+}
+
+// no check of the limit here: it may have been turned off since acquire()
+void conn_limiter::release(in_addr_t ip) {
+  shard &s = shard_(ip);
+  std::lock_guard<std::mutex> locker(s.mtx);
+  auto iter = s.conns.find(ip);
+  // erase at zero so the table only holds addresses with open connections
+  if (iter != s.conns.end() && --iter->second <= 0) {
+    s.conns.erase(iter);
+  }
+}
@@ -0,0 +1,93 @@
+#include "cpu_topology.h"
+
+#include <dirent.h>
+#include <pthread.h>
+#include <sched.h>
+
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+
+std::vector<int> cpu_topology::allowed() {
+  std::vector<int> cpus;
+  cpu_set_t set;
+  CPU_ZERO(&set);
+  if (sched_getaffinity(0, sizeof(set), &set) < 0) {
+    return cpus;
+  }
+  for (int cpu = 0; cpu < CPU_SETSIZE; ++cpu) {
+    if (CPU_ISSET(cpu, &set)) {
+      cpus.push_back(cpu);
+    }
+  }
+  return cpus;
+}
+
+int cpu_topology::node_of(int cpu) {
+  char path[64];
+  snprintf(path, sizeof(path), "/sys/devices/system/cpu/cpu%d", cpu);
+  DIR *dir = opendir(path);
+  if (!dir) {
+    return 0;
+  }
+  int node = 0;
+  // the cpu directory holds a nodeN link to its node
+  while (dirent *entry = readdir(dir)) {
+    if (sscanf(entry->d_name, "node%d", &node) == 1) {
+      break;
+    }
+  }
+  closedir(dir);
+  return node;
+}
+
+std::vector<int> cpu_topology::same_node(int cpu) {
+  std::vector<int> cpus = allowed();
+  char path[64];
+  snprintf(path, sizeof(path), "/sys/devices/system/node/node%d/cpulist",
+           node_of(cpu));
+  std::ifstream file(path);
+  std::string list;
+  if (!std::getline(file, list)) {
+    return cpus;
+  }
+  std::vector<int> node_cpus = parse_list(list);
+  std::erase_if(cpus, [&node_cpus](int c) {
+    return !std::binary_search(node_cpus.begin(), node_cpus.end(), c);
+  });
+  return cpus;
+}
+
+bool cpu_topology::pin_self(int cpu) {
+  cpu_set_t set;
+  CPU_ZERO(&set);
+  CPU_SET(cpu, &set);
+  return pthread_setaffinity_np(pthread_self(), sizeof(set), &set) == 0;
+}
+
+std::vector<int> cpu_topology::parse_list(const std::string &list) {
+  std::vector<int> cpus;
+  const char *p = list.c_str();
+  while (*p) {
+    char *end;
+    long first = strtol(p, &end, 10);
+    if (end == p) {
+      break;
+    }
+    long last = first;
+    if (*end == '-') {
+      p = end + 1;
+      last = strtol(p, &end, 10);
+    }
+    for (long cpu = first; cpu <= last && cpu < CPU_SETSIZE; ++cpu) {
+      cpus.push_back(cpu);
+    }
+    if (*end != ',') {
+      break;
+    }
+    p = end + 1;
+  }
+  std::sort(cpus.begin(), cpus.end());
+  return cpus;
+}
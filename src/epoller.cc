@@ -1,7 +1,7 @@
 #include "epoller.h"
 
 epoller::epoller(size_t max_event_)
-    : epoll_fd_(epoll_create(512)), events_(max_event_) {}
+    : epoll_fd_(epoll_create1(EPOLL_CLOEXEC)), events_(max_event_) {}
 
 epoller::~epoller() { close(epoll_fd_); }
 
@@ -0,0 +1,78 @@
+#include "file_io.h"
+
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <chrono>
+
+#include "log.h"
+
+file_io *file_io::instance() {
+  static file_io inst;
+  return &inst;
+}
+
+void file_io::init(int threads_num) {
+  if (threads_num > 0 && !pool_) {
+    pool_ = std::make_unique<threadpool>(threads_num);
+  }
+}
+
+long file_io::now_() {
+  return std::chrono::duration_cast<std::chrono::seconds>(
+             std::chrono::steady_clock::now().time_since_epoch())
+      .count();
+}
+
+bool file_io::is_warm(const std::string &path) {
+  shard &s = shards_[std::hash<std::string>()(path) % SHARDS_];
+  long now = now_();
+  std::lock_guard<std::mutex> locker(s.mtx);
+  auto iter = s.seen.find(path);
+  if (iter == s.seen.end() || now - iter->second > WARM_SECONDS_) {
+    return false;
+  }
+  iter->second = now;
+  return true;
+}
+
+void file_io::mark_(const std::string &path, long now) {
+  shard &s = shards_[std::hash<std::string>()(path) % SHARDS_];
+  std::lock_guard<std::mutex> locker(s.mtx);
+  if (s.seen.size() >= MAX_PER_SHARD_ && !s.seen.contains(path)) {
+    s.seen.clear();
+  }
+  s.seen[path] = now;
+}
+
+bool file_io::prefetch(const std::string &path, std::function<void()> done) {
+  return pool_->try_add_task([this, path, done = std::move(done)]() {
+    load_(path);
+    done();
+  });
+}
+
+void file_io::load_(const std::string &path) {
+  int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+  struct stat st;
+  if (fd >= 0 && fstat(fd, &st) == 0 && S_ISREG(st.st_mode)) {
+    size_t len = st.st_size;
+    if (len > READAHEAD_MAX_) {
+      posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+      len = READAHEAD_MAX_;
+    }
+    posix_fadvise(fd, 0, len, POSIX_FADV_WILLNEED);
+    // readahead blocks until the range is read, so the data is resident
+    // once this returns
+    if (len && readahead(fd, 0, len) < 0) {
+      LOG_WARN("readahead %s error: %d", path.c_str(), errno);
+    }
+  }
+  // a missing path or a directory counts too: its lookup is cached now,
+  // and the worker answers it without another trip here
+  mark_(path, now_());
+  if (fd >= 0) {
+    close(fd);
+  }
+}
@@ -0,0 +1,237 @@
+#include "file_upload.h"
+
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <cctype>
+#include <chrono>
+#include <cstring>
+
+#include "log.h"
+
+std::atomic<uint64_t> file_upload::seq_{0};
+
+namespace {
+
+// the client's name, reduced to a safe last path component
+std::string clean_name(std::string_view name) {
+  size_t slash = name.find_last_of("/\\");
+  if (slash != std::string_view::npos) {
+    name.remove_prefix(slash + 1);
+  }
+  while (!name.empty() && name.front() == '.') {
+    name.remove_prefix(1);
+  }
+  std::string out;
+  for (char c : name.substr(0, 64)) {
+    bool safe = isalnum(static_cast<unsigned char>(c)) || c == '.' ||
+                c == '-' || c == '_';
+    out.push_back(safe ? c : '_');
+  }
+  return out;
+}
+
+// a full disk is the server's problem, not the request's
+int write_error_status(int err) {
+  return err == ENOSPC || err == EDQUOT ? 507 : 500;
+}
+
+}  // namespace
+
+file_upload::file_upload(std::string dir, size_t max_size)
+    : dir_(std::move(dir)), max_size_(max_size) {}
+
+file_upload::~file_upload() {
+  if (fd_ >= 0) {
+    close(fd_);
+  }
+  for (int fd : pipe_) {
+    if (fd >= 0) {
+      close(fd);
+    }
+  }
+  if (complete_) {
+    return;
+  }
+  if (!part_path_.empty()) {
+    unlink(part_path_.c_str());
+  }
+  for (const file &f : files_) {
+    unlink(f.path.c_str());
+  }
+}
+
+bool file_upload::begin(std::string_view content_type,
+                        std::string_view content_disposition) {
+  std::string boundary = multipart_parser::boundary_of(content_type);
+  if (!boundary.empty()) {
+    multipart_parser::callbacks cbs;
+    cbs.on_part = [this](const multipart_parser::part &part) {
+      return open_(part);
+    };
+    cbs.on_data = [this](const char *data, size_t len) {
+      return append_(data, len);
+    };
+    cbs.on_part_end = [this]() { return close_(); };
+    parser_ = std::make_unique<multipart_parser>(boundary, std::move(cbs));
+    return true;
+  }
+  if (content_type.starts_with("multipart/")) {
+    // form-data without a boundary, or another multipart type
+    return fail_(content_type.starts_with("multipart/form-data") ? 400 : 415);
+  }
+  multipart_parser::part whole;
+  whole.filename = multipart_parser::param(content_disposition, "filename");
+  whole.type = content_type;
+  return open_(whole);
+}
+
+bool file_upload::open_(const multipart_parser::part &part) {
+  // a part without a filename is a plain form field
+  in_field_ = parser_ && part.filename.empty();
+  if (in_field_) {
+    field_ = part.name;
+    fields_[field_];
+    return true;
+  }
+  auto now = std::chrono::system_clock::now().time_since_epoch();
+  std::string name =
+      std::to_string(
+          std::chrono::duration_cast<std::chrono::milliseconds>(now)
+              .count()) +
+      "-" + std::to_string(seq_.fetch_add(1));
+  std::string clean = clean_name(part.filename);
+  if (!clean.empty()) {
+    name += "-" + clean;
+  }
+  std::string path = dir_ + "/" + name;
+  part_path_ = path + ".part";
+  fd_ = ::open(part_path_.c_str(), O_WRONLY | O_CREAT | O_EXCL | O_CLOEXEC,
+               0644);
+  if (fd_ < 0) {
+    LOG_WARN("upload %s: %s", part_path_.c_str(), strerror(errno));
+    part_path_.clear();
+    return fail_(write_error_status(errno));
+  }
+  files_.push_back({part.name, part.filename, part.type, path, 0});
+  return true;
+}
+
+bool file_upload::charge_(size_t len) {
+  size_ += len;
+  return size_ <= max_size_ || fail_(413);
+}
+
+bool file_upload::write(const char *data, size_t len) {
+  if (error_) {
+    return false;
+  }
+  return parser_ ? parser_->feed(data, len) || fail_(400)
+                 : append_(data, len);
+}
+
+bool file_upload::append_(const char *data, size_t len) {
+  if (!charge_(len)) {
+    return false;
+  }
+  if (in_field_) {
+    fields_size_ += len;
+    if (fields_size_ > MAX_FIELDS_SIZE) {
+      return fail_(413);
+    }
+    fields_[field_].append(data, len);
+    return true;
+  }
+  while (len) {
+    ssize_t n = ::write(fd_, data, len);
+    if (n < 0 && errno == EINTR) {
+      continue;
+    }
+    if (n < 0) {
+      LOG_WARN("upload %s: %s", part_path_.c_str(), strerror(errno));
+      return fail_(write_error_status(errno));
+    }
+    data += n;
+    len -= n;
+    files_.back().size += n;
+  }
+  return true;
+}
+
+ssize_t file_upload::splice_from(int fd, size_t len, int &save_errno) {
+  if (pipe_[0] < 0) {
+    if (pipe2(pipe_, O_CLOEXEC | O_NONBLOCK) < 0) {
+      save_errno = EIO;
+      LOG_WARN("upload pipe: %s", strerror(errno));
+      fail_(500);
+      return -1;
+    }
+    // fewer round trips per megabyte; the default 64k is fine if refused
+    fcntl(pipe_[1], F_SETPIPE_SZ, 1 << 20);
+  }
+  ssize_t len_in = splice(fd, nullptr, pipe_[1], nullptr, len,
+                          SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+  if (len_in <= 0) {
+    save_errno = errno;
+    return len_in;
+  }
+  if (!charge_(len_in)) {
+    save_errno = EIO;
+    return -1;
+  }
+  // the pipe is emptied every time, so the next call starts with all of it
+  for (size_t left = len_in; left;) {
+    ssize_t n = splice(pipe_[0], nullptr, fd_, nullptr, left, SPLICE_F_MOVE);
+    if (n <= 0) {
+      LOG_WARN("upload %s: %s", part_path_.c_str(), strerror(errno));
+      save_errno = EIO;
+      fail_(write_error_status(errno));
+      return -1;
+    }
+    left -= n;
+    files_.back().size += n;
+  }
+  return len_in;
+}
+
+bool file_upload::close_() {
+  if (in_field_) {
+    in_field_ = false;
+    return true;
+  }
+  int fd = fd_;
+  fd_ = -1;
+  if (fd < 0) {
+    return true;
+  }
+  if (::close(fd) < 0 ||
+      rename(part_path_.c_str(), files_.back().path.c_str()) < 0) {
+    LOG_WARN("upload %s: %s", part_path_.c_str(), strerror(errno));
+    return fail_(write_error_status(errno));
+  }
+  part_path_.clear();
+  return true;
+}
+
+bool file_upload::finish() {
+  if (error_) {
+    return false;
+  }
+  if (parser_ ? !parser_->is_done() : !close_()) {
+    return fail_(400);
+  }
+  complete_ = true;
+  LOG_INFO("upload of %zu bytes, %zu files", size_, files_.size());
+  return true;
+}
+
+bool file_upload::fail_(int code) {
+  if (!error_) {
+    error_ = code;
+  }
+  if (fd_ >= 0) {
+    close(fd_);
+    fd_ = -1;
+  }
+  return false;
+}
@@ -0,0 +1,661 @@
+#include "h2_session.h"
+
+#include <algorithm>
+#include <cstring>
+
+#include "http_conn.h"
+#include "http_response.h"
+#include "log.h"
+
+namespace {
+
+const char PREFACE[] = "PRI * HTTP/2.0\r\n\r\nSM\r\n\r\n";
+const size_t PREFACE_LEN = sizeof(PREFACE) - 1;
+const size_t FRAME_HEADER_LEN = 9;
+
+enum FRAME_TYPE : uint8_t {
+  DATA = 0x0,
+  HEADERS = 0x1,
+  PRIORITY = 0x2,
+  RST_STREAM = 0x3,
+  SETTINGS = 0x4,
+  PUSH_PROMISE = 0x5,
+  PING = 0x6,
+  GOAWAY = 0x7,
+  WINDOW_UPDATE = 0x8,
+  CONTINUATION = 0x9,
+};
+
+enum FRAME_FLAG : uint8_t {
+  END_STREAM = 0x1,
+  ACK = 0x1,
+  END_HEADERS = 0x4,
+  PADDED = 0x8,
+  PRIORITY_FLAG = 0x20,
+};
+
+enum ERROR_CODE : uint32_t {
+  NO_ERROR = 0x0,
+  PROTOCOL_ERROR = 0x1,
+  INTERNAL_ERROR = 0x2,
+  FLOW_CONTROL_ERROR = 0x3,
+  STREAM_CLOSED = 0x5,
+  FRAME_SIZE_ERROR = 0x6,
+  REFUSED_STREAM = 0x7,
+  COMPRESSION_ERROR = 0x9,
+  ENHANCE_YOUR_CALM = 0xb,
+};
+
+enum SETTINGS_ID : uint16_t {
+  MAX_CONCURRENT_STREAMS = 0x3,
+  INITIAL_WINDOW_SIZE = 0x4,
+  MAX_FRAME_SIZE = 0x5,
+};
+
+uint32_t read_u32(const uint8_t *p) {
+  return (uint32_t(p[0]) << 24) | (uint32_t(p[1]) << 16) |
+         (uint32_t(p[2]) << 8) | p[3];
+}
+
+void put_u32(char *p, uint32_t v) {
+  p[0] = v >> 24;
+  p[1] = v >> 16;
+  p[2] = v >> 8;
+  p[3] = v;
+}
+
+// connection-specific fields are not allowed in http/2 (RFC 9113 8.2.2)
+bool is_hop_header(const std::string &name) {
+  return name == "connection" || name == "keep-alive" ||
+         name == "proxy-connection" || name == "transfer-encoding" ||
+         name == "upgrade" || name == "http2-settings";
+}
+
+bool base64url_decode(const std::string &src, std::string &dest) {
+  uint32_t acc = 0;
+  int bits = 0;
+  for (char c : src) {
+    int v;
+    if (c >= 'A' && c <= 'Z') {
+      v = c - 'A';
+    } else if (c >= 'a' && c <= 'z') {
+      v = c - 'a' + 26;
+    } else if (c >= '0' && c <= '9') {
+      v = c - '0' + 52;
+    } else if (c == '-' || c == '+') {
+      v = 62;
+    } else if (c == '_' || c == '/') {
+      v = 63;
+    } else if (c == '=') {
+      break;
+    } else {
+      return false;
+    }
+    acc = (acc << 6) | v;
+    bits += 6;
+    if (bits >= 8) {
+      bits -= 8;
+      dest.push_back(static_cast<char>((acc >> bits) & 0xff));
+    }
+  }
+  return true;
+}
+
+}  // namespace
+
+h2_session::h2_session(std::function<bool()> admit)
+    : admit_(std::move(admit)) {}
+
+h2_session::~h2_session() = default;
+
+int h2_session::check_preface(const buffer &in) {
+  size_t len = std::min(in.readable_bytes(), PREFACE_LEN);
+  if (memcmp(in.peek(), PREFACE, len) != 0) {
+    return -1;
+  }
+  return len == PREFACE_LEN ? 1 : 0;
+}
+
+bool h2_session::is_upgrade(const http_request &request) {
+  std::string upgrade = request.header("upgrade");
+  std::string length = request.header("content-length");
+  // requests with a body keep http/1.1, the upgrade is optional for servers
+  return upgrade.find("h2c") != std::string::npos &&
+         !request.header("http2-settings").empty() &&
+         request.header("transfer-encoding").empty() &&
+         (length.empty() || length == "0");
+}
+
+void h2_session::write_frame_(buffer &out, uint8_t type, uint8_t flags,
+                              uint32_t id, const char *data, size_t len) {
+  char head[FRAME_HEADER_LEN];
+  head[0] = len >> 16;
+  head[1] = len >> 8;
+  head[2] = len;
+  head[3] = type;
+  head[4] = flags;
+  put_u32(head + 5, id & 0x7fffffff);
+  out.append(head, sizeof(head));
+  if (len) {
+    out.append(data, len);
+  }
+}
+
+void h2_session::write_window_update_(buffer &out, uint32_t id,
+                                      uint32_t increment) {
+  char payload[4];
+  put_u32(payload, increment);
+  write_frame_(out, WINDOW_UPDATE, 0, id, payload, sizeof(payload));
+}
+
+void h2_session::reset_stream_(buffer &out, uint32_t id, uint32_t code) {
+  char payload[4];
+  put_u32(payload, code);
+  write_frame_(out, RST_STREAM, 0, id, payload, sizeof(payload));
+  streams_.erase(id);
+  if (continuation_id_ == id) {
+    continuation_id_ = 0;
+  }
+}
+
+void h2_session::goaway_(buffer &out, uint32_t code) {
+  char payload[8];
+  put_u32(payload, last_stream_id_);
+  put_u32(payload + 4, code);
+  write_frame_(out, GOAWAY, 0, 0, payload, sizeof(payload));
+  closed_ = true;
+  if (code != NO_ERROR) {
+    LOG_WARN("h2 goaway, error code:%d", code);
+  }
+}
+
+void h2_session::start(buffer &out) {
+  char payload[6];
+  payload[0] = 0;
+  payload[1] = MAX_CONCURRENT_STREAMS;
+  put_u32(payload + 2, MAX_STREAMS_);
+  write_frame_(out, SETTINGS, 0, 0, payload, sizeof(payload));
+}
+
+bool h2_session::upgrade(const http_request &request, buffer &out) {
+  std::string settings;
+  if (!base64url_decode(request.header("http2-settings"), settings)) {
+    return false;
+  }
+  // the HTTP2-Settings header holds a SETTINGS payload, applied without ack
+  on_settings_(ACK, reinterpret_cast<const uint8_t *>(settings.data()),
+               settings.size(), out);
+
+  stream &s = streams_[1];
+  s.send_window = peer_initial_window_;
+  s.end_stream = true;
+  s.headers.emplace_back(":method", request.method());
+  s.headers.emplace_back(":path", request.target());
+  for (auto &[name, value] : request.headers()) {
+    s.headers.emplace_back(name, value);
+  }
+  last_stream_id_ = 1;
+  dispatch_(1, out);
+  return true;
+}
+
+void h2_session::on_read(buffer &in, buffer &out) {
+  if (!preface_) {
+    int ret = check_preface(in);
+    if (ret < 0) {
+      goaway_(out, PROTOCOL_ERROR);
+    }
+    if (ret <= 0) {
+      return;
+    }
+    in.retrieve(PREFACE_LEN);
+    preface_ = true;
+  }
+
+  while (!closed_ && in.readable_bytes() >= FRAME_HEADER_LEN) {
+    auto head = reinterpret_cast<const uint8_t *>(in.peek());
+    size_t len = (size_t(head[0]) << 16) | (size_t(head[1]) << 8) | head[2];
+    if (len > MAX_FRAME_) {
+      goaway_(out, FRAME_SIZE_ERROR);
+      break;
+    }
+    if (in.readable_bytes() < FRAME_HEADER_LEN + len) {
+      break;
+    }
+    uint8_t type = head[3], flags = head[4];
+    uint32_t id = read_u32(head + 5) & 0x7fffffff;
+    on_frame_(type, flags, id, head + FRAME_HEADER_LEN, len, out);
+    in.retrieve(FRAME_HEADER_LEN + len);
+  }
+  if (closed_) {
+    in.retrieve_all();
+  }
+}
+
+void h2_session::on_frame_(uint8_t type, uint8_t flags, uint32_t id,
+                           const uint8_t *data, size_t len, buffer &out) {
+  if (continuation_id_ && (type != CONTINUATION || id != continuation_id_)) {
+    goaway_(out, PROTOCOL_ERROR);
+    return;
+  }
+
+  switch (type) {
+    case DATA:
+      on_data_(flags, id, data, len, out);
+      break;
+    case HEADERS:
+      on_headers_(flags, id, data, len, out);
+      break;
+    case CONTINUATION:
+      on_continuation_(flags, id, data, len, out);
+      break;
+    case SETTINGS:
+      if (id != 0) {
+        goaway_(out, PROTOCOL_ERROR);
+        break;
+      }
+      on_settings_(flags, data, len, out);
+      break;
+    case WINDOW_UPDATE:
+      on_window_update_(id, data, len, out);
+      break;
+    case PING:
+      if (id != 0 || len != 8) {
+        goaway_(out, len != 8 ? FRAME_SIZE_ERROR : PROTOCOL_ERROR);
+      } else if (!(flags & ACK)) {
+        write_frame_(out, PING, ACK, 0, reinterpret_cast<const char *>(data),
+                     len);
+      }
+      break;
+    case RST_STREAM:
+      if (id == 0 || len != 4) {
+        goaway_(out, PROTOCOL_ERROR);
+      } else {
+        streams_.erase(id);
+      }
+      break;
+    case GOAWAY:
+      peer_goaway_ = true;
+      break;
+    case PUSH_PROMISE:
+      goaway_(out, PROTOCOL_ERROR);
+      break;
+    case PRIORITY:
+    default:
+      // priorities are advisory; unknown frame types must be ignored
+      break;
+  }
+}
+
+void h2_session::on_headers_(uint8_t flags, uint32_t id, const uint8_t *data,
+                             size_t len, buffer &out) {
+  if (id == 0 || !(id & 1)) {
+    goaway_(out, PROTOCOL_ERROR);
+    return;
+  }
+  size_t pad = 0;
+  if (flags & PADDED) {
+    if (len < 1) {
+      goaway_(out, PROTOCOL_ERROR);
+      return;
+    }
+    pad = data[0];
+    ++data;
+    --len;
+  }
+  if (flags & PRIORITY_FLAG) {
+    if (len < 5) {
+      goaway_(out, PROTOCOL_ERROR);
+      return;
+    }
+    data += 5;
+    len -= 5;
+  }
+  if (pad > len) {
+    goaway_(out, PROTOCOL_ERROR);
+    return;
+  }
+  len -= pad;
+
+  auto iter = streams_.find(id);
+  if (iter == streams_.end()) {
+    if (id <= last_stream_id_) {
+      goaway_(out, STREAM_CLOSED);
+      return;
+    }
+    last_stream_id_ = id;
+    iter = streams_.emplace(id, stream()).first;
+    iter->second.send_window = peer_initial_window_;
+  } else if (iter->second.end_stream) {
+    reset_stream_(out, id, STREAM_CLOSED);
+    return;
+  }
+
+  // trailers reuse the same path, they are decoded and dropped
+  stream &s = iter->second;
+  s.header_block.assign(reinterpret_cast<const char *>(data), len);
+  s.end_stream = s.end_stream || (flags & END_STREAM);
+  if (flags & END_HEADERS) {
+    on_header_block_end_(id, out);
+  } else {
+    continuation_id_ = id;
+  }
+}
+
+void h2_session::on_continuation_(uint8_t flags, uint32_t id,
+                                  const uint8_t *data, size_t len,
+                                  buffer &out) {
+  auto iter = streams_.find(id);
+  if (id == 0 || id != continuation_id_ || iter == streams_.end()) {
+    goaway_(out, PROTOCOL_ERROR);
+    return;
+  }
+  stream &s = iter->second;
+  if (s.header_block.size() + len > MAX_HEADER_BLOCK_) {
+    goaway_(out, ENHANCE_YOUR_CALM);
+    return;
+  }
+  s.header_block.append(reinterpret_cast<const char *>(data), len);
+  if (flags & END_HEADERS) {
+    continuation_id_ = 0;
+    on_header_block_end_(id, out);
+  }
+}
+
+void h2_session::on_header_block_end_(uint32_t id, buffer &out) {
+  stream &s = streams_[id];
+  hpack::header_list headers;
+  bool ok = decoder_.decode(
+      reinterpret_cast<const uint8_t *>(s.header_block.data()),
+      s.header_block.size(), headers);
+  s.header_block.clear();
+  if (!ok) {
+    goaway_(out, COMPRESSION_ERROR);
+    return;
+  }
+  if (s.dispatched || !s.headers.empty()) {
+    // trailers
+    if (s.end_stream && !s.dispatched) {
+      dispatch_(id, out);
+    }
+    return;
+  }
+  s.headers = std::move(headers);
+  if (streams_.size() > MAX_STREAMS_) {
+    reset_stream_(out, id, REFUSED_STREAM);
+    return;
+  }
+  s.limited = admit_ && !admit_();
+  if (s.end_stream) {
+    dispatch_(id, out);
+  }
+}
+
+void h2_session::on_data_(uint8_t flags, uint32_t id, const uint8_t *data,
+                          size_t len, buffer &out) {
+  if (id == 0) {
+    goaway_(out, PROTOCOL_ERROR);
+    return;
+  }
+  // received data is consumed right away, so hand the credit straight back
+  if (len) {
+    write_window_update_(out, 0, len);
+  }
+  auto iter = streams_.find(id);
+  if (iter == streams_.end() || iter->second.end_stream) {
+    reset_stream_(out, id, STREAM_CLOSED);
+    return;
+  }
+  stream &s = iter->second;
+  size_t frame_len = len;
+  if (flags & PADDED) {
+    if (len < 1 || data[0] >= len) {
+      goaway_(out, PROTOCOL_ERROR);
+      return;
+    }
+    len -= 1 + data[0];
+    ++data;
+  }
+
+  bool end_stream = flags & END_STREAM;
+  if (!s.dispatched) {
+    size_t limit = http_request::max_body_size;
+    if (limit && s.body.size() + len > limit) {
+      s.too_large = true;
+    } else {
+      s.body.append(reinterpret_cast<const char *>(data), len);
+    }
+  }
+  s.end_stream = end_stream;
+  if (!end_stream && frame_len && !s.too_large) {
+    write_window_update_(out, id, frame_len);
+  }
+  // dispatching may finish and erase the stream
+  if (!s.dispatched && (end_stream || s.too_large)) {
+    dispatch_(id, out);
+  }
+}
+
+void h2_session::on_settings_(uint8_t flags, const uint8_t *data, size_t len,
+                              buffer &out) {
+  if ((flags & ACK) && len == 0) {
+    return;
+  }
+  if (len % 6) {
+    goaway_(out, FRAME_SIZE_ERROR);
+    return;
+  }
+  for (size_t i = 0; i < len; i += 6) {
+    uint16_t key = (uint16_t(data[i]) << 8) | data[i + 1];
+    uint32_t value = read_u32(data + i + 2);
+    if (key == INITIAL_WINDOW_SIZE) {
+      if (value > MAX_WINDOW_) {
+        goaway_(out, FLOW_CONTROL_ERROR);
+        return;
+      }
+      int64_t delta = int64_t(value) - peer_initial_window_;
+      peer_initial_window_ = value;
+      for (auto &[id, s] : streams_) {
+        s.send_window += delta;
+      }
+    } else if (key == MAX_FRAME_SIZE) {
+      if (value < MAX_FRAME_ || value > 0xffffff) {
+        goaway_(out, PROTOCOL_ERROR);
+        return;
+      }
+      peer_max_frame_ = value;
+    }
+  }
+  // a settings ack carries no payload; the upgrade payload is not acked
+  if (!(flags & ACK)) {
+    write_frame_(out, SETTINGS, ACK, 0, nullptr, 0);
+  }
+}
+
+void h2_session::on_window_update_(uint32_t id, const uint8_t *data,
+                                   size_t len, buffer &out) {
+  if (len != 4) {
+    goaway_(out, FRAME_SIZE_ERROR);
+    return;
+  }
+  uint32_t increment = read_u32(data) & 0x7fffffff;
+  if (id == 0) {
+    if (increment == 0 || conn_send_window_ + increment > MAX_WINDOW_) {
+      goaway_(out, increment ? FLOW_CONTROL_ERROR : PROTOCOL_ERROR);
+      return;
+    }
+    conn_send_window_ += increment;
+    return;
+  }
+  auto iter = streams_.find(id);
+  if (iter == streams_.end()) {
+    return;
+  }
+  if (increment == 0) {
+    reset_stream_(out, id, PROTOCOL_ERROR);
+  } else if (iter->second.send_window + increment > MAX_WINDOW_) {
+    reset_stream_(out, id, FLOW_CONTROL_ERROR);
+  } else {
+    iter->second.send_window += increment;
+  }
+}
+
+// rebuild an http/1.1 request and run it through a stream-local http_conn
+void h2_session::dispatch_(uint32_t id, buffer &out) {
+  stream &s = streams_[id];
+  s.dispatched = true;
+
+  std::string method, path, authority, cookie, head;
+  for (auto &[name, value] : s.headers) {
+    if (name == ":method") {
+      method = value;
+    } else if (name == ":path") {
+      path = value;
+    } else if (name == ":authority") {
+      authority = value;
+    } else if (name == "cookie") {
+      cookie += (cookie.empty() ? "" : "; ") + value;
+    } else if (name[0] != ':' && !is_hop_header(name) &&
+               name != "content-length") {
+      head += name + ": " + value + "\r\n";
+    }
+  }
+  if (method.empty() || path.empty()) {
+    reset_stream_(out, id, PROTOCOL_ERROR);
+    return;
+  }
+
+  s.conn = std::make_unique<http_conn>();
+  if (s.limited) {
+    std::string().swap(s.body);
+    http_response::make_body_response(s.conn->write_buff(), 429, false,
+                                      "text/plain", "too many requests\n");
+    if (!send_response_(id, s, out)) {
+      reset_stream_(out, id, INTERNAL_ERROR);
+    }
+    return;
+  }
+  buffer &req = s.conn->read_buff();
+  req.append(method + " " + path + " HTTP/1.1\r\n");
+  if (!authority.empty()) {
+    req.append("host: " + authority + "\r\n");
+  }
+  if (!cookie.empty()) {
+    req.append("cookie: " + cookie + "\r\n");
+  }
+  req.append(head);
+  if (s.too_large) {
+    // let http_request answer 413 the way it does for http/1.1
+    req.append("content-length: " +
+               std::to_string(http_request::max_body_size + 1) + "\r\n\r\n");
+  } else {
+    req.append("content-length: " + std::to_string(s.body.size()) +
+               "\r\n\r\n");
+    req.append(s.body);
+  }
+  std::string().swap(s.body);
+
+  if (!s.conn->process()) {
+    reset_stream_(out, id, INTERNAL_ERROR);
+    return;
+  }
+  if (!send_response_(id, s, out)) {
+    reset_stream_(out, id, INTERNAL_ERROR);
+  }
+}
+
+// turn the http/1.1 head the stream produced into a HEADERS frame
+bool h2_session::send_response_(uint32_t id, stream &s, buffer &out) {
+  buffer &resp = s.conn->write_buff();
+  const char CRLF2[] = "\r\n\r\n";
+  const char *begin = resp.peek(), *end = begin + resp.readable_bytes();
+  const char *head_end = std::search(begin, end, CRLF2, CRLF2 + 4);
+  if (head_end == end || head_end - begin < 12) {
+    return false;
+  }
+
+  hpack::header_list headers;
+  headers.emplace_back(":status", std::string(begin + 9, 3));
+  const char *line = std::find(begin, head_end, '\n') + 1;
+  while (line < head_end) {
+    const char *eol = std::search(line, head_end + 2, CRLF2, CRLF2 + 2);
+    const char *colon = std::find(line, eol, ':');
+    if (colon != eol) {
+      std::string name(line, colon), value(colon + 1, eol);
+      std::transform(name.begin(), name.end(), name.begin(), ::tolower);
+      value.erase(0, value.find_first_not_of(' '));
+      value.erase(value.find_last_not_of(' ') + 1);
+      if (!is_hop_header(name)) {
+        headers.emplace_back(std::move(name), std::move(value));
+      }
+    }
+    line = eol + 2;
+  }
+  resp.retrieve(head_end + 4 - begin);
+
+  bool head_only = s.conn->request().method() == "HEAD";
+  bool has_body = !head_only && s.conn->bytes() > 0;
+
+  std::string block;
+  hpack::encode(headers, block);
+  size_t sent = 0;
+  do {
+    size_t n = std::min(block.size() - sent, peer_max_frame_);
+    uint8_t type = sent ? CONTINUATION : HEADERS;
+    uint8_t flags = sent + n == block.size() ? END_HEADERS : 0;
+    if (!sent && !has_body) {
+      flags |= END_STREAM;
+    }
+    write_frame_(out, type, flags, id, block.data() + sent, n);
+    sent += n;
+  } while (sent < block.size());
+
+  if (has_body) {
+    ready_.push_back(id);
+  } else {
+    streams_.erase(id);
+  }
+  return true;
+}
+
+void h2_session::flush(buffer &out) {
+  // after an upgrade, hold the body of stream 1 until the client preface
+  if (!preface_) {
+    return;
+  }
+  char data[MAX_FRAME_];
+  size_t blocked = 0;
+  while (!closed_ && !ready_.empty() && blocked < ready_.size() &&
+         conn_send_window_ > 0 && out.readable_bytes() < FLUSH_BUDGET_) {
+    uint32_t id = ready_.front();
+    ready_.pop_front();
+    auto iter = streams_.find(id);
+    if (iter == streams_.end() || !iter->second.conn) {
+      continue;
+    }
+    stream &s = iter->second;
+    if (s.send_window <= 0) {
+      ready_.push_back(id);
+      ++blocked;
+      continue;
+    }
+    blocked = 0;
+
+    size_t n = std::min({sizeof(data), peer_max_frame_, s.conn->bytes(),
+                         size_t(std::min(conn_send_window_, s.send_window))});
+    size_t len = s.conn->read_output(data, n);
+    if (len == 0) {
+      reset_stream_(out, id, INTERNAL_ERROR);
+      continue;
+    }
+    bool end = s.conn->bytes() == 0;
+    write_frame_(out, DATA, end ? END_STREAM : 0, id, data, len);
+    conn_send_window_ -= len;
+    s.send_window -= len;
+    if (end) {
+      streams_.erase(iter);
+    } else {
+      ready_.push_back(id);
+    }
+  }
+}
@@ -0,0 +1,612 @@
+#include "handlers.h"
+
+#include <mysql/mysql.h>
+#include <openssl/sha.h>
+
+#include <algorithm>
+#include <cstdlib>
+#include <memory>
+
+#include "file_io.h"
+#include "http_conn.h"
+#include "log.h"
+#include "password_hasher.h"
+#include "proxy_exchange.h"
+#include "register_writer.h"
+#include "resource_index.h"
+#include "session_store.h"
+#include "sql_connpool.h"
+#include "ws_hub.h"
+
+namespace {
+
+void append_json_string(std::string &out, std::string_view text) {
+  out.push_back('"');
+  for (char c : text) {
+    if (c == '"' || c == '\\') {
+      out.push_back('\\');
+      out.push_back(c);
+    } else if (static_cast<unsigned char>(c) < 0x20) {
+      char escaped[8];
+      snprintf(escaped, sizeof(escaped), "\\u%04x", c);
+      out += escaped;
+    } else {
+      out.push_back(c);
+    }
+  }
+  out.push_back('"');
+}
+
+}  // namespace
+
+void static_file_handler::serve(http_conn &conn, const std::string &path,
+                                std::string_view extra_header) {
+  const http_request &request = conn.request();
+  http_response &response = conn.response();
+  response.init(http_conn::src_dir, path, conn.is_keep_alive(), 200);
+  response.add_header(extra_header);
+  if (request.method() == "GET" || request.method() == "HEAD") {
+    response.set_condition(request.header("if-none-match"),
+                           request.header("if-modified-since"));
+    response.set_range(request.header("range"), request.header("if-range"));
+    response.set_encoding(request.header("accept-encoding"));
+  }
+  response.make_response(conn.write_buff());
+}
+
+bool static_file_handler::is_preloaded_(const std::string &path) {
+  auto snap = resource_index::instance()->current();
+  const resource_index::resource *res =
+      snap ? resource_index::find(*snap, path) : nullptr;
+  return res && res->data;
+}
+
+void static_file_handler::handle(http_conn &conn) const {
+  const std::string &path = target_.empty() ? conn.request().path() : target_;
+  file_io *io = file_io::instance();
+  if (!io->is_open() || !conn.can_suspend() || is_preloaded_(path)) {
+    serve(conn, path);
+    return;
+  }
+  std::string real_path = http_conn::src_dir + path;
+  if (io->is_warm(real_path)) {
+    serve(conn, path);
+    return;
+  }
+  // cold file: looked up and read in on an I/O thread, then served from
+  // the page cache. a full I/O queue serves it on this worker instead
+  uint64_t generation = conn.generation();
+  auto done = [&conn, generation]() { conn.resume(generation); };
+  conn.suspend([path](http_conn &conn) { serve(conn, path); },
+               [io, real_path, done]() {
+                 return io->prefetch(real_path, done);
+               });
+}
+
+user_handler::result_cache user_handler::cache_;
+
+void user_handler::handle(http_conn &conn) const {
+  const http_request &request = conn.request();
+  // a live session already proves who this is, no query needed
+  if (is_login_ && session_store::instance()->find(session_store::token_of(
+                       request.header("cookie")))) {
+    static_file_handler::serve(conn, "/welcome.html");
+    return;
+  }
+  if (request.method() != "POST") {
+    static_file_handler::serve(conn, page_);
+    return;
+  }
+  std::string name = request.get_post("username");
+  std::string pwd = request.get_post("password");
+  std::string key = cache_.is_open() ? cache_key_(request) : "";
+  RESULT cached = RESULT::DENIED;
+  // the same post a moment ago: its outcome, without a query or a hash
+  if (!key.empty() && cache_.peek(key, &cached)) {
+    finish_(conn, cached, name);
+    return;
+  }
+  // a full hashing queue turns the attempt away before any query is made
+  if (password_hasher::instance()->is_saturated()) {
+    finish_(conn, RESULT::BUSY, "");
+    return;
+  }
+  bool is_login = is_login_;
+  auto store = [is_login, key](RESULT result) {
+    remember_(is_login, key, result);
+  };
+  if (!conn.can_suspend()) {
+    auto found = key.empty() ? result_cache::LOOKUP::MISS
+                             : cache_.lookup(key, &cached);
+    if (found == result_cache::LOOKUP::STALE) {
+      compute_(is_login, name, pwd, store);
+    } else if (found != result_cache::LOOKUP::HIT) {
+      cached = is_login ? login_(name, pwd) : register_(name, pwd);
+      store(cached);
+    }
+    finish_(conn, cached, name);
+    return;
+  }
+  // queries run on the database threads and hashes on the hashing
+  // threads; this worker moves on and the last step resumes the client.
+  // with the cache on, a post already being worked out waits for that
+  auto result = std::make_shared<RESULT>(RESULT::DENIED);
+  uint64_t generation = conn.generation();
+  auto done = [&conn, generation, result](RESULT outcome) {
+    *result = outcome;
+    conn.resume(generation);
+  };
+  auto next = [result, name](http_conn &conn) {
+    finish_(conn, *result, name);
+  };
+  conn.suspend(next, [is_login, name, pwd, key, store, done]() {
+    RESULT cached = RESULT::DENIED;
+    switch (key.empty() ? result_cache::LOOKUP::MISS
+                        : cache_.lookup(key, &cached, done)) {
+      case result_cache::LOOKUP::HIT:
+        done(cached);
+        break;
+      case result_cache::LOOKUP::STALE:
+        done(cached);
+        compute_(is_login, name, pwd, store);
+        break;
+      case result_cache::LOOKUP::MISS:
+        compute_(is_login, name, pwd, [store, done](RESULT outcome) {
+          store(outcome);
+          done(outcome);
+        });
+        break;
+      case result_cache::LOOKUP::WAIT:
+        break;
+    }
+    return true;
+  });
+}
+
+void user_handler::compute_(bool is_login, const std::string &name,
+                            const std::string &pwd,
+                            std::function<void(RESULT)> done) {
+  password_hasher *hasher = password_hasher::instance();
+  if (is_login) {
+    run_query_([name, pwd, done]() {
+      std::string stored;
+      if (!lookup_(name, &stored)) {
+        done(RESULT::DENIED);
+        return;
+      }
+      if (!password_hasher::instance()->submit([pwd, stored, done]() {
+            done(password_hasher::check(pwd, stored) ? RESULT::OK
+                                                     : RESULT::DENIED);
+          })) {
+        done(RESULT::BUSY);
+      }
+    });
+    return;
+  }
+  if (!hasher->submit([hasher, name, pwd, done]() {
+        std::string stored = hasher->hash(pwd);
+        register_writer *writer = register_writer::instance();
+        if (stored.empty()) {
+          done(RESULT::DENIED);
+        } else if (writer->is_open()) {
+          // written with the other registrations of the moment
+          if (!writer->add(name, stored, [done](bool added) {
+                done(added ? RESULT::OK : RESULT::DENIED);
+              })) {
+            done(RESULT::BUSY);
+          }
+        } else {
+          run_query_([name, stored, done]() {
+            done(insert_(name, stored) ? RESULT::OK : RESULT::DENIED);
+          });
+        }
+      })) {
+    done(RESULT::BUSY);
+  }
+}
+
+void user_handler::remember_(bool is_login, const std::string &key,
+                             RESULT result) {
+  if (key.empty()) {
+    return;
+  }
+  // a login refused a moment ago may be good now
+  if (!is_login && result == RESULT::OK) {
+    cache_.clear();
+  }
+  // busy says nothing about the post itself
+  cache_.fill(key, result, result != RESULT::BUSY);
+}
+
+// the body goes in as a digest, so no password is kept in the cache
+std::string user_handler::cache_key_(const http_request &request) {
+  const std::string &body = request.body();
+  unsigned char digest[SHA256_DIGEST_LENGTH];
+  SHA256(reinterpret_cast<const unsigned char *>(body.data()), body.size(),
+         digest);
+  std::string key = request.method() + " " + request.path() + "\n" +
+                    request.header("content-type") + "\n";
+  key.append(reinterpret_cast<const char *>(digest), sizeof(digest));
+  return key;
+}
+
+user_handler::RESULT user_handler::login_(const std::string &name,
+                                          const std::string &pwd) {
+  std::string stored;
+  return lookup_(name, &stored) && password_hasher::check(pwd, stored)
+             ? RESULT::OK
+             : RESULT::DENIED;
+}
+
+user_handler::RESULT user_handler::register_(const std::string &name,
+                                             const std::string &pwd) {
+  std::string stored = password_hasher::instance()->hash(pwd);
+  return !stored.empty() && insert_(name, stored) ? RESULT::OK
+                                                  : RESULT::DENIED;
+}
+
+void user_handler::run_query_(std::function<void()> task) {
+  sql_connpool *pool = sql_connpool::instance();
+  if (pool->is_async()) {
+    pool->run(std::move(task));
+  } else {
+    task();
+  }
+}
+
+// a verified user gets the welcome page and a session cookie
+void user_handler::finish_(http_conn &conn, RESULT result,
+                           const std::string &name) {
+  if (result == RESULT::BUSY) {
+    http_response::make_body_response(conn.write_buff(), 503,
+                                      conn.is_keep_alive(), "text/plain",
+                                      "busy, try again shortly\n");
+    return;
+  }
+  if (result != RESULT::OK) {
+    static_file_handler::serve(conn, "/error.html");
+    return;
+  }
+  session_store *sessions = session_store::instance();
+  std::string token = sessions->is_open() ? sessions->create(name) : "";
+  std::string cookie;
+  if (!token.empty()) {
+    cookie = "Set-Cookie: " + std::string(session_store::COOKIE_NAME) + "=" +
+             token + "; Max-Age=" + std::to_string(sessions->ttl_s()) +
+             "; Path=/; HttpOnly; SameSite=Lax";
+    cookie += conn.is_tls() ? "; Secure\r\n" : "\r\n";
+  }
+  static_file_handler::serve(conn, "/welcome.html", cookie);
+}
+
+void logout_handler::handle(http_conn &conn) const {
+  session_store::instance()->remove(
+      session_store::token_of(conn.request().header("cookie")));
+  std::string cookie = "Set-Cookie: " +
+                       std::string(session_store::COOKIE_NAME) +
+                       "=; Max-Age=0; Path=/; HttpOnly; SameSite=Lax\r\n";
+  static_file_handler::serve(conn, "/login.html", cookie);
+}
+
+void proxy_handler::handle(http_conn &conn) const {
+  const http_request &request = conn.request();
+  std::string method = request.method();
+  auto exchange = std::make_unique<proxy_exchange>(
+      group_, make_request_(conn),
+      method == "GET" || method == "HEAD" || method == "OPTIONS",
+      method == "HEAD");
+  if (!conn.can_suspend()) {
+    if (!exchange->fetch(conn.write_buff(), conn.is_keep_alive(),
+                         FETCH_TIMEOUT_MS_)) {
+      fail_(conn, exchange->error());
+    }
+    return;
+  }
+  proxy_exchange *ex = exchange.get();
+  conn.set_proxy(std::move(exchange));
+  int owner = conn.fd();
+  uint64_t generation = conn.generation();
+  auto done = [&conn, generation]() { conn.resume(generation); };
+  conn.suspend(finish_, [ex, owner, done]() {
+    ex->start(owner, done);
+    return true;
+  });
+}
+
+void proxy_handler::finish_(http_conn &conn) {
+  proxy_exchange *ex = conn.proxy();
+  if (ex->error()) {
+    fail_(conn, ex->error());
+    conn.set_proxy(nullptr);
+    return;
+  }
+  if (ex->ends_at_close()) {
+    conn.close_after_response();
+  }
+  ex->write_head(conn.write_buff(), conn.is_keep_alive());
+}
+
+void proxy_handler::fail_(http_conn &conn, int code) {
+  http_response::make_body_response(
+      conn.write_buff(), code, conn.is_keep_alive(), "text/plain",
+      code == 504 ? "upstream timed out\n" : "upstream unavailable\n");
+}
+
+std::string proxy_handler::make_request_(const http_conn &conn) const {
+  const http_request &request = conn.request();
+  std::string out =
+      request.method() + " " + request.target() + " HTTP/1.1\r\n";
+  std::string forwarded_for;
+  bool has_host = false;
+  for (const auto &[name, value] : request.headers()) {
+    // the framing and connection headers belong to the client's hop, this
+    // one gets its own below
+    if (name == "connection" || name == "keep-alive" ||
+        name == "proxy-connection" || name == "te" || name == "trailer" ||
+        name == "transfer-encoding" || name == "upgrade" ||
+        name == "http2-settings" || name == "content-length" ||
+        name == "expect") {
+      continue;
+    }
+    if (name == "x-forwarded-for") {
+      forwarded_for = value + ", ";
+      continue;
+    }
+    has_host |= name == "host";
+    out += name + ": " + value + "\r\n";
+  }
+  if (!has_host) {
+    out += "host: " + group_->host() + "\r\n";
+  }
+  // h2 streams have no address of their own
+  if (conn.fd() >= 0) {
+    char ip[INET_ADDRSTRLEN] = "";
+    sockaddr_in addr = conn.addr();
+    inet_ntop(AF_INET, &addr.sin_addr, ip, sizeof(ip));
+    out += "x-forwarded-for: " + forwarded_for + ip + "\r\n";
+  }
+  out += conn.is_tls() ? "x-forwarded-proto: https\r\n"
+                       : "x-forwarded-proto: http\r\n";
+  // servers may insist on a length for these, even zero
+  const std::string &body = request.body();
+  std::string method = request.method();
+  if (!body.empty() || method == "POST" || method == "PUT" ||
+      method == "PATCH") {
+    out += "content-length: " + std::to_string(body.size()) + "\r\n";
+  }
+  out += "connection: keep-alive\r\n\r\n";
+  out += body;
+  return out;
+}
+
+void websocket_handler::handle(http_conn &conn) const {
+  const http_request &request = conn.request();
+  std::string connection = request.header("connection");
+  std::transform(connection.begin(), connection.end(), connection.begin(),
+                 ::tolower);
+  std::string upgrade = request.header("upgrade");
+  std::transform(upgrade.begin(), upgrade.end(), upgrade.begin(), ::tolower);
+  std::string key = request.header("sec-websocket-key");
+  // h2 streams have no socket of their own to take over
+  if (conn.fd() < 0) {
+    refuse_(conn, 400, "websockets need http/1.1\n");
+    return;
+  }
+  if (request.method() != "GET" || upgrade != "websocket" ||
+      connection.find("upgrade") == std::string::npos || key.empty() ||
+      request.header("sec-websocket-version") != "13") {
+    refuse_(conn, 400, "not a websocket handshake\n");
+    return;
+  }
+  if (http_conn::draining) {
+    refuse_(conn, 503, "shutting down\n");
+    return;
+  }
+  std::string channel = request.path().substr(prefix_.size());
+
+  ws_session::message_callback on_message = on_message_;
+  if (!on_message) {
+    on_message = [channel](ws_session &, std::string_view data, bool binary) {
+      ws_hub::instance()->publish(channel, data, binary);
+    };
+  }
+  auto session = std::make_shared<ws_session>(conn.fd(), on_message);
+  conn.write_buff().append(
+      "HTTP/1.1 101 Switching Protocols\r\nUpgrade: websocket\r\n"
+      "Connection: Upgrade\r\nSec-WebSocket-Accept: " +
+      ws_session::accept_key(key) + "\r\n\r\n");
+  conn.upgrade_websocket(session);
+  ws_hub::instance()->subscribe(channel, session);
+  LOG_DEBUG("client[%d] joined websocket channel '%s'", conn.fd(),
+            channel.c_str());
+}
+
+void websocket_handler::refuse_(http_conn &conn, int code, const char *why) {
+  conn.close_after_response();
+  http_response::make_body_response(conn.write_buff(), code, false,
+                                    "text/plain", why);
+}
+
+int upload_handler::check_(const http_request &request) const {
+  if (request.method() != "POST" && request.method() != "PUT") {
+    return 405;
+  }
+  session_store *sessions = session_store::instance();
+  if (sessions->is_open() &&
+      !sessions->find(session_store::token_of(request.header("cookie")))) {
+    return 403;
+  }
+  // a chunked body is held to the limit as it arrives
+  std::string length = request.header("content-length");
+  if (!length.empty() && strtoull(length.c_str(), nullptr, 10) > max_size_) {
+    return 413;
+  }
+  return 0;
+}
+
+// refused here, the body is never read and nothing reaches the disk
+int upload_handler::on_body(http_conn &conn, http_request &request) const {
+  int code = check_(request);
+  if (code) {
+    return code;
+  }
+  auto upload = std::make_unique<file_upload>(dir_, max_size_);
+  if (!upload->begin(request.header("content-type"),
+                     request.header("content-disposition"))) {
+    return upload->error();
+  }
+  file_upload *sink = upload.get();
+  request.set_body_callback([sink, &request](const char *data, size_t len) {
+    if (sink->write(data, len)) {
+      return true;
+    }
+    request.reject(sink->error());
+    return false;
+  });
+  conn.set_upload(std::move(upload));
+  return 0;
+}
+
+void upload_handler::handle(http_conn &conn) const {
+  const http_request &request = conn.request();
+  file_upload *upload = conn.upload();
+  if (!upload) {
+    // no body, or that of an h2 stream, which arrives in memory
+    if (int code = check_(request)) {
+      conn.close_after_response();
+      http_response::make_body_response(conn.write_buff(), code, false,
+                                        "text/plain", "upload refused\n");
+      return;
+    }
+    auto buffered = std::make_unique<file_upload>(dir_, max_size_);
+    upload = buffered.get();
+    conn.set_upload(std::move(buffered));
+    if (upload->begin(request.header("content-type"),
+                      request.header("content-disposition"))) {
+      upload->write(request.body().data(), request.body().size());
+    }
+  }
+  if (!upload->finish()) {
+    conn.close_after_response();
+    http_response::make_body_response(conn.write_buff(), upload->error(),
+                                      false, "text/plain",
+                                      "upload failed\n");
+    return;
+  }
+  if (on_upload_) {
+    on_upload_(conn, *upload);
+  } else {
+    list_(conn, *upload);
+  }
+}
+
+void upload_handler::list_(http_conn &conn, const file_upload &upload) {
+  std::string body = "{\"files\":[";
+  for (const file_upload::file &f : upload.files()) {
+    if (body.back() == '}') {
+      body.push_back(',');
+    }
+    body += "{\"field\":";
+    append_json_string(body, f.field);
+    body += ",\"filename\":";
+    append_json_string(body, f.filename);
+    body += ",\"saved\":";
+    append_json_string(body, f.path.substr(f.path.rfind('/') + 1));
+    body += ",\"size\":" + std::to_string(f.size) + "}";
+  }
+  body += "],\"fields\":" + std::to_string(upload.fields().size()) + "}\n";
+  http_response::make_body_response(conn.write_buff(), 200,
+                                    conn.is_keep_alive(), "application/json",
+                                    body);
+}
+
+void health_handler::handle(http_conn &conn) const {
+  http_response::make_body_response(conn.write_buff(), 200,
+                                    conn.is_keep_alive(),
+                                    "text/plain", "ok\n");
+}
+
+void status_handler::handle(http_conn &conn) const {
+  std::string body = "{\"connections\":";
+  body += std::to_string(http_conn::user_count.load());
+  body += ",\"sql_free_conns\":";
+  body += std::to_string(sql_connpool::instance()->get_free_conn_count());
+  body += ",\"sessions\":";
+  body += std::to_string(session_store::instance()->size());
+  body += ",\"websockets\":";
+  body += std::to_string(ws_hub::instance()->size());
+  body += "}\n";
+  http_response::make_body_response(conn.write_buff(), 200,
+                                    conn.is_keep_alive(),
+                                    "application/json", body);
+}
+
+// the stored password of name; false if there is no such user or the
+// database can't be reached
+bool user_handler::lookup_(const std::string &name, std::string *stored) {
+  LOG_INFO("login name:%s", name.c_str());
+  MYSQL *sql;
+  sql_RAII sql_r(&sql, sql_connpool::instance());
+  if (!sql) {
+    return false;
+  }
+
+  std::string order = "SELECT username, password FROM user WHERE username = ";
+  sql_connpool::append_quoted(sql, order, name);
+  order += " LIMIT 1";
+  LOG_DEBUG("%s", order.c_str());
+
+  if (mysql_real_query(sql, order.data(), order.size())) {
+    return false;
+  }
+
+  MYSQL_RES *sql_res = mysql_store_result(sql);
+  MYSQL_ROW row = mysql_fetch_row(sql_res);
+  bool found = row && row[1];
+  if (found) {
+    stored->assign(row[1]);
+  } else {
+    LOG_DEBUG("user verify failed: user doesn't exist");
+  }
+  mysql_free_result(sql_res);
+  return found;
+}
+
+bool user_handler::insert_(const std::string &name, const std::string &stored) {
+  LOG_INFO("register name:%s", name.c_str());
+  MYSQL *sql;
+  sql_RAII sql_r(&sql, sql_connpool::instance());
+  if (!sql) {
+    return false;
+  }
+
+  std::string order = "SELECT username FROM user WHERE username = ";
+  sql_connpool::append_quoted(sql, order, name);
+  order += " LIMIT 1";
+  LOG_DEBUG("%s", order.c_str());
+
+  if (mysql_real_query(sql, order.data(), order.size())) {
+    return false;
+  }
+
+  MYSQL_RES *sql_res = mysql_store_result(sql);
+  bool exists = mysql_fetch_row(sql_res) != nullptr;
+  mysql_free_result(sql_res);
+  if (exists) {
+    LOG_DEBUG("user verify failed: user exist");
+    return false;
+  }
+
+  // not logged: the text holds the password hash
+  order = "INSERT INTO user(username, password) VALUES(";
+  sql_connpool::append_quoted(sql, order, name);
+  order += ", ";
+  sql_connpool::append_quoted(sql, order, stored);
+  order += ")";
+  if (mysql_real_query(sql, order.data(), order.size())) {
+    LOG_DEBUG("user verify failed: insert error");
+    return false;
+  }
+  LOG_DEBUG("user verify success");
+  return true;
+}
@@ -0,0 +1,107 @@
+#include "header_writer.h"
+
+#include <charconv>
+#include <cstring>
+
+char header_writer::date_[DATE_SLOTS_][HTTP_DATE_LEN];
+std::atomic<size_t> header_writer::date_idx_{0};
+
+namespace {
+
+constexpr char WEEKDAY[7][4] = {"Sun", "Mon", "Tue", "Wed",
+                                "Thu", "Fri", "Sat"};
+constexpr char MONTH[12][4] = {"Jan", "Feb", "Mar", "Apr", "May", "Jun",
+                               "Jul", "Aug", "Sep", "Oct", "Nov", "Dec"};
+
+char *put_2digits(char *p, int value) {
+  p[0] = '0' + value / 10;
+  p[1] = '0' + value % 10;
+  return p + 2;
+}
+
+}  // namespace
+
+char *header_writer::reserve_(size_t len) {
+  buff_.ensure_writeable(len);
+  return buff_.begin_write();
+}
+
+char *header_writer::put_(char *p, std::string_view text) {
+  memcpy(p, text.data(), text.size());
+  return p + text.size();
+}
+
+char *header_writer::put_(char *p, uint64_t value) {
+  return std::to_chars(p, p + 20, value).ptr;
+}
+
+header_writer &header_writer::field(std::string_view name,
+                                    std::string_view value) {
+  char *begin = reserve_(name.size() + value.size() + 2);
+  char *p = put_(put_(begin, name), value);
+  p = put_(p, "\r\n");
+  buff_.has_written(p - begin);
+  return *this;
+}
+
+header_writer &header_writer::field(std::string_view name, uint64_t value) {
+  char *begin = reserve_(name.size() + 22);
+  char *p = put_(put_(begin, name), value);
+  p = put_(p, "\r\n");
+  buff_.has_written(p - begin);
+  return *this;
+}
+
+header_writer &header_writer::content_range(uint64_t first, uint64_t last,
+                                            uint64_t size) {
+  char *begin = reserve_(96);
+  char *p = put_(begin, "Content-Range: bytes ");
+  if (first <= last) {
+    p = put_(put_(put_(p, first), "-"), last);
+  } else {
+    p = put_(p, "*");
+  }
+  p = put_(put_(put_(p, "/"), size), "\r\n");
+  buff_.has_written(p - begin);
+  return *this;
+}
+
+header_writer &header_writer::date() {
+  char *begin = reserve_(DATE_NAME_.size() + HTTP_DATE_LEN + 2);
+  char *p = put_(begin, DATE_NAME_);
+  const char *date = date_[date_idx_.load(std::memory_order_acquire)];
+  if (date[0]) {
+    p = put_(p, std::string_view(date, HTTP_DATE_LEN));
+  } else {
+    p += format_date(time(nullptr), p);
+  }
+  p = put_(p, "\r\n");
+  buff_.has_written(p - begin);
+  return *this;
+}
+
+void header_writer::update_date(time_t t) {
+  size_t next = (date_idx_.load(std::memory_order_relaxed) + 1) % DATE_SLOTS_;
+  format_date(t, date_[next]);
+  date_idx_.store(next, std::memory_order_release);
+}
+
+size_t header_writer::format_date(time_t t, char *out) {
+  tm gmt;
+  gmtime_r(&t, &gmt);
+  char *p = put_(out, WEEKDAY[gmt.tm_wday]);
+  p = put_(p, ", ");
+  p = put_2digits(p, gmt.tm_mday);
+  *p++ = ' ';
+  p = put_(p, MONTH[gmt.tm_mon]);
+  *p++ = ' ';
+  p = std::to_chars(p, p + 4, gmt.tm_year + 1900).ptr;
+  *p++ = ' ';
+  p = put_2digits(p, gmt.tm_hour);
+  *p++ = ':';
+  p = put_2digits(p, gmt.tm_min);
+  *p++ = ':';
+  p = put_2digits(p, gmt.tm_sec);
+  p = put_(p, " GMT");
+  return p - out;
+}
@@ -29,19 +29,29 @@ void heap_timer::down_(size_t idx) {
   }
 }
 
+// the node leaves the heap before the one moved into its slot is sifted,
+// otherwise down_() can swap it right back in and drop another timer
 void heap_timer::del_(size_t idx) {
   size_t heap_size_ = heap_.size() - 1;
   if (idx < heap_size_) {
     swap_node_(idx, heap_size_);
-    down_(idx);
-    up_(idx);
   }
   ref_.erase(heap_.back().id_);
   heap_.pop_back();
+  if (idx < heap_.size()) {
+    down_(idx);
+    up_(idx);
+  }
 }
 
+// an unknown id has nothing to move; looking it up with [] would aim it at
+// the unused slot 0 and sift that into the heap
 void heap_timer::adjust(size_t id, int new_expire) {
-  size_t idx = ref_[id];
+  auto iter = ref_.find(id);
+  if (iter == ref_.end()) {
+    return;
+  }
+  size_t idx = iter->second;
   heap_[idx].expire_ = chrono_clock::now() + ms(new_expire);
   down_(idx);
   up_(idx);
@@ -75,14 +85,15 @@ void heap_timer::tick() {
     if (duration_cast(node.expire_ - chrono_clock::now()).count() > 0) {
       break;
     }
-    node.cb_();
+    // pop first, so a callback may add its own id again
     pop();
+    node.cb_();
   }
 }
 
 int heap_timer::get_next_tick() {
   tick();
-  size_t res = -1;
+  int res = -1;
   if (heap_.size() > 1) {
     res = duration_cast(heap_[1].expire_ - chrono_clock::now()).count();
     if (res < 0) {
@@ -0,0 +1,374 @@
+#include "hpack.h"
+
+#include <iterator>
+
+namespace {
+
+const hpack::header_field STATIC_TABLE[] = {
+    {":authority", ""},
+    {":method", "GET"},
+    {":method", "POST"},
+    {":path", "/"},
+    {":path", "/index.html"},
+    {":scheme", "http"},
+    {":scheme", "https"},
+    {":status", "200"},
+    {":status", "204"},
+    {":status", "206"},
+    {":status", "304"},
+    {":status", "400"},
+    {":status", "404"},
+    {":status", "500"},
+    {"accept-charset", ""},
+    {"accept-encoding", "gzip, deflate"},
+    {"accept-language", ""},
+    {"accept-ranges", ""},
+    {"accept", ""},
+    {"access-control-allow-origin", ""},
+    {"age", ""},
+    {"allow", ""},
+    {"authorization", ""},
+    {"cache-control", ""},
+    {"content-disposition", ""},
+    {"content-encoding", ""},
+    {"content-language", ""},
+    {"content-length", ""},
+    {"content-location", ""},
+    {"content-range", ""},
+    {"content-type", ""},
+    {"cookie", ""},
+    {"date", ""},
+    {"etag", ""},
+    {"expect", ""},
+    {"expires", ""},
+    {"from", ""},
+    {"host", ""},
+    {"if-match", ""},
+    {"if-modified-since", ""},
+    {"if-none-match", ""},
+    {"if-range", ""},
+    {"if-unmodified-since", ""},
+    {"last-modified", ""},
+    {"link", ""},
+    {"location", ""},
+    {"max-forwards", ""},
+    {"proxy-authenticate", ""},
+    {"proxy-authorization", ""},
+    {"range", ""},
+    {"referer", ""},
+    {"refresh", ""},
+    {"retry-after", ""},
+    {"server", ""},
+    {"set-cookie", ""},
+    {"strict-transport-security", ""},
+    {"transfer-encoding", ""},
+    {"user-agent", ""},
+    {"vary", ""},
+    {"via", ""},
+    {"www-authenticate", ""},
+};
+const size_t STATIC_TABLE_SIZE = std::size(STATIC_TABLE);
+
+// RFC 7541 appendix B, symbol 256 is EOS
+const struct {
+  uint32_t code;
+  uint8_t len;
+} HUFFMAN_CODES[257] = {
+    {0x1ff8, 13}, {0x7fffd8, 23}, {0xfffffe2, 28}, {0xfffffe3, 28},
+    {0xfffffe4, 28}, {0xfffffe5, 28}, {0xfffffe6, 28}, {0xfffffe7, 28},
+    {0xfffffe8, 28}, {0xffffea, 24}, {0x3ffffffc, 30}, {0xfffffe9, 28},
+    {0xfffffea, 28}, {0x3ffffffd, 30}, {0xfffffeb, 28}, {0xfffffec, 28},
+    {0xfffffed, 28}, {0xfffffee, 28}, {0xfffffef, 28}, {0xffffff0, 28},
+    {0xffffff1, 28}, {0xffffff2, 28}, {0x3ffffffe, 30}, {0xffffff3, 28},
+    {0xffffff4, 28}, {0xffffff5, 28}, {0xffffff6, 28}, {0xffffff7, 28},
+    {0xffffff8, 28}, {0xffffff9, 28}, {0xffffffa, 28}, {0xffffffb, 28},
+    {0x14, 6}, {0x3f8, 10}, {0x3f9, 10}, {0xffa, 12},
+    {0x1ff9, 13}, {0x15, 6}, {0xf8, 8}, {0x7fa, 11},
+    {0x3fa, 10}, {0x3fb, 10}, {0xf9, 8}, {0x7fb, 11},
+    {0xfa, 8}, {0x16, 6}, {0x17, 6}, {0x18, 6},
+    {0x0, 5}, {0x1, 5}, {0x2, 5}, {0x19, 6},
+    {0x1a, 6}, {0x1b, 6}, {0x1c, 6}, {0x1d, 6},
+    {0x1e, 6}, {0x1f, 6}, {0x5c, 7}, {0xfb, 8},
+    {0x7ffc, 15}, {0x20, 6}, {0xffb, 12}, {0x3fc, 10},
+    {0x1ffa, 13}, {0x21, 6}, {0x5d, 7}, {0x5e, 7},
+    {0x5f, 7}, {0x60, 7}, {0x61, 7}, {0x62, 7},
+    {0x63, 7}, {0x64, 7}, {0x65, 7}, {0x66, 7},
+    {0x67, 7}, {0x68, 7}, {0x69, 7}, {0x6a, 7},
+    {0x6b, 7}, {0x6c, 7}, {0x6d, 7}, {0x6e, 7},
+    {0x6f, 7}, {0x70, 7}, {0x71, 7}, {0x72, 7},
+    {0xfc, 8}, {0x73, 7}, {0xfd, 8}, {0x1ffb, 13},
+    {0x7fff0, 19}, {0x1ffc, 13}, {0x3ffc, 14}, {0x22, 6},
+    {0x7ffd, 15}, {0x3, 5}, {0x23, 6}, {0x4, 5},
+    {0x24, 6}, {0x5, 5}, {0x25, 6}, {0x26, 6},
+    {0x27, 6}, {0x6, 5}, {0x74, 7}, {0x75, 7},
+    {0x28, 6}, {0x29, 6}, {0x2a, 6}, {0x7, 5},
+    {0x2b, 6}, {0x76, 7}, {0x2c, 6}, {0x8, 5},
+    {0x9, 5}, {0x2d, 6}, {0x77, 7}, {0x78, 7},
+    {0x79, 7}, {0x7a, 7}, {0x7b, 7}, {0x7ffe, 15},
+    {0x7fc, 11}, {0x3ffd, 14}, {0x1ffd, 13}, {0xffffffc, 28},
+    {0xfffe6, 20}, {0x3fffd2, 22}, {0xfffe7, 20}, {0xfffe8, 20},
+    {0x3fffd3, 22}, {0x3fffd4, 22}, {0x3fffd5, 22}, {0x7fffd9, 23},
+    {0x3fffd6, 22}, {0x7fffda, 23}, {0x7fffdb, 23}, {0x7fffdc, 23},
+    {0x7fffdd, 23}, {0x7fffde, 23}, {0xffffeb, 24}, {0x7fffdf, 23},
+    {0xffffec, 24}, {0xffffed, 24}, {0x3fffd7, 22}, {0x7fffe0, 23},
+    {0xffffee, 24}, {0x7fffe1, 23}, {0x7fffe2, 23}, {0x7fffe3, 23},
+    {0x7fffe4, 23}, {0x1fffdc, 21}, {0x3fffd8, 22}, {0x7fffe5, 23},
+    {0x3fffd9, 22}, {0x7fffe6, 23}, {0x7fffe7, 23}, {0xffffef, 24},
+    {0x3fffda, 22}, {0x1fffdd, 21}, {0xfffe9, 20}, {0x3fffdb, 22},
+    {0x3fffdc, 22}, {0x7fffe8, 23}, {0x7fffe9, 23}, {0x1fffde, 21},
+    {0x7fffea, 23}, {0x3fffdd, 22}, {0x3fffde, 22}, {0xfffff0, 24},
+    {0x1fffdf, 21}, {0x3fffdf, 22}, {0x7fffeb, 23}, {0x7fffec, 23},
+    {0x1fffe0, 21}, {0x1fffe1, 21}, {0x3fffe0, 22}, {0x1fffe2, 21},
+    {0x7fffed, 23}, {0x3fffe1, 22}, {0x7fffee, 23}, {0x7fffef, 23},
+    {0xfffea, 20}, {0x3fffe2, 22}, {0x3fffe3, 22}, {0x3fffe4, 22},
+    {0x7ffff0, 23}, {0x3fffe5, 22}, {0x3fffe6, 22}, {0x7ffff1, 23},
+    {0x3ffffe0, 26}, {0x3ffffe1, 26}, {0xfffeb, 20}, {0x7fff1, 19},
+    {0x3fffe7, 22}, {0x7ffff2, 23}, {0x3fffe8, 22}, {0x1ffffec, 25},
+    {0x3ffffe2, 26}, {0x3ffffe3, 26}, {0x3ffffe4, 26}, {0x7ffffde, 27},
+    {0x7ffffdf, 27}, {0x3ffffe5, 26}, {0xfffff1, 24}, {0x1ffffed, 25},
+    {0x7fff2, 19}, {0x1fffe3, 21}, {0x3ffffe6, 26}, {0x7ffffe0, 27},
+    {0x7ffffe1, 27}, {0x3ffffe7, 26}, {0x7ffffe2, 27}, {0xfffff2, 24},
+    {0x1fffe4, 21}, {0x1fffe5, 21}, {0x3ffffe8, 26}, {0x3ffffe9, 26},
+    {0xffffffd, 28}, {0x7ffffe3, 27}, {0x7ffffe4, 27}, {0x7ffffe5, 27},
+    {0xfffec, 20}, {0xfffff3, 24}, {0xfffed, 20}, {0x1fffe6, 21},
+    {0x3fffe9, 22}, {0x1fffe7, 21}, {0x1fffe8, 21}, {0x7ffff3, 23},
+    {0x3fffea, 22}, {0x3fffeb, 22}, {0x1ffffee, 25}, {0x1ffffef, 25},
+    {0xfffff4, 24}, {0xfffff5, 24}, {0x3ffffea, 26}, {0x7ffff4, 23},
+    {0x3ffffeb, 26}, {0x7ffffe6, 27}, {0x3ffffec, 26}, {0x3ffffed, 26},
+    {0x7ffffe7, 27}, {0x7ffffe8, 27}, {0x7ffffe9, 27}, {0x7ffffea, 27},
+    {0x7ffffeb, 27}, {0xffffffe, 28}, {0x7ffffec, 27}, {0x7ffffed, 27},
+    {0x7ffffee, 27}, {0x7ffffef, 27}, {0x7fffff0, 27}, {0x3ffffee, 26},
+    {0x3fffffff, 30},
+};
+
+// binary decoding tree built once from HUFFMAN_CODES
+struct huffman_tree {
+  struct node {
+    int16_t child[2] = {-1, -1};
+    int16_t sym = -1;
+  };
+  std::vector<node> nodes;
+
+  huffman_tree() : nodes(1) {
+    for (int sym = 0; sym < 257; ++sym) {
+      size_t cur = 0;
+      for (int bit = HUFFMAN_CODES[sym].len - 1; bit >= 0; --bit) {
+        int b = (HUFFMAN_CODES[sym].code >> bit) & 1;
+        if (nodes[cur].child[b] == -1) {
+          nodes[cur].child[b] = nodes.size();
+          nodes.emplace_back();
+        }
+        cur = nodes[cur].child[b];
+      }
+      nodes[cur].sym = sym;
+    }
+  }
+};
+
+}  // namespace
+
+bool hpack::decode_int_(const uint8_t *&p, const uint8_t *end, int prefix,
+                        uint64_t &value) {
+  if (p == end) {
+    return false;
+  }
+  uint64_t mask = (1 << prefix) - 1;
+  value = *p++ & mask;
+  if (value < mask) {
+    return true;
+  }
+  for (int shift = 0; p != end; shift += 7) {
+    if (shift > 56) {
+      return false;
+    }
+    uint8_t b = *p++;
+    value += static_cast<uint64_t>(b & 0x7f) << shift;
+    if (!(b & 0x80)) {
+      return true;
+    }
+  }
+  return false;
+}
+
+bool hpack::huffman_decode_(const uint8_t *p, size_t len, std::string &str) {
+  static const huffman_tree tree;
+  size_t cur = 0;
+  int pad_bits = 0;
+  bool pad_ones = true;
+  for (size_t i = 0; i < len; ++i) {
+    for (int bit = 7; bit >= 0; --bit) {
+      int b = (p[i] >> bit) & 1;
+      int next = tree.nodes[cur].child[b];
+      if (next == -1) {
+        return false;
+      }
+      ++pad_bits;
+      pad_ones = pad_ones && b;
+      if (tree.nodes[next].sym != -1) {
+        if (tree.nodes[next].sym == 256) {
+          return false;
+        }
+        str.push_back(static_cast<char>(tree.nodes[next].sym));
+        cur = 0;
+        pad_bits = 0;
+        pad_ones = true;
+      } else {
+        cur = next;
+      }
+    }
+  }
+  // padding: the most significant bits of EOS, shorter than a byte
+  return pad_bits < 8 && pad_ones;
+}
+
+bool hpack::decode_string_(const uint8_t *&p, const uint8_t *end,
+                           std::string &str) {
+  if (p == end) {
+    return false;
+  }
+  bool huffman = *p & 0x80;
+  uint64_t len;
+  if (!decode_int_(p, end, 7, len) || len > MAX_STRING_ ||
+      len > static_cast<uint64_t>(end - p)) {
+    return false;
+  }
+  str.clear();
+  if (huffman) {
+    if (!huffman_decode_(p, len, str)) {
+      return false;
+    }
+  } else {
+    str.assign(reinterpret_cast<const char *>(p), len);
+  }
+  p += len;
+  return true;
+}
+
+bool hpack::lookup_(uint64_t idx, header_field &field) const {
+  if (idx == 0) {
+    return false;
+  }
+  if (idx <= STATIC_TABLE_SIZE) {
+    field = STATIC_TABLE[idx - 1];
+    return true;
+  }
+  idx -= STATIC_TABLE_SIZE + 1;
+  if (idx >= dynamic_.size()) {
+    return false;
+  }
+  field = dynamic_[idx];
+  return true;
+}
+
+void hpack::evict_(size_t max_size) {
+  while (dynamic_size_ > max_size && !dynamic_.empty()) {
+    auto &field = dynamic_.back();
+    dynamic_size_ -= field.first.size() + field.second.size() + ENTRY_OVERHEAD_;
+    dynamic_.pop_back();
+  }
+}
+
+void hpack::insert_(const header_field &field) {
+  size_t size = field.first.size() + field.second.size() + ENTRY_OVERHEAD_;
+  if (size > max_size_) {
+    evict_(0);
+    return;
+  }
+  evict_(max_size_ - size);
+  dynamic_.push_front(field);
+  dynamic_size_ += size;
+}
+
+bool hpack::decode(const uint8_t *data, size_t len, header_list &headers) {
+  const uint8_t *p = data, *end = data + len;
+  while (p != end) {
+    uint8_t first = *p;
+    uint64_t idx;
+    header_field field;
+    if (first & 0x80) {
+      // indexed header field
+      if (!decode_int_(p, end, 7, idx) || !lookup_(idx, field)) {
+        return false;
+      }
+      headers.push_back(std::move(field));
+      continue;
+    }
+    if ((first & 0xe0) == 0x20) {
+      // dynamic table size update
+      if (!decode_int_(p, end, 5, idx) || idx > SETTINGS_TABLE_SIZE_) {
+        return false;
+      }
+      max_size_ = idx;
+      evict_(max_size_);
+      continue;
+    }
+
+    // literal: with incremental indexing (01), without (0000) or never (0001)
+    bool indexing = (first & 0xc0) == 0x40;
+    if (!decode_int_(p, end, indexing ? 6 : 4, idx)) {
+      return false;
+    }
+    if (idx) {
+      if (!lookup_(idx, field)) {
+        return false;
+      }
+    } else if (!decode_string_(p, end, field.first)) {
+      return false;
+    }
+    if (!decode_string_(p, end, field.second)) {
+      return false;
+    }
+    if (indexing) {
+      insert_(field);
+    }
+    headers.push_back(std::move(field));
+  }
+  return true;
+}
+
+void hpack::encode_int_(std::string &out, uint8_t first, int prefix,
+                        uint64_t value) {
+  uint64_t mask = (1 << prefix) - 1;
+  if (value < mask) {
+    out.push_back(static_cast<char>(first | value));
+    return;
+  }
+  out.push_back(static_cast<char>(first | mask));
+  value -= mask;
+  while (value >= 0x80) {
+    out.push_back(static_cast<char>((value & 0x7f) | 0x80));
+    value >>= 7;
+  }
+  out.push_back(static_cast<char>(value));
+}
+
+void hpack::encode_string_(std::string &out, const std::string &str) {
+  encode_int_(out, 0, 7, str.size());
+  out.append(str);
+}
+
+void hpack::encode(const header_list &headers, std::string &out) {
+  for (auto &[name, value] : headers) {
+    size_t name_idx = 0;
+    bool exact = false;
+    for (size_t i = 0; i < STATIC_TABLE_SIZE && !exact; ++i) {
+      if (STATIC_TABLE[i].first != name) {
+        continue;
+      }
+      exact = STATIC_TABLE[i].second == value;
+      if (!name_idx || exact) {
+        name_idx = i + 1;
+      }
+    }
+    if (exact) {
+      encode_int_(out, 0x80, 7, name_idx);
+      continue;
+    }
+    // literal header field without indexing
+    encode_int_(out, 0, 4, name_idx);
+    if (!name_idx) {
+      encode_string_(out, name);
+    }
+    encode_string_(out, value);
+  }
+}
@@ -1,78 +1,546 @@
 #include "http_conn.h"
 
+#include <openssl/err.h>
+#include <sys/uio.h>
 #include <unistd.h>
 
+#include <cstring>
+#include <string_view>
+
+#include "conn_limiter.h"
+#include "h2_session.h"
 #include "log.h"
+#include "router.h"
+#include "socket_options.h"
+#include "ws_hub.h"
 
 bool http_conn::ET = true;
+bool http_conn::cork = true;
 std::atomic<int> http_conn::user_count;
+std::atomic<bool> http_conn::draining;
 const char* http_conn::src_dir = nullptr;
+std::function<void(http_conn*)> http_conn::on_resume;
+std::function<bool(const http_conn&)> http_conn::admit;
+
+http_conn::http_conn() {
+  request_.set_head_callback(
+      [this](http_request &request) { return start_body_(request); });
+}
 
 http_conn::~http_conn() { close_(); }
 
 void http_conn::close_() {
-  if (fd_) {
-    close(fd_);
+  ++generation_;
+  next_ = nullptr;
+  start_ = nullptr;
+  pending_ = false;
+  h2_.reset();
+  proxy_.reset();
+  upload_.reset();
+  close_websocket_();
+  if (ssl_) {
+    SSL_shutdown(ssl_);
+    SSL_free(ssl_);
+    ssl_ = nullptr;
+  }
+  if (fd_ >= 0) {
+    // the number can be handed to a new client as soon as it is closed,
+    // and that client's init() must not be undone here
+    int fd = fd_;
+    sockaddr_in addr = addr_;
+    fd_ = -1;
+    close(fd);
     user_count.fetch_sub(1);
-    LOG_DEBUG("client[%d](%s:%d) quit, user_count:%d", fd_, ip(), port(),
-              user_count.load());
+    conn_limiter::instance()->release(addr.sin_addr.s_addr);
+    LOG_DEBUG("client[%d](%s:%d) quit, user_count:%d", fd,
+              inet_ntoa(addr.sin_addr), addr.sin_port, user_count.load());
   }
 }
 
-void http_conn::init(int fd, const sockaddr_in& addr) {
+void http_conn::init(int fd, const sockaddr_in& addr, SSL* ssl) {
   addr_ = addr;
   fd_ = fd;
+  ssl_ = ssl;
+  handshaked_ = want_write_ = ktls_send_ = corked_ = false;
+  idle_ = true;
   user_count.fetch_add(1);
   write_buff_.retrieve_all();
   read_buff_.retrieve_all();
+  request_.init();
+  h2_.reset();
+  proxy_.reset();
+  upload_.reset();
+  close_websocket_();
+  next_ = nullptr;
+  start_ = nullptr;
+  pending_ = keep_alive_ = admitted_ = false;
+  ++generation_;
   LOG_INFO("client[%d](%s:%d) in, user_count:%d", fd_, ip(), port(),
            user_count.load());
 }
 
+// before the fd is closed: a publisher must not arm a number that may
+// already belong to the next client
+void http_conn::close_websocket_() {
+  if (ws_) {
+    ws_->close();
+    ws_hub::instance()->remove(ws_.get());
+    ws_.reset();
+  }
+}
+
+int http_conn::handshake() {
+  int ret = SSL_do_handshake(ssl_);
+  if (ret == 1) {
+    handshaked_ = true;
+    ktls_send_ = BIO_get_ktls_send(SSL_get_wbio(ssl_));
+    LOG_DEBUG("client[%d] %s %s, ktls send:%d, reused:%d", fd_,
+              SSL_get_version(ssl_), SSL_get_cipher(ssl_), ktls_send_,
+              SSL_session_reused(ssl_));
+    return 1;
+  }
+  int err = SSL_get_error(ssl_, ret);
+  if (err == SSL_ERROR_WANT_READ || err == SSL_ERROR_WANT_WRITE) {
+    want_write_ = err == SSL_ERROR_WANT_WRITE;
+    return 0;
+  }
+  LOG_WARN("client[%d] handshake error: %s", fd_,
+           ERR_error_string(ERR_get_error(), nullptr));
+  return -1;
+}
+
+ssize_t http_conn::tls_read_(int& save_errno) {
+  char extra[TLS_RECORD_];
+  ssize_t len = -1;
+  do {
+    len = SSL_read(ssl_, extra, sizeof(extra));
+    if (len > 0) {
+      read_buff_.append(extra, len);
+      continue;
+    }
+    int err = SSL_get_error(ssl_, len);
+    if (err == SSL_ERROR_WANT_READ || err == SSL_ERROR_WANT_WRITE) {
+      save_errno = EAGAIN;
+      len = -1;
+    } else if (err == SSL_ERROR_ZERO_RETURN) {
+      len = 0;
+    } else {
+      save_errno = errno ? errno : EIO;
+      len = -1;
+    }
+    break;
+  } while ((ET && !window_full_()) || SSL_pending(ssl_));
+  return len;
+}
+
+ssize_t http_conn::tls_write_(int& save_errno) {
+  ssize_t len = -1;
+  size_t file_sent = 0;
+  do {
+    if (!write_buff_.readable_bytes() && !mm_file_len && !file_len &&
+        proxy_ && proxy_->body_left()) {
+      // no splice into a TLS stream, the body is read and encrypted here
+      len = proxy_->relay(fd_, write_buff_, false, save_errno);
+      if (len < 0) {
+        return -1;
+      }
+    }
+    if (!write_buff_.readable_bytes() && ws_) {
+      ws_->take(write_buff_, TLS_RECORD_);
+    }
+    if (!write_buff_.readable_bytes() && !mm_file_len && file_len &&
+        !ktls_send_) {
+      char record[TLS_RECORD_];
+      len = pread(file_fd, record, std::min(file_len, sizeof(record)),
+                  file_offset);
+      if (len <= 0) {
+        save_errno = len < 0 ? errno : EIO;
+        return -1;
+      }
+      write_buff_.append(record, len);
+      file_offset += len;
+      file_len -= len;
+      file_sent += len;
+    }
+
+    if (write_buff_.readable_bytes()) {
+      len = SSL_write(ssl_, write_buff_.peek(), write_buff_.readable_bytes());
+      if (len > 0) {
+        write_buff_.retrieve(len);
+      }
+    } else if (mm_file_len) {
+      len = SSL_write(ssl_, mm_file, mm_file_len);
+      if (len > 0) {
+        mm_file += len;
+        mm_file_len -= len;
+      }
+    } else if (file_len) {
+      len = SSL_sendfile(ssl_, file_fd, file_offset,
+                         std::min(file_len, SENDFILE_WINDOW_), 0);
+      if (len > 0) {
+        file_offset += len;
+        file_len -= len;
+        file_sent += len;
+      }
+    } else {
+      return 0;
+    }
+
+    if (len <= 0) {
+      int err = SSL_get_error(ssl_, len);
+      if (err == SSL_ERROR_WANT_WRITE || err == SSL_ERROR_WANT_READ) {
+        save_errno = EAGAIN;
+      } else {
+        save_errno = errno ? errno : EIO;
+      }
+      return -1;
+    }
+    // one window of the file per task, the fd is re-armed for the rest
+  } while (ET && file_sent < SENDFILE_WINDOW_);
+  return len;
+}
+
+ssize_t http_conn::h2_write_(int& save_errno) {
+  ssize_t len = 0;
+  do {
+    if (!write_buff_.readable_bytes()) {
+      h2_->flush(write_buff_);
+      if (!write_buff_.readable_bytes()) {
+        return 0;
+      }
+    }
+    len = write_buff_.write_fd(fd_, save_errno);
+  } while (len > 0);
+  return len;
+}
+
 ssize_t http_conn::read(int& save_errno) {
+  if (ssl_) {
+    return tls_read_(save_errno);
+  }
+  if (upload_ && upload_->can_splice() && request_.body_left() &&
+      !read_buff_.readable_bytes()) {
+    return splice_body_(save_errno);
+  }
   ssize_t len = -1;
   do {
     len = read_buff_.read_fd(fd_, save_errno);
     if (len <= 0) {
       break;
     }
-  } while (ET);
+  } while (ET && !window_full_());
+  return len;
+}
+
+// stopping short of EAGAIN is safe: re-arming a oneshot fd reports the
+// data still waiting
+bool http_conn::window_full_() const {
+  return read_buff_.readable_bytes() >= READ_WINDOW_;
+}
+
+// a whole-body upload goes from the socket to its file, and the request
+// is only told how much went
+ssize_t http_conn::splice_body_(int& save_errno) {
+  ssize_t len = -1;
+  do {
+    len = upload_->splice_from(fd_, request_.body_left(), save_errno);
+    if (len > 0) {
+      request_.skip_body(len);
+    } else if (upload_->error()) {
+      // the request fails, which process() answers
+      request_.reject(upload_->error());
+      return 1;
+    }
+  } while (len > 0 && ET && request_.body_left());
   return len;
 }
 
+// the handler of a request with a body may want to take it as it arrives;
+// h2 streams have their bodies in memory already
+int http_conn::start_body_(http_request& request) {
+  upload_.reset();
+  if (fd_ < 0) {
+    return 0;
+  }
+  const http_handler* handler = router::instance()->route(request.path());
+  return handler ? handler->on_body(*this, request) : 0;
+}
+
 /*
   TODO: async read, process, write
 */
 ssize_t http_conn::write(int& save_errno) {
+  if (h2_) {
+    return h2_write_(save_errno);
+  }
+  cork_head_();
+  if (ssl_) {
+    ssize_t len = tls_write_(save_errno);
+    uncork_();
+    return len;
+  }
   ssize_t len = -1;
   do {
-    if (write_buff_.readable_bytes())
+    if (write_buff_.readable_bytes() && mm_file_len) {
+      // one call for the head and a mapped body, so they share segments
+      iovec iov[2] = {{const_cast<char *>(write_buff_.peek()),
+                       write_buff_.readable_bytes()},
+                      {mm_file, mm_file_len}};
+      len = writev(fd_, iov, 2);
+      if (len > 0) {
+        size_t head = std::min<size_t>(len, iov[0].iov_len);
+        write_buff_.retrieve(head);
+        mm_file += len - head;
+        mm_file_len -= len - head;
+      }
+    } else if (write_buff_.readable_bytes()) {
       len = write_buff_.write_fd(fd_, save_errno);
-    else {
+    } else if (mm_file_len) {
       len = ::write(fd_, mm_file, mm_file_len);
-      if (len >= 0) {
+      if (len > 0) {
+        mm_file += len;
         mm_file_len -= len;
       }
+    } else if (file_len) {
+      len = sendfile(fd_, file_fd, &file_offset,
+                     std::min(file_len, SENDFILE_WINDOW_));
+      if (len > 0) {
+        file_len -= len;
+      }
+      // one window per task: the fd is re-armed for the rest, so the
+      // worker is free for other connections in between
+      if (len > 0 && file_len) {
+        break;
+      }
+    } else if (proxy_ && proxy_->body_left()) {
+      // the errno is set by the relay and may be the upstream's
+      len = proxy_->relay(fd_, write_buff_, true, save_errno);
+      if (len < 0) {
+        return len;
+      }
+    } else if (ws_) {
+      len = ws_->write_fd(fd_, save_errno);
+      if (len < 0) {
+        return len;
+      }
+    } else {
+      len = 0;
+    }
+    if (len < 0) {
+      save_errno = errno;
     }
     if (len <= 0) break;
   } while (ET);
+  uncork_();
   return len;
 }
 
+// a head written ahead of a sendfile body would leave as a short segment
+// of its own; corked, it fills the first segment of the body
+void http_conn::cork_head_() {
+  if (cork && !corked_ && file_len && write_buff_.readable_bytes()) {
+    socket_options::cork(fd_, true);
+    corked_ = true;
+  }
+}
+
+// once the body is out, the last partial segment is pushed
+void http_conn::uncork_() {
+  if (corked_ && !file_len) {
+    socket_options::cork(fd_, false);
+    corked_ = false;
+  }
+}
+
+size_t http_conn::read_output(char* dest, size_t len) {
+  if (write_buff_.readable_bytes()) {
+    len = std::min(len, write_buff_.readable_bytes());
+    memcpy(dest, write_buff_.peek(), len);
+    write_buff_.retrieve(len);
+  } else if (mm_file_len) {
+    len = std::min(len, mm_file_len);
+    memcpy(dest, mm_file, len);
+    mm_file += len;
+    mm_file_len -= len;
+  } else if (file_len) {
+    ssize_t ret = pread(file_fd, dest, std::min(len, file_len), file_offset);
+    if (ret <= 0) {
+      return 0;
+    }
+    len = ret;
+    file_offset += len;
+    file_len -= len;
+  } else {
+    len = 0;
+  }
+  return len;
+}
+
+bool http_conn::is_keep_alive() const {
+  if (h2_) {
+    return !h2_->is_closed();
+  }
+  if (ws_) {
+    return !ws_->is_closing();
+  }
+  return keep_alive_;
+}
+
 bool http_conn::process() {
-  request_.init();
-  if (!request_.parse(read_buff_)) {
+  if (h2_) {
+    h2_->on_read(read_buff_, write_buff_);
+    h2_->flush(write_buff_);
+    return write_buff_.readable_bytes() || h2_->is_closed();
+  }
+  if (ws_) {
+    ws_->on_read(read_buff_);
+    return ws_->queued_bytes() || ws_->is_closing();
+  }
+  if (pending_) {
+    continuation next = std::move(next_);
+    next_ = nullptr;
+    pending_ = false;
+    next(*this);
+    if (pending_) {
+      return false;
+    }
+    take_file_();
+    return true;
+  }
+  if (request_.state() == http_request::PARSE_STATE::FINISH) {
+    request_.init();
+    upload_.reset();
+    admitted_ = false;
+  }
+  // h2c with prior knowledge, only on plain connections (no ALPN here)
+  if (fd_ >= 0 && !ssl_ &&
+      request_.state() == http_request::PARSE_STATE::REQUEST_LINE) {
+    int preface = h2_session::check_preface(read_buff_);
+    if (preface == 0) {
+      return false;
+    }
+    if (preface == 1) {
+      h2_ = std::make_unique<h2_session>([this]() { return admit_(); });
+      h2_->start(write_buff_);
+      return process();
+    }
+  }
+  // a request counts once its request line is in, before any of it is
+  // handled; h2 streams are counted by the session, not per read
+  if (fd_ >= 0 && !admitted_ &&
+      request_.state() == http_request::PARSE_STATE::REQUEST_LINE &&
+      std::string_view(read_buff_.peek(), read_buff_.readable_bytes())
+              .find("\r\n") != std::string_view::npos) {
+    admitted_ = true;
+    if (!admit_()) {
+      LOG_WARN("client[%d](%s) is over its rate limit", fd_, ip());
+      request_.reject(429);
+      keep_alive_ = false;
+      read_buff_.retrieve_all();
+      http_response::make_body_response(write_buff_, 429, false, "text/plain",
+                                        "too many requests\n");
+      return true;
+    }
+  }
+  if (!request_.parse(read_buff_) && !request_.error_code()) {
     return false;
   }
   LOG_DEBUG("request %s", request_.path().c_str());
-  response_.init(src_dir, request_.path(), request_.is_keep_alive(), 200);
+  if (fd_ >= 0 && !ssl_ && !request_.error_code() &&
+      h2_session::is_upgrade(request_)) {
+    write_buff_.append(
+        "HTTP/1.1 101 Switching Protocols\r\nConnection: Upgrade\r\n"
+        "Upgrade: h2c\r\n\r\n");
+    h2_ = std::make_unique<h2_session>([this]() { return admit_(); });
+    h2_->start(write_buff_);
+    if (h2_->upgrade(request_, write_buff_)) {
+      return process();
+    }
+    LOG_WARN("client[%d] bad HTTP2-Settings", fd_);
+    h2_.reset();
+    write_buff_.retrieve_all();
+  }
+  return dispatch_();
+}
 
-  response_.make_response(write_buff_);
+bool http_conn::has_requests_in_flight() const {
+  if (ws_) {
+    return false;
+  }
+  return h2_ ? !h2_->is_idle() : read_buff_.readable_bytes() > 0;
+}
+
+void http_conn::suspend(continuation next, std::function<bool()> start) {
+  next_ = std::move(next);
+  start_ = std::move(start);
+  pending_ = true;
+}
+
+bool http_conn::start_pending() {
+  std::function<bool()> start = std::move(start_);
+  start_ = nullptr;
+  return start();
+}
 
+void http_conn::resume(uint64_t generation) {
+  if (generation == generation_) {
+    on_resume(this);
+  }
+}
+
+bool http_conn::dispatch_() {
+  mm_file = nullptr;
+  mm_file_len = 0;
+  file_fd = -1;
+  file_offset = 0;
+  file_len = 0;
+  proxy_.reset();
+  response_.reset();
+  response_start_ = write_buff_.readable_bytes();
+  // decided once, so the header sent and the close after it always agree
+  // even when draining starts in between
+  keep_alive_ =
+      !draining && !request_.error_code() && request_.is_keep_alive();
+
+  if (request_.error_code()) {
+    response_.init(src_dir, request_.path(), false, request_.error_code());
+    response_.make_response(write_buff_);
+  } else if (const http_handler *handler =
+                 router::instance()->route(request_.path())) {
+    handler->handle(*this);
+  } else {
+    response_.init(src_dir, request_.path(), false, 404);
+    response_.make_response(write_buff_);
+  }
+  if (pending_) {
+    return false;
+  }
+  // frames the client sent right behind the upgrade request
+  if (ws_ && read_buff_.readable_bytes()) {
+    ws_->on_read(read_buff_);
+  }
+  take_file_();
+  return true;
+}
+
+void http_conn::take_file_() {
+  // HEAD gets the head GET would get, length and validators included, and
+  // nothing after it
+  if (request_.method() == "HEAD") {
+    std::string_view out(write_buff_.peek(), write_buff_.readable_bytes());
+    size_t end = out.find("\r\n\r\n", response_start_);
+    if (end != std::string_view::npos) {
+      write_buff_.unwrite(out.size() - end - 4);
+    }
+    return;
+  }
   if (response_.mm_file_len() > 0 && response_.mm_file()) {
     mm_file = response_.mm_file();
     mm_file_len = response_.mm_file_len();
+  } else if (response_.file_len() > 0) {
+    file_fd = response_.file_fd();
+    file_offset = response_.file_offset();
+    file_len = response_.file_len();
   }
   LOG_DEBUG("file size: %d, %d", mm_file_len, bytes());
-  return true;
 }
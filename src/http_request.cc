@@ -1,57 +1,69 @@
 #include "http_request.h"
 
 #include <assert.h>
-#include <mysql/mysql.h>
-#include <sql_connpool.h>
 
 #include <algorithm>
+#include <charconv>
 #include <regex>
 
 #include "log.h"
+#include "path_resolver.h"
 
-const std::unordered_set<std::string> http_request::DEFAULT_HTML{
-    "/index", "/register", "/login", "/welcome", "/video", "/picture",
-};
-
-const std::unordered_map<std::string, int> http_request::DEFAULT_HTML_TAG{
-    {"/register.html", 0},
-    {"/login.html", 1},
-};
+size_t http_request::max_body_size = 1 << 20;
 
 void http_request::init() {
-  method_ = path_ = version_ = body_ = "";
+  method_ = target_ = path_ = version_ = body_ = "";
   state_ = PARSE_STATE::REQUEST_LINE;
+  error_code_ = 0;
+  body_remaining_ = body_size_ = 0;
+  body_cb_ = nullptr;
   header_.clear();
   post_.clear();
 }
 
-bool http_request::is_keep_alive() const {
-  auto c_iter = header_.find("Connection");
-  return c_iter != header_.end() && c_iter->second == "keep-alive" &&
-         version_ == "1.1";
+void http_request::set_error_(int code) {
+  error_code_ = code;
+  LOG_WARN("bad request: %d", code);
 }
 
-void http_request::parse_path_() {
-  if (path_ == "/") {
-    path_.append("/index.html");
-  } else {
-    for (auto &item : DEFAULT_HTML) {
-      if (item == path_) {
-        path_.append(".html");
-        break;
-      }
-    }
+void http_request::reject(int code) {
+  if (!error_code_) {
+    set_error_(code);
   }
 }
 
+// parse() finishes the request once it sees nothing is left
+void http_request::skip_body(size_t len) {
+  assert(state_ == PARSE_STATE::BODY && len <= body_remaining_);
+  body_size_ += len;
+  body_remaining_ -= len;
+}
+
+bool http_request::begin_body_() {
+  int code = head_cb_ ? head_cb_(*this) : 0;
+  if (code) {
+    reject(code);
+  }
+  return !error_code_;
+}
+
+bool http_request::is_keep_alive() const {
+  auto c_iter = header_.find("connection");
+  return c_iter != header_.end() && c_iter->second == "keep-alive" &&
+         version_ == "1.1";
+}
+
 bool http_request::parse_request_line_(const std::string &line) {
   std::regex pattern("^([^ ]*) ([^ ]*) HTTP/([^ ]*)$");
   std::smatch match;
   if (std::regex_match(line, match, pattern)) {
     method_ = match[1];
-    path_ = match[2];
+    target_ = match[2];
     version_ = match[3];
     state_ = PARSE_STATE::HEADERS;
+    if (int code = path_resolver::instance()->resolve(target_, &path_)) {
+      set_error_(code);
+    }
     return true;
   }
   LOG_ERROR("request_line error");
@@ -62,52 +74,205 @@ void http_request::parse_header_(const std::string &line) {
   std::regex pattern("^([^:]*): ?(.*)$");
   std::smatch match;
   if (std::regex_match(line, match, pattern)) {
-    header_[match[1]] = match[2];
+    std::string key = match[1], value = match[2];
+    std::transform(key.begin(), key.end(), key.begin(), ::tolower);
+    value.erase(value.find_last_not_of(" \t") + 1);
+    header_[key] = value;
+  } else if (line.empty()) {
+    parse_headers_end_();
   } else {
-    state_ = PARSE_STATE::BODY;
+    set_error_(400);
   }
 }
 
-void http_request::parse_body_(const std::string &line) {
-  body_ = line;
+// pick the body framing: chunked wins over Content-Length (RFC 7230 3.3.3)
+void http_request::parse_headers_end_() {
+  auto te = header_.find("transfer-encoding");
+  if (te != header_.end()) {
+    std::string coding = te->second;
+    std::transform(coding.begin(), coding.end(), coding.begin(), ::tolower);
+    if (!coding.ends_with("chunked")) {
+      set_error_(501);
+      return;
+    }
+    header_.erase("content-length");
+    if (begin_body_()) {
+      state_ = PARSE_STATE::CHUNK_SIZE;
+    }
+    return;
+  }
+
+  auto cl = header_.find("content-length");
+  if (cl == header_.end()) {
+    finish_body_();
+    return;
+  }
+  const std::string &value = cl->second;
+  auto res =
+      std::from_chars(value.data(), value.data() + value.size(), body_remaining_);
+  if (value.empty() || res.ec != std::errc() ||
+      res.ptr != value.data() + value.size()) {
+    set_error_(400);
+    return;
+  }
+  if (body_remaining_ == 0) {
+    finish_body_();
+    return;
+  }
+  if (!begin_body_()) {
+    return;
+  }
+  if (!body_cb_ && max_body_size && body_remaining_ > max_body_size) {
+    set_error_(413);
+    return;
+  }
+  state_ = PARSE_STATE::BODY;
+}
+
+bool http_request::consume_body_(const char *data, size_t len) {
+  body_size_ += len;
+  if (body_cb_) {
+    if (!body_cb_(data, len)) {
+      reject(400);
+      return false;
+    }
+    return true;
+  }
+  if (max_body_size && body_size_ > max_body_size) {
+    set_error_(413);
+    return false;
+  }
+  body_.append(data, len);
+  return true;
+}
+
+void http_request::finish_body_() {
   parse_post_();
   state_ = PARSE_STATE::FINISH;
-  LOG_DEBUG("body:%s, len:%d", line.c_str(), line.size());
+  LOG_DEBUG("body len:%d", body_size_);
+}
+
+bool http_request::parse_body_(buffer &buff) {
+  if (body_remaining_ == 0) {
+    finish_body_();
+    return true;
+  }
+  size_t len = std::min(buff.readable_bytes(), body_remaining_);
+  if (len == 0) {
+    return false;
+  }
+  if (!consume_body_(buff.peek(), len)) {
+    return false;
+  }
+  buff.retrieve(len);
+  body_remaining_ -= len;
+  if (body_remaining_ == 0) {
+    finish_body_();
+  }
+  return true;
+}
+
+bool http_request::parse_chunk_size_(buffer &buff) {
+  auto res = buff.search("\r\n", 2);
+  if (!res.first) {
+    if (buff.readable_bytes() > MAX_LINE_) {
+      set_error_(400);
+    }
+    return false;
+  }
+  buff.retrieve(2);
+  const std::string &line = res.second;
+  size_t size = 0;
+  auto conv = std::from_chars(line.data(), line.data() + line.size(), size, 16);
+  // chunk extensions after ';' are ignored
+  if (conv.ec != std::errc() ||
+      (conv.ptr != line.data() + line.size() && *conv.ptr != ';' &&
+       *conv.ptr != ' ')) {
+    set_error_(400);
+    return false;
+  }
+  if (size == 0) {
+    state_ = PARSE_STATE::CHUNK_TRAILER;
+  } else {
+    body_remaining_ = size;
+    state_ = PARSE_STATE::CHUNK_DATA;
+  }
+  return true;
+}
+
+bool http_request::parse_chunk_data_(buffer &buff) {
+  size_t len = std::min(buff.readable_bytes(), body_remaining_);
+  if (len == 0) {
+    return false;
+  }
+  if (!consume_body_(buff.peek(), len)) {
+    return false;
+  }
+  buff.retrieve(len);
+  body_remaining_ -= len;
+  if (body_remaining_ == 0) {
+    state_ = PARSE_STATE::CHUNK_CRLF;
+  }
+  return true;
+}
+
+bool http_request::parse_chunk_crlf_(buffer &buff) {
+  if (buff.readable_bytes() < 2) {
+    return false;
+  }
+  if (buff.peek()[0] != '\r' || buff.peek()[1] != '\n') {
+    set_error_(400);
+    return false;
+  }
+  buff.retrieve(2);
+  state_ = PARSE_STATE::CHUNK_SIZE;
+  return true;
+}
+
+// trailer fields are read and dropped
+bool http_request::parse_chunk_trailer_(buffer &buff) {
+  auto res = buff.search("\r\n", 2);
+  if (!res.first) {
+    if (buff.readable_bytes() > MAX_LINE_) {
+      set_error_(400);
+    }
+    return false;
+  }
+  buff.retrieve(2);
+  if (res.second.empty()) {
+    finish_body_();
+  }
+  return true;
 }
 
 int http_request::conver_hex(char ch) {
   if (ch >= 'A' && ch <= 'F') return ch - 'A' + 10;
   if (ch >= 'a' && ch <= 'f') return ch - 'a' + 10;
-  return ch;
+  if (ch >= '0' && ch <= '9') return ch - '0';
+  return 0;
 }
 
 void http_request::parse_post_() {
-  if (method_ == "POST" &&
-      header_["Content-Type"] == "application/x-www-form-urlencoded") {
+  const std::string form_type = "application/x-www-form-urlencoded";
+  if (method_ == "POST" && header("content-type").starts_with(form_type)) {
     parse_from_url_();
-    auto iter = DEFAULT_HTML_TAG.find(path_);
-    if (iter != DEFAULT_HTML_TAG.end()) {
-      int tag = iter->second;
-      if (tag == 0 || tag == 1) {
-        bool is_login = tag == 1;
-        if (user_verify(post_["username"], post_["password"], is_login)) {
-          path_ = "/welcome.html";
-        } else {
-          path_ = "/error.html";
-        }
-      }
-    }
   }
 }
 
-std::string http_request::path() const { return path_; }
-
-std::string &http_request::path() { return path_; }
-
 std::string http_request::method() const { return method_; }
 
 std::string http_request::version() const { return version_; }
 
+std::string http_request::header(const std::string &key) const {
+  std::string lower(key);
+  std::transform(lower.begin(), lower.end(), lower.begin(), ::tolower);
+  auto iter = header_.find(lower);
+  if (iter != header_.end()) {
+    return iter->second;
+  }
+  return "";
+}
+
 std::string http_request::get_post(const std::string &key) const {
   assert(key != "");
   auto iter = post_.find(key);
@@ -128,57 +293,53 @@ std::string http_request::get_post(const char *key) const {
 
 bool http_request::parse(buffer &buff) {
   const char CRLF[] = "\r\n";
-  if (buff.readable_bytes() <= 0) {
-    return false;
-  }
-
-  // FIXME: MAYBE BUG
-  while (buff.readable_bytes() && state_ != PARSE_STATE::FINISH) {
-    std::string line;
-    if (state_ != PARSE_STATE::BODY) {
-      auto res = buff.search(CRLF, 2);
-      if (res.first == false) break;
-      line = std::move(res.second);
-    } else {
-      size_t content_length = std::stoi(header_["Content-length"]);
-      if (buff.readable_bytes() < content_length) {
-        break;
-      }
-      line = buff.retrieve_as_string(content_length);
-    }
-
+  bool progress = true;
+  while (progress && error_code_ == 0 && state_ != PARSE_STATE::FINISH) {
     switch (state_) {
       case PARSE_STATE::REQUEST_LINE:
-        if (!parse_request_line_(line)) {
-          return false;
+      case PARSE_STATE::HEADERS: {
+        auto res = buff.search(CRLF, 2);
+        if (!res.first) {
+          if (buff.readable_bytes() > MAX_LINE_) {
+            set_error_(400);
+          }
+          progress = false;
+          break;
+        }
+        buff.retrieve(2);
+        if (state_ == PARSE_STATE::HEADERS) {
+          parse_header_(res.second);
+        } else if (!parse_request_line_(res.second)) {
+          set_error_(400);
         }
-        parse_path_();
         break;
+      }
+      case PARSE_STATE::BODY:
+        progress = parse_body_(buff);
+        break;
+      case PARSE_STATE::CHUNK_SIZE:
+        progress = parse_chunk_size_(buff);
         break;
-      case PARSE_STATE::HEADERS:
-        parse_header_(line);
+      case PARSE_STATE::CHUNK_DATA:
+        progress = parse_chunk_data_(buff);
         break;
-      case PARSE_STATE::BODY:
-        parse_body_(line);
+      case PARSE_STATE::CHUNK_CRLF:
+        progress = parse_chunk_crlf_(buff);
+        break;
+      case PARSE_STATE::CHUNK_TRAILER:
+        progress = parse_chunk_trailer_(buff);
         break;
       default:
+        progress = false;
         break;
     }
-
-    if (state_ != PARSE_STATE::FINISH) {
-      buff.retrieve(2);
-    }
-
-    if (state_ == PARSE_STATE::BODY && !header_.contains("Content-length")) {
-      state_ = PARSE_STATE::FINISH;
-    }
   }
 
   if (state_ != PARSE_STATE::FINISH) {
     return false;
   }
 
-  LOG_DEBUG("[%s], [%s], [%s]", method_.c_str(), path_.c_str(),
+  LOG_DEBUG("[%s], [%s], [%s]", method_.c_str(), target_.c_str(),
             version_.c_str());
   return true;
 }
@@ -191,13 +352,14 @@ void http_request::parse_from_url_() {
   std::smatch match;
   auto search_start = body_.cbegin();
   while (std::regex_search(search_start, body_.cend(), match, pattern)) {
-    std::string value = std::move(match[2]), key = std::move(match[1]);
+    std::string key = match[2], value = match[3];
+    search_start = match.suffix().first;
     size_t j = 0, n = value.size();
     for (size_t i = 0; i < n; ++i) {
       char c = value[i], tmp = c;
       if (c == '+') {
         tmp = ' ';
-      } else if (c == '%') {
+      } else if (c == '%' && i + 2 < n) {
         tmp = conver_hex(value[i + 1]) * 16 + conver_hex(value[i + 2]);
         i += 2;
       }
@@ -208,67 +370,3 @@ void http_request::parse_from_url_() {
     post_[key] = value;
   }
 }
-
-bool http_request::user_verify(const std::string &name, const std::string &pwd,
-                               bool is_login) {
-  LOG_INFO("verify name:%s pwd:%s", name.c_str(), pwd.c_str());
-  MYSQL *sql;
-  sql_RAII sql_r(&sql, sql_connpool::instance());
-
-  char sql_order[256] = {0};
-  MYSQL_RES *sql_res = nullptr;
-
-  snprintf(sql_order, 256,
-           "SELECT username, password FROM user WHERE username = '%s' LIMIT 1",
-           name.c_str());
-  LOG_DEBUG("%s", sql_order);
-
-  if (mysql_query(sql, sql_order)) {
-    // mysql_free_result(sql_res);
-    return false;
-  }
-
-  sql_res = mysql_store_result(sql);
-
-  MYSQL_ROW row = mysql_fetch_row(sql_res);
-  std::string failed_str("undefine");
-  bool flag = false;
-
-  if (row) {
-    LOG_DEBUG("Mysql row: %s %s", row[0], row[1]);
-    std::string real_password(row[1]);
-    if (is_login) {
-      if (pwd == real_password) {
-        flag = true;
-      } else {
-        failed_str = "password error";
-        flag = false;
-      }
-    } else {
-      failed_str = "user exist";
-      flag = false;
-    }
-  } else if (is_login) {
-    failed_str = "user doesn't exist";
-    flag = false;
-  } else {
-    flag = true;
-    LOG_DEBUG("user registering");
-    snprintf(sql_order, 256,
-             "INSERT INTO user(username, password) VALUES('%s', '%s')",
-             name.c_str(), pwd.c_str());
-    LOG_DEBUG("%s", sql_order);
-    if (mysql_query(sql, sql_order)) {
-      failed_str = "insert error";
-      flag = false;
-    }
-  }
-
-  if (flag) {
-    LOG_DEBUG("user verify success");
-  } else {
-    LOG_DEBUG("user verify failed: %s", failed_str.c_str());
-  }
-  mysql_free_result(sql_res);
-  return flag;
-}
\ No newline at end of file
@@ -1,155 +1,562 @@
 #include "http_response.h"
 
 #include <fcntl.h>
+#include <time.h>
+#include <unistd.h>
 
+#include <algorithm>
+#include <charconv>
+#include <cstdlib>
+
+#include "header_writer.h"
 #include "log.h"
+#include "resource_index.h"
+#include "static_table.hpp"
+
+namespace {
+
+constexpr auto SUFFIX_TYPE = make_static_table<std::string_view,
+                                               std::string_view>({
+    {".html", "text/html"},
+    {".xml", "text/xml"},
+    {".xhtml", "application/xhtml+xml"},
+    {".txt", "text/plain"},
+    {".rtf", "application/rtf"},
+    {".pdf", "application/pdf"},
+    {".word", "application/nsword"},
+    {".png", "image/png"},
+    {".gif", "image/gif"},
+    {".jpg", "image/jpeg"},
+    {".jpeg", "image/jpeg"},
+    {".au", "audio/basic"},
+    {".mpeg", "video/mpeg"},
+    {".mpg", "video/mpeg"},
+    {".avi", "video/x-msvideo"},
+    {".mp4", "video/mp4"},
+    {".webm", "video/webm"},
+    {".gz", "application/x-gzip"},
+    {".tar", "application/x-tar"},
+    {".css", "text/css"},
+    {".js", "text/javascript"},
+});
+
+constexpr std::string_view KEEP_ALIVE =
+    "Connection: keep-alive\r\nkeep-alive: max=6, timeout=120\r\n";
+constexpr std::string_view CLOSE = "Connection: close\r\n";
 
-const std::unordered_map<std::string, std::string> http_response::SUFFIX_TYPE_ =
-    {
-        {".html", "text/html"},
-        {".xml", "text/xml"},
-        {".xhtml", "application/xhtml+xml"},
-        {".txt", "text/plain"},
-        {".rtf", "application/rtf"},
-        {".pdf", "application/pdf"},
-        {".word", "application/nsword"},
-        {".png", "image/png"},
-        {".gif", "image/gif"},
-        {".jpg", "image/jpeg"},
-        {".jpeg", "image/jpeg"},
-        {".au", "audio/basic"},
-        {".mpeg", "video/mpeg"},
-        {".mpg", "video/mpeg"},
-        {".avi", "video/x-msvideo"},
-        {".gz", "application/x-gzip"},
-        {".tar", "application/x-tar"},
-        {".css", "text/css "},
-        {".js", "text/javascript "},
-};
-
-const std::unordered_map<int, std::string> http_response::CODE_STATUS_ = {
-    {200, "OK"},
-    {400, "Bad Request"},
-    {403, "Forbidden"},
-    {404, "Not Found"},
-};
-
-const std::unordered_map<int, std::string> http_response::CODE_PATH_ = {
+// complete status lines, the reason phrase sits between the code and CRLF
+constexpr auto STATUS_LINE = make_static_table<int, std::string_view>({
+    {200, "HTTP/1.1 200 OK\r\n"},
+    {206, "HTTP/1.1 206 Partial Content\r\n"},
+    {304, "HTTP/1.1 304 Not Modified\r\n"},
+    {400, "HTTP/1.1 400 Bad Request\r\n"},
+    {403, "HTTP/1.1 403 Forbidden\r\n"},
+    {404, "HTTP/1.1 404 Not Found\r\n"},
+    {405, "HTTP/1.1 405 Method Not Allowed\r\n"},
+    {413, "HTTP/1.1 413 Payload Too Large\r\n"},
+    {415, "HTTP/1.1 415 Unsupported Media Type\r\n"},
+    {416, "HTTP/1.1 416 Range Not Satisfiable\r\n"},
+    {429, "HTTP/1.1 429 Too Many Requests\r\n"},
+    {500, "HTTP/1.1 500 Internal Server Error\r\n"},
+    {501, "HTTP/1.1 501 Not Implemented\r\n"},
+    {502, "HTTP/1.1 502 Bad Gateway\r\n"},
+    {503, "HTTP/1.1 503 Service Unavailable\r\n"},
+    {504, "HTTP/1.1 504 Gateway Timeout\r\n"},
+    {507, "HTTP/1.1 507 Insufficient Storage\r\n"},
+});
+
+constexpr auto CODE_PATH = make_static_table<int, std::string_view>({
     {400, "/400.html"},
     {403, "/403.html"},
     {404, "/404.html"},
-};
+    {405, "/405.html"},
+});
+
+constexpr std::string_view status_line(int code) {
+  return STATUS_LINE.get(code, *STATUS_LINE.find(400));
+}
+
+constexpr std::string_view status_reason(int code) {
+  std::string_view line = status_line(code);
+  return line.substr(13, line.size() - 15);
+}
+
+static_assert(status_reason(404) == "Not Found");
+
+}  // namespace
+
+std::unordered_map<std::string, std::string> http_response::cache_control_map_;
+
+void http_response::set_cache_control(const std::string& pattern,
+                                      const std::string& value) {
+  cache_control_map_[pattern] = value;
+}
+
+void http_response::reset() {
+  unmap_file();
+  close_file_();
+  code_ = -1;
+}
 
 void http_response::init(const std::string& dir, const std::string& path,
                          bool is_keep_alive, int code) {
-  if (mm_file_) {
-    unmap_file();
-  }
+  unmap_file();
+  close_file_();
   dir_ = dir;
   path_ = path;
+  real_path_.assign(dir_).append(path_);
   is_keep_alive_ = is_keep_alive;
   code_ = code;
+  if_none_match_.clear();
+  if_modified_since_.clear();
+  range_.clear();
+  if_range_.clear();
+  accept_encoding_.clear();
+  range_start_ = 0;
+  range_len_ = 0;
+  extra_headers_.clear();
   mm_file_ = nullptr;
   mm_file_stat_ = {0};
 }
 
+void http_response::set_condition(const std::string& if_none_match,
+                                  const std::string& if_modified_since) {
+  if_none_match_ = if_none_match;
+  if_modified_since_ = if_modified_since;
+}
+
+void http_response::make_body_response(buffer& buff, int code,
+                                       bool is_keep_alive,
+                                       std::string_view type,
+                                       std::string_view body) {
+  header_writer(buff)
+      .line(status_line(code))
+      .date()
+      .line(is_keep_alive ? KEEP_ALIVE : CLOSE)
+      .field("Content-type: ", type)
+      .field("Content-length: ", body.size())
+      .end();
+  buff.append(body.data(), body.size());
+}
+
+void http_response::set_range(const std::string& range,
+                              const std::string& if_range) {
+  range_ = range;
+  if_range_ = if_range;
+}
+
+void http_response::close_file_() {
+  if (file_fd_ != -1 && file_owned_) {
+    close(file_fd_);
+  }
+  file_fd_ = -1;
+  file_owned_ = true;
+  file_offset_ = 0;
+  file_len_ = 0;
+}
+
 void http_response::unmap_file() {
-  if (mm_file_) {
-    munmap(mm_file_, mm_file_stat_.st_size);
-    mm_file_ = nullptr;
+  if (mm_file_ && mapped_) {
+    munmap(mm_file_, mm_len_);
+  }
+  mm_file_ = nullptr;
+  mm_len_ = 0;
+  mapped_ = false;
+  entry_ = nullptr;
+  encoding_ = nullptr;
+  snapshot_.reset();
+}
+
+std::string_view http_response::mime_type(std::string_view path) {
+  std::string_view::size_type pos = path.find_last_of('.');
+  if (pos == std::string_view::npos) {
+    return "text/plain";
   }
+  return SUFFIX_TYPE.get(path.substr(pos), "text/plain");
+}
+
+std::string_view http_response::file_type_() const {
+  return entry_ ? entry_->type : mime_type(path_);
+}
+
+std::string_view http_response::make_etag(time_t mtime, off_t size,
+                                          char* tag) {
+  char *p = tag, *end = tag + ETAG_LEN;
+  *p++ = '"';
+  p = std::to_chars(p, end, static_cast<uint64_t>(mtime), 16).ptr;
+  *p++ = '-';
+  p = std::to_chars(p, end, static_cast<uint64_t>(size), 16).ptr;
+  *p++ = '"';
+  return std::string_view(tag, p - tag);
 }
 
-std::string http_response::file_type_() {
-  std::string::size_type pos = path_.find_last_of('.');
+// fills mm_file_stat_ from the resource index, falling back to stat() for
+// files the index does not know
+bool http_response::stat_file_() {
+  entry_ = nullptr;
+  if (!snapshot_) {
+    snapshot_ = resource_index::instance()->current();
+  }
+  if (snapshot_ && snapshot_->root == dir_) {
+    entry_ = resource_index::find(*snapshot_, path_);
+    if (entry_) {
+      mm_file_stat_ = {};
+      mm_file_stat_.st_mode = S_IFREG | S_IRUSR | S_IRGRP | S_IROTH;
+      mm_file_stat_.st_size = entry_->size;
+      mm_file_stat_.st_mtime = entry_->mtime;
+      return true;
+    }
+  }
+  return stat(real_path_.c_str(), &mm_file_stat_) == 0;
+}
+
+time_t http_response::parse_http_date_(const std::string& date) {
+  tm gmt = {0};
+  if (!strptime(date.c_str(), "%a, %d %b %Y %H:%M:%S GMT", &gmt)) {
+    return -1;
+  }
+  return timegm(&gmt);
+}
+
+std::string_view http_response::cache_control_() const {
+  if (cache_control_map_.empty()) {
+    return "";
+  }
+  auto iter = cache_control_map_.find(path_);
+  if (iter != cache_control_map_.end()) {
+    return iter->second;
+  }
+  for (auto pos = path_.find_last_of('/'); pos != std::string::npos;
+       pos = pos ? path_.find_last_of('/', pos - 1) : std::string::npos) {
+    iter = cache_control_map_.find(path_.substr(0, pos + 1));
+    if (iter != cache_control_map_.end()) {
+      return iter->second;
+    }
+  }
+  auto pos = path_.find_last_of('.');
   if (pos != std::string::npos) {
-    std::string suffix = path_.substr(pos);
-    auto iter = SUFFIX_TYPE_.find(suffix);
-    if (iter != SUFFIX_TYPE_.end()) {
+    iter = cache_control_map_.find(path_.substr(pos));
+    if (iter != cache_control_map_.end()) {
       return iter->second;
     }
   }
-failed:
-  return "text/plain";
+  return "";
+}
+
+// If-None-Match wins over If-Modified-Since (RFC 7232 3.3)
+bool http_response::is_not_modified_() const {
+  if (!if_none_match_.empty()) {
+    if (if_none_match_ == "*") {
+      return true;
+    }
+    char buf[ETAG_LEN];
+    std::string_view etag = etag_(buf);
+    size_t start = 0;
+    while (start < if_none_match_.size()) {
+      size_t end = if_none_match_.find(',', start);
+      if (end == std::string::npos) {
+        end = if_none_match_.size();
+      }
+      std::string tag = if_none_match_.substr(start, end - start);
+      tag.erase(0, tag.find_first_not_of(' '));
+      tag.erase(tag.find_last_not_of(' ') + 1);
+      if (tag.starts_with("W/")) {
+        tag.erase(0, 2);
+      }
+      if (tag == etag) {
+        return true;
+      }
+      start = end + 1;
+    }
+    return false;
+  }
+  if (!if_modified_since_.empty()) {
+    time_t since = parse_http_date_(if_modified_since_);
+    return since != -1 && mm_file_stat_.st_mtime <= since;
+  }
+  return false;
+}
+
+// If-Range needs a strong match: an exact etag, or the exact Last-Modified
+bool http_response::is_range_fresh_() const {
+  if (if_range_.empty()) {
+    return true;
+  }
+  if (if_range_.front() == '"') {
+    char buf[ETAG_LEN];
+    return if_range_ == etag_(buf);
+  }
+  return parse_http_date_(if_range_) == mm_file_stat_.st_mtime;
+}
+
+// only a single "bytes=" range is honoured; multiple or malformed ranges fall
+// back to the whole file (RFC 7233 3.1 allows ignoring Range)
+void http_response::check_range_() {
+  if (range_.empty() || !range_.starts_with("bytes=") || !is_range_fresh_()) {
+    return;
+  }
+  std::string spec = range_.substr(6);
+  size_t dash = spec.find('-');
+  if (spec.find(',') != std::string::npos || dash == std::string::npos) {
+    return;
+  }
+  auto parse_num = [](const std::string& str, off_t& num) {
+    auto res = std::from_chars(str.data(), str.data() + str.size(), num);
+    return !str.empty() && res.ec == std::errc() &&
+           res.ptr == str.data() + str.size();
+  };
+
+  off_t size = mm_file_stat_.st_size, start, end;
+  std::string first = spec.substr(0, dash), last = spec.substr(dash + 1);
+  if (first.empty()) {
+    off_t suffix;
+    if (!parse_num(last, suffix)) {
+      return;
+    }
+    if (suffix == 0 || size == 0) {
+      code_ = 416;
+      return;
+    }
+    start = std::max<off_t>(0, size - suffix);
+    end = size - 1;
+  } else {
+    if (!parse_num(first, start)) {
+      return;
+    }
+    end = size - 1;
+    if (!last.empty()) {
+      if (!parse_num(last, end) || end < start) {
+        return;
+      }
+      end = std::min(end, size - 1);
+    }
+    if (start >= size) {
+      code_ = 416;
+      return;
+    }
+  }
+  code_ = 206;
+  range_start_ = start;
+  range_len_ = end - start + 1;
+}
+
+// the first of the entry's encodings the client takes; a range is always
+// of the identity bytes
+void http_response::choose_encoding_() {
+  if (!entry_ || entry_->encodings.empty() || accept_encoding_.empty() ||
+      !range_.empty()) {
+    return;
+  }
+  for (const auto &encoding : entry_->encodings) {
+    if (accepts_(accept_encoding_, encoding.name)) {
+      encoding_ = &encoding;
+      return;
+    }
+  }
+}
+
+bool http_response::accepts_(std::string_view accept,
+                             std::string_view coding) {
+  size_t start = 0;
+  while (start < accept.size()) {
+    size_t end = std::min(accept.find(',', start), accept.size());
+    std::string_view item = accept.substr(start, end - start);
+    start = end + 1;
+    size_t semi = std::min(item.find(';'), item.size());
+    std::string_view name = item.substr(0, semi);
+    while (!name.empty() && name.front() == ' ') {
+      name.remove_prefix(1);
+    }
+    while (!name.empty() && name.back() == ' ') {
+      name.remove_suffix(1);
+    }
+    if (name.size() != coding.size() ||
+        !std::equal(name.begin(), name.end(), coding.begin(),
+                    [](char a, char b) { return tolower(a) == b; })) {
+      continue;
+    }
+    // "q=0", "q=0.0" and so on turn the coding down
+    std::string_view params = item.substr(semi);
+    size_t q = params.find("q=");
+    if (q == std::string_view::npos) {
+      return true;
+    }
+    return strtod(std::string(params.substr(q + 2)).c_str(), nullptr) > 0;
+  }
+  return false;
 }
 
 void http_response::error_html() {
-  if (CODE_PATH_.contains(code_)) {
-    path_ = CODE_PATH_.at(code_);
-    stat(real_path().c_str(), &mm_file_stat_);
+  if (const std::string_view *path = CODE_PATH.find(code_)) {
+    path_ = *path;
+    real_path_.assign(dir_).append(path_);
+    stat_file_();
   }
 }
 
-void http_response::error_content(buffer& buff, std::string message) {
-  std::string body, status;
+void http_response::error_content(buffer& buff, std::string_view message) {
+  std::string body;
   body += "<html><title>Error</title>";
   body += "<body bgcolor=\"ffffff\">";
-  if (CODE_STATUS_.contains(code_)) {
-    status = CODE_STATUS_.at(code_);
-  } else {
-    status = CODE_STATUS_.at(400);
-  }
-  body += std::to_string(code_) + " : " + status + "\n";
-  body += "<p>" + message + "</p>";
+  body += std::to_string(code_) + " : ";
+  body += status_reason(code_);
+  body += "\n<p>";
+  body += message;
+  body += "</p>";
   body += "<hr><em>TinyWebserver</em></body></html>";
 
-  buff.append("Content-length: " + std::to_string(body.size()) + "\r\n\r\n");
+  header_writer(buff).field("Content-length: ", body.size()).end();
   buff.append(body);
 }
 
 void http_response::add_response_status_line_(buffer& buff) {
-  std::string status;
-  if (CODE_STATUS_.contains(code_)) {
-    status = CODE_STATUS_.at(code_);
-  } else {
-    status = CODE_STATUS_.at(400);
-  }
-  buff.append("HTTP/1.1 " + std::to_string(code_) + " " + status + "\r\n");
+  header_writer(buff).line(status_line(code_));
 }
 
 void http_response::add_response_header_(buffer& buff) {
-  buff.append("Connection: ");
-  if (is_keep_alive_) {
-    buff.append("keep-alive\r\n");
-    buff.append("keep-alive: max=6, timeout=120\r\n");
-  } else {
-    buff.append("close\r\n");
+  header_writer writer(buff);
+  writer.date();
+  writer.line(is_keep_alive_ ? KEEP_ALIVE : CLOSE);
+  // ranges are of the identity bytes, so a compressed copy offers none
+  if ((code_ == 200 && !encoding_) || code_ == 206) {
+    writer.line("Accept-Ranges: bytes\r\n");
+  }
+  if (code_ == 206) {
+    writer.content_range(range_start_, range_start_ + range_len_ - 1,
+                         mm_file_stat_.st_size);
+  } else if (code_ == 416) {
+    writer.content_range(1, 0, mm_file_stat_.st_size);
+  }
+  if (code_ == 200 || code_ == 206 || code_ == 304) {
+    if (entry_ && !entry_->head.empty()) {
+      writer.line(encoding_ ? encoding_->body->head : entry_->head);
+    } else if (entry_) {
+      writer.field("ETag: ", entry_->etag);
+      writer.field("Last-Modified: ", entry_->last_modified);
+    } else {
+      char etag[ETAG_LEN];
+      char date[header_writer::HTTP_DATE_LEN];
+      size_t date_len =
+          header_writer::format_date(mm_file_stat_.st_mtime, date);
+      writer.field("ETag: ", etag_(etag));
+      writer.field("Last-Modified: ", std::string_view(date, date_len));
+    }
+    std::string_view cache_control = cache_control_();
+    if (!cache_control.empty()) {
+      writer.field("Cache-Control: ", cache_control);
+    }
   }
-  buff.append("Content-type: " + file_type_() + "\r\n");
+  if (code_ != 304) {
+    writer.field("Content-type: ", file_type_());
+  }
+  writer.line(extra_headers_);
 }
 
 void http_response::add_response_content_(buffer& buff) {
-  int src_fd = open(real_path().c_str(), O_RDONLY);
+  // a bundle's bodies start on a page of its file: big ones go out with
+  // sendfile from there, the rest straight from the mapping
+  if (entry_ && entry_->fd >= 0) {
+    const char* data = encoding_ ? encoding_->body->data : entry_->data;
+    off_t offset = encoding_ ? encoding_->body->offset : entry_->offset;
+    size_t len = encoding_ ? encoding_->body->size : entry_->size;
+    if (code_ == 206) {
+      data += range_start_;
+      offset += range_start_;
+      len = range_len_;
+    }
+    if (len >= MMAP_THRESHOLD_) {
+      file_fd_ = entry_->fd;
+      file_owned_ = false;
+      file_offset_ = offset;
+      file_len_ = len;
+    } else {
+      mm_file_ = const_cast<char*>(data);
+      mm_len_ = len;
+    }
+    header_writer(buff).field("Content-length: ", len).end();
+    return;
+  }
+  if (entry_ && entry_->data) {
+    size_t len = code_ == 206 ? range_len_ : entry_->size;
+    off_t offset = code_ == 206 ? range_start_ : 0;
+    mm_file_ = const_cast<char*>(entry_->data) + offset;
+    mm_len_ = len;
+    header_writer(buff).field("Content-length: ", len).end();
+    return;
+  }
+
+  int src_fd = open(real_path_.c_str(), O_RDONLY | O_CLOEXEC);
   if (src_fd == -1) {
     error_content(buff, "Not found");
     return;
   }
 
-  LOG_DEBUG("file path: %s", (dir_ + path_).c_str());
-  void* mm_src =
-      mmap(0, mm_file_stat_.st_size, PROT_READ, MAP_PRIVATE, src_fd, 0);
-  if (*static_cast<int*>(mm_src) == -1) {
-    error_content(buff, "mmap error");
-    return;
+  LOG_DEBUG("file path: %s", real_path_.c_str());
+  size_t len = mm_file_stat_.st_size;
+  if (code_ == 206) {
+    len = range_len_;
   }
 
-  mm_file_ = (char*)mm_src;
-  close(src_fd);
-  buff.append("Content-length: " + std::to_string(mm_file_stat_.st_size) +
-              "\r\n\r\n");
+  if (code_ == 206 || len >= MMAP_THRESHOLD_) {
+    file_fd_ = src_fd;
+    file_offset_ = code_ == 206 ? range_start_ : 0;
+    file_len_ = len;
+  } else {
+    if (len > 0) {
+      void* mm_src = mmap(0, len, PROT_READ, MAP_PRIVATE, src_fd, 0);
+      if (mm_src == MAP_FAILED) {
+        close(src_fd);
+        error_content(buff, "mmap error");
+        return;
+      }
+      mm_file_ = (char*)mm_src;
+      mm_len_ = len;
+      mapped_ = true;
+    }
+    close(src_fd);
+  }
+  header_writer(buff).field("Content-length: ", len).end();
+}
+
+// errors raised before a file was looked at and that have no page of their own
+void http_response::make_error_response_(buffer& buff) {
+  add_response_status_line_(buff);
+  header_writer(buff).date().line(CLOSE).line("Content-type: text/html\r\n");
+  error_content(buff, status_reason(code_));
 }
 
 void http_response::make_response(buffer& buff) {
-  if (stat(real_path().c_str(), &mm_file_stat_) < 0 ||
-      S_ISDIR(mm_file_stat_.st_mode)) {
+  if (code_ >= 400) {
+    if (!CODE_PATH.contains(code_)) {
+      make_error_response_(buff);
+      return;
+    }
+  } else if (!stat_file_() || S_ISDIR(mm_file_stat_.st_mode)) {
     code_ = 404;
   } else if (!(mm_file_stat_.st_mode & S_IROTH)) {
     code_ = 403;
   } else {
     code_ = 200;
   }
+  if (code_ == 200) {
+    choose_encoding_();
+  }
+  if (code_ == 200 && is_not_modified_()) {
+    code_ = 304;
+  }
+  if (code_ == 200) {
+    check_range_();
+  }
   error_html();
   add_response_status_line_(buff);
   add_response_header_(buff);
+  if (code_ == 304) {
+    header_writer(buff).end();
+    return;
+  }
+  if (code_ == 416) {
+    header_writer(buff).line("Content-length: 0\r\n").end();
+    return;
+  }
   add_response_content_(buff);
 }
\ No newline at end of file
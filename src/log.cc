@@ -5,9 +5,7 @@
 #include <cstring>
 
 log::~log() {
-  is_thread_close = true;
-  if (write_thread_ptr && write_thread_ptr->joinable())
-    write_thread_ptr->join();
+  close();
   if (m_fp_) {
     fclose(m_fp_);
   }
@@ -15,13 +13,31 @@ log::~log() {
 
 void log::flush() { fflush(m_fp_); }
 
+void log::close() {
+  std::unique_lock lock_(mutex_);
+  is_async = false;
+  lock_.unlock();
+  is_thread_close = true;
+  if (write_thread_ptr && write_thread_ptr->joinable()) {
+    // wakes the writer out of pop()
+    deq_ptr_->push_back(std::string());
+    write_thread_ptr->join();
+  }
+  if (m_fp_) {
+    flush();
+  }
+}
+
 void log::async_write() {
   std::string str;
   while (!is_thread_close) {
-    while (deq_ptr_->pop(str, 1)) {
+    if (deq_ptr_->pop(str, 1)) {
       fputs(str.c_str(), m_fp_);
     }
   }
+  while (deq_ptr_->pop(str, 0)) {
+    fputs(str.c_str(), m_fp_);
+  }
 }
 
 void log::flush_log_thread() { log::instance()->async_write(); }
@@ -47,7 +63,7 @@ void log::init(int level, const char *path, const char *suffix,
   printf("filename : %s\n", filename);
   today_ = systime->tm_mday;
 
-  m_fp_ = fopen(filename, "a");
+  m_fp_ = fopen(filename, "ae");
 
   assert(m_fp_ != NULL);
 
@@ -89,7 +105,7 @@ void log::write(int level, const char *format, ...) {
 
     deq_ptr_->waiting_empty();
     fclose(m_fp_);
-    m_fp_ = fopen(new_file, "a");
+    m_fp_ = fopen(new_file, "ae");
   }
   lock.unlock();
 
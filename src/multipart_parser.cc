@@ -0,0 +1,200 @@
+#include "multipart_parser.h"
+
+#include <strings.h>
+
+#include <algorithm>
+
+namespace {
+
+std::string_view trim(std::string_view text) {
+  size_t begin = text.find_first_not_of(" \t");
+  if (begin == std::string_view::npos) {
+    return {};
+  }
+  size_t end = text.find_last_not_of(" \t");
+  return text.substr(begin, end - begin + 1);
+}
+
+bool iequals(std::string_view a, std::string_view b) {
+  return a.size() == b.size() &&
+         strncasecmp(a.data(), b.data(), a.size()) == 0;
+}
+
+bool istarts_with(std::string_view text, std::string_view prefix) {
+  return text.size() >= prefix.size() &&
+         iequals(text.substr(0, prefix.size()), prefix);
+}
+
+}  // namespace
+
+multipart_parser::multipart_parser(std::string_view boundary, callbacks cbs)
+    : delimiter_("\r\n--" + std::string(boundary)), cbs_(std::move(cbs)) {
+  // the first boundary may open the body with no CRLF before it
+  carry_ = "\r\n";
+}
+
+std::string multipart_parser::boundary_of(std::string_view content_type) {
+  if (!istarts_with(content_type, "multipart/form-data")) {
+    return {};
+  }
+  std::string boundary = param(content_type, "boundary");
+  // RFC 2046 5.1.1
+  return boundary.size() <= 70 ? boundary : std::string();
+}
+
+// "form-data; name=\"a\"; filename=b"
+std::string multipart_parser::param(std::string_view value,
+                                    std::string_view name) {
+  size_t at = value.find(';');
+  while (at < value.size()) {
+    size_t eq = value.find('=', ++at);
+    if (eq == std::string_view::npos) {
+      break;
+    }
+    std::string_view key = trim(value.substr(at, eq - at));
+    std::string out;
+    at = eq + 1;
+    while (at < value.size() && value[at] == ' ') {
+      ++at;
+    }
+    if (at < value.size() && value[at] == '"') {
+      for (++at; at < value.size() && value[at] != '"'; ++at) {
+        if (value[at] == '\\' && at + 1 < value.size()) {
+          ++at;
+        }
+        out.push_back(value[at]);
+      }
+      at = value.find(';', at);
+    } else {
+      size_t end = value.find(';', at);
+      out = trim(value.substr(at, end - at));
+      at = end;
+    }
+    if (iequals(key, name)) {
+      return out;
+    }
+  }
+  return {};
+}
+
+bool multipart_parser::feed(const char *data, size_t len) {
+  if (failed_) {
+    return false;
+  }
+  if (carry_.empty()) {
+    size_t used = parse_(data, len);
+    if (!failed_) {
+      carry_.assign(data + used, len - used);
+    }
+  } else {
+    carry_.append(data, len);
+    size_t used = parse_(carry_.data(), carry_.size());
+    carry_.erase(0, used);
+  }
+  return !failed_;
+}
+
+size_t multipart_parser::parse_(const char *data, size_t len) {
+  std::string_view in(data, len);
+  size_t at = 0;
+  while (!failed_ && at < in.size()) {
+    std::string_view rest = in.substr(at);
+    switch (state_) {
+      case STATE::DATA: {
+        size_t hit = rest.find(delimiter_);
+        size_t take = hit;
+        if (hit == std::string_view::npos) {
+          // a tail that may be the start of the delimiter waits for more
+          size_t keep = std::min(rest.size(), delimiter_.size() - 1);
+          while (keep && !rest.ends_with(
+                             std::string_view(delimiter_).substr(0, keep))) {
+            --keep;
+          }
+          take = rest.size() - keep;
+        }
+        // before the first boundary is the preamble, which is dropped
+        if (take && in_part_ && cbs_.on_data &&
+            !cbs_.on_data(rest.data(), take)) {
+          failed_ = true;
+          break;
+        }
+        at += take;
+        if (hit == std::string_view::npos) {
+          return at;
+        }
+        at += delimiter_.size();
+        state_ = STATE::BOUNDARY_END;
+        if (in_part_) {
+          in_part_ = false;
+          failed_ = cbs_.on_part_end && !cbs_.on_part_end();
+        }
+        break;
+      }
+      case STATE::BOUNDARY_END: {
+        // transport padding may follow a boundary
+        size_t pad = std::min(rest.find_first_not_of(" \t"), rest.size());
+        at += pad;
+        rest = rest.substr(pad);
+        if (rest.size() < 2) {
+          return at;
+        }
+        if (rest.starts_with("--")) {
+          state_ = STATE::DONE;
+        } else if (rest.starts_with("\r\n")) {
+          state_ = STATE::HEADERS;
+          part_ = {};
+          header_bytes_ = 0;
+        } else {
+          failed_ = true;
+        }
+        at += 2;
+        break;
+      }
+      case STATE::HEADERS: {
+        size_t eol = rest.find("\r\n");
+        if (eol == std::string_view::npos) {
+          failed_ = header_bytes_ + rest.size() > MAX_HEADERS_;
+          return at;
+        }
+        header_bytes_ += eol + 2;
+        at += eol + 2;
+        if (header_bytes_ > MAX_HEADERS_) {
+          failed_ = true;
+        } else if (eol) {
+          failed_ = !header_line_(rest.substr(0, eol));
+        } else if (part_.name.empty()) {
+          // every form-data part is named
+          failed_ = true;
+        } else {
+          state_ = STATE::DATA;
+          in_part_ = true;
+          failed_ = cbs_.on_part && !cbs_.on_part(part_);
+        }
+        break;
+      }
+      case STATE::DONE:
+        // the epilogue is ignored
+        return in.size();
+    }
+  }
+  return at;
+}
+
+bool multipart_parser::header_line_(std::string_view line) {
+  size_t colon = line.find(':');
+  if (colon == std::string_view::npos) {
+    return false;
+  }
+  std::string_view name = trim(line.substr(0, colon));
+  std::string_view value = trim(line.substr(colon + 1));
+  if (iequals(name, "content-disposition")) {
+    if (!istarts_with(value, "form-data")) {
+      return false;
+    }
+    part_.name = param(value, "name");
+    part_.filename = param(value, "filename");
+  } else if (iequals(name, "content-type")) {
+    part_.type = value;
+  }
+  return true;
+}
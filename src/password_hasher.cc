@@ -0,0 +1,113 @@
+#include "password_hasher.h"
+
+#include <openssl/crypto.h>
+#include <openssl/evp.h>
+#include <sys/random.h>
+#include <sys/resource.h>
+#include <unistd.h>
+
+#include <charconv>
+
+namespace {
+
+constexpr char HEX[] = "0123456789abcdef";
+
+std::string to_hex(const unsigned char *data, size_t len) {
+  std::string out(len * 2, '0');
+  for (size_t i = 0; i < len; ++i) {
+    out[i * 2] = HEX[data[i] >> 4];
+    out[i * 2 + 1] = HEX[data[i] & 0xf];
+  }
+  return out;
+}
+
+// lengths first, so equal-length strings are compared in constant time
+bool same(std::string_view a, std::string_view b) {
+  return a.size() == b.size() &&
+         CRYPTO_memcmp(a.data(), b.data(), a.size()) == 0;
+}
+
+}  // namespace
+
+password_hasher *password_hasher::instance() {
+  static password_hasher inst;
+  return &inst;
+}
+
+void password_hasher::init(int threads_num, int queue_size, int iterations) {
+  iterations_ = iterations;
+  if (threads_num > 0 && !pool_) {
+    pool_ = std::make_unique<threadpool>(threads_num, queue_size);
+  }
+}
+
+bool password_hasher::submit(std::function<void()> task) {
+  if (!pool_) {
+    task();
+    return true;
+  }
+  return pool_->try_add_task([task = std::move(task)]() {
+    // set once per thread, on its first hash
+    thread_local bool niced = false;
+    if (!niced) {
+      setpriority(PRIO_PROCESS, gettid(),
+                  getpriority(PRIO_PROCESS, gettid()) + NICE_);
+      niced = true;
+    }
+    task();
+  });
+}
+
+bool password_hasher::is_saturated() {
+  return pool_ && pool_->queue_size() >= pool_->queue_capacity();
+}
+
+std::string password_hasher::derive_(std::string_view pwd,
+                                     std::string_view salt, int iterations) {
+  unsigned char key[KEY_LEN_];
+  if (!PKCS5_PBKDF2_HMAC(pwd.data(), pwd.size(),
+                         reinterpret_cast<const unsigned char *>(salt.data()),
+                         salt.size(), iterations, EVP_sha256(), KEY_LEN_,
+                         key)) {
+    return "";
+  }
+  return to_hex(key, KEY_LEN_);
+}
+
+std::string password_hasher::hash(std::string_view pwd) const {
+  unsigned char raw[SALT_LEN_];
+  if (getrandom(raw, SALT_LEN_, 0) != SALT_LEN_) {
+    return "";
+  }
+  int iterations = iterations_;
+  std::string salt = to_hex(raw, SALT_LEN_);
+  std::string key = derive_(pwd, salt, iterations);
+  if (key.empty()) {
+    return "";
+  }
+  std::string out(SCHEME);
+  out += "$" + std::to_string(iterations) + "$" + salt + "$" + key;
+  return out;
+}
+
+bool password_hasher::check(std::string_view pwd, std::string_view stored) {
+  if (!stored.starts_with(SCHEME) || stored.size() == SCHEME.size() ||
+      stored[SCHEME.size()] != '$') {
+    return same(pwd, stored);
+  }
+  std::string_view rest = stored.substr(SCHEME.size() + 1);
+  size_t salt_at = rest.find('$');
+  size_t key_at = rest.find('$', salt_at + 1);
+  if (salt_at == std::string_view::npos || key_at == std::string_view::npos) {
+    return false;
+  }
+  int iterations = 0;
+  auto [end, ec] = std::from_chars(rest.data(), rest.data() + salt_at,
+                                   iterations);
+  if (ec != std::errc() || end != rest.data() + salt_at || iterations <= 0) {
+    return false;
+  }
+  std::string_view salt = rest.substr(salt_at + 1, key_at - salt_at - 1);
+  std::string key = derive_(pwd, salt, iterations);
+  return !key.empty() && same(key, rest.substr(key_at + 1));
+}
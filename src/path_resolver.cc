@@ -0,0 +1,151 @@
+#include "path_resolver.h"
+
+#include <limits.h>
+#include <stdlib.h>
+
+#include <algorithm>
+
+namespace {
+
+int hex_value(char c) {
+  if (c >= '0' && c <= '9') return c - '0';
+  if (c >= 'a' && c <= 'f') return c - 'a' + 10;
+  if (c >= 'A' && c <= 'F') return c - 'A' + 10;
+  return -1;
+}
+
+}  // namespace
+
+path_resolver *path_resolver::instance() {
+  static path_resolver inst;
+  return &inst;
+}
+
+void path_resolver::init(const std::string &dir, size_t max_entries) {
+  root_.clear();
+  char real[PATH_MAX];
+  if (!dir.empty() && realpath(dir.c_str(), real)) {
+    root_ = real;
+    if (root_.back() != '/') {
+      root_.push_back('/');
+    }
+  }
+  set_max(max_entries);
+  clear();
+}
+
+void path_resolver::set_max(size_t max_entries) {
+  max_per_shard_ =
+      max_entries ? std::max<size_t>(max_entries / SHARDS_, 1) : 0;
+}
+
+void path_resolver::clear() {
+  generation_.fetch_add(1);
+  for (shard &s : shards_) {
+    std::lock_guard<std::mutex> locker(s.mtx);
+    s.entries.clear();
+  }
+}
+
+int path_resolver::resolve(std::string_view target, std::string *path) {
+  // absolute-form, as sent to proxies (RFC 7230 5.3.2)
+  for (std::string_view scheme : {"http://", "https://"}) {
+    if (target.starts_with(scheme)) {
+      size_t slash = target.find('/', scheme.size());
+      target = slash == std::string_view::npos ? "/" : target.substr(slash);
+      break;
+    }
+  }
+  target = target.substr(0, target.find_first_of("?#"));
+  size_t max = max_per_shard_.load(std::memory_order_relaxed);
+  if (!max) {
+    return resolve_(target, path);
+  }
+  shard &s = shards_[path_hash()(target) % SHARDS_];
+  {
+    std::lock_guard<std::mutex> locker(s.mtx);
+    auto iter = s.entries.find(target);
+    if (iter != s.entries.end()) {
+      *path = iter->second.path;
+      return iter->second.code;
+    }
+  }
+  uint64_t generation = generation_.load();
+  int code = resolve_(target, path);
+  std::lock_guard<std::mutex> locker(s.mtx);
+  if (generation == generation_.load()) {
+    // raw paths are the client's to choose; a full shard starts over
+    if (s.entries.size() >= max) {
+      s.entries.clear();
+    }
+    s.entries.try_emplace(std::string(target), entry{code, *path});
+  }
+  return code;
+}
+
+int path_resolver::resolve_(std::string_view path, std::string *out) const {
+  if (!canonicalize(path, out)) {
+    out->clear();
+    return 400;
+  }
+  if (root_.empty()) {
+    return 0;
+  }
+  // nothing there, nothing to lead out; most handler paths are like that
+  char real[PATH_MAX];
+  if (!realpath((root_ + out->substr(1)).c_str(), real)) {
+    return 0;
+  }
+  std::string_view resolved(real);
+  bool inside = resolved.size() + 1 == root_.size()
+                    ? root_.starts_with(resolved)
+                    : resolved.starts_with(root_);
+  return inside ? 0 : 403;
+}
+
+bool path_resolver::canonicalize(std::string_view path, std::string *out) {
+  if (!path.starts_with('/')) {
+    return false;
+  }
+  std::string decoded;
+  decoded.reserve(path.size());
+  for (size_t i = 0; i < path.size(); ++i) {
+    char c = path[i];
+    if (c == '%') {
+      int hi = i + 2 < path.size() ? hex_value(path[i + 1]) : -1;
+      int lo = hi >= 0 ? hex_value(path[i + 2]) : -1;
+      if (lo < 0) {
+        return false;
+      }
+      c = static_cast<char>(hi * 16 + lo);
+      i += 2;
+    }
+    if (c == '\0') {
+      return false;
+    }
+    decoded.push_back(c);
+  }
+
+  out->clear();
+  // a trailing "/", "." or ".." leaves a directory, which keeps its slash
+  bool is_dir = false;
+  for (size_t at = 1; at <= decoded.size();) {
+    size_t end = std::min(decoded.find('/', at), decoded.size());
+    std::string_view segment(decoded.data() + at, end - at);
+    is_dir = segment.empty() || segment == "." || segment == "..";
+    if (segment == "..") {
+      if (out->empty()) {
+        return false;
+      }
+      out->erase(out->rfind('/'));
+    } else if (!is_dir) {
+      out->push_back('/');
+      out->append(segment);
+    }
+    at = end + 1;
+  }
+  if (is_dir || out->empty()) {
+    out->push_back('/');
+  }
+  return true;
+}
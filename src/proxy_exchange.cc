@@ -0,0 +1,525 @@
+#include "proxy_exchange.h"
+
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+
+#include "log.h"
+
+std::function<void(int, int, uint32_t)> proxy_exchange::watch;
+
+namespace {
+
+int hex_value(char c) {
+  if (c >= '0' && c <= '9') return c - '0';
+  if (c >= 'a' && c <= 'f') return c - 'a' + 10;
+  if (c >= 'A' && c <= 'F') return c - 'A' + 10;
+  return -1;
+}
+
+std::string lower(std::string text) {
+  std::transform(text.begin(), text.end(), text.begin(), ::tolower);
+  return text;
+}
+
+// headers of one hop only, never passed along
+bool is_hop_header(const std::string &name) {
+  return name == "connection" || name == "keep-alive" ||
+         name == "proxy-connection" || name == "te" || name == "trailer" ||
+         name == "transfer-encoding" || name == "upgrade";
+}
+
+}  // namespace
+
+size_t proxy_exchange::chunk_scanner::scan(const char *data, size_t len,
+                                           std::string *payload) {
+  size_t i = 0;
+  while (i < len && at != AT::END && at != AT::BAD) {
+    char c = data[i];
+    switch (at) {
+      case AT::SIZE:
+        if (hex_value(c) >= 0 && digits < 15) {
+          left = left * 16 + hex_value(c);
+          ++digits;
+          ++i;
+        } else {
+          // extensions and the line end, the size has to have a digit
+          at = digits ? AT::EXT : AT::BAD;
+        }
+        break;
+      case AT::EXT:
+        if (c == '\n') {
+          at = left ? AT::DATA : AT::TRAILER;
+          line_len = 0;
+        }
+        ++i;
+        break;
+      case AT::DATA: {
+        size_t n = std::min(left, len - i);
+        if (payload) {
+          payload->append(data + i, n);
+        }
+        left -= n;
+        i += n;
+        if (!left) {
+          at = AT::DATA_END;
+        }
+        break;
+      }
+      case AT::DATA_END:
+        if (c == '\n') {
+          at = AT::SIZE;
+          digits = 0;
+        } else if (c != '\r') {
+          at = AT::BAD;
+        }
+        ++i;
+        break;
+      case AT::TRAILER:
+        // trailer fields are dropped, the body ends at an empty line
+        if (c == '\n') {
+          if (!line_len) {
+            at = AT::END;
+          }
+          line_len = 0;
+        } else if (c != '\r') {
+          ++line_len;
+        }
+        ++i;
+        break;
+      default:
+        break;
+    }
+  }
+  return i;
+}
+
+proxy_exchange::proxy_exchange(std::shared_ptr<upstream> group,
+                               std::string request, bool retryable,
+                               bool head_only)
+    : group_(std::move(group)),
+      request_(std::move(request)),
+      retryable_(retryable),
+      head_only_(head_only) {}
+
+proxy_exchange::~proxy_exchange() {
+  if (be_) {
+    release_(false);
+  }
+  for (int fd : pipe_) {
+    if (fd >= 0) {
+      close(fd);
+    }
+  }
+}
+
+void proxy_exchange::start(int owner_fd, std::function<void()> done) {
+  owner_ = owner_fd;
+  done_ = std::move(done);
+  if (open_()) {
+    step_();
+  }
+}
+
+bool proxy_exchange::open_() {
+  while (attempts_ < MAX_ATTEMPTS_) {
+    ++attempts_;
+    be_ = group_->pick();
+    fd_ = group_->connect(be_, &reused_);
+    if (fd_ >= 0) {
+      state_ = reused_ ? STATE::SENDING : STATE::CONNECTING;
+      sent_ = 0;
+      in_.clear();
+      return true;
+    }
+    group_->mark_down(be_);
+    group_->release(be_, -1, false);
+    be_ = nullptr;
+  }
+  fail_(502);
+  return false;
+}
+
+void proxy_exchange::on_ready() {
+  if (state_ == STATE::CONNECTING) {
+    int err = 0;
+    socklen_t len = sizeof(err);
+    if (getsockopt(fd_, SOL_SOCKET, SO_ERROR, &err, &len) < 0 || err) {
+      LOG_WARN("upstream: connect %s error %d", be_->name.c_str(), err);
+      group_->mark_down(be_);
+      release_(false);
+      if (!open_()) {
+        return;
+      }
+    } else {
+      state_ = STATE::SENDING;
+    }
+  }
+  step_();
+}
+
+void proxy_exchange::step_() {
+  while (true) {
+    if (state_ == STATE::CONNECTING) {
+      arm_(EPOLLOUT);
+      return;
+    }
+    if (state_ == STATE::SENDING) {
+      ssize_t len = send(fd_, request_.data() + sent_,
+                         request_.size() - sent_, MSG_NOSIGNAL);
+      if (len < 0 && errno == EAGAIN) {
+        arm_(EPOLLOUT);
+        return;
+      }
+      if (len < 0) {
+        if (!retry_()) {
+          return;
+        }
+        continue;
+      }
+      sent_ += len;
+      if (sent_ == request_.size()) {
+        state_ = STATE::READING_HEAD;
+      }
+      continue;
+    }
+    char chunk[16384];
+    ssize_t len = recv(fd_, chunk, sizeof(chunk), 0);
+    if (len < 0 && errno == EAGAIN) {
+      arm_(EPOLLIN);
+      return;
+    }
+    if (len <= 0) {
+      if (!retry_()) {
+        return;
+      }
+      continue;
+    }
+    in_.append(chunk, len);
+    int ret = parse_head_();
+    if (ret < 0) {
+      LOG_WARN("upstream: bad response from %s", be_->name.c_str());
+      fail_(502);
+      return;
+    }
+    if (ret > 0) {
+      state_ = STATE::BODY;
+      if (framing_ == FRAMING::LENGTH && !left_) {
+        reusable_ = reusable_ && in_.empty();
+        in_.clear();
+        end_body_();
+      }
+      notify_();
+      return;
+    }
+  }
+}
+
+bool proxy_exchange::retry_() {
+  // a pooled connection the backend has since closed fails before any of
+  // the response comes back; the request goes out again on a fresh one
+  // when that is safe
+  bool again = reused_ && in_.empty() && retryable_;
+  LOG_DEBUG("upstream: %s dropped the connection, retry:%d",
+            be_->name.c_str(), again);
+  release_(false);
+  if (again) {
+    return open_();
+  }
+  fail_(502);
+  return false;
+}
+
+int proxy_exchange::parse_head_() {
+  while (true) {
+    size_t end = in_.find("\r\n\r\n");
+    if (end == std::string::npos) {
+      return in_.size() > HEAD_MAX_ ? -1 : 0;
+    }
+    if (end < 12 || in_.compare(0, 7, "HTTP/1.") != 0) {
+      return -1;
+    }
+    int status = atoi(in_.c_str() + 9);
+    // the connection was never asked to switch protocols
+    if (status < 100 || status > 999 || status == 101) {
+      return -1;
+    }
+    if (status < 200) {
+      // interim responses (100 Continue) are not passed on
+      in_.erase(0, end + 4);
+      continue;
+    }
+    size_t line_end = in_.find("\r\n");
+    head_.assign(in_, 0, line_end + 2);
+    bool close = in_[7] == '0';
+    bool chunked = false;
+    long long length = -1;
+    for (size_t pos = line_end + 2; pos < end + 2; pos = line_end + 2) {
+      line_end = in_.find("\r\n", pos);
+      size_t colon = in_.find(':', pos);
+      if (colon >= line_end) {
+        continue;
+      }
+      std::string name = lower(in_.substr(pos, colon - pos));
+      std::string value = lower(in_.substr(colon + 1, line_end - colon - 1));
+      if (name == "content-length") {
+        length = strtoll(value.c_str(), nullptr, 10);
+      } else if (name == "transfer-encoding") {
+        chunked = value.find("chunked") != std::string::npos;
+      } else if (name == "connection") {
+        if (value.find("close") != std::string::npos) {
+          close = true;
+        } else if (value.find("keep-alive") != std::string::npos) {
+          close = false;
+        }
+      }
+      if (!is_hop_header(name)) {
+        head_.append(in_, pos, line_end + 2 - pos);
+      }
+    }
+    in_.erase(0, end + 4);
+    reusable_ = !close;
+    left_ = 0;
+    if (head_only_ || status == 204 || status == 304) {
+      framing_ = FRAMING::LENGTH;
+    } else if (chunked) {
+      framing_ = FRAMING::CHUNKED;
+    } else if (length >= 0) {
+      framing_ = FRAMING::LENGTH;
+      left_ = length;
+    } else {
+      framing_ = FRAMING::CLOSE;
+      reusable_ = false;
+    }
+    return 1;
+  }
+}
+
+void proxy_exchange::write_head(buffer &out, bool keep_alive) {
+  out.append(head_);
+  if (framing_ == FRAMING::CHUNKED) {
+    out.append("Transfer-Encoding: chunked\r\n");
+  }
+  out.append(keep_alive ? "Connection: keep-alive\r\n\r\n"
+                        : "Connection: close\r\n\r\n");
+  if (!in_.empty() && state_ == STATE::BODY) {
+    out.append(in_.data(), take_(in_.data(), in_.size(), nullptr));
+  }
+  in_.clear();
+}
+
+size_t proxy_exchange::take_(const char *data, size_t len,
+                             std::string *payload) {
+  size_t used = len;
+  if (framing_ == FRAMING::LENGTH) {
+    used = std::min(len, left_);
+    left_ -= used;
+    if (payload) {
+      payload->append(data, used);
+    }
+  } else if (framing_ == FRAMING::CHUNKED) {
+    used = chunks_.scan(data, len, payload);
+  } else if (payload) {
+    payload->append(data, len);
+  }
+  // the backend sent more than the response, the connection can't be
+  // trusted for the next one
+  if (used < len) {
+    reusable_ = false;
+  }
+  if ((framing_ == FRAMING::LENGTH && !left_) ||
+      (framing_ == FRAMING::CHUNKED && chunks_.done())) {
+    end_body_();
+  }
+  return used;
+}
+
+size_t proxy_exchange::body_left() const {
+  size_t left = piped_;
+  if (state_ == STATE::BODY) {
+    left += framing_ == FRAMING::LENGTH ? left_ : 1;
+  }
+  return left;
+}
+
+void proxy_exchange::wait_upstream() { arm_(EPOLLIN); }
+
+ssize_t proxy_exchange::relay(int client_fd, buffer &out, bool can_splice,
+                              int &save_errno) {
+  wants_upstream_ = false;
+  if (piped_ || (can_splice && framing_ == FRAMING::LENGTH &&
+                 left_ >= SPLICE_MIN_ &&
+                 (pipe_[0] >= 0 || pipe2(pipe_, O_NONBLOCK | O_CLOEXEC) == 0))) {
+    return splice_(client_fd, save_errno);
+  }
+  size_t want = RELAY_CHUNK_;
+  if (framing_ == FRAMING::LENGTH) {
+    want = std::min(want, left_);
+  }
+  out.ensure_writeable(want);
+  ssize_t len = recv(fd_, out.begin_write(), want, 0);
+  if (len < 0) {
+    save_errno = errno;
+    wants_upstream_ = errno == EAGAIN;
+    return -1;
+  }
+  if (len == 0) {
+    if (framing_ == FRAMING::CLOSE) {
+      end_body_();
+      return 0;
+    }
+    LOG_WARN("upstream: %s closed mid-body", be_->name.c_str());
+    save_errno = EIO;
+    return -1;
+  }
+  len = take_(out.begin_write(), len, nullptr);
+  if (framing_ == FRAMING::CHUNKED && chunks_.bad()) {
+    LOG_WARN("upstream: bad chunk from %s", be_->name.c_str());
+    save_errno = EIO;
+    return -1;
+  }
+  out.has_written(len);
+  return len;
+}
+
+ssize_t proxy_exchange::splice_(int client_fd, int &save_errno) {
+  if (!piped_) {
+    ssize_t len = splice(fd_, nullptr, pipe_[1], nullptr, left_,
+                         SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+    if (len <= 0) {
+      save_errno = len < 0 ? errno : EIO;
+      wants_upstream_ = len < 0 && errno == EAGAIN;
+      return -1;
+    }
+    piped_ = len;
+    left_ -= len;
+    if (!left_) {
+      end_body_();
+    }
+  }
+  ssize_t len = splice(pipe_[0], nullptr, client_fd, nullptr, piped_,
+                       SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+  if (len < 0) {
+    save_errno = errno;
+    return -1;
+  }
+  piped_ -= len;
+  return len;
+}
+
+void proxy_exchange::end_body_() {
+  state_ = STATE::DONE;
+  release_(reusable_);
+}
+
+void proxy_exchange::fail_(int code) {
+  if (be_) {
+    release_(false);
+  }
+  error_ = code;
+  state_ = STATE::DONE;
+  notify_();
+}
+
+void proxy_exchange::release_(bool reusable) {
+  if (watched_ && watch) {
+    watch(fd_, owner_, 0);
+  }
+  watched_ = false;
+  group_->release(be_, fd_, reusable);
+  be_ = nullptr;
+  fd_ = -1;
+}
+
+void proxy_exchange::arm_(uint32_t events) {
+  if (blocking_) {
+    want_ = events;
+    return;
+  }
+  watched_ = true;
+  watch(fd_, owner_, events);
+}
+
+void proxy_exchange::notify_() {
+  if (!blocking_) {
+    std::function<void()> done = std::move(done_);
+    done_ = nullptr;
+    done();
+  }
+}
+
+bool proxy_exchange::fetch(buffer &out, bool keep_alive, int timeout_ms) {
+  blocking_ = true;
+  auto deadline =
+      std::chrono::steady_clock::now() + std::chrono::milliseconds(timeout_ms);
+  // false once the deadline has passed
+  auto wait = [this, deadline](uint32_t events) {
+    int left = std::chrono::duration_cast<std::chrono::milliseconds>(
+                   deadline - std::chrono::steady_clock::now())
+                   .count();
+    pollfd pfd = {fd_, static_cast<short>(events & EPOLLOUT ? POLLOUT : POLLIN),
+                  0};
+    return left > 0 && poll(&pfd, 1, left) == 1;
+  };
+  if (open_()) {
+    step_();
+  }
+  while (is_pending()) {
+    if (!wait(want_)) {
+      LOG_WARN("upstream: %s timed out", be_->name.c_str());
+      fail_(504);
+      break;
+    }
+    on_ready();
+  }
+  if (error_) {
+    return false;
+  }
+
+  std::string body;
+  if (!in_.empty() && state_ == STATE::BODY) {
+    take_(in_.data(), in_.size(), &body);
+  }
+  in_.clear();
+  char chunk[16384];
+  while (state_ == STATE::BODY && !error_) {
+    if (!wait(EPOLLIN)) {
+      error_ = 504;
+      break;
+    }
+    ssize_t len = recv(fd_, chunk, sizeof(chunk), 0);
+    if (len < 0 && errno == EAGAIN) {
+      continue;
+    }
+    if (len == 0 && framing_ == FRAMING::CLOSE) {
+      end_body_();
+    } else if (len <= 0) {
+      error_ = 502;
+    } else {
+      take_(chunk, len, &body);
+      if (framing_ == FRAMING::CHUNKED && chunks_.bad()) {
+        error_ = 502;
+      }
+    }
+  }
+  if (error_) {
+    LOG_WARN("upstream: %s failed mid-body", be_->name.c_str());
+    release_(false);
+    return false;
+  }
+
+  out.append(head_);
+  if (framing_ != FRAMING::LENGTH) {
+    out.append("Content-Length: " + std::to_string(body.size()) + "\r\n");
+  }
+  out.append(keep_alive ? "Connection: keep-alive\r\n\r\n"
+                        : "Connection: close\r\n\r\n");
+  out.append(body);
+  return true;
+}
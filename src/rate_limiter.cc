@@ -0,0 +1,136 @@
+#include "rate_limiter.h"
+
+#include <algorithm>
+#include <chrono>
+#include <climits>
+
+rate_limiter *rate_limiter::instance() {
+  static rate_limiter inst;
+  return &inst;
+}
+
+void rate_limiter::init(uint32_t req_rate, uint32_t req_burst,
+                        uint32_t byte_rate, uint32_t byte_burst) {
+  // the table is in place before a nonzero rate can be seen
+  if ((req_rate || byte_rate) && !shards_) {
+    shards_ = std::make_unique<std::array<shard, SHARDS_>>();
+  }
+  req_.burst = std::min<int64_t>(int64_t(std::max(req_burst, 1u)) * req_.scale,
+                                 INT32_MAX);
+  req_.rate = uint64_t(req_rate) * req_.scale;
+  bytes_.burst = std::min<int64_t>(std::max(byte_burst, byte_rate), INT32_MAX);
+  bytes_.rate = byte_rate;
+}
+
+uint32_t rate_limiter::now_ms_() {
+  return std::chrono::duration_cast<std::chrono::milliseconds>(
+             std::chrono::steady_clock::now().time_since_epoch())
+      .count();
+}
+
+uint64_t rate_limiter::pack_(int64_t tokens, uint32_t stamp) {
+  return uint64_t(uint32_t(int32_t(tokens))) << 32 | stamp;
+}
+
+int64_t rate_limiter::peek_(const std::atomic<uint64_t> &state,
+                            const bucket_cfg &cfg, uint32_t now) {
+  uint64_t cur = state.load(std::memory_order_relaxed);
+  int64_t tokens = int32_t(cur >> 32);
+  uint64_t add = uint64_t(uint32_t(now - uint32_t(cur))) * cfg.rate / 1000;
+  return std::min<int64_t>(tokens + int64_t(std::min<uint64_t>(add, INT32_MAX)),
+                           cfg.burst);
+}
+
+bool rate_limiter::take_(std::atomic<uint64_t> &state, const bucket_cfg &cfg,
+                         uint32_t now, int64_t cost, bool debt) {
+  uint64_t cur = state.load(std::memory_order_relaxed);
+  while (true) {
+    uint32_t stamp = cur;
+    int64_t tokens = int32_t(cur >> 32);
+    uint64_t add = uint64_t(uint32_t(now - stamp)) * cfg.rate / 1000;
+    // the stamp only moves once whole units were added, so fractions add up
+    if (add) {
+      tokens = std::min<int64_t>(
+          tokens + int64_t(std::min<uint64_t>(add, INT32_MAX)), cfg.burst);
+      stamp = now;
+    }
+    bool ok = debt ? tokens > 0 : tokens >= cost;
+    if (ok || debt) {
+      tokens = std::max<int64_t>(tokens - cost, INT32_MIN);
+    }
+    if (state.compare_exchange_weak(cur, pack_(tokens, stamp),
+                                    std::memory_order_relaxed)) {
+      return ok;
+    }
+  }
+}
+
+rate_limiter::entry &rate_limiter::find_(in_addr_t ip, uint32_t now) {
+  // murmur3's finalizer: every bit of the address reaches the low bits
+  uint32_t h = ip;
+  h ^= h >> 16;
+  h *= 0x85ebca6bu;
+  h ^= h >> 13;
+  h *= 0xc2b2ae35u;
+  h ^= h >> 16;
+  shard &s = (*shards_)[h >> 28 & (SHARDS_ - 1)];
+  size_t start = h & (SLOTS_ - 1);
+  entry *victim = nullptr;
+  uint32_t oldest = 0;
+  for (size_t i = 0; i < PROBE_; ++i) {
+    entry &e = s.slots[(start + i) & (SLOTS_ - 1)];
+    uint32_t key = e.ip.load(std::memory_order_acquire);
+    if (key == ip) {
+      e.used.store(now, std::memory_order_relaxed);
+      return e;
+    }
+    // empty slots (0.0.0.0 never connects) count as idle forever
+    uint32_t idle = key ? now - e.used.load(std::memory_order_relaxed)
+                        : UINT32_MAX;
+    if (!victim || idle > oldest) {
+      victim = &e;
+      oldest = idle;
+    }
+  }
+  // a lost race hands back another client's entry for this one call,
+  // which the limiter can live with
+  uint32_t key = victim->ip.load(std::memory_order_relaxed);
+  if (victim->ip.compare_exchange_strong(key, ip,
+                                         std::memory_order_acq_rel)) {
+    victim->req.store(pack_(req_.burst, now), std::memory_order_relaxed);
+    victim->bytes.store(pack_(bytes_.burst, now), std::memory_order_relaxed);
+  }
+  victim->used.store(now, std::memory_order_relaxed);
+  return *victim;
+}
+
+bool rate_limiter::allow_conn(in_addr_t ip) {
+  if (!is_open()) {
+    return true;
+  }
+  uint32_t now = now_ms_();
+  entry &e = find_(ip, now);
+  return (!req_.rate || peek_(e.req, req_, now) >= req_.scale) &&
+         (!bytes_.rate || peek_(e.bytes, bytes_, now) > 0);
+}
+
+bool rate_limiter::allow_request(in_addr_t ip) {
+  if (!is_open()) {
+    return true;
+  }
+  uint32_t now = now_ms_();
+  entry &e = find_(ip, now);
+  if (bytes_.rate && peek_(e.bytes, bytes_, now) <= 0) {
+    return false;
+  }
+  return !req_.rate || take_(e.req, req_, now, req_.scale, false);
+}
+
+void rate_limiter::charge_bytes(in_addr_t ip, size_t bytes) {
+  if (!bytes_.rate || !bytes) {
+    return;
+  }
+  uint32_t now = now_ms_();
+  take_(find_(ip, now).bytes, bytes_, now,
+        int64_t(std::min<size_t>(bytes, INT32_MAX)), true);
+}
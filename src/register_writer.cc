@@ -0,0 +1,153 @@
+#include "register_writer.h"
+
+#include <mysql/mysql.h>
+#include <mysql/mysqld_error.h>
+
+#include <chrono>
+#include <unordered_set>
+
+#include "log.h"
+#include "sql_connpool.h"
+
+register_writer *register_writer::instance() {
+  static register_writer inst;
+  return &inst;
+}
+
+void register_writer::init(int window_ms, int max_rows) {
+  window_ms_ = window_ms;
+  if (max_rows > 0 && !thread_.joinable()) {
+    max_rows_ = max_rows;
+    is_close_ = false;
+    thread_ = std::thread([this]() { run_(); });
+  }
+}
+
+void register_writer::stop() {
+  if (!thread_.joinable()) {
+    return;
+  }
+  {
+    std::lock_guard<std::mutex> locker(mtx_);
+    is_close_ = true;
+  }
+  cond_.notify_one();
+  thread_.join();
+}
+
+bool register_writer::add(std::string name, std::string stored,
+                          callback done) {
+  std::unique_lock<std::mutex> locker(mtx_);
+  if (queue_.size() >= max_rows_ * QUEUE_BATCHES_) {
+    return false;
+  }
+  queue_.push_back({std::move(name), std::move(stored), std::move(done)});
+  // the first row starts the window, a full batch ends it
+  bool wake = queue_.size() == 1 || queue_.size() == max_rows_;
+  locker.unlock();
+  if (wake) {
+    cond_.notify_one();
+  }
+  return true;
+}
+
+void register_writer::run_() {
+  std::unique_lock<std::mutex> locker(mtx_);
+  while (true) {
+    cond_.wait(locker, [this]() { return is_close_ || !queue_.empty(); });
+    if (queue_.empty()) {
+      return;
+    }
+    auto until = std::chrono::steady_clock::now() +
+                 std::chrono::milliseconds(window_ms_.load());
+    cond_.wait_until(locker, until, [this]() {
+      return is_close_ || queue_.size() >= max_rows_;
+    });
+    std::vector<row> batch;
+    if (queue_.size() <= max_rows_) {
+      batch.swap(queue_);
+    } else {
+      auto end = queue_.begin() + max_rows_;
+      batch.assign(std::make_move_iterator(queue_.begin()),
+                   std::make_move_iterator(end));
+      queue_.erase(queue_.begin(), end);
+    }
+    locker.unlock();
+    write_(batch);
+    locker.lock();
+  }
+}
+
+void register_writer::write_(std::vector<row> &batch) {
+  std::vector<bool> added(batch.size(), false);
+  {
+    MYSQL *sql;
+    sql_RAII sql_r(&sql, sql_connpool::instance());
+    std::unordered_set<std::string> taken;
+    bool ok = sql != nullptr;
+    if (ok) {
+      std::string order = "SELECT username FROM user WHERE username IN (";
+      for (size_t i = 0; i < batch.size(); ++i) {
+        order += i ? "," : "";
+        sql_connpool::append_quoted(sql, order, batch[i].name);
+      }
+      order += ")";
+      LOG_DEBUG("%s", order.c_str());
+      ok = mysql_real_query(sql, order.data(), order.size()) == 0;
+    }
+    if (ok) {
+      MYSQL_RES *sql_res = mysql_store_result(sql);
+      while (MYSQL_ROW found = mysql_fetch_row(sql_res)) {
+        taken.insert(found[0]);
+      }
+      mysql_free_result(sql_res);
+    }
+
+    // a name already in the table, or earlier in this batch, fails
+    std::vector<size_t> fresh;
+    std::string order = "INSERT INTO user(username, password) VALUES ";
+    for (size_t i = 0; ok && i < batch.size(); ++i) {
+      if (!taken.insert(batch[i].name).second) {
+        continue;
+      }
+      order += fresh.empty() ? "(" : ",(";
+      sql_connpool::append_quoted(sql, order, batch[i].name);
+      order += ",";
+      sql_connpool::append_quoted(sql, order, batch[i].stored);
+      order += ")";
+      fresh.push_back(i);
+    }
+    if (ok && !fresh.empty()) {
+      // the text holds password hashes, so only its size is logged
+      LOG_DEBUG("register batch insert: %zu rows", fresh.size());
+      if (mysql_real_query(sql, order.data(), order.size()) == 0) {
+        for (size_t i : fresh) {
+          added[i] = true;
+        }
+      } else if (mysql_errno(sql) == ER_DUP_ENTRY) {
+        // a name was taken after the SELECT, the statement added nothing;
+        // one INSERT per row finds out which
+        for (size_t i : fresh) {
+          order = "INSERT INTO user(username, password) VALUES (";
+          sql_connpool::append_quoted(sql, order, batch[i].name);
+          order += ",";
+          sql_connpool::append_quoted(sql, order, batch[i].stored);
+          order += ")";
+          added[i] = mysql_real_query(sql, order.data(), order.size()) == 0;
+        }
+      } else {
+        ok = false;
+      }
+    }
+    if (ok) {
+      LOG_INFO("register batch: %zu rows, %zu new", batch.size(),
+               fresh.size());
+    } else {
+      LOG_WARN("register batch: %zu rows failed", batch.size());
+    }
+  }
+  // the connection is back in the pool before anyone is resumed
+  for (size_t i = 0; i < batch.size(); ++i) {
+    batch[i].done(added[i]);
+  }
+}
@@ -0,0 +1,365 @@
+#include "resource_bundle.h"
+
+#include <brotli/encode.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <zlib.h>
+
+#include <algorithm>
+#include <cstring>
+#include <filesystem>
+
+#include "header_writer.h"
+#include "http_response.h"
+
+namespace fs = std::filesystem;
+
+struct resource_bundle::file_header {
+  char magic[8];
+  uint32_t version;
+  uint32_t count;
+  // the string area, file_entry refs are relative to it
+  uint64_t strings;
+  uint64_t strings_size;
+};
+
+struct resource_bundle::file_entry {
+  struct ref {
+    uint32_t offset;
+    uint32_t size;
+  };
+  struct file_body {
+    uint64_t offset;
+    uint64_t size;
+    ref etag;
+    ref head;
+  };
+  int64_t mtime;
+  ref path;
+  ref type;
+  ref last_modified;
+  // size 0 past IDENTITY: not stored
+  file_body bodies[ENCODINGS];
+};
+
+namespace {
+
+constexpr char MAGIC[8] = {'W', 'S', 'B', 'U', 'N', 'D', 'L', 'E'};
+constexpr uint32_t VERSION = 1;
+
+// files smaller than this aren't compressed, the headers would eat the gain
+constexpr size_t COMPRESS_MIN = 256;
+
+size_t align_up(size_t n, size_t align = resource_bundle::ALIGN) {
+  return (n + align - 1) / align * align;
+}
+
+bool read_file(const std::string &path, size_t size, std::string *out) {
+  int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+  if (fd < 0) {
+    return false;
+  }
+  out->resize(size);
+  size_t done = 0;
+  while (done < size) {
+    ssize_t len = pread(fd, out->data() + done, size - done, done);
+    if (len <= 0) {
+      break;
+    }
+    done += len;
+  }
+  close(fd);
+  return done == size;
+}
+
+std::string gzip(const std::string &in) {
+  z_stream zs = {};
+  // 16 over the window bits asks for a gzip wrapper
+  if (deflateInit2(&zs, Z_BEST_COMPRESSION, Z_DEFLATED, 15 + 16, 9,
+                   Z_DEFAULT_STRATEGY) != Z_OK) {
+    return {};
+  }
+  std::string out(deflateBound(&zs, in.size()), '\0');
+  zs.next_in = reinterpret_cast<Bytef *>(const_cast<char *>(in.data()));
+  zs.avail_in = in.size();
+  zs.next_out = reinterpret_cast<Bytef *>(out.data());
+  zs.avail_out = out.size();
+  int ret = deflate(&zs, Z_FINISH);
+  out.resize(zs.total_out);
+  deflateEnd(&zs);
+  return ret == Z_STREAM_END ? out : std::string();
+}
+
+std::string brotli(const std::string &in) {
+  size_t size = BrotliEncoderMaxCompressedSize(in.size());
+  std::string out(size, '\0');
+  if (!size ||
+      !BrotliEncoderCompress(
+          BROTLI_MAX_QUALITY, BROTLI_DEFAULT_WINDOW, BROTLI_MODE_GENERIC,
+          in.size(), reinterpret_cast<const uint8_t *>(in.data()), &size,
+          reinterpret_cast<uint8_t *>(out.data()))) {
+    return {};
+  }
+  out.resize(size);
+  return out;
+}
+
+}  // namespace
+
+resource_bundle::~resource_bundle() {
+  if (map_) {
+    munmap(map_, size_);
+  }
+  if (fd_ >= 0) {
+    close(fd_);
+  }
+}
+
+std::string_view resource_bundle::encoding_name(ENCODING encoding) {
+  switch (encoding) {
+    case GZIP:
+      return "gzip";
+    case BROTLI:
+      return "br";
+    default:
+      return "identity";
+  }
+}
+
+std::shared_ptr<resource_bundle> resource_bundle::open(
+    const std::string &path) {
+  std::shared_ptr<resource_bundle> bundle(new resource_bundle());
+  bundle->fd_ = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+  struct stat st;
+  if (bundle->fd_ < 0 || fstat(bundle->fd_, &st) < 0 ||
+      st.st_size < (off_t)sizeof(file_header)) {
+    return nullptr;
+  }
+  bundle->size_ = st.st_size;
+  void *map = mmap(nullptr, bundle->size_, PROT_READ, MAP_SHARED,
+                   bundle->fd_, 0);
+  if (map == MAP_FAILED) {
+    return nullptr;
+  }
+  bundle->map_ = static_cast<char *>(map);
+  // small enough to want all of it, and faulting it in here keeps the
+  // page faults off the request path
+  madvise(map, bundle->size_, MADV_WILLNEED);
+  return bundle->parse_() ? bundle : nullptr;
+}
+
+// every offset is checked against the mapping, a truncated or foreign file
+// is refused rather than read out of bounds
+bool resource_bundle::parse_() {
+  file_header header;
+  memcpy(&header, map_, sizeof(header));
+  if (memcmp(header.magic, MAGIC, sizeof(MAGIC)) != 0 ||
+      header.version != VERSION) {
+    return false;
+  }
+  size_t table_end = sizeof(header) + size_t(header.count) * sizeof(file_entry);
+  if (table_end > size_ || header.strings < table_end ||
+      header.strings > size_ || header.strings_size > size_ - header.strings) {
+    return false;
+  }
+  const char *strings = map_ + header.strings;
+  bool ok = true;
+  auto text = [&](file_entry::ref ref) {
+    if (ref.offset > header.strings_size ||
+        ref.size > header.strings_size - ref.offset) {
+      ok = false;
+      return std::string_view();
+    }
+    return std::string_view(strings + ref.offset, ref.size);
+  };
+
+  entries_.resize(header.count);
+  for (uint32_t i = 0; i < header.count && ok; ++i) {
+    file_entry raw;
+    memcpy(&raw, map_ + sizeof(header) + i * sizeof(file_entry), sizeof(raw));
+    entry &out = entries_[i];
+    out.path = text(raw.path);
+    out.type = text(raw.type);
+    out.last_modified = text(raw.last_modified);
+    out.mtime = raw.mtime;
+    for (int e = IDENTITY; e < ENCODINGS; ++e) {
+      const file_entry::file_body &src = raw.bodies[e];
+      if (e != IDENTITY && !src.size) {
+        continue;
+      }
+      if (src.offset > size_ || src.size > size_ - src.offset) {
+        ok = false;
+        break;
+      }
+      body &dest = out.bodies[e];
+      dest.data = map_ + src.offset;
+      dest.size = src.size;
+      dest.offset = src.offset;
+      dest.etag = text(src.etag);
+      dest.head = text(src.head);
+    }
+  }
+  return ok;
+}
+
+bool resource_bundle::pack(const std::string &dir, const std::string &path,
+                           std::string *error) {
+  auto fail = [error](std::string why) {
+    if (error) {
+      *error = std::move(why);
+    }
+    return false;
+  };
+  std::string root = dir;
+  while (root.size() > 1 && root.back() == '/') {
+    root.pop_back();
+  }
+
+  struct item {
+    std::string path;
+    struct stat st;
+  };
+  std::vector<item> items;
+  std::error_code ec;
+  for (fs::recursive_directory_iterator iter(root, ec), end;
+       !ec && iter != end; iter.increment(ec)) {
+    item it;
+    if (stat(iter->path().c_str(), &it.st) < 0 || !S_ISREG(it.st.st_mode) ||
+        !(it.st.st_mode & S_IROTH)) {
+      continue;
+    }
+    it.path = iter->path().string().substr(root.size());
+    items.push_back(std::move(it));
+  }
+  if (ec) {
+    return fail(root + ": " + ec.message());
+  }
+  // the same tree packs to the same bytes
+  std::sort(items.begin(), items.end(),
+            [](const item &a, const item &b) { return a.path < b.path; });
+
+  std::string strings;
+  auto add = [&strings](std::string_view text) {
+    file_entry::ref ref = {static_cast<uint32_t>(strings.size()),
+                           static_cast<uint32_t>(text.size())};
+    strings.append(text);
+    return ref;
+  };
+
+  std::vector<file_entry> entries(items.size());
+  // the bodies, in the order they go into the file
+  std::vector<std::pair<file_entry::file_body *, std::string>> bodies;
+  for (size_t i = 0; i < items.size(); ++i) {
+    const item &it = items[i];
+    std::string data;
+    if (!read_file(root + it.path, it.st.st_size, &data)) {
+      return fail(root + it.path + ": read error");
+    }
+    file_entry &entry = entries[i];
+    entry = {};
+    entry.mtime = it.st.st_mtime;
+    entry.path = add(it.path);
+    entry.type = add(http_response::mime_type(it.path));
+    char date[header_writer::HTTP_DATE_LEN];
+    std::string_view last_modified(
+        date, header_writer::format_date(it.st.st_mtime, date));
+    entry.last_modified = add(last_modified);
+    char tag[http_response::ETAG_LEN];
+    std::string etag(
+        http_response::make_etag(it.st.st_mtime, it.st.st_size, tag));
+
+    std::string encoded[ENCODINGS];
+    if (data.size() >= COMPRESS_MIN) {
+      encoded[GZIP] = gzip(data);
+      encoded[BROTLI] = brotli(data);
+    }
+    bool varies = false;
+    for (int e = GZIP; e < ENCODINGS; ++e) {
+      // kept only when it saves at least an eighth
+      if (encoded[e].empty() ||
+          encoded[e].size() > data.size() - data.size() / 8) {
+        encoded[e].clear();
+      }
+      varies |= !encoded[e].empty();
+    }
+    encoded[IDENTITY] = std::move(data);
+
+    for (int e = IDENTITY; e < ENCODINGS; ++e) {
+      if (e != IDENTITY && encoded[e].empty()) {
+        continue;
+      }
+      file_entry::file_body &body = entry.bodies[e];
+      // a variant has a tag of its own, the bytes differ
+      std::string variant_etag = etag;
+      if (e != IDENTITY) {
+        variant_etag.insert(variant_etag.size() - 1,
+                            "-" + std::string(encoding_name(ENCODING(e))));
+      }
+      body.etag = add(variant_etag);
+      std::string head = "ETag: " + variant_etag + "\r\nLast-Modified: " +
+                         std::string(last_modified) + "\r\n";
+      if (e != IDENTITY) {
+        head += "Content-Encoding: " +
+                std::string(encoding_name(ENCODING(e))) + "\r\n";
+      }
+      if (varies) {
+        head += "Vary: Accept-Encoding\r\n";
+      }
+      body.head = add(head);
+      body.size = encoded[e].size();
+      bodies.emplace_back(&body, std::move(encoded[e]));
+    }
+  }
+
+  file_header header = {};
+  memcpy(header.magic, MAGIC, sizeof(MAGIC));
+  header.version = VERSION;
+  header.count = entries.size();
+  header.strings = sizeof(header) + entries.size() * sizeof(file_entry);
+  header.strings_size = strings.size();
+  size_t offset = align_up(header.strings + strings.size());
+  for (auto &[body, data] : bodies) {
+    // small bodies are packed tight, padding each to a page would double
+    // the bundle of a typical site
+    body->offset = data.size() >= ALIGN ? align_up(offset) : offset;
+    offset = align_up(body->offset + data.size(), 8);
+  }
+  offset = align_up(offset);
+
+  std::string tmp = path + ".tmp";
+  int fd = ::open(tmp.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+  if (fd < 0) {
+    return fail(tmp + ": " + strerror(errno));
+  }
+  bool ok = true;
+  auto write_at = [fd, &ok](const void *data, size_t len, off_t at) {
+    const char *p = static_cast<const char *>(data);
+    while (ok && len) {
+      ssize_t n = pwrite(fd, p, len, at);
+      ok = n > 0;
+      p += n;
+      len -= n;
+      at += n;
+    }
+  };
+  write_at(&header, sizeof(header), 0);
+  write_at(entries.data(), entries.size() * sizeof(file_entry),
+           sizeof(header));
+  write_at(strings.data(), strings.size(), header.strings);
+  for (auto &[body, data] : bodies) {
+    write_at(data.data(), data.size(), body->offset);
+  }
+  // the last page's padding, so every page the server maps is in the file
+  ok = ok && ftruncate(fd, offset) == 0 && fsync(fd) == 0;
+  if (close(fd) < 0 || !ok) {
+    unlink(tmp.c_str());
+    return fail(tmp + ": write error");
+  }
+  if (rename(tmp.c_str(), path.c_str()) < 0) {
+    unlink(tmp.c_str());
+    return fail(path + ": " + strerror(errno));
+  }
+  return true;
+}
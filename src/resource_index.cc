@@ -0,0 +1,228 @@
+#include "resource_index.h"
+
+#include <fcntl.h>
+#include <sys/inotify.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <filesystem>
+#include <vector>
+
+#include "header_writer.h"
+#include "http_response.h"
+#include "log.h"
+
+namespace fs = std::filesystem;
+
+resource_index::snapshot::~snapshot() {
+  if (locked) {
+    munlock(arena.get(), arena_size);
+  }
+}
+
+resource_index *resource_index::instance() {
+  static resource_index inst;
+  return &inst;
+}
+
+resource_index::~resource_index() {
+  if (inotify_fd_ >= 0) {
+    close(inotify_fd_);
+  }
+}
+
+void resource_index::init(const std::string &dir, size_t preload_max,
+                          size_t budget, bool lock,
+                          const std::string &bundle) {
+  root_ = dir;
+  dir_ = dir;
+  while (dir_.size() > 1 && dir_.back() == '/') {
+    dir_.pop_back();
+  }
+  preload_max_ = preload_max;
+  budget_ = budget;
+  lock_ = lock;
+  bundle_ = bundle;
+  bundle_name_ = fs::path(bundle).filename().string();
+  inotify_fd_ = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+  if (inotify_fd_ < 0) {
+    LOG_WARN("inotify_init error: %d", errno);
+  }
+  reload();
+}
+
+const resource_index::resource *resource_index::find(const snapshot &snap,
+                                                     std::string_view path) {
+  auto iter = snap.files.find(path);
+  return iter == snap.files.end() ? nullptr : &iter->second;
+}
+
+void resource_index::watch_tree_() {
+  if (inotify_fd_ < 0) {
+    return;
+  }
+  const uint32_t mask = IN_CLOSE_WRITE | IN_CREATE | IN_DELETE |
+                        IN_MOVED_FROM | IN_MOVED_TO | IN_ATTRIB |
+                        IN_DELETE_SELF;
+  std::error_code ec;
+  if (!bundle_.empty()) {
+    // a deploy renames a new bundle over the old one
+    fs::path parent = fs::path(bundle_).parent_path();
+    inotify_add_watch(inotify_fd_, parent.empty() ? "." : parent.c_str(),
+                      IN_CLOSE_WRITE | IN_MOVED_TO);
+    return;
+  }
+  inotify_add_watch(inotify_fd_, dir_.c_str(), mask);
+  for (fs::recursive_directory_iterator iter(dir_, ec), end;
+       !ec && iter != end; iter.increment(ec)) {
+    if (iter->is_directory(ec)) {
+      // watching an already watched dir only returns its old descriptor
+      inotify_add_watch(inotify_fd_, iter->path().c_str(), mask);
+    }
+  }
+}
+
+std::shared_ptr<resource_index::snapshot> resource_index::load_bundle_() {
+  std::shared_ptr<resource_bundle> bundle = resource_bundle::open(bundle_);
+  if (!bundle) {
+    return nullptr;
+  }
+  auto snap = std::make_shared<snapshot>();
+  snap->root = root_;
+  size_t compressed = 0;
+  for (const resource_bundle::entry &entry : bundle->entries()) {
+    const resource_bundle::body &body =
+        entry.bodies[resource_bundle::IDENTITY];
+    resource res;
+    res.size = body.size;
+    res.mtime = entry.mtime;
+    res.type = entry.type;
+    res.etag = body.etag;
+    res.last_modified = entry.last_modified;
+    res.data = body.data;
+    res.fd = bundle->fd();
+    res.offset = body.offset;
+    res.head = body.head;
+    for (auto encoding : {resource_bundle::BROTLI, resource_bundle::GZIP}) {
+      if (entry.bodies[encoding].data) {
+        res.encodings.push_back({resource_bundle::encoding_name(encoding),
+                                 &entry.bodies[encoding]});
+      }
+    }
+    compressed += !res.encodings.empty();
+    snap->files.emplace(entry.path, std::move(res));
+  }
+  LOG_INFO("resource bundle %s: %zu files, %zu compressed, %zu bytes",
+           bundle_.c_str(), snap->files.size(), compressed, bundle->size());
+  snap->bundle = std::move(bundle);
+  return snap;
+}
+
+std::shared_ptr<resource_index::snapshot> resource_index::build_() {
+  if (!bundle_.empty()) {
+    if (auto snap = load_bundle_()) {
+      return snap;
+    }
+    // better the tree than nothing; the next good bundle replaces it
+    LOG_ERROR("bad resource bundle %s, reading %s instead", bundle_.c_str(),
+              dir_.c_str());
+  }
+  struct item {
+    std::string path;
+    struct stat st;
+  };
+  std::vector<item> items;
+  std::error_code ec;
+  for (fs::recursive_directory_iterator iter(dir_, ec), end;
+       !ec && iter != end; iter.increment(ec)) {
+    item it;
+    if (stat(iter->path().c_str(), &it.st) < 0 || !S_ISREG(it.st.st_mode) ||
+        !(it.st.st_mode & S_IROTH)) {
+      continue;
+    }
+    it.path = iter->path().string().substr(dir_.size());
+    items.push_back(std::move(it));
+  }
+
+  auto snap = std::make_shared<snapshot>();
+  snap->root = root_;
+  size_t arena_size = 0;
+  for (auto &it : items) {
+    size_t size = it.st.st_size;
+    if (size > 0 && size <= preload_max_ && arena_size + size <= budget_) {
+      arena_size += size;
+    }
+  }
+  if (arena_size) {
+    snap->arena = std::make_unique<char[]>(arena_size);
+    snap->arena_size = arena_size;
+  }
+
+  size_t used = 0;
+  for (auto &it : items) {
+    resource res;
+    res.size = it.st.st_size;
+    res.mtime = it.st.st_mtime;
+    res.type = http_response::mime_type(it.path);
+    char tag[http_response::ETAG_LEN];
+    res.etag = http_response::make_etag(res.mtime, res.size, tag);
+    char date[header_writer::HTTP_DATE_LEN];
+    res.last_modified.assign(date, header_writer::format_date(res.mtime, date));
+
+    if (res.size > 0 && res.size <= preload_max_ &&
+        used + res.size <= arena_size) {
+      int fd = open((dir_ + it.path).c_str(), O_RDONLY | O_CLOEXEC);
+      char *dest = snap->arena.get() + used;
+      if (fd >= 0 && pread(fd, dest, res.size, 0) == (ssize_t)res.size) {
+        res.data = dest;
+        used += res.size;
+      }
+      if (fd >= 0) {
+        close(fd);
+      }
+    }
+    snap->files.emplace(std::move(it.path), std::move(res));
+  }
+  if (lock_ && used) {
+    snap->locked = mlock(snap->arena.get(), snap->arena_size) == 0;
+    if (!snap->locked) {
+      LOG_WARN("mlock resources error: %d", errno);
+    }
+  }
+  LOG_INFO("resource index: %zu files, %zu bytes preloaded",
+           snap->files.size(), used);
+  return snap;
+}
+
+void resource_index::reload() {
+  std::lock_guard<std::mutex> locker(reload_mtx_);
+  watch_tree_();
+  snapshot_.store(build_());
+}
+
+void resource_index::set_preload(size_t preload_max, size_t budget) {
+  std::lock_guard<std::mutex> locker(reload_mtx_);
+  preload_max_ = preload_max;
+  budget_ = budget;
+}
+
+bool resource_index::drain() {
+  alignas(inotify_event) char events[4096];
+  bool changed = false;
+  ssize_t len;
+  while ((len = read(inotify_fd_, events, sizeof(events))) > 0) {
+    if (bundle_name_.empty()) {
+      changed = true;
+      continue;
+    }
+    // other files next to the bundle, its temporary copy included, don't
+    // count
+    for (char *p = events; p < events + len;) {
+      auto *event = reinterpret_cast<inotify_event *>(p);
+      changed |= event->len && bundle_name_ == event->name;
+      p += sizeof(inotify_event) + event->len;
+    }
+  }
+  return changed;
+}
@@ -0,0 +1,64 @@
+#include "router.h"
+
+#include <algorithm>
+
+router::router() : nodes_(1) {}
+
+router *router::instance() {
+  static router inst;
+  return &inst;
+}
+
+uint32_t router::child_(uint32_t idx, char c) const {
+  auto &children = nodes_[idx].children;
+  auto iter = std::lower_bound(
+      children.begin(), children.end(), c,
+      [](const std::pair<char, uint32_t> &item, char c) {
+        return item.first < c;
+      });
+  return iter != children.end() && iter->first == c ? iter->second : 0;
+}
+
+void router::add(std::string_view path, MATCH match,
+                 std::shared_ptr<const http_handler> handler) {
+  uint32_t idx = 0;
+  for (char c : path) {
+    uint32_t next = child_(idx, c);
+    if (!next) {
+      next = nodes_.size();
+      nodes_.emplace_back();
+      auto &children = nodes_[idx].children;
+      auto iter = std::lower_bound(
+          children.begin(), children.end(), c,
+          [](const std::pair<char, uint32_t> &item, char c) {
+            return item.first < c;
+          });
+      children.emplace(iter, c, next);
+    }
+    idx = next;
+  }
+  if (match == MATCH::EXACT) {
+    nodes_[idx].exact = handler.get();
+  } else {
+    nodes_[idx].prefix = handler.get();
+  }
+  handlers_.push_back(std::move(handler));
+}
+
+const http_handler *router::route(std::string_view path) const {
+  const http_handler *prefix = nodes_[0].prefix;
+  uint32_t idx = 0;
+  for (char c : path) {
+    idx = child_(idx, c);
+    if (!idx) {
+      return prefix ? prefix : fallback_.get();
+    }
+    if (nodes_[idx].prefix) {
+      prefix = nodes_[idx].prefix;
+    }
+  }
+  if (nodes_[idx].exact) {
+    return nodes_[idx].exact;
+  }
+  return prefix ? prefix : fallback_.get();
+}
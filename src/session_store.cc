@@ -0,0 +1,154 @@
+#include "session_store.h"
+
+#include <sys/random.h>
+
+#include <algorithm>
+#include <chrono>
+
+session_store *session_store::instance() {
+  static session_store inst;
+  return &inst;
+}
+
+void session_store::init(int ttl_s, size_t max_sessions) {
+  ttl_ms_ = int64_t(std::max(ttl_s, 0)) * 1000;
+  max_per_shard_ = std::max<size_t>(max_sessions / SHARDS_, 1);
+}
+
+int64_t session_store::now_ms_() {
+  return std::chrono::duration_cast<std::chrono::milliseconds>(
+             std::chrono::steady_clock::now().time_since_epoch())
+      .count();
+}
+
+bool session_store::parse_(std::string_view token, key *out) {
+  if (token.size() != TOKEN_LEN) {
+    return false;
+  }
+  uint64_t words[2] = {0, 0};
+  for (size_t i = 0; i < TOKEN_LEN; ++i) {
+    char c = token[i];
+    uint64_t digit;
+    if (c >= '0' && c <= '9') {
+      digit = c - '0';
+    } else if (c >= 'a' && c <= 'f') {
+      digit = c - 'a' + 10;
+    } else {
+      return false;
+    }
+    words[i / 16] = words[i / 16] << 4 | digit;
+  }
+  *out = {words[0], words[1]};
+  return true;
+}
+
+std::string session_store::create(const std::string &user) {
+  key k;
+  if (getrandom(&k, sizeof(k), 0) != sizeof(k)) {
+    return "";
+  }
+  static const char HEX[] = "0123456789abcdef";
+  std::string token(TOKEN_LEN, '0');
+  uint64_t words[2] = {k.hi, k.lo};
+  for (size_t i = 0; i < TOKEN_LEN; ++i) {
+    token[i] = HEX[words[i / 16] >> (60 - i % 16 * 4) & 0xf];
+  }
+  int64_t expires = now_ms_() + ttl_ms_;
+  shard &s = shard_(k);
+  std::lock_guard<std::mutex> locker(s.mtx);
+  // full: the session whose deadline was set longest ago goes
+  while (s.sessions.size() >= max_per_shard_ && !s.deadlines.empty()) {
+    s.sessions.erase(s.deadlines.front().first);
+    s.deadlines.pop_front();
+  }
+  s.sessions[k] = {user, expires};
+  s.deadlines.emplace_back(k, expires);
+  return token;
+}
+
+bool session_store::find(std::string_view token, std::string *user) {
+  key k;
+  if (!is_open() || !parse_(token, &k)) {
+    return false;
+  }
+  int64_t now = now_ms_();
+  int64_t ttl = ttl_ms_;
+  shard &s = shard_(k);
+  std::lock_guard<std::mutex> locker(s.mtx);
+  auto iter = s.sessions.find(k);
+  if (iter == s.sessions.end() || iter->second.expires_ms <= now) {
+    return false;
+  }
+  // renewing at half-life keeps most lookups read-only and the deadline
+  // queue short
+  if (iter->second.expires_ms - now < ttl / 2) {
+    iter->second.expires_ms = now + ttl;
+  }
+  if (user) {
+    *user = iter->second.user;
+  }
+  return true;
+}
+
+void session_store::remove(std::string_view token) {
+  key k;
+  if (!parse_(token, &k)) {
+    return;
+  }
+  shard &s = shard_(k);
+  std::lock_guard<std::mutex> locker(s.mtx);
+  // its deadline entry is skipped when it comes up
+  s.sessions.erase(k);
+}
+
+size_t session_store::expire() {
+  int64_t now = now_ms_();
+  size_t dropped = 0;
+  for (shard &s : shards_) {
+    std::lock_guard<std::mutex> locker(s.mtx);
+    while (!s.deadlines.empty() && s.deadlines.front().second <= now) {
+      key k = s.deadlines.front().first;
+      s.deadlines.pop_front();
+      auto iter = s.sessions.find(k);
+      if (iter == s.sessions.end()) {
+        continue;
+      }
+      if (iter->second.expires_ms <= now) {
+        s.sessions.erase(iter);
+        ++dropped;
+      } else {
+        s.deadlines.emplace_back(k, iter->second.expires_ms);
+      }
+    }
+  }
+  return dropped;
+}
+
+size_t session_store::size() {
+  size_t total = 0;
+  for (shard &s : shards_) {
+    std::lock_guard<std::mutex> locker(s.mtx);
+    total += s.sessions.size();
+  }
+  return total;
+}
+
+std::string_view session_store::token_of(std::string_view cookie) {
+  while (!cookie.empty()) {
+    size_t end = cookie.find(';');
+    std::string_view pair = cookie.substr(0, end);
+    size_t start = pair.find_first_not_of(' ');
+    if (start != std::string_view::npos) {
+      pair.remove_prefix(start);
+      if (pair.size() > COOKIE_NAME.size() &&
+          pair.starts_with(COOKIE_NAME) && pair[COOKIE_NAME.size()] == '=') {
+        return pair.substr(COOKIE_NAME.size() + 1);
+      }
+    }
+    if (end == std::string_view::npos) {
+      break;
+    }
+    cookie.remove_prefix(end + 1);
+  }
+  return {};
+}
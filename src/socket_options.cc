@@ -0,0 +1,79 @@
+#include "socket_options.h"
+
+#include <errno.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+
+#include <cstring>
+
+#include "log.h"
+
+namespace {
+
+void set_int(int fd, int level, int name, int value, const char *what) {
+  if (setsockopt(fd, level, name, &value, sizeof(value)) < 0) {
+    LOG_WARN("socket[%d] %s=%d: %s", fd, what, value, strerror(errno));
+  }
+}
+
+}  // namespace
+
+void socket_options::tune_listener(int fd, const server_config &cfg) {
+  if (cfg.tcp_nodelay) {
+    set_int(fd, IPPROTO_TCP, TCP_NODELAY, 1, "TCP_NODELAY");
+  }
+  // the connection is accepted once its first bytes are in, so the
+  // reactor never wakes for a client that connects and says nothing
+  if (cfg.defer_accept_s) {
+    set_int(fd, IPPROTO_TCP, TCP_DEFER_ACCEPT, cfg.defer_accept_s,
+            "TCP_DEFER_ACCEPT");
+  }
+  // a returning client's request rides on its SYN; the kernel must allow
+  // it too (net.ipv4.tcp_fastopen bit 2)
+  if (cfg.fastopen_queue) {
+    set_int(fd, IPPROTO_TCP, TCP_FASTOPEN, cfg.fastopen_queue,
+            "TCP_FASTOPEN");
+  }
+  // a fixed size turns the kernel's autotuning off for these sockets
+  if (cfg.rcvbuf) {
+    set_int(fd, SOL_SOCKET, SO_RCVBUF, cfg.rcvbuf, "SO_RCVBUF");
+  }
+  if (cfg.sndbuf) {
+    set_int(fd, SOL_SOCKET, SO_SNDBUF, cfg.sndbuf, "SO_SNDBUF");
+  }
+  // spins on the device queue before sleeping in a read; only pays with
+  // a NIC that supports it, and above net.core.busy_read needs
+  // CAP_NET_ADMIN
+  if (cfg.busy_poll_us) {
+    set_int(fd, SOL_SOCKET, SO_BUSY_POLL, cfg.busy_poll_us, "SO_BUSY_POLL");
+  }
+}
+
+void socket_options::cork(int fd, bool on) {
+  int value = on;
+  setsockopt(fd, IPPROTO_TCP, TCP_CORK, &value, sizeof(value));
+}
+
+std::string socket_options::describe(const server_config &cfg) {
+  std::string out = cfg.tcp_nodelay ? "nodelay" : "nagle";
+  if (cfg.tcp_cork) {
+    out += ", cork";
+  }
+  if (cfg.defer_accept_s) {
+    out += ", defer_accept " + std::to_string(cfg.defer_accept_s) + "s";
+  }
+  if (cfg.fastopen_queue) {
+    out += ", fastopen " + std::to_string(cfg.fastopen_queue);
+  }
+  if (cfg.rcvbuf) {
+    out += ", rcvbuf " + std::to_string(cfg.rcvbuf);
+  }
+  if (cfg.sndbuf) {
+    out += ", sndbuf " + std::to_string(cfg.sndbuf);
+  }
+  if (cfg.busy_poll_us) {
+    out += ", busy_poll " + std::to_string(cfg.busy_poll_us) + "us";
+  }
+  return out + ", accept batch " + std::to_string(cfg.accept_batch);
+}
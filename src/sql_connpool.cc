@@ -1,5 +1,7 @@
 #include "sql_connpool.h"
 
+#include <algorithm>
+
 #include "log.h"
 
 // sql_connpool::sql_connpool() : sem_(0), mutex_(0) {}
@@ -9,9 +11,11 @@ sql_connpool* sql_connpool::instance() {
   return &sql_coonpool_;
 }
 
-std::unique_ptr<mysql> sql_connpool::get_conn() {
+std::unique_ptr<mysql> sql_connpool::get_conn(int timeout_ms) {
   std::unique_ptr<mysql> mysql_;
-  conn_que_.pop(mysql_);
+  if (!conn_que_.pop(mysql_, std::chrono::milliseconds(timeout_ms))) {
+    LOG_WARN("sql_connpool: no free connection after %dms", timeout_ms);
+  }
   return mysql_;
 }
 
@@ -40,3 +44,21 @@ void sql_connpool::init(const char* host, int port, const char* user,
   }
   max_conn_ = conn_size;
 }
+
+void sql_connpool::start_workers(int threads_num) {
+  if (threads_num > 0 && !workers_) {
+    workers_ = std::make_unique<threadpool>(std::min(threads_num, MIN_WORKERS_),
+                                            1024, threads_num);
+  }
+}
+
+void sql_connpool::append_quoted(MYSQL* sql, std::string& out,
+                                 std::string_view value) {
+  size_t at = out.size();
+  out.resize(at + value.size() * 2 + 3);
+  out[at] = '\'';
+  unsigned long len =
+      mysql_real_escape_string(sql, &out[at + 1], value.data(), value.size());
+  out.resize(at + 1 + len);
+  out += '\'';
+}
@@ -1,21 +1,155 @@
 #include "threadpool.h"
 
-void threadpool::init_array_() {
-  for (auto &t_ptr_ : threads_array_) {
-    t_ptr_ = std::make_unique<std::thread>([this]() {
-      while (!is_close_.load()) {
-        std::function<void()> task;
-        if (tasks_.pop(task, 1)) {
-          task();
-        }
+#include <pthread.h>
+
+#include <algorithm>
+
+#include "log.h"
+
+threadpool::threadpool(int threads_num, int max_queue_size, int max_threads,
+                       std::vector<int> cpus)
+    : tasks_(max_queue_size),
+      last_pop_us_(now_us_()),
+      min_threads_(std::max(threads_num, 1)),
+      max_threads_(std::max(max_threads, min_threads_)),
+      cpus_(std::move(cpus)) {
+  CPU_ZERO(&inherited_);
+  sched_getaffinity(0, sizeof(inherited_), &inherited_);
+  std::lock_guard<std::mutex> locker(threads_mtx_);
+  for (int i = 0; i < min_threads_; ++i) {
+    spawn_();
+  }
+}
+
+int64_t threadpool::now_us_() {
+  return std::chrono::duration_cast<std::chrono::microseconds>(
+             std::chrono::steady_clock::now().time_since_epoch())
+      .count();
+}
+
+void threadpool::set_max_threads(int max_threads) {
+  max_threads_ = std::max(max_threads, min_threads_);
+}
+
+// called by producers, so a pool nobody feeds never grows
+void threadpool::maybe_grow_() {
+  if (is_close_.load(std::memory_order_relaxed) ||
+      idle_.load(std::memory_order_relaxed) > 0 ||
+      threads_.load(std::memory_order_relaxed) >= max_threads_) {
+    return;
+  }
+  int64_t now = now_us_();
+  int64_t grow_us =
+      std::chrono::duration_cast<std::chrono::microseconds>(GROW_DELAY_)
+          .count();
+  // the average only moves on pops, so workers stuck on slow calls show up
+  // as a pop that is overdue instead
+  if (queue_delay_us_.load(std::memory_order_relaxed) < grow_us &&
+      now - last_pop_us_.load(std::memory_order_relaxed) < grow_us) {
+    return;
+  }
+  // at most one new thread per GROW_DELAY_, and only one producer spawns it
+  int64_t last = last_grow_us_.load(std::memory_order_relaxed);
+  if (now - last < grow_us ||
+      !last_grow_us_.compare_exchange_strong(last, now)) {
+    return;
+  }
+  std::lock_guard<std::mutex> locker(threads_mtx_);
+  if (is_close_ || threads_ >= max_threads_) {
+    return;
+  }
+  spawn_();
+  LOG_INFO("threadpool grew to %d threads, queue:%zu", threads_.load(),
+           tasks_.size());
+}
+
+// with threads_mtx_ held; also joins workers that have retired
+void threadpool::spawn_() {
+  for (std::thread::id id : exited_) {
+    auto iter = std::find_if(threads_array_.begin(), threads_array_.end(),
+                             [id](const std::unique_ptr<std::thread> &t) {
+                               return t->get_id() == id;
+                             });
+    if (iter != threads_array_.end()) {
+      (*iter)->join();
+      threads_array_.erase(iter);
+    }
+  }
+  exited_.clear();
+  ++threads_;
+  size_t index = next_index_++;
+  threads_array_.push_back(
+      std::make_unique<std::thread>([this, index]() { worker_(index); }));
+}
+
+// leaves only while the pool is above its floor and still serving
+bool threadpool::retire_() {
+  int count = threads_.load();
+  while (count > min_threads_ && !is_close_) {
+    if (threads_.compare_exchange_weak(count, count - 1)) {
+      return true;
+    }
+  }
+  return false;
+}
+
+void threadpool::worker_(size_t index) {
+  // threads spawned from a pinned thread would inherit its single cpu
+  if (cpus_.empty()) {
+    pthread_setaffinity_np(pthread_self(), sizeof(inherited_), &inherited_);
+  } else {
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    CPU_SET(cpus_[index % cpus_.size()], &set);
+    pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+  }
+  auto idle_since = std::chrono::steady_clock::now();
+  // on close the queue is worked off before the thread exits
+  while (!is_close_.load() || !tasks_.empty()) {
+    task_item task;
+    ++idle_;
+    bool popped = tasks_.pop(task, POP_WAIT_);
+    --idle_;
+    auto now = std::chrono::steady_clock::now();
+    if (!popped) {
+      if (now - idle_since >= IDLE_EXIT_ && retire_()) {
+        std::lock_guard<std::mutex> locker(threads_mtx_);
+        exited_.push_back(std::this_thread::get_id());
+        LOG_INFO("threadpool shrank to %d threads", threads_.load());
+        return;
       }
-    });
+      continue;
+    }
+    if (!task.fn) {
+      break;
+    }
+    last_pop_us_.store(now_us_(), std::memory_order_relaxed);
+    int64_t waited =
+        std::chrono::duration_cast<std::chrono::microseconds>(now - task.queued)
+            .count();
+    // 1/8 weight, close enough without a lock
+    int64_t avg = queue_delay_us_.load(std::memory_order_relaxed);
+    queue_delay_us_.store(avg + (waited - avg) / 8, std::memory_order_relaxed);
+    task.fn();
+    idle_since = std::chrono::steady_clock::now();
   }
 }
 
 threadpool::~threadpool() {
   is_close_.store(true);
-  for (auto &ptr : threads_array_) {
+  // taken out first: a worker that is retiring right now still needs the
+  // lock to finish
+  std::vector<std::unique_ptr<std::thread>> threads;
+  {
+    std::lock_guard<std::mutex> locker(threads_mtx_);
+    threads.swap(threads_array_);
+  }
+  // queued behind everything else, one empty task per thread wakes it out
+  // of pop() and ends it
+  for (size_t i = 0; i < threads.size(); ++i) {
+    add_task(nullptr);
+  }
+  for (auto &ptr : threads) {
     ptr->join();
   }
 }
@@ -0,0 +1,61 @@
+#include "tls_context.h"
+
+#include <openssl/err.h>
+
+#include "log.h"
+
+tls_context *tls_context::instance() {
+  static tls_context tls_ctx_;
+  return &tls_ctx_;
+}
+
+tls_context::~tls_context() {
+  if (ctx_) {
+    SSL_CTX_free(ctx_);
+  }
+}
+
+bool tls_context::init(const char *cert_file, const char *key_file) {
+  ctx_ = SSL_CTX_new(TLS_server_method());
+  if (!ctx_) {
+    LOG_ERROR("SSL_CTX_new error");
+    return false;
+  }
+  SSL_CTX_set_min_proto_version(ctx_, TLS1_2_VERSION);
+  // kTLS lets the kernel encrypt, so sendfile keeps working under https
+  SSL_CTX_set_options(ctx_, SSL_OP_ENABLE_KTLS);
+  SSL_CTX_set_mode(ctx_, SSL_MODE_ENABLE_PARTIAL_WRITE |
+                             SSL_MODE_ACCEPT_MOVING_WRITE_BUFFER |
+                             SSL_MODE_RELEASE_BUFFERS);
+
+  // resumption: server side session cache for ids, tickets for TLS 1.3
+  static const unsigned char sid_ctx[] = "tiny_webserver";
+  SSL_CTX_set_session_id_context(ctx_, sid_ctx, sizeof(sid_ctx) - 1);
+  SSL_CTX_set_session_cache_mode(ctx_, SSL_SESS_CACHE_SERVER);
+  SSL_CTX_sess_set_cache_size(ctx_, SESSION_CACHE_SIZE_);
+  SSL_CTX_set_timeout(ctx_, SESSION_TIMEOUT_);
+
+  if (SSL_CTX_use_certificate_chain_file(ctx_, cert_file) <= 0 ||
+      SSL_CTX_use_PrivateKey_file(ctx_, key_file, SSL_FILETYPE_PEM) <= 0 ||
+      !SSL_CTX_check_private_key(ctx_)) {
+    LOG_ERROR("load cert:%s key:%s error: %s", cert_file, key_file,
+              ERR_error_string(ERR_get_error(), nullptr));
+    SSL_CTX_free(ctx_);
+    ctx_ = nullptr;
+    return false;
+  }
+  return true;
+}
+
+SSL *tls_context::new_ssl(int fd) {
+  SSL *ssl = SSL_new(ctx_);
+  if (!ssl) {
+    return nullptr;
+  }
+  if (!SSL_set_fd(ssl, fd)) {
+    SSL_free(ssl);
+    return nullptr;
+  }
+  SSL_set_accept_state(ssl);
+  return ssl;
+}
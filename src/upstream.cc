@@ -0,0 +1,198 @@
+#include "upstream.h"
+
+#include <arpa/inet.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <netinet/tcp.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <chrono>
+#include <cstring>
+
+#include "log.h"
+
+namespace {
+
+// waits for events on fd until deadline_ms; false on timeout or error
+bool wait_fd(int fd, short events, int64_t deadline_ms, int64_t now_ms) {
+  pollfd pfd = {fd, events, 0};
+  int left = static_cast<int>(deadline_ms - now_ms);
+  return left > 0 && poll(&pfd, 1, left) == 1 && !(pfd.revents & POLLERR);
+}
+
+}  // namespace
+
+upstream::~upstream() {
+  for (auto &be : backends_) {
+    for (auto [fd, since] : be->idle) {
+      close(fd);
+    }
+  }
+}
+
+int64_t upstream::now_ms_() {
+  return std::chrono::duration_cast<std::chrono::milliseconds>(
+             std::chrono::steady_clock::now().time_since_epoch())
+      .count();
+}
+
+bool upstream::init(const std::string &backends, size_t idle_max) {
+  spec_ = backends;
+  idle_max_ = idle_max;
+  size_t start = 0;
+  while (start <= backends.size()) {
+    size_t end = backends.find(',', start);
+    if (end == std::string::npos) {
+      end = backends.size();
+    }
+    std::string item = backends.substr(start, end - start);
+    start = end + 1;
+    size_t colon = item.rfind(':');
+    auto be = std::make_unique<backend>();
+    memset(&be->addr, 0, sizeof(be->addr));
+    be->addr.sin_family = AF_INET;
+    int port =
+        colon == std::string::npos ? 0 : atoi(item.c_str() + colon + 1);
+    if (port <= 0 || port > 65535 ||
+        inet_pton(AF_INET, item.substr(0, colon).c_str(),
+                  &be->addr.sin_addr) != 1) {
+      LOG_ERROR("upstream: bad backend address '%s'", item.c_str());
+      return false;
+    }
+    be->addr.sin_port = htons(port);
+    be->name = item;
+    backends_.push_back(std::move(be));
+  }
+  return !backends_.empty();
+}
+
+upstream::backend *upstream::pick() {
+  size_t n = backends_.size();
+  // scanning from a rotating start spreads ties
+  size_t first = next_.fetch_add(1, std::memory_order_relaxed) % n;
+  backend *best = nullptr;
+  int best_active = 0;
+  // with every backend down, one of them is tried anyway: health checks
+  // may be off, and a backend that is back is better found by a request
+  // than never
+  for (bool any : {false, true}) {
+    for (size_t i = 0; i < n; ++i) {
+      backend *be = backends_[(first + i) % n].get();
+      if (!any && !be->healthy) {
+        continue;
+      }
+      int active = be->active.load(std::memory_order_relaxed);
+      if (!best || active < best_active) {
+        best = be;
+        best_active = active;
+      }
+    }
+    if (best) {
+      break;
+    }
+  }
+  ++best->active;
+  return best;
+}
+
+int upstream::connect(backend *be, bool *reused) {
+  int64_t now = now_ms_();
+  {
+    std::lock_guard<std::mutex> locker(be->mtx);
+    while (!be->idle.empty()) {
+      auto [fd, since] = be->idle.back();
+      be->idle.pop_back();
+      char probe;
+      // a parked connection the backend has closed, or that has stray
+      // bytes waiting, is no use
+      if (now - since < IDLE_MS_ &&
+          recv(fd, &probe, 1, MSG_PEEK | MSG_DONTWAIT) < 0 &&
+          errno == EAGAIN) {
+        *reused = true;
+        return fd;
+      }
+      close(fd);
+    }
+  }
+  *reused = false;
+  int fd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+  if (fd < 0) {
+    LOG_ERROR("upstream: socket error %d", errno);
+    return -1;
+  }
+  int one = 1;
+  setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+  if (::connect(fd, (sockaddr *)&be->addr, sizeof(be->addr)) < 0 &&
+      errno != EINPROGRESS) {
+    LOG_WARN("upstream: connect %s error %d", be->name.c_str(), errno);
+    close(fd);
+    return -1;
+  }
+  return fd;
+}
+
+void upstream::release(backend *be, int fd, bool reusable) {
+  --be->active;
+  if (fd < 0) {
+    return;
+  }
+  if (reusable) {
+    std::lock_guard<std::mutex> locker(be->mtx);
+    if (be->idle.size() < idle_max_) {
+      be->idle.emplace_back(fd, now_ms_());
+      return;
+    }
+  }
+  close(fd);
+}
+
+void upstream::mark_down(backend *be) {
+  if (be->healthy.exchange(false)) {
+    LOG_WARN("upstream: %s is down", be->name.c_str());
+  }
+}
+
+void upstream::check_health(const std::string &path, int timeout_ms) {
+  for (auto &be : backends_) {
+    bool ok = probe_(*be, path, timeout_ms);
+    if (ok && !be->healthy.exchange(true)) {
+      LOG_INFO("upstream: %s is up", be->name.c_str());
+    } else if (!ok) {
+      mark_down(be.get());
+    }
+  }
+}
+
+bool upstream::probe_(const backend &be, const std::string &path,
+                      int timeout_ms) {
+  int fd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+  if (fd < 0) {
+    return false;
+  }
+  int64_t deadline = now_ms_() + timeout_ms;
+  std::string request = "GET " + path + " HTTP/1.1\r\nHost: " + be.name +
+                        "\r\nConnection: close\r\n\r\n";
+  char status[16];
+  size_t got = 0;
+  int err = 0;
+  socklen_t len = sizeof(err);
+  bool ok = (::connect(fd, (sockaddr *)&be.addr, sizeof(be.addr)) == 0 ||
+             errno == EINPROGRESS) &&
+            wait_fd(fd, POLLOUT, deadline, now_ms_()) &&
+            getsockopt(fd, SOL_SOCKET, SO_ERROR, &err, &len) == 0 && !err &&
+            send(fd, request.data(), request.size(), MSG_NOSIGNAL) ==
+                static_cast<ssize_t>(request.size());
+  // "HTTP/1.1 200"
+  while (ok && got < 12 && wait_fd(fd, POLLIN, deadline, now_ms_())) {
+    ssize_t n = recv(fd, status + got, 12 - got, 0);
+    if (n <= 0) {
+      break;
+    }
+    got += n;
+  }
+  close(fd);
+  return ok && got == 12 && memcmp(status, "HTTP/1.", 7) == 0 &&
+         status[9] >= '1' && status[9] <= '4';
+}
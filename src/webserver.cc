@@ -1,58 +1,209 @@
 #include "webserver.h"
 
 #include <fcntl.h>
+#include <limits.h>
+#include <sched.h>
+#include <signal.h>
 #include <string.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
 
+#include <algorithm>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "conn_limiter.h"
+#include "cpu_topology.h"
+#include "file_io.h"
+#include "handlers.h"
+#include "header_writer.h"
 #include "log.h"
+#include "password_hasher.h"
+#include "path_resolver.h"
+#include "proxy_exchange.h"
+#include "rate_limiter.h"
+#include "register_writer.h"
+#include "resource_index.h"
+#include "session_store.h"
+#include "socket_options.h"
 #include "sql_connpool.h"
+#include "tls_context.h"
+#include "ws_hub.h"
+
+namespace {
+
+// what a client gets when the server sheds it instead of queueing it
+constexpr char BUSY_RESPONSE[] =
+    "HTTP/1.1 503 Service Unavailable\r\n"
+    "Retry-After: 1\r\n"
+    "Content-Length: 0\r\n"
+    "Connection: close\r\n\r\n";
+
+// and when its address is over the rate limit
+constexpr char LIMITED_RESPONSE[] =
+    "HTTP/1.1 429 Too Many Requests\r\n"
+    "Retry-After: 1\r\n"
+    "Content-Length: 0\r\n"
+    "Connection: close\r\n\r\n";
 
-webserver::webserver(int port, int trig_mode, int timeout_ms, bool opt_linger,
-                     int sql_port, const char *sql_user, const char *sql_pwd,
-                     const char *db_name, int connpool_num, int threads_num,
-                     bool open_log, int log_level, int log_que_size)
-    : port_(port),
-      open_linger_(opt_linger),
-      timeout_ms_(timeout_ms),
+}  // namespace
+
+int webserver::signal_write_fd_ = -1;
+
+webserver::webserver(const config &conf, const server_config &cfg)
+    : conf_(conf),
+      cfg_(cfg),
       timer_(std::make_unique<heap_timer>()),
-      threadpool_(std::make_unique<threadpool>(threads_num)),
-      epoller_(std::make_unique<epoller>()) {
+      epoller_(std::make_unique<epoller>()),
+      upstream_owner_(std::make_unique<std::atomic<int>[]>(MAX_FD_)) {
+  buffer::set_initial_size(cfg_.buffer_size);
+  threadpool_ = std::make_unique<threadpool>(cfg_.threads, cfg_.task_queue,
+                                             threads_max_(), worker_cpus_());
   src_dir_ = getcwd(nullptr, 256);
   strcat(src_dir_, "/resources/");
   http_conn::user_count = 0;
+  http_conn::draining = false;
   http_conn::src_dir = src_dir_;
+  http_conn::cork = cfg_.tcp_cork;
+  http_conn::on_resume = [this](http_conn *client) {
+    threadpool_->add_task([this, client]() { process_(client); });
+  };
+  http_conn::admit = [](const http_conn &client) {
+    return rate_limiter::instance()->allow_request(
+        client.addr().sin_addr.s_addr);
+  };
+  proxy_exchange::watch = [this](int fd, int owner_fd, uint32_t events) {
+    watch_upstream_(fd, owner_fd, events);
+  };
+  ws_session::arm = [this](int fd, bool write) {
+    epoller_->mod_fd(fd, conn_event_ | EPOLLIN | (write ? EPOLLOUT : 0));
+  };
+  apply_ws_limits_();
+  file_io::instance()->init(cfg_.io_threads);
+  conn_limiter::instance()->init(cfg_.max_conn_per_ip);
+  rate_limiter::instance()->init(cfg_.rate_requests, cfg_.rate_request_burst,
+                                 cfg_.rate_bytes, cfg_.rate_byte_burst);
+  session_store::instance()->init(cfg_.session_ttl_s, cfg_.max_sessions);
+  password_hasher::instance()->init(cfg_.hash_threads, cfg_.hash_queue,
+                                    cfg_.hash_iterations);
+  register_writer::instance()->init(cfg_.register_batch_ms,
+                                    cfg_.register_batch_rows);
+  user_handler::set_cache(cfg_.micro_cache_ms, cfg_.micro_cache_stale_ms,
+                          cfg_.micro_cache_entries);
+  init_routes_();
 
-  sql_connpool::instance()->init("0.0.0.0", sql_port, sql_user, sql_pwd,
-                                 db_name, connpool_num);
+  sql_connpool::instance()->init(cfg_.sql_host.c_str(), cfg_.sql_port,
+                                 cfg_.sql_user.c_str(), cfg_.sql_pwd.c_str(),
+                                 cfg_.db_name.c_str(), cfg_.sql_pool);
+  sql_connpool::instance()->set_wait_ms(cfg_.sql_wait_ms);
+  sql_connpool::instance()->start_workers(cfg_.db_threads);
 
-  init_event_mode_(trig_mode);
+  init_event_mode_(cfg_.trig_mode);
   is_close_ = !init_socket_();
-  if (open_log) {
-    log::instance()->init(log_level, "./log", ".log", log_que_size);
+  if (cfg_.open_log) {
+    log::instance()->init(cfg_.log_level, "./log", ".log", cfg_.log_queue);
     if (is_close_) {
       LOG_ERROR("========== server init error ==========");
     } else {
       LOG_INFO("========== server init ==========");
-      LOG_INFO("port:%d, open_linger: %s", port_,
-               opt_linger ? "true" : "false");
+      LOG_INFO("port:%d, open_linger: %s", cfg_.port,
+               cfg_.opt_linger ? "true" : "false");
+      if (tls_listen_fd_ != -1) {
+        LOG_INFO("https port:%d, cert:%s", cfg_.tls_port,
+                 cfg_.cert_file.c_str());
+      }
       LOG_INFO("listen mode: %s, open_conn mode: %s",
                (listen_event_ & EPOLLET ? "ET" : "LT"),
                (conn_event_ & EPOLLET ? "ET" : "LT"));
-      LOG_INFO("log_sys level: %d", log_level);
+      LOG_INFO("backlog: %d, socket: %s", cfg_.backlog,
+               socket_options::describe(cfg_).c_str());
+      LOG_INFO("log_sys level: %d", cfg_.log_level);
       LOG_INFO("src_dir: %s", http_conn::src_dir);
-      LOG_INFO("sql_connpool num: %d, threadpool num: %d", connpool_num,
-               threads_num);
+      LOG_INFO("sql_connpool num: %d, db threads: %d", cfg_.sql_pool,
+               cfg_.db_threads);
+      LOG_INFO("threadpool num: %d-%d, queue: %d", cfg_.threads,
+               threads_max_(), cfg_.task_queue);
+      if (reactor_cpu_ >= 0) {
+        LOG_INFO("event loop on cpu %d, node %d", reactor_cpu_,
+                 cpu_topology::node_of(reactor_cpu_));
+      }
+      LOG_INFO("max conn: %d, per ip: %d", cfg_.max_conn,
+               cfg_.max_conn_per_ip);
+      LOG_INFO("rate limit per ip: %d req/s, %d bytes/s", cfg_.rate_requests,
+               cfg_.rate_bytes);
     }
     printf("log init success\n");
   }
+
+  resource_index::instance()->init(src_dir_, cfg_.preload_max,
+                                   cfg_.preload_budget, false, cfg_.bundle);
+  path_resolver::instance()->init(src_dir_, cfg_.path_cache);
+  index_fd_ = resource_index::instance()->watch_fd();
+  if (index_fd_ >= 0) {
+    epoller_->add_fd(index_fd_, EPOLLIN);
+  }
+  if (!is_close_ && !init_signals_()) {
+    LOG_ERROR("init signals error");
+    is_close_ = true;
+  }
+  if (!is_close_ && !init_proxy_()) {
+    LOG_ERROR("init proxy error");
+    is_close_ = true;
+  }
 }
 
 webserver::~webserver() {
-  close(listen_fd_);
+  // hashes and queries in flight resume their clients onto the workers,
+  // and workers still hold client pointers, so all finish before users_
+  // goes. a finished hash may still queue a write, so hashing stops first
+  password_hasher::instance()->stop();
+  register_writer::instance()->stop();
+  sql_connpool::instance()->stop_workers();
+  http_conn::on_resume = nullptr;
+  threadpool_.reset();
+  // the connections still close their upstream sockets, without the loop
+  proxy_exchange::watch = nullptr;
+  ws_session::arm = nullptr;
+  for (int fd : {listen_fd_, tls_listen_fd_, signal_fd_, signal_write_fd_,
+                 handoff_fd_}) {
+    if (fd >= 0) {
+      close(fd);
+    }
+  }
+  signal_write_fd_ = -1;
   free(src_dir_);
 }
 
+int webserver::threads_max_() const {
+  int max_threads = cfg_.threads_max;
+  if (max_threads <= 0) {
+    max_threads = std::thread::hardware_concurrency();
+  }
+  return std::max(max_threads, cfg_.threads);
+}
+
+// the event loop stays on the cpu it starts on (pinned in start(), once the
+// other thread groups exist and won't inherit the mask); workers get the
+// rest of that NUMA node, so the connections they share stay in one cache
+// domain
+std::vector<int> webserver::worker_cpus_() {
+  if (!cfg_.cpu_affinity) {
+    return {};
+  }
+  reactor_cpu_ = sched_getcpu();
+  if (reactor_cpu_ < 0) {
+    return {};
+  }
+  std::vector<int> cpus = cpu_topology::same_node(reactor_cpu_);
+  if (cpus.size() > 1) {
+    std::erase(cpus, reactor_cpu_);
+  }
+  return cpus;
+}
+
 void webserver::init_event_mode_(int trig_mode) {
-  listen_event_ |= EPOLLRDHUP;
+  listen_event_ = EPOLLRDHUP;
   conn_event_ = EPOLLONESHOT | EPOLLRDHUP;
   switch (trig_mode) {
     case 0:
@@ -72,72 +223,109 @@ void webserver::init_event_mode_(int trig_mode) {
 }
 
 bool webserver::init_socket_() {
+  // started by hot_restart_(): take over the old process's sockets
+  const char *handoff = getenv(HANDOFF_ENV_);
+  if (handoff) {
+    handoff_fd_ = atoi(handoff);
+    unsetenv(HANDOFF_ENV_);
+    fcntl(handoff_fd_, F_SETFD, FD_CLOEXEC);
+    if (!recv_listeners_(handoff_fd_)) {
+      LOG_ERROR("receive listeners error");
+    }
+  }
+  if (listen_fd_ < 0) {
+    listen_fd_ = init_listen_fd_(cfg_.port);
+  }
+  if (listen_fd_ < 0) {
+    return false;
+  }
+  if (cfg_.tls_port > 0) {
+    if (!tls_context::instance()->init(cfg_.cert_file.c_str(),
+                                       cfg_.key_file.c_str())) {
+      LOG_ERROR("init tls error");
+      close(listen_fd_);
+      return false;
+    }
+    if (tls_listen_fd_ < 0) {
+      tls_listen_fd_ = init_listen_fd_(cfg_.tls_port);
+    }
+    if (tls_listen_fd_ < 0) {
+      close(listen_fd_);
+      return false;
+    }
+  }
+  return true;
+}
+
+int webserver::init_listen_fd_(int port) {
   int ret;
+  int listen_fd;
   sockaddr_in addr;
 
-  if (port_ > 65535 || port_ < 1024) {
-    LOG_ERROR("port:%d error", port_);
-    return false;
+  if (port > 65535 || port < 1024) {
+    LOG_ERROR("port:%d error", port);
+    return -1;
   }
 
   addr.sin_family = PF_INET;
-  addr.sin_port = htons(port_);
+  addr.sin_port = htons(port);
   addr.sin_addr.s_addr = htonl(INADDR_ANY);
 
   {
     linger opt_linger = {0};
-    if (open_linger_) {
+    if (cfg_.opt_linger) {
       opt_linger.l_linger = 1;
       opt_linger.l_onoff = 1;
     }
 
-    listen_fd_ = socket(PF_INET, SOCK_STREAM, 0);
-    if (listen_fd_ < 0) {
-      LOG_ERROR("create socket error port:%d", port_);
-      return false;
+    listen_fd =
+        socket(PF_INET, SOCK_STREAM | SOCK_CLOEXEC | SOCK_NONBLOCK, 0);
+    if (listen_fd < 0) {
+      LOG_ERROR("create socket error port:%d", port);
+      return -1;
     }
 
-    ret = setsockopt(listen_fd_, SOL_SOCKET, SO_LINGER, &opt_linger,
+    ret = setsockopt(listen_fd, SOL_SOCKET, SO_LINGER, &opt_linger,
                      sizeof(opt_linger));
     if (ret < 0) {
-      close(listen_fd_);
-      LOG_ERROR("init linger error port:%d", port_);
-      return false;
+      close(listen_fd);
+      LOG_ERROR("init linger error port:%d", port);
+      return -1;
     }
   }
 
   int optval = 1;
-  ret = setsockopt(listen_fd_, SOL_SOCKET, SO_REUSEADDR, (const void *)&optval,
+  ret = setsockopt(listen_fd, SOL_SOCKET, SO_REUSEADDR, (const void *)&optval,
                    sizeof(optval));
   if (ret < 0) {
     LOG_ERROR("set socket opt error");
-    close(listen_fd_);
-    return false;
+    close(listen_fd);
+    return -1;
   }
 
-  ret = bind(listen_fd_, (sockaddr *)&addr, sizeof(addr));
+  ret = bind(listen_fd, (sockaddr *)&addr, sizeof(addr));
   if (ret < 0) {
-    LOG_ERROR("bind port:%d error", port_);
-    close(listen_fd_);
-    return false;
+    LOG_ERROR("bind port:%d error", port);
+    close(listen_fd);
+    return -1;
   }
 
-  ret = listen(listen_fd_, 6);
+  socket_options::tune_listener(listen_fd, cfg_);
+  ret = listen(listen_fd, cfg_.backlog);
   if (ret < 0) {
-    LOG_ERROR("listen port:%d error", port_);
-    close(listen_fd_);
-    return false;
+    LOG_ERROR("listen port:%d error", port);
+    close(listen_fd);
+    return -1;
   }
 
-  ret = epoller_->add_fd(listen_fd_, listen_event_ | EPOLLIN);
+  ret = epoller_->add_fd(listen_fd, listen_event_ | EPOLLIN);
   if (ret == 0) {
     LOG_ERROR("add listen error");
-    close(listen_fd_);
-    return false;
+    close(listen_fd);
+    return -1;
   }
-  setnonblock(listen_fd_);
-  LOG_INFO("server port:%d", port_);
-  return true;
+  LOG_INFO("server port:%d", port);
+  return listen_fd;
 }
 
 int webserver::setnonblock(int fd) {
@@ -152,55 +340,227 @@ void webserver::send_error_(int fd, const char *info) {
   close(fd);
 }
 
+// closes a connection refused at accept(), telling plain http clients why
+void webserver::reject_(int fd, bool is_tls, const char *response) {
+  if (is_tls) {
+    close(fd);
+  } else {
+    send_error_(fd, response);
+  }
+}
+
+// answers with a canned response and drops the connection; the request is
+// read off first so the close doesn't turn into a reset that swallows the
+// response. TLS and h2 clients are just closed
+void webserver::refuse_(http_conn *client, const char *response) {
+  if (ws_session *ws = client->websocket()) {
+    // no http text inside a frame stream
+    if (!client->is_tls()) {
+      ws->refuse();
+    }
+  } else if (!client->is_tls() && !client->is_h2()) {
+    char scratch[4096];
+    while (recv(client->fd(), scratch, sizeof(scratch), MSG_DONTWAIT) > 0) {
+    }
+    send(client->fd(), response, strlen(response), MSG_DONTWAIT | MSG_NOSIGNAL);
+  }
+  close_conn_(client);
+}
+
+bool webserver::is_overloaded_() {
+  size_t queued = threadpool_->queue_size();
+  if (queued >= threadpool_->queue_capacity() * 3 / 4) {
+    return true;
+  }
+  // the average only moves when workers pop, so it is stale on an empty queue
+  return queued > 0 &&
+         threadpool_->queue_delay_us() > cfg_.queue_delay_max_ms * 1000ll;
+}
+
+void webserver::submit_(std::function<void()> task) {
+  // behind older deferred tasks, so they still run in order
+  if (!deferred_.empty() || !threadpool_->try_add_task(task)) {
+    deferred_.push_back(std::move(task));
+  }
+}
+
+void webserver::run_deferred_() {
+  size_t sent = 0;
+  while (sent < deferred_.size() &&
+         threadpool_->try_add_task(deferred_[sent])) {
+    ++sent;
+  }
+  deferred_.erase(deferred_.begin(), deferred_.begin() + sent);
+}
+
+// stops epoll from reporting new connections; they wait in the kernel
+// backlog until resume_accept_() sees the load drop
+void webserver::pause_accept_() {
+  if (accept_paused_) {
+    return;
+  }
+  accept_paused_ = true;
+  epoller_->del_fd(listen_fd_);
+  if (tls_listen_fd_ >= 0) {
+    epoller_->del_fd(tls_listen_fd_);
+  }
+  LOG_WARN("overloaded, accept paused, user_count:%d",
+           http_conn::user_count.load());
+  timer_->add(ADMIT_TIMER_, ADMIT_CHECK_MS_, [this]() { resume_accept_(); });
+}
+
+void webserver::resume_accept_() {
+  if (http_conn::draining) {
+    return;
+  }
+  if (http_conn::user_count >= cfg_.max_conn / 10 * 9 ||
+      threadpool_->queue_size() >= threadpool_->queue_capacity() / 4) {
+    timer_->add(ADMIT_TIMER_, ADMIT_CHECK_MS_, [this]() { resume_accept_(); });
+    return;
+  }
+  accept_paused_ = false;
+  epoller_->add_fd(listen_fd_, listen_event_ | EPOLLIN);
+  if (tls_listen_fd_ >= 0) {
+    epoller_->add_fd(tls_listen_fd_, listen_event_ | EPOLLIN);
+  }
+  LOG_INFO("accept resumed, user_count:%d", http_conn::user_count.load());
+}
+
 void webserver::close_conn_(http_conn *client) {
   LOG_INFO("client[%d] quit", client->fd());
   epoller_->del_fd(client->fd());
   client->close_();
 }
 
-void webserver::add_client_(int fd, sockaddr_in addr) {
-  users_[fd].init(fd, addr);
-  if (timeout_ms_ > 0) {
-    timer_->add(fd, timeout_ms_, [this, fd]() { close_conn_(&users_[fd]); });
+void webserver::add_client_(int fd, sockaddr_in addr, bool is_tls) {
+  SSL *ssl = nullptr;
+  if (is_tls) {
+    ssl = tls_context::instance()->new_ssl(fd);
+    if (!ssl) {
+      LOG_WARN("create ssl for client[%d] error", fd);
+      conn_limiter::instance()->release(addr.sin_addr.s_addr);
+      close(fd);
+      return;
+    }
+  }
+  users_[fd].init(fd, addr, ssl);
+  if (cfg_.timeout_ms > 0) {
+    timer_->add(fd, cfg_.timeout_ms,
+                [this, fd]() { close_conn_(&users_[fd]); });
   }
   epoller_->add_fd(fd, EPOLLIN | conn_event_);
-  setnonblock(fd);
   LOG_INFO("client[%d] in", users_[fd].fd());
 }
 
-void webserver::deal_listen_() {
+void webserver::deal_listen_(int listen_fd) {
   sockaddr_in addr;
   socklen_t len = sizeof(addr);
-  do {
-    int fd = accept(listen_fd_, (sockaddr *)&addr, &len);
+  bool is_tls = listen_fd == tls_listen_fd_;
+  if (is_overloaded_()) {
+    pause_accept_();
+    return;
+  }
+  // an edge-triggered listener reports nothing new until it is drained; a
+  // level-triggered one is woken again, so it takes a batch at a time
+  // rather than one connection per epoll_wait
+  int batch = listen_event_ & EPOLLET ? INT_MAX : cfg_.accept_batch;
+  for (int i = 0; i < batch; ++i) {
+    int fd = accept4(listen_fd, (sockaddr *)&addr, &len,
+                     SOCK_CLOEXEC | SOCK_NONBLOCK);
     if (fd <= 0) {
       return;
-    } else if (http_conn::user_count >= MAX_FD_) {
-      send_error_(fd, "server busy");
+    } else if (http_conn::user_count >= cfg_.max_conn) {
+      reject_(fd, is_tls, BUSY_RESPONSE);
       LOG_WARN("client is full");
+      pause_accept_();
       return;
+    } else if (!rate_limiter::instance()->allow_conn(addr.sin_addr.s_addr)) {
+      reject_(fd, is_tls, LIMITED_RESPONSE);
+      LOG_WARN("client %s is over its rate limit", inet_ntoa(addr.sin_addr));
+      continue;
+    } else if (!conn_limiter::instance()->acquire(addr.sin_addr.s_addr)) {
+      reject_(fd, is_tls, BUSY_RESPONSE);
+      LOG_WARN("client %s is over its connection limit",
+               inet_ntoa(addr.sin_addr));
+      continue;
     }
-    add_client_(fd, addr);
-  } while (listen_event_ & EPOLLET);
+    add_client_(fd, addr, is_tls);
+  }
 }
 
+// reads are where new work enters, so that is where load is shed; writes
+// and resumed requests always get a worker
 void webserver::deal_read_(http_conn *client) {
   extent_time_(client);
-  threadpool_->add_task([this, client]() { read_(client); });
+  client->set_idle(false);
+  if (is_overloaded_() ||
+      !threadpool_->try_add_task([this, client]() { read_(client); })) {
+    LOG_WARN("overloaded, shedding client[%d]", client->fd());
+    refuse_(client, BUSY_RESPONSE);
+  }
+}
+
+// on a worker: the head of a proxied response is still on its way, or the
+// client is waiting for more of the body
+void webserver::deal_upstream_(http_conn *client) {
+  extent_time_(client);
+  submit_([this, client]() {
+    proxy_exchange *proxy = client->proxy();
+    if (!proxy) {
+      return;
+    }
+    if (proxy->is_pending()) {
+      proxy->on_ready();
+    } else {
+      write_(client);
+    }
+  });
+}
+
+void webserver::watch_upstream_(int fd, int owner_fd, uint32_t events) {
+  if (!events) {
+    epoller_->del_fd(fd);
+    upstream_owner_[fd] = 0;
+    return;
+  }
+  upstream_owner_[fd] = owner_fd + 1;
+  events |= EPOLLONESHOT | EPOLLRDHUP;
+  if (!epoller_->mod_fd(fd, events)) {
+    epoller_->add_fd(fd, events);
+  }
 }
 
 void webserver::deal_write_(http_conn *client) {
   extent_time_(client);
-  threadpool_->add_task([this, client]() { write_(client); });
+  client->set_idle(false);
+  submit_([this, client]() { write_(client); });
 }
 
 void webserver::extent_time_(http_conn *client) {
-  if (timeout_ms_ > 0) {
-    timer_->adjust(client->fd(), timeout_ms_);
+  if (cfg_.timeout_ms > 0) {
+    timer_->adjust(client->fd(), cfg_.timeout_ms);
+  }
+}
+
+// non-blocking TLS handshake, driven by whichever event the peer needs next
+void webserver::handshake_(http_conn *client) {
+  int ret = client->handshake();
+  if (ret < 0) {
+    close_conn_(client);
+  } else if (ret == 0) {
+    epoller_->mod_fd(client->fd(),
+                     conn_event_ | (client->want_write() ? EPOLLOUT : EPOLLIN));
+  } else {
+    read_(client);
   }
 }
 
 void webserver::read_(http_conn *client) {
+  std::unique_lock<std::mutex> io = client->lock_io();
+  if (!client->is_handshaked()) {
+    handshake_(client);
+    return;
+  }
   int ret = -1;
   int read_errno = 0;
   ret = client->read(read_errno);
@@ -212,46 +572,533 @@ void webserver::read_(http_conn *client) {
 }
 
 void webserver::process_(http_conn *client) {
-  if (client->process()) {
-    epoller_->mod_fd(client->fd(), conn_event_ | EPOLLOUT);
+  in_addr_t ip = client->addr().sin_addr.s_addr;
+  bool ready = client->process();
+  while (client->is_pending()) {
+    // the fd stays disarmed until resume() brings the client back here;
+    // work that could not be started is finished here instead
+    if (client->start_pending()) {
+      return;
+    }
+    ready = client->process();
+  }
+  if (ready) {
+    // websocket traffic is not metered
+    if (!client->websocket()) {
+      rate_limiter::instance()->charge_bytes(ip, client->bytes());
+    }
+    arm_write_(client);
+  } else {
+    arm_read_(client);
+  }
+}
+
+// a websocket is read while it waits to write too, or a client that is
+// slow to take its frames would also stop being heard
+void webserver::arm_write_(http_conn *client) {
+  epoller_->mod_fd(client->fd(), conn_event_ | EPOLLOUT |
+                                     (client->websocket() ? EPOLLIN : 0));
+}
+
+void webserver::arm_read_(http_conn *client) {
+  if (ws_session *ws = client->websocket()) {
+    ws->park();
   } else {
     epoller_->mod_fd(client->fd(), conn_event_ | EPOLLIN);
   }
 }
 
 void webserver::write_(http_conn *client) {
+  std::unique_lock<std::mutex> io = client->lock_io();
+  if (!client->is_handshaked()) {
+    handshake_(client);
+    return;
+  }
   int ret = -1;
   int write_errno = 0;
   ret = client->write(write_errno);
   if (client->bytes() == 0) {
+    // while draining, http/1 connections close after their response; h2
+    // ones stay until the sweep finds their streams done
     if (client->is_keep_alive()) {
-      epoller_->mod_fd(client->fd(), conn_event_ | EPOLLIN);
+      bool in_flight = client->has_requests_in_flight();
+      client->set_idle(!in_flight);
+      // pipelined requests already read would never raise EPOLLIN again
+      if (in_flight) {
+        process_(client);
+      } else {
+        arm_read_(client);
+      }
       return;
     }
-  } else if (ret < 0) {
-    if (write_errno == EAGAIN) {
-      epoller_->mod_fd(client->fd(), conn_event_ | EPOLLOUT);
+  } else if (ret != 0) {
+    // a write may stop short of EAGAIN to let other connections in
+    if (ret > 0 || write_errno == EAGAIN) {
+      if (client->wants_upstream()) {
+        // the client can take more, the backend hasn't sent it yet
+        client->proxy()->wait_upstream();
+      } else {
+        arm_write_(client);
+      }
       return;
     }
   }
   close_conn_(client);
 }
 
+// the site pages; main() may add or replace routes before start()
+void webserver::init_routes_() {
+  router *r = router::instance();
+  r->set_fallback(std::make_shared<static_file_handler>());
+  r->add("/", router::MATCH::EXACT,
+         std::make_shared<static_file_handler>("/index.html"));
+  for (const char *page : {"/index", "/welcome", "/video", "/picture"}) {
+    r->add(page, router::MATCH::EXACT,
+           std::make_shared<static_file_handler>(std::string(page) + ".html"));
+  }
+  for (const char *page : {"/login", "/login.html"}) {
+    r->add(page, router::MATCH::EXACT,
+           std::make_shared<user_handler>(true, "/login.html"));
+  }
+  for (const char *page : {"/register", "/register.html"}) {
+    r->add(page, router::MATCH::EXACT,
+           std::make_shared<user_handler>(false, "/register.html"));
+  }
+  r->add("/logout", router::MATCH::EXACT, std::make_shared<logout_handler>());
+  if (!cfg_.upload_dir.empty()) {
+    // made here if missing; a directory that can't be written fails the
+    // uploads with 500
+    mkdir(cfg_.upload_dir.c_str(), 0755);
+    r->add("/upload", router::MATCH::EXACT,
+           std::make_shared<upload_handler>(cfg_.upload_dir,
+                                            cfg_.upload_max));
+  }
+}
+
+bool webserver::init_proxy_() {
+  const std::string &spec = cfg_.proxy;
+  size_t start = 0;
+  while (start < spec.size()) {
+    size_t end = std::min(spec.find(';', start), spec.size());
+    std::string item = spec.substr(start, end - start);
+    start = end + 1;
+    size_t eq = item.find('=');
+    auto group = std::make_shared<upstream>();
+    if (eq == std::string::npos || item[0] != '/' ||
+        !group->init(item.substr(eq + 1), cfg_.proxy_idle)) {
+      LOG_ERROR("bad proxy route '%s'", item.c_str());
+      return false;
+    }
+    router::instance()->add(item.substr(0, eq), router::MATCH::PREFIX,
+                            std::make_shared<proxy_handler>(group));
+    upstreams_.push_back(group);
+    LOG_INFO("proxy %s -> %s", item.substr(0, eq).c_str(),
+             group->spec().c_str());
+  }
+  return true;
+}
+
+// coalesces a burst of changes (a deploy) into one rebuild on a worker
+void webserver::deal_index_change_() {
+  if (!resource_index::instance()->drain()) {
+    return;
+  }
+  timer_->add(INDEX_TIMER_, INDEX_DELAY_MS_, [this]() {
+    submit_([]() {
+      resource_index::instance()->reload();
+      path_resolver::instance()->clear();
+    });
+  });
+}
+
+// the cached Date header, re-armed for the start of each second
+void webserver::refresh_date_() {
+  auto now = std::chrono::system_clock::now();
+  header_writer::update_date(std::chrono::system_clock::to_time_t(now));
+  auto ms = std::chrono::duration_cast<std::chrono::milliseconds>(
+                now.time_since_epoch())
+                .count();
+  timer_->add(DATE_TIMER_, 1000 - ms % 1000, [this]() { refresh_date_(); });
+}
+
+// the sweep itself runs on a worker, it takes every shard lock in turn
+void webserver::expire_sessions_() {
+  if (session_store::instance()->is_open()) {
+    submit_([]() {
+      size_t dropped = session_store::instance()->expire();
+      if (dropped) {
+        LOG_DEBUG("%zu sessions expired", dropped);
+      }
+    });
+  }
+  timer_->add(SESSION_TIMER_, SESSION_SWEEP_MS_,
+              [this]() { expire_sessions_(); });
+}
+
+// probes run on a worker, one round at a time
+void webserver::check_upstreams_() {
+  if (!checking_upstreams_.exchange(true)) {
+    std::string path = cfg_.proxy_health_path;
+    int timeout_ms = std::min(cfg_.proxy_health_ms, PROXY_PROBE_MS_);
+    submit_([this, path, timeout_ms]() {
+      for (auto &group : upstreams_) {
+        group->check_health(path, timeout_ms);
+      }
+      checking_upstreams_ = false;
+    });
+  }
+  timer_->add(PROXY_TIMER_, cfg_.proxy_health_ms,
+              [this]() { check_upstreams_(); });
+}
+
+// the frame is shared by all sessions, the round runs on a worker
+void webserver::ping_websockets_() {
+  if (cfg_.ws_ping_ms <= 0) {
+    return;
+  }
+  submit_([]() { ws_hub::instance()->ping_all(); });
+  timer_->add(WS_TIMER_, cfg_.ws_ping_ms, [this]() { ping_websockets_(); });
+}
+
+void webserver::apply_ws_limits_() {
+  ws_session::max_message = cfg_.ws_max_message;
+  ws_session::max_queued = cfg_.ws_queue_max;
+}
+
+void webserver::on_signal_(int sig) {
+  int saved_errno = errno;
+  char c = sig;
+  ::write(signal_write_fd_, &c, 1);
+  errno = saved_errno;
+}
+
+// signals are turned into bytes on a pipe, so the event loop handles them
+// like any other fd, on its own thread
+bool webserver::init_signals_() {
+  int fds[2];
+  if (pipe2(fds, O_NONBLOCK | O_CLOEXEC) < 0) {
+    return false;
+  }
+  signal_fd_ = fds[0];
+  signal_write_fd_ = fds[1];
+  struct sigaction sa = {};
+  sa.sa_handler = on_signal_;
+  sa.sa_flags = SA_RESTART;
+  sigemptyset(&sa.sa_mask);
+  for (int sig : {SIGTERM, SIGINT, SIGUSR2, SIGHUP}) {
+    if (sigaction(sig, &sa, nullptr) < 0) {
+      return false;
+    }
+  }
+  signal(SIGPIPE, SIG_IGN);
+  return epoller_->add_fd(signal_fd_, EPOLLIN);
+}
+
+void webserver::deal_signal_() {
+  char sigs[16];
+  ssize_t len;
+  while ((len = read(signal_fd_, sigs, sizeof(sigs))) > 0) {
+    for (ssize_t i = 0; i < len; ++i) {
+      if (sigs[i] == SIGUSR2) {
+        hot_restart_();
+      } else if (sigs[i] == SIGHUP) {
+        reload_config_();
+      } else if (http_conn::draining) {
+        // a second TERM/INT doesn't wait for the deadline
+        LOG_WARN("signal %d while draining, stopping now", sigs[i]);
+        is_close_ = true;
+      } else {
+        LOG_INFO("signal %d, shutting down", sigs[i]);
+        drain_();
+      }
+    }
+  }
+}
+
+void webserver::reload_config_() {
+  server_config next;
+  if (!conf_.load(next)) {
+    LOG_ERROR("config reload failed, keeping the current settings");
+    return;
+  }
+  std::vector<config::change> changes = config::merge_live(cfg_, next);
+  bool preload_changed = false;
+  for (const config::change &item : changes) {
+    if (item.live) {
+      LOG_INFO("config reload: %s = %s", item.key, item.value.c_str());
+      preload_changed |= strncmp(item.key, "preload_", 8) == 0;
+    } else {
+      LOG_WARN("config reload: %s changed, needs a restart", item.key);
+    }
+  }
+  LOG_INFO("config reloaded, %zu settings changed", changes.size());
+  log::instance()->set_level(cfg_.log_level);
+  sql_connpool::instance()->set_wait_ms(cfg_.sql_wait_ms);
+  threadpool_->set_max_threads(threads_max_());
+  conn_limiter::instance()->init(cfg_.max_conn_per_ip);
+  rate_limiter::instance()->init(cfg_.rate_requests, cfg_.rate_request_burst,
+                                 cfg_.rate_bytes, cfg_.rate_byte_burst);
+  session_store::instance()->init(cfg_.session_ttl_s, cfg_.max_sessions);
+  password_hasher::instance()->set_iterations(cfg_.hash_iterations);
+  register_writer::instance()->set_window_ms(cfg_.register_batch_ms);
+  user_handler::set_cache(cfg_.micro_cache_ms, cfg_.micro_cache_stale_ms,
+                          cfg_.micro_cache_entries);
+  path_resolver::instance()->set_max(cfg_.path_cache);
+  apply_ws_limits_();
+  if (cfg_.ws_ping_ms > 0) {
+    timer_->add(WS_TIMER_, cfg_.ws_ping_ms, [this]() { ping_websockets_(); });
+  }
+  if (preload_changed) {
+    resource_index::instance()->set_preload(cfg_.preload_max,
+                                            cfg_.preload_budget);
+    submit_([]() { resource_index::instance()->reload(); });
+  }
+}
+
+void webserver::drain_() {
+  if (http_conn::draining) {
+    return;
+  }
+  http_conn::draining = true;
+  drain_start_ = std::chrono::steady_clock::now();
+  for (int *fd : {&listen_fd_, &tls_listen_fd_}) {
+    if (*fd >= 0) {
+      epoller_->del_fd(*fd);
+      close(*fd);
+      *fd = -1;
+    }
+  }
+  LOG_INFO("draining, user_count:%d", http_conn::user_count.load());
+  timer_->add(SHUTDOWN_TIMER_, cfg_.drain_ms, [this]() {
+    LOG_WARN("drain deadline passed, dropping %d connections",
+             http_conn::user_count.load());
+    is_close_ = true;
+  });
+  sweep_idle_();
+}
+
+// only shutdown() here: the fd stays valid for any worker still touching
+// it, and the hangup event closes the connection on this thread
+void webserver::sweep_idle_() {
+  if (std::chrono::steady_clock::now() - drain_start_ >=
+      std::chrono::milliseconds(DRAIN_IDLE_GRACE_MS_)) {
+    for (auto &[fd, client] : users_) {
+      if (client.fd() >= 0 && client.is_idle()) {
+        shutdown(fd, SHUT_RDWR);
+      }
+    }
+  }
+  if (http_conn::user_count == 0) {
+    is_close_ = true;
+    return;
+  }
+  timer_->add(DRAIN_TIMER_, DRAIN_CHECK_MS_, [this]() { sweep_idle_(); });
+}
+
+void webserver::hot_restart_() {
+  if (http_conn::draining || handoff_fd_ >= 0) {
+    LOG_WARN("hot restart already in progress");
+    return;
+  }
+  // same binary path and arguments as this process; /proc/self/exe would
+  // still name the old binary after a deploy has replaced it
+  std::string cmdline;
+  int cmd_fd = open("/proc/self/cmdline", O_RDONLY | O_CLOEXEC);
+  if (cmd_fd >= 0) {
+    char chunk[4096];
+    ssize_t len;
+    while ((len = read(cmd_fd, chunk, sizeof(chunk))) > 0) {
+      cmdline.append(chunk, len);
+    }
+    close(cmd_fd);
+  }
+  std::vector<char *> argv;
+  for (size_t pos = 0; pos < cmdline.size();
+       pos = cmdline.find('\0', pos) + 1) {
+    argv.push_back(&cmdline[pos]);
+  }
+  char exe[PATH_MAX];
+  if (!argv.empty() && strchr(argv[0], '/')) {
+    snprintf(exe, sizeof(exe), "%s", argv[0]);
+  } else {
+    ssize_t exe_len = readlink("/proc/self/exe", exe, sizeof(exe) - 1);
+    if (exe_len <= 0) {
+      LOG_ERROR("hot restart: readlink error: %d", errno);
+      return;
+    }
+    exe[exe_len] = '\0';
+  }
+  if (argv.empty()) {
+    argv.push_back(exe);
+  }
+  argv.push_back(nullptr);
+
+  int sv[2];
+  if (socketpair(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0, sv) < 0) {
+    LOG_ERROR("hot restart: socketpair error: %d", errno);
+    return;
+  }
+  std::string handoff = std::string(HANDOFF_ENV_) + "=" + std::to_string(sv[1]);
+  std::vector<char *> envp;
+  size_t env_name_len = strlen(HANDOFF_ENV_);
+  for (char **env = environ; *env; ++env) {
+    if (strncmp(*env, HANDOFF_ENV_, env_name_len) != 0) {
+      envp.push_back(*env);
+    }
+  }
+  envp.push_back(handoff.data());
+  envp.push_back(nullptr);
+
+  // everything is prepared before fork(): the child of a threaded process
+  // may only make async-signal-safe calls until it execs
+  pid_t pid = fork();
+  if (pid == 0) {
+    fcntl(sv[1], F_SETFD, 0);
+    execve(exe, argv.data(), envp.data());
+    _exit(127);
+  }
+  close(sv[1]);
+  if (pid < 0 || !send_listeners_(sv[0])) {
+    LOG_ERROR("hot restart: start new process error: %d", errno);
+    close(sv[0]);
+    return;
+  }
+  handoff_fd_ = sv[0];
+  epoller_->add_fd(handoff_fd_, EPOLLIN);
+  LOG_INFO("hot restart: started pid %d", pid);
+}
+
+// the new process writes one byte when it is serving, or exits
+void webserver::deal_handoff_() {
+  char ready = 0;
+  ssize_t len = read(handoff_fd_, &ready, 1);
+  epoller_->del_fd(handoff_fd_);
+  close(handoff_fd_);
+  handoff_fd_ = -1;
+  if (len == 1 && ready == 'R') {
+    LOG_INFO("hot restart: new process is up");
+    drain_();
+  } else {
+    LOG_ERROR("hot restart: new process failed, still serving");
+    waitpid(-1, nullptr, WNOHANG);
+  }
+}
+
+bool webserver::send_listeners_(int sock) {
+  int fds[2];
+  int count = 0;
+  for (int fd : {listen_fd_, tls_listen_fd_}) {
+    if (fd >= 0) {
+      fds[count++] = fd;
+    }
+  }
+  char cmsg_buf[CMSG_SPACE(sizeof(fds))] = {};
+  char count_byte = count;
+  iovec iov = {&count_byte, 1};
+  msghdr msg = {};
+  msg.msg_iov = &iov;
+  msg.msg_iovlen = 1;
+  msg.msg_control = cmsg_buf;
+  msg.msg_controllen = CMSG_SPACE(sizeof(int) * count);
+  cmsghdr *cmsg = CMSG_FIRSTHDR(&msg);
+  cmsg->cmsg_level = SOL_SOCKET;
+  cmsg->cmsg_type = SCM_RIGHTS;
+  cmsg->cmsg_len = CMSG_LEN(sizeof(int) * count);
+  memcpy(CMSG_DATA(cmsg), fds, sizeof(int) * count);
+  return sendmsg(sock, &msg, MSG_NOSIGNAL) == 1;
+}
+
+// matches the received sockets to the configured port and tls_port by their
+// bound port; any other port is closed
+bool webserver::recv_listeners_(int sock) {
+  int fds[2];
+  char cmsg_buf[CMSG_SPACE(sizeof(fds))] = {};
+  char count_byte = 0;
+  iovec iov = {&count_byte, 1};
+  msghdr msg = {};
+  msg.msg_iov = &iov;
+  msg.msg_iovlen = 1;
+  msg.msg_control = cmsg_buf;
+  msg.msg_controllen = sizeof(cmsg_buf);
+  if (recvmsg(sock, &msg, MSG_CMSG_CLOEXEC) != 1) {
+    return false;
+  }
+  cmsghdr *cmsg = CMSG_FIRSTHDR(&msg);
+  if (!cmsg || cmsg->cmsg_level != SOL_SOCKET ||
+      cmsg->cmsg_type != SCM_RIGHTS) {
+    return false;
+  }
+  int count = std::min<size_t>((cmsg->cmsg_len - CMSG_LEN(0)) / sizeof(int),
+                               sizeof(fds) / sizeof(int));
+  memcpy(fds, CMSG_DATA(cmsg), sizeof(int) * count);
+  for (int i = 0; i < count; ++i) {
+    sockaddr_in addr;
+    socklen_t len = sizeof(addr);
+    int port = getsockname(fds[i], (sockaddr *)&addr, &len) == 0
+                   ? ntohs(addr.sin_port)
+                   : -1;
+    int *target = port == cfg_.port ? &listen_fd_
+                  : cfg_.tls_port > 0 && port == cfg_.tls_port ? &tls_listen_fd_
+                                                      : nullptr;
+    if (!target || *target >= 0 ||
+        !epoller_->add_fd(fds[i], listen_event_ | EPOLLIN)) {
+      close(fds[i]);
+      continue;
+    }
+    // the new configuration's tuning; the old process's is inherited
+    socket_options::tune_listener(fds[i], cfg_);
+    *target = fds[i];
+  }
+  return listen_fd_ >= 0;
+}
+
 void webserver::start() {
   int time_ms = -1;
-  if (is_close_) {
+  if (!is_close_) {
     LOG_INFO("========== server start ==========");
   }
+  // a hot-restarted process is serving now; the old one can drain
+  if (handoff_fd_ >= 0) {
+    if (!is_close_) {
+      ::write(handoff_fd_, "R", 1);
+    }
+    close(handoff_fd_);
+    handoff_fd_ = -1;
+  }
+  if (reactor_cpu_ >= 0 && !cpu_topology::pin_self(reactor_cpu_)) {
+    LOG_WARN("pin event loop to cpu %d error", reactor_cpu_);
+  }
+  refresh_date_();
+  expire_sessions_();
+  if (!upstreams_.empty() && cfg_.proxy_health_ms > 0) {
+    check_upstreams_();
+  }
+  if (cfg_.ws_ping_ms > 0) {
+    timer_->add(WS_TIMER_, cfg_.ws_ping_ms, [this]() { ping_websockets_(); });
+  }
   while (!is_close_) {
-    if (timeout_ms_ > 0) {
-      time_ms = timer_->get_next_tick();
+    time_ms = timer_->get_next_tick();
+    if (!deferred_.empty()) {
+      run_deferred_();
+    }
+    if (!deferred_.empty() &&
+        (time_ms < 0 || time_ms > DEFERRED_RETRY_MS_)) {
+      time_ms = DEFERRED_RETRY_MS_;
     }
     int event_cnt = epoller_->wait(time_ms);
     for (int i = 0; i < event_cnt; ++i) {
       int fd = epoller_->event_fd(i);
       uint32_t events = epoller_->events(i);
-      if (fd == listen_fd_) {
-        deal_listen_();
+      if (fd == listen_fd_ || fd == tls_listen_fd_) {
+        deal_listen_(fd);
+      } else if (fd == index_fd_) {
+        deal_index_change_();
+      } else if (fd == signal_fd_) {
+        deal_signal_();
+      } else if (fd == handoff_fd_) {
+        deal_handoff_();
+      } else if (int owner = fd < MAX_FD_ ? upstream_owner_[fd].load() : 0) {
+        deal_upstream_(&users_[owner - 1]);
       } else if (events & (EPOLLRDHUP | EPOLLHUP | EPOLLERR)) {
         close_conn_(&users_[fd]);
       } else if (events & EPOLLIN) {
@@ -263,4 +1110,8 @@ void webserver::start() {
       }
     }
   }
+  LOG_INFO("========== server stop ==========");
+  if (log::instance()->is_open()) {
+    log::instance()->close();
+  }
 }
\ No newline at end of file
@@ -0,0 +1,83 @@
+#include "ws_hub.h"
+
+#include <algorithm>
+#include <mutex>
+
+#include "log.h"
+
+ws_hub *ws_hub::instance() {
+  static ws_hub inst;
+  return &inst;
+}
+
+void ws_hub::subscribe(const std::string &channel,
+                       const std::shared_ptr<ws_session> &session) {
+  std::unique_lock<std::shared_mutex> locker(mtx_);
+  std::vector<std::string> &joined = session->channels();
+  if (std::find(joined.begin(), joined.end(), channel) != joined.end()) {
+    return;
+  }
+  joined.push_back(channel);
+  channels_[channel].push_back(session);
+  sessions_.emplace(session.get(), session);
+}
+
+void ws_hub::remove(ws_session *session) {
+  std::unique_lock<std::shared_mutex> locker(mtx_);
+  for (const std::string &channel : session->channels()) {
+    auto it = channels_.find(channel);
+    if (it == channels_.end()) {
+      continue;
+    }
+    std::vector<std::shared_ptr<ws_session>> &members = it->second;
+    // order doesn't matter, the last one takes the gap
+    for (size_t i = 0; i < members.size(); ++i) {
+      if (members[i].get() == session) {
+        members[i] = std::move(members.back());
+        members.pop_back();
+        break;
+      }
+    }
+    if (members.empty()) {
+      channels_.erase(it);
+    }
+  }
+  session->channels().clear();
+  sessions_.erase(session);
+}
+
+size_t ws_hub::publish(const std::string &channel, std::string_view payload,
+                       bool binary) {
+  ws_session::frame f = ws_session::make_frame(
+      binary ? ws_session::BINARY : ws_session::TEXT, payload);
+  std::shared_lock<std::shared_mutex> locker(mtx_);
+  auto it = channels_.find(channel);
+  if (it == channels_.end()) {
+    return 0;
+  }
+  size_t reached = 0;
+  for (const auto &session : it->second) {
+    reached += session->send(f);
+  }
+  return reached;
+}
+
+void ws_hub::ping_all() {
+  ws_session::frame f = ws_session::make_frame(ws_session::PING, {});
+  size_t dropped = 0;
+  std::shared_lock<std::shared_mutex> locker(mtx_);
+  for (const auto &[ptr, session] : sessions_) {
+    if (!session->ping(f)) {
+      session->drop();
+      ++dropped;
+    }
+  }
+  if (dropped) {
+    LOG_INFO("dropped %zu silent websockets", dropped);
+  }
+}
+
+size_t ws_hub::size() {
+  std::shared_lock<std::shared_mutex> locker(mtx_);
+  return sessions_.size();
+}
@@ -0,0 +1,344 @@
+#include "ws_session.h"
+
+#include <openssl/evp.h>
+#include <openssl/sha.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+
+#include <cstring>
+
+#if defined(__AVX2__) || defined(__SSE2__)
+#include <immintrin.h>
+#endif
+
+#include "log.h"
+
+std::function<void(int, bool)> ws_session::arm;
+std::atomic<size_t> ws_session::max_message{64 * 1024};
+std::atomic<size_t> ws_session::max_queued{1 << 20};
+
+namespace {
+
+constexpr std::string_view HANDSHAKE_GUID =
+    "258EAFA5-E914-47DA-95CA-C5AB0DC85B11";
+
+}  // namespace
+
+ws_session::ws_session(int fd, message_callback on_message)
+    : fd_(fd), on_message_(std::move(on_message)) {}
+
+std::string ws_session::accept_key(std::string_view key) {
+  std::string text(key);
+  text += HANDSHAKE_GUID;
+  unsigned char digest[SHA_DIGEST_LENGTH];
+  SHA1(reinterpret_cast<const unsigned char *>(text.data()), text.size(),
+       digest);
+  // 20 bytes are 28 base64 characters, plus the NUL EVP writes
+  char encoded[32];
+  int len = EVP_EncodeBlock(reinterpret_cast<unsigned char *>(encoded), digest,
+                            sizeof(digest));
+  return std::string(encoded, len);
+}
+
+ws_session::frame ws_session::make_frame(OPCODE opcode,
+                                         std::string_view payload) {
+  auto out = std::make_shared<std::string>();
+  out->reserve(payload.size() + 10);
+  out->push_back(static_cast<char>(0x80 | opcode));
+  size_t len = payload.size();
+  if (len < 126) {
+    out->push_back(static_cast<char>(len));
+  } else if (len <= 0xffff) {
+    out->push_back(126);
+    out->push_back(static_cast<char>(len >> 8));
+    out->push_back(static_cast<char>(len));
+  } else {
+    out->push_back(127);
+    for (int shift = 56; shift >= 0; shift -= 8) {
+      out->push_back(static_cast<char>(static_cast<uint64_t>(len) >> shift));
+    }
+  }
+  out->append(payload);
+  return out;
+}
+
+// the key repeats every 4 bytes, so it is widened to the vector width and
+// xored in whole registers; the tail starts at a multiple of 4 and keeps
+// the byte order
+void ws_session::unmask(char *data, size_t len, const uint8_t key[4]) {
+  uint32_t key32;
+  memcpy(&key32, key, 4);
+  size_t i = 0;
+#if defined(__AVX2__)
+  __m256i wide = _mm256_set1_epi32(static_cast<int>(key32));
+  for (; i + 32 <= len; i += 32) {
+    __m256i *at = reinterpret_cast<__m256i *>(data + i);
+    _mm256_storeu_si256(at, _mm256_xor_si256(_mm256_loadu_si256(at), wide));
+  }
+#endif
+#if defined(__SSE2__)
+  __m128i narrow = _mm_set1_epi32(static_cast<int>(key32));
+  for (; i + 16 <= len; i += 16) {
+    __m128i *at = reinterpret_cast<__m128i *>(data + i);
+    _mm_storeu_si128(at, _mm_xor_si128(_mm_loadu_si128(at), narrow));
+  }
+#endif
+  uint64_t key64 = static_cast<uint64_t>(key32) << 32 | key32;
+  for (; i + 8 <= len; i += 8) {
+    uint64_t word;
+    memcpy(&word, data + i, 8);
+    word ^= key64;
+    memcpy(data + i, &word, 8);
+  }
+  for (; i < len; ++i) {
+    data[i] ^= key[i & 3];
+  }
+}
+
+size_t ws_session::parse_header_(const buffer &in) {
+  size_t avail = in.readable_bytes();
+  if (avail < 2) {
+    return 0;
+  }
+  const uint8_t *p = reinterpret_cast<const uint8_t *>(in.peek());
+  size_t len7 = p[1] & 0x7f;
+  size_t size = 2 + (len7 == 126 ? 2 : len7 == 127 ? 8 : 0) +
+                (p[1] & 0x80 ? 4 : 0);
+  if (avail < size) {
+    return 0;
+  }
+  fin_ = p[0] & 0x80;
+  rsv_ = p[0] & 0x70;
+  opcode_ = p[0] & 0x0f;
+  masked_ = p[1] & 0x80;
+  payload_len_ = len7;
+  size_t at = 2;
+  if (len7 >= 126) {
+    int bytes = len7 == 126 ? 2 : 8;
+    payload_len_ = 0;
+    for (int i = 0; i < bytes; ++i) {
+      payload_len_ = payload_len_ << 8 | p[at++];
+    }
+  }
+  if (masked_) {
+    memcpy(key_, p + at, 4);
+  }
+  return size;
+}
+
+bool ws_session::on_read(buffer &in) {
+  heard_ = true;
+  while (!closing_) {
+    size_t header = parse_header_(in);
+    if (!header) {
+      break;
+    }
+    bool control = opcode_ & 0x8;
+    // clients must mask every frame
+    if (rsv_ || !masked_) {
+      return fail_(1002);
+    }
+    if (control && (!fin_ || payload_len_ > 125)) {
+      return fail_(1002);
+    }
+    if (!control && (payload_len_ > max_message ||
+                     payload_len_ + message_.size() > max_message)) {
+      return fail_(1009);
+    }
+    if (in.readable_bytes() - header < payload_len_) {
+      break;
+    }
+    in.retrieve(header);
+    size_t len = payload_len_;
+    if (control) {
+      std::string payload(in.peek(), len);
+      in.retrieve(len);
+      unmask(payload.data(), len, key_);
+      if (!on_frame_(opcode_, payload)) {
+        return false;
+      }
+      continue;
+    }
+    if (opcode_ == CONTINUATION ? !message_opcode_
+                                : opcode_ > BINARY || message_opcode_) {
+      return fail_(1002);
+    }
+    if (opcode_ != CONTINUATION) {
+      message_opcode_ = opcode_;
+    }
+    size_t at = message_.size();
+    message_.append(in.peek(), len);
+    in.retrieve(len);
+    unmask(message_.data() + at, len, key_);
+    if (fin_) {
+      if (on_message_) {
+        on_message_(*this, message_, message_opcode_ == BINARY);
+      }
+      message_.clear();
+      message_opcode_ = 0;
+    }
+  }
+  return !closing_;
+}
+
+bool ws_session::on_frame_(uint8_t opcode, std::string_view payload) {
+  switch (opcode) {
+    case CLOSE: {
+      // the client's status is echoed back, then the connection closes
+      uint16_t status = 1000;
+      if (payload.size() >= 2) {
+        status = static_cast<uint8_t>(payload[0]) << 8 |
+                 static_cast<uint8_t>(payload[1]);
+      }
+      send_close_(status);
+      return false;
+    }
+    case PING:
+      send(make_frame(PONG, payload));
+      return true;
+    case PONG:
+      return true;
+    default:
+      return fail_(1002);
+  }
+}
+
+bool ws_session::fail_(uint16_t status) {
+  LOG_DEBUG("websocket[%d] closing with %d", fd_, status);
+  send_close_(status);
+  return false;
+}
+
+void ws_session::send_close_(uint16_t status) {
+  if (closing_) {
+    return;
+  }
+  char payload[2] = {static_cast<char>(status >> 8),
+                     static_cast<char>(status)};
+  send(make_frame(CLOSE, std::string_view(payload, 2)));
+  closing_ = true;
+}
+
+bool ws_session::send(frame f) {
+  std::lock_guard<std::mutex> locker(mtx_);
+  if (closed_ || closing_) {
+    return false;
+  }
+  if (queued_ + f->size() > max_queued) {
+    // a client this far behind would hold on to every broadcast
+    LOG_WARN("websocket[%d] is too slow, dropping it", fd_);
+    drop_();
+    return false;
+  }
+  queued_ += f->size();
+  queue_.push_back(std::move(f));
+  if (parked_) {
+    parked_ = false;
+    arm(fd_, true);
+  }
+  return true;
+}
+
+ssize_t ws_session::write_fd(int fd, int &save_errno) {
+  std::lock_guard<std::mutex> locker(mtx_);
+  iovec iov[IOV_MAX_];
+  int count = 0;
+  for (auto it = queue_.begin(); it != queue_.end() && count < IOV_MAX_;
+       ++it, ++count) {
+    size_t skip = count ? 0 : offset_;
+    iov[count].iov_base = const_cast<char *>((*it)->data() + skip);
+    iov[count].iov_len = (*it)->size() - skip;
+  }
+  if (!count) {
+    return 0;
+  }
+  ssize_t len = writev(fd, iov, count);
+  if (len < 0) {
+    save_errno = errno;
+    return -1;
+  }
+  queued_ -= len;
+  size_t left = len;
+  while (left) {
+    size_t rest = queue_.front()->size() - offset_;
+    if (left < rest) {
+      offset_ += left;
+      break;
+    }
+    left -= rest;
+    offset_ = 0;
+    queue_.pop_front();
+  }
+  return len;
+}
+
+size_t ws_session::take(buffer &out, size_t len) {
+  std::lock_guard<std::mutex> locker(mtx_);
+  size_t taken = 0;
+  while (taken < len && !queue_.empty()) {
+    const std::string &front = *queue_.front();
+    size_t n = std::min(len - taken, front.size() - offset_);
+    out.append(front.data() + offset_, n);
+    taken += n;
+    offset_ += n;
+    if (offset_ == front.size()) {
+      offset_ = 0;
+      queue_.pop_front();
+    }
+  }
+  queued_ -= taken;
+  return taken;
+}
+
+void ws_session::park() {
+  std::lock_guard<std::mutex> locker(mtx_);
+  parked_ = queue_.empty();
+  arm(fd_, !parked_);
+}
+
+void ws_session::close() {
+  std::lock_guard<std::mutex> locker(mtx_);
+  closed_ = true;
+  queue_.clear();
+  queued_ = 0;
+  offset_ = 0;
+}
+
+void ws_session::refuse() {
+  std::unique_lock<std::mutex> io(io_mtx_, std::try_to_lock);
+  std::lock_guard<std::mutex> locker(mtx_);
+  if (io.owns_lock() && !closed_ && !closing_ && offset_ == 0) {
+    // unread frames would turn the close into a reset that loses it
+    char scratch[4096];
+    while (recv(fd_, scratch, sizeof(scratch), MSG_DONTWAIT) > 0) {
+    }
+    const char payload[2] = {0x03, static_cast<char>(0xf5)};
+    frame f = make_frame(CLOSE, std::string_view(payload, 2));
+    ::send(fd_, f->data(), f->size(), MSG_DONTWAIT | MSG_NOSIGNAL);
+  }
+  closing_ = true;
+}
+
+void ws_session::drop() {
+  std::lock_guard<std::mutex> locker(mtx_);
+  drop_();
+}
+
+void ws_session::drop_() {
+  if (closed_) {
+    return;
+  }
+  closed_ = true;
+  queue_.clear();
+  queued_ = 0;
+  offset_ = 0;
+  shutdown(fd_, SHUT_RDWR);
+}
+
+bool ws_session::ping(const frame &ping_frame) {
+  if (!heard_.exchange(false)) {
+    return false;
+  }
+  send(ping_frame);
+  return true;
+}
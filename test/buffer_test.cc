@@ -120,7 +120,12 @@ TEST(BufferTest, EnsureWriteableTest) {
   EXPECT_GE(buf.writeable_bytes(), 0);
 }
 
-int main(int argc, char** argv) {
-  ::testing::InitGoogleTest(&argc, argv);
-  return RUN_ALL_TESTS();
+// Test for taking back the tail of what was appended
+TEST(BufferTest, UnwriteTest) {
+  buffer buf;
+  buf.append("head\r\n\r\nbody");
+  buf.retrieve(2);
+
+  buf.unwrite(4);
+  EXPECT_EQ(buf.retrieve_all_as_string(), "ad\r\n\r\n");
 }
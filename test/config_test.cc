@@ -0,0 +1,92 @@
+#include "config.h"
+
+#include <gtest/gtest.h>
+#include <unistd.h>
+
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <vector>
+
+namespace {
+
+std::string write_config(const char *text) {
+  char path[] = "/tmp/config_testXXXXXX";
+  int fd = mkstemp(path);
+  EXPECT_GE(fd, 0);
+  EXPECT_EQ(write(fd, text, strlen(text)), ssize_t(strlen(text)));
+  close(fd);
+  return path;
+}
+
+bool parse(config &conf, std::vector<std::string> args) {
+  std::vector<char *> argv = {const_cast<char *>("webserver")};
+  for (std::string &arg : args) {
+    argv.push_back(arg.data());
+  }
+  return conf.parse_args(argv.size(), argv.data());
+}
+
+}  // namespace
+
+TEST(ConfigTest, CommandLineOverridesFile) {
+  std::string path = write_config(
+      "# comment\n"
+      "port = 8080\n"
+      "threads = 12   # trailing comment\n"
+      "preload_budget = 16m\n"
+      "sql_user = web\n"
+      "opt_linger = yes\n");
+  config conf;
+  ASSERT_TRUE(parse(conf, {"-c", path, "--threads=3", "--log-level", "2"}));
+  server_config cfg;
+  ASSERT_TRUE(conf.load(cfg));
+  EXPECT_EQ(cfg.port, 8080);
+  EXPECT_EQ(cfg.threads, 3);
+  EXPECT_EQ(cfg.log_level, 2);
+  EXPECT_EQ(cfg.preload_budget, size_t(16) << 20);
+  EXPECT_EQ(cfg.sql_user, "web");
+  EXPECT_TRUE(cfg.opt_linger);
+  EXPECT_EQ(cfg.timeout_ms, server_config().timeout_ms);
+  unlink(path.c_str());
+}
+
+TEST(ConfigTest, RejectsBadInput) {
+  config conf;
+  EXPECT_FALSE(parse(conf, {"--no-such-setting=1"}));
+
+  std::string path = write_config("threads = many\n");
+  config bad_value;
+  ASSERT_TRUE(parse(bad_value, {"-c", path}));
+  server_config cfg;
+  cfg.threads = 7;
+  EXPECT_FALSE(bad_value.load(cfg));
+  // a failed load leaves the settings alone
+  EXPECT_EQ(cfg.threads, 7);
+  unlink(path.c_str());
+
+  config out_of_range;
+  ASSERT_TRUE(parse(out_of_range, {"-c", "/dev/null", "--port=70000"}));
+  EXPECT_FALSE(out_of_range.load(cfg));
+
+  config missing;
+  ASSERT_TRUE(parse(missing, {"-c", "/nonexistent/webserver.conf"}));
+  EXPECT_FALSE(missing.load(cfg));
+}
+
+TEST(ConfigTest, MergeCopiesOnlyLiveSettings) {
+  server_config cur;
+  server_config next;
+  next.timeout_ms = 3000;
+  next.log_level = 3;
+  next.threads = 32;
+  std::vector<config::change> changes = config::merge_live(cur, next);
+  ASSERT_EQ(changes.size(), 3u);
+  EXPECT_EQ(cur.timeout_ms, 3000);
+  EXPECT_EQ(cur.log_level, 3);
+  EXPECT_EQ(cur.threads, server_config().threads);
+  for (const config::change &item : changes) {
+    EXPECT_EQ(item.live, std::string(item.key) != "threads");
+  }
+  EXPECT_TRUE(config::merge_live(cur, cur).empty());
+}
@@ -0,0 +1,39 @@
+#include "header_writer.h"
+
+#include <gtest/gtest.h>
+
+TEST(HeaderWriterTest, FormatsFields) {
+  buffer buff;
+  header_writer(buff)
+      .line("HTTP/1.1 206 Partial Content\r\n")
+      .field("Content-length: ", uint64_t(1) << 40)
+      .field("Content-type: ", "text/html")
+      .content_range(0, 99, 1000)
+      .content_range(1, 0, 1000)
+      .end();
+  EXPECT_EQ(buff.retrieve_all_as_string(),
+            "HTTP/1.1 206 Partial Content\r\n"
+            "Content-length: 1099511627776\r\n"
+            "Content-type: text/html\r\n"
+            "Content-Range: bytes 0-99/1000\r\n"
+            "Content-Range: bytes */1000\r\n\r\n");
+}
+
+TEST(HeaderWriterTest, DateMatchesStrftime) {
+  for (time_t t : {time_t(0), time_t(951782400), time(nullptr)}) {
+    char expect[64], date[header_writer::HTTP_DATE_LEN];
+    tm gmt;
+    gmtime_r(&t, &gmt);
+    strftime(expect, sizeof(expect), "%a, %d %b %Y %H:%M:%S GMT", &gmt);
+    size_t len = header_writer::format_date(t, date);
+    EXPECT_EQ(std::string(date, len), expect);
+  }
+}
+
+TEST(HeaderWriterTest, CachedDate) {
+  header_writer::update_date(784111777);
+  buffer buff;
+  header_writer(buff).date();
+  EXPECT_EQ(buff.retrieve_all_as_string(),
+            "Date: Sun, 06 Nov 1994 08:49:37 GMT\r\n");
+}
@@ -0,0 +1,63 @@
+#include "hpack.h"
+
+#include <gtest/gtest.h>
+
+static std::vector<uint8_t> from_hex(const std::string &hex) {
+  std::vector<uint8_t> bytes;
+  for (size_t i = 0; i + 1 < hex.size(); i += 2) {
+    bytes.push_back(std::stoi(hex.substr(i, 2), nullptr, 16));
+  }
+  return bytes;
+}
+
+// RFC 7541 C.3, requests sharing one dynamic table
+TEST(HpackTest, DecodeWithDynamicTable) {
+  hpack decoder;
+  hpack::header_list headers;
+  auto first = from_hex("828684410f7777772e6578616d706c652e636f6d");
+  ASSERT_TRUE(decoder.decode(first.data(), first.size(), headers));
+  hpack::header_list expect = {{":method", "GET"},
+                               {":scheme", "http"},
+                               {":path", "/"},
+                               {":authority", "www.example.com"}};
+  EXPECT_EQ(headers, expect);
+
+  headers.clear();
+  auto second = from_hex("828684be58086e6f2d6361636865");
+  ASSERT_TRUE(decoder.decode(second.data(), second.size(), headers));
+  expect.emplace_back("cache-control", "no-cache");
+  EXPECT_EQ(headers, expect);
+}
+
+// RFC 7541 C.4.1
+TEST(HpackTest, DecodeHuffman) {
+  hpack decoder;
+  hpack::header_list headers;
+  auto block = from_hex("828684418cf1e3c2e5f23a6ba0ab90f4ff");
+  ASSERT_TRUE(decoder.decode(block.data(), block.size(), headers));
+  ASSERT_EQ(headers.size(), 4);
+  EXPECT_EQ(headers[3].second, "www.example.com");
+}
+
+TEST(HpackTest, EncodeRoundTrip) {
+  hpack::header_list headers = {{":status", "200"},
+                                {":status", "206"},
+                                {"content-type", "text/html"},
+                                {"etag", "\"1-2\""},
+                                {"x-custom", std::string(300, 'a')}};
+  std::string block;
+  hpack::encode(headers, block);
+
+  hpack decoder;
+  hpack::header_list decoded;
+  ASSERT_TRUE(decoder.decode(reinterpret_cast<const uint8_t *>(block.data()),
+                             block.size(), decoded));
+  EXPECT_EQ(decoded, headers);
+}
+
+TEST(HpackTest, TruncatedBlockFails) {
+  hpack decoder;
+  hpack::header_list headers;
+  auto block = from_hex("8286844110");
+  EXPECT_FALSE(decoder.decode(block.data(), block.size(), headers));
+}
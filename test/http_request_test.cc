@@ -0,0 +1,142 @@
+#include "http_request.h"
+
+#include <gtest/gtest.h>
+
+// Feed a request in arbitrary pieces, the way it arrives from the socket
+static bool feed(http_request &request, buffer &buf, const std::string &data,
+                 size_t step) {
+  bool done = false;
+  for (size_t i = 0; i < data.size() && !done; i += step) {
+    buf.append(data.substr(i, step));
+    done = request.parse(buf);
+  }
+  return done;
+}
+
+TEST(HttpRequestTest, HeaderLookupIsCaseInsensitive) {
+  http_request request;
+  request.init();
+  buffer buf;
+  buf.append(
+      "GET /index.html HTTP/1.1\r\nHOST: a\r\nconnection: keep-alive\r\n\r\n");
+
+  EXPECT_TRUE(request.parse(buf));
+  EXPECT_EQ(request.header("Host"), "a");
+  EXPECT_TRUE(request.is_keep_alive());
+}
+
+TEST(HttpRequestTest, ContentLengthBodyInPieces) {
+  http_request request;
+  request.init();
+  buffer buf;
+  std::string body(5000, 'x');
+  std::string data = "POST /up HTTP/1.1\r\ncontent-LENGTH: 5000\r\n\r\n" + body;
+
+  std::string received;
+  request.set_body_callback([&](const char *data, size_t len) {
+    received.append(data, len);
+    return true;
+  });
+  EXPECT_TRUE(feed(request, buf, data, 7));
+  EXPECT_EQ(received, body);
+  EXPECT_EQ(buf.readable_bytes(), 0);
+}
+
+TEST(HttpRequestTest, ChunkedBodyInPieces) {
+  http_request request;
+  request.init();
+  buffer buf;
+  std::string data =
+      "POST /up HTTP/1.1\r\nTransfer-Encoding: chunked\r\n\r\n"
+      "5\r\nhello\r\n6;ext=1\r\n world\r\n0\r\nTrailer: x\r\n\r\n";
+
+  std::string received;
+  request.set_body_callback([&](const char *data, size_t len) {
+    received.append(data, len);
+    return true;
+  });
+  EXPECT_TRUE(feed(request, buf, data, 3));
+  EXPECT_EQ(received, "hello world");
+  EXPECT_EQ(request.error_code(), 0);
+}
+
+TEST(HttpRequestTest, BodyOverLimitIsRejected) {
+  http_request request;
+  request.init();
+  buffer buf;
+  size_t saved = http_request::max_body_size;
+  http_request::max_body_size = 16;
+  buf.append("POST /up HTTP/1.1\r\nContent-Length: 17\r\n\r\n");
+
+  EXPECT_FALSE(request.parse(buf));
+  EXPECT_EQ(request.error_code(), 413);
+  http_request::max_body_size = saved;
+}
+
+TEST(HttpRequestTest, BadChunkSizeIsRejected) {
+  http_request request;
+  request.init();
+  buffer buf;
+  buf.append("POST /up HTTP/1.1\r\nTransfer-Encoding: chunked\r\n\r\nzz\r\n");
+
+  EXPECT_FALSE(request.parse(buf));
+  EXPECT_EQ(request.error_code(), 400);
+}
+
+TEST(HttpRequestTest, HeadCallbackSeesTheHeadBeforeTheBody) {
+  http_request request;
+  buffer buf;
+  size_t saved = http_request::max_body_size;
+  http_request::max_body_size = 16;
+  std::string received;
+  request.set_head_callback([&](http_request &req) {
+    if (req.header("x-allow") != "yes") {
+      return 403;
+    }
+    // a streamed body is past max_body_size's reach
+    req.set_body_callback([&](const char *data, size_t len) {
+      received.append(data, len);
+      return true;
+    });
+    return 0;
+  });
+
+  request.init();
+  buf.append("POST /up HTTP/1.1\r\nContent-Length: 2\r\n\r\nno");
+  EXPECT_FALSE(request.parse(buf));
+  EXPECT_EQ(request.error_code(), 403);
+
+  // kept across init()
+  request.init();
+  buf.retrieve_all();
+  std::string body(100, 'y');
+  EXPECT_TRUE(feed(request, buf,
+                   "POST /up HTTP/1.1\r\nX-Allow: yes\r\nContent-Length: 100"
+                   "\r\n\r\n" + body,
+                   9));
+  EXPECT_EQ(received, body);
+  http_request::max_body_size = saved;
+}
+
+TEST(HttpRequestTest, PipelinedRequestsStayInTheBuffer) {
+  http_request request;
+  request.init();
+  buffer buf;
+  buf.append(
+      "POST /a HTTP/1.1\r\nContent-Length: 2\r\n\r\nhi"
+      "GET /b HTTP/1.1\r\n\r\n"
+      "GET /c HTTP/1.1\r\nHo");
+
+  // each request takes its own bytes and leaves the next one's in place
+  EXPECT_TRUE(request.parse(buf));
+  EXPECT_EQ(request.path(), "/a");
+  request.init();
+  EXPECT_TRUE(request.parse(buf));
+  EXPECT_EQ(request.path(), "/b");
+  request.init();
+  EXPECT_FALSE(request.parse(buf));
+  buf.append("st: a\r\n\r\n");
+  EXPECT_TRUE(request.parse(buf));
+  EXPECT_EQ(request.path(), "/c");
+  EXPECT_EQ(buf.readable_bytes(), 0);
+}
@@ -0,0 +1,126 @@
+#include "http_response.h"
+
+#include <gtest/gtest.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <utime.h>
+
+#include <fstream>
+#include <string>
+
+namespace {
+
+// Sun, 06 Nov 1994 08:49:37 GMT
+const time_t MTIME = 784111777;
+const char *LAST_MODIFIED = "Sun, 06 Nov 1994 08:49:37 GMT";
+
+class HttpResponseTest : public ::testing::Test {
+ protected:
+  void SetUp() override {
+    char tmpl[] = "/tmp/http_response_testXXXXXX";
+    ASSERT_TRUE(mkdtemp(tmpl));
+    dir_ = tmpl;
+    std::ofstream(dir_ + "/f.txt") << std::string(1000, 'x');
+    utimbuf times = {MTIME, MTIME};
+    ASSERT_EQ(utime((dir_ + "/f.txt").c_str(), &times), 0);
+    char tag[http_response::ETAG_LEN];
+    etag_ = http_response::make_etag(MTIME, 1000, tag);
+  }
+  void TearDown() override {
+    unlink((dir_ + "/f.txt").c_str());
+    rmdir(dir_.c_str());
+  }
+
+  // the code of a GET of f.txt; head gets what was written before the body
+  int get(const std::string &range, const std::string &if_range = "",
+          const std::string &if_none_match = "",
+          const std::string &if_modified_since = "") {
+    http_response response;
+    response.init(dir_, "/f.txt", false, 200);
+    response.set_condition(if_none_match, if_modified_since);
+    response.set_range(range, if_range);
+    buffer buff;
+    response.make_response(buff);
+    head_ = buff.retrieve_all_as_string();
+    return response.code();
+  }
+  bool has(const std::string &line) const {
+    return head_.find(line + "\r\n") != std::string::npos;
+  }
+
+  std::string dir_;
+  std::string etag_;
+  std::string head_;
+};
+
+}  // namespace
+
+TEST_F(HttpResponseTest, SingleRanges) {
+  EXPECT_EQ(get(""), 200);
+  EXPECT_TRUE(has("Content-length: 1000"));
+  EXPECT_TRUE(has("Accept-Ranges: bytes"));
+
+  EXPECT_EQ(get("bytes=0-99"), 206);
+  EXPECT_TRUE(has("Content-Range: bytes 0-99/1000"));
+  EXPECT_TRUE(has("Content-length: 100"));
+  EXPECT_EQ(get("bytes=900-"), 206);
+  EXPECT_TRUE(has("Content-Range: bytes 900-999/1000"));
+  // past the end is cut to the end
+  EXPECT_EQ(get("bytes=990-5000"), 206);
+  EXPECT_TRUE(has("Content-Range: bytes 990-999/1000"));
+}
+
+TEST_F(HttpResponseTest, SuffixRanges) {
+  EXPECT_EQ(get("bytes=-100"), 206);
+  EXPECT_TRUE(has("Content-Range: bytes 900-999/1000"));
+  EXPECT_EQ(get("bytes=-5000"), 206);
+  EXPECT_TRUE(has("Content-Range: bytes 0-999/1000"));
+  EXPECT_EQ(get("bytes=-0"), 416);
+  EXPECT_TRUE(has("Content-Range: bytes */1000"));
+  EXPECT_TRUE(has("Content-length: 0"));
+}
+
+TEST_F(HttpResponseTest, UnsatisfiableAndIgnoredRanges) {
+  EXPECT_EQ(get("bytes=1000-"), 416);
+  EXPECT_TRUE(has("Content-Range: bytes */1000"));
+  // anything else malformed or unsupported gets the whole file
+  for (const char *range :
+       {"items=0-99", "bytes=0-1,5-6", "bytes=50-10", "bytes=abc", "bytes=a-b",
+        "bytes=-", "bytes=0x10-", "bytes=99999999999999999999999-",
+        "bytes=-99999999999999999999999"}) {
+    EXPECT_EQ(get(range), 200) << range;
+    EXPECT_TRUE(has("Content-length: 1000")) << range;
+  }
+}
+
+TEST_F(HttpResponseTest, IfRangeNeedsAStrongMatch) {
+  EXPECT_EQ(get("bytes=0-9", etag_), 206);
+  EXPECT_EQ(get("bytes=0-9", LAST_MODIFIED), 206);
+  // a changed file is sent whole
+  EXPECT_EQ(get("bytes=0-9", "\"other\""), 200);
+  EXPECT_EQ(get("bytes=0-9", "W/" + etag_), 200);
+  EXPECT_EQ(get("bytes=0-9", "Sun, 06 Nov 1994 08:49:38 GMT"), 200);
+  EXPECT_EQ(get("bytes=0-9", "yesterday"), 200);
+}
+
+TEST_F(HttpResponseTest, Validators) {
+  EXPECT_EQ(get(""), 200);
+  EXPECT_TRUE(has("ETag: " + etag_));
+  EXPECT_TRUE(has(std::string("Last-Modified: ") + LAST_MODIFIED));
+
+  EXPECT_EQ(get("", "", etag_), 304);
+  EXPECT_TRUE(has("ETag: " + etag_));
+  EXPECT_EQ(get("", "", "\"a\", " + etag_), 304);
+  EXPECT_EQ(get("", "", "W/" + etag_), 304);
+  EXPECT_EQ(get("", "", "*"), 304);
+  EXPECT_EQ(get("", "", "\"a\""), 200);
+  // If-None-Match wins over If-Modified-Since
+  EXPECT_EQ(get("", "", "\"a\"", LAST_MODIFIED), 200);
+
+  EXPECT_EQ(get("", "", "", LAST_MODIFIED), 304);
+  EXPECT_EQ(get("", "", "", "Mon, 07 Nov 1994 00:00:00 GMT"), 304);
+  EXPECT_EQ(get("", "", "", "Sat, 05 Nov 1994 00:00:00 GMT"), 200);
+  EXPECT_EQ(get("", "", "", "not a date"), 200);
+  // a fresh copy means no range either
+  EXPECT_EQ(get("bytes=0-9", "", etag_), 304);
+}
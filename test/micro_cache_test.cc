@@ -0,0 +1,74 @@
+#include "micro_cache.hpp"
+
+#include <gtest/gtest.h>
+
+#include <chrono>
+#include <string>
+#include <thread>
+
+using cache = micro_cache<int>;
+
+TEST(MicroCacheTest, OneComputesTheRestWait) {
+  cache c;
+  c.init(1000, 0, 64);
+  int value = 0;
+  EXPECT_EQ(c.lookup("k", &value), cache::LOOKUP::MISS);
+  // the leader is busy: others wait, or compute themselves if they can't
+  int got = 0, calls = 0;
+  auto wait = [&got, &calls](const int &v) {
+    got = v;
+    ++calls;
+  };
+  EXPECT_EQ(c.lookup("k", &value, wait), cache::LOOKUP::WAIT);
+  EXPECT_EQ(c.lookup("k", &value, wait), cache::LOOKUP::WAIT);
+  EXPECT_EQ(c.lookup("k", &value), cache::LOOKUP::MISS);
+  EXPECT_FALSE(c.peek("k", &value));
+
+  c.fill("k", 7);
+  EXPECT_EQ(calls, 2);
+  EXPECT_EQ(got, 7);
+  EXPECT_EQ(c.lookup("k", &value), cache::LOOKUP::HIT);
+  EXPECT_EQ(value, 7);
+  EXPECT_TRUE(c.peek("k", &value));
+
+  // a result not kept still reaches the waiters
+  EXPECT_EQ(c.lookup("busy", &value), cache::LOOKUP::MISS);
+  EXPECT_EQ(c.lookup("busy", &value, wait), cache::LOOKUP::WAIT);
+  c.fill("busy", 3, false);
+  EXPECT_EQ(got, 3);
+  EXPECT_EQ(c.lookup("busy", &value), cache::LOOKUP::MISS);
+}
+
+TEST(MicroCacheTest, StaleWhileOneRefreshes) {
+  cache c;
+  c.init(100, 5000, 64);
+  int value = 0;
+  ASSERT_EQ(c.lookup("k", &value), cache::LOOKUP::MISS);
+  c.fill("k", 1);
+  std::this_thread::sleep_for(std::chrono::milliseconds(150));
+  EXPECT_FALSE(c.peek("k", &value));
+  // the first to see it stale refreshes it, the rest take the old value
+  EXPECT_EQ(c.lookup("k", &value), cache::LOOKUP::STALE);
+  EXPECT_EQ(value, 1);
+  EXPECT_EQ(c.lookup("k", &value), cache::LOOKUP::HIT);
+  c.fill("k", 2);
+  EXPECT_TRUE(c.peek("k", &value));
+  EXPECT_EQ(value, 2);
+}
+
+TEST(MicroCacheTest, ClearDropsWhatIsBeingComputed) {
+  cache c;
+  c.init(1000, 0, 64);
+  int value = 0, got = 0;
+  ASSERT_EQ(c.lookup("a", &value), cache::LOOKUP::MISS);
+  c.fill("a", 1);
+  ASSERT_EQ(c.lookup("b", &value), cache::LOOKUP::MISS);
+  ASSERT_EQ(c.lookup("b", &value, [&got](const int &v) { got = v; }),
+            cache::LOOKUP::WAIT);
+  c.clear();
+  EXPECT_FALSE(c.peek("a", &value));
+  // worked out before the clear: handed on, not kept
+  c.fill("b", 5);
+  EXPECT_EQ(got, 5);
+  EXPECT_FALSE(c.peek("b", &value));
+}
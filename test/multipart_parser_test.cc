@@ -0,0 +1,105 @@
+#include "multipart_parser.h"
+
+#include <gtest/gtest.h>
+
+#include <string>
+#include <vector>
+
+namespace {
+
+struct recorded {
+  std::vector<multipart_parser::part> parts;
+  std::vector<std::string> bodies;
+  int ends = 0;
+};
+
+multipart_parser::callbacks record(recorded &out) {
+  multipart_parser::callbacks cbs;
+  cbs.on_part = [&out](const multipart_parser::part &part) {
+    out.parts.push_back(part);
+    out.bodies.emplace_back();
+    return true;
+  };
+  cbs.on_data = [&out](const char *data, size_t len) {
+    out.bodies.back().append(data, len);
+    return true;
+  };
+  cbs.on_part_end = [&out]() {
+    ++out.ends;
+    return true;
+  };
+  return cbs;
+}
+
+// a file whose bytes come close to the boundary without being it
+const std::string FILE_DATA = std::string("\r\n--XyY\r\n--Xy\r\r\n-") +
+                              std::string(3000, '\0') + "\r\n--Xy";
+
+const std::string BODY =
+    "preamble\r\n"
+    "--XyZ\r\n"
+    "Content-Disposition: form-data; name=\"title\"\r\n"
+    "\r\n"
+    "holiday\r\n"
+    "--XyZ\r\n"
+    "Content-Disposition: form-data; name=\"photo\"; "
+    "filename=\"a \\\"b\\\".jpg\"\r\n"
+    "Content-Type: image/jpeg\r\n"
+    "\r\n" +
+    FILE_DATA +
+    "\r\n"
+    "--XyZ--\r\n"
+    "epilogue";
+
+}  // namespace
+
+TEST(MultipartParserTest, BoundaryFromContentType) {
+  EXPECT_EQ(multipart_parser::boundary_of(
+                "multipart/form-data; boundary=----WebKitFormBoundary7MA"),
+            "----WebKitFormBoundary7MA");
+  EXPECT_EQ(multipart_parser::boundary_of(
+                "Multipart/Form-Data; charset=utf-8; boundary=\"a;b\""),
+            "a;b");
+  EXPECT_EQ(multipart_parser::boundary_of("text/plain; boundary=x"), "");
+  EXPECT_EQ(multipart_parser::boundary_of("multipart/form-data"), "");
+}
+
+TEST(MultipartParserTest, SameResultHoweverTheBodyIsSplit) {
+  for (size_t step : {1, 2, 5, 7, 64, 4096}) {
+    recorded out;
+    multipart_parser parser("XyZ", record(out));
+    for (size_t at = 0; at < BODY.size(); at += step) {
+      std::string piece = BODY.substr(at, step);
+      ASSERT_TRUE(parser.feed(piece.data(), piece.size())) << step;
+    }
+    EXPECT_TRUE(parser.is_done()) << step;
+    ASSERT_EQ(out.parts.size(), 2u) << step;
+    EXPECT_EQ(out.ends, 2);
+    EXPECT_EQ(out.parts[0].name, "title");
+    EXPECT_EQ(out.parts[0].filename, "");
+    EXPECT_EQ(out.bodies[0], "holiday");
+    EXPECT_EQ(out.parts[1].name, "photo");
+    EXPECT_EQ(out.parts[1].filename, "a \"b\".jpg");
+    EXPECT_EQ(out.parts[1].type, "image/jpeg");
+    EXPECT_EQ(out.bodies[1], FILE_DATA);
+  }
+}
+
+TEST(MultipartParserTest, RefusesMalformedBodies) {
+  recorded out;
+  // a part with no name
+  std::string unnamed =
+      "--XyZ\r\nContent-Disposition: form-data\r\n\r\nx\r\n--XyZ--";
+  multipart_parser parser("XyZ", record(out));
+  EXPECT_FALSE(parser.feed(unnamed.data(), unnamed.size()));
+
+  // junk right after a boundary
+  std::string junk = "--XyZjunk\r\n";
+  multipart_parser second("XyZ", record(out));
+  EXPECT_FALSE(second.feed(junk.data(), junk.size()));
+
+  // a header section that never ends
+  std::string endless = "--XyZ\r\nX-Pad: " + std::string(10000, 'p');
+  multipart_parser third("XyZ", record(out));
+  EXPECT_FALSE(third.feed(endless.data(), endless.size()));
+}
@@ -0,0 +1,46 @@
+#include "password_hasher.h"
+
+#include <gtest/gtest.h>
+
+#include <atomic>
+#include <chrono>
+#include <string>
+#include <thread>
+
+TEST(PasswordHasherTest, HashAndCheck) {
+  password_hasher *hasher = password_hasher::instance();
+  hasher->set_iterations(1000);
+  std::string stored = hasher->hash("secret");
+  EXPECT_EQ(stored.rfind("pbkdf2_sha256$1000$", 0), 0u);
+  // salted: the same password never hashes the same twice
+  EXPECT_NE(hasher->hash("secret"), stored);
+  EXPECT_TRUE(password_hasher::check("secret", stored));
+  EXPECT_FALSE(password_hasher::check("Secret", stored));
+  EXPECT_FALSE(password_hasher::check("secret", stored.substr(0, 30)));
+  // rows from before hashing
+  EXPECT_TRUE(password_hasher::check("plain", "plain"));
+  EXPECT_FALSE(password_hasher::check("plain", "plain2"));
+}
+
+TEST(PasswordHasherTest, RejectsWhenQueueIsFull) {
+  password_hasher *hasher = password_hasher::instance();
+  hasher->init(1, 2, 1000);
+  std::atomic<bool> release{false};
+  std::atomic<int> done{0};
+  auto task = [&]() {
+    while (!release) {
+      std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+    ++done;
+  };
+  int accepted = 0;
+  for (int i = 0; i < 10; ++i) {
+    accepted += hasher->submit(task);
+  }
+  // one running and two queued at most
+  EXPECT_LE(accepted, 3);
+  EXPECT_TRUE(hasher->is_saturated());
+  release = true;
+  hasher->stop();
+  EXPECT_EQ(done.load(), accepted);
+}
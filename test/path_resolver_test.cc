@@ -0,0 +1,70 @@
+#include "path_resolver.h"
+
+#include <gtest/gtest.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include <fstream>
+#include <string>
+
+namespace {
+
+std::string canonical(std::string_view path) {
+  std::string out;
+  return path_resolver::canonicalize(path, &out) ? out : "<bad>";
+}
+
+}  // namespace
+
+TEST(PathResolverTest, Canonicalize) {
+  EXPECT_EQ(canonical("/"), "/");
+  EXPECT_EQ(canonical("/index.html"), "/index.html");
+  EXPECT_EQ(canonical("//a///b"), "/a/b");
+  EXPECT_EQ(canonical("/a/./b/"), "/a/b/");
+  EXPECT_EQ(canonical("/a/b/.."), "/a/");
+  EXPECT_EQ(canonical("/a/../../a"), "<bad>");
+  EXPECT_EQ(canonical("/a%20b.html"), "/a b.html");
+  EXPECT_EQ(canonical("/%2e%2E/etc/passwd"), "<bad>");
+  EXPECT_EQ(canonical("/a/..%2f..%2fetc"), "<bad>");
+  EXPECT_EQ(canonical("/a%2Fb"), "/a/b");
+  EXPECT_EQ(canonical("/a%00.html"), "<bad>");
+  EXPECT_EQ(canonical("/a%2"), "<bad>");
+  EXPECT_EQ(canonical("/a%zz"), "<bad>");
+  EXPECT_EQ(canonical("a.html"), "<bad>");
+  EXPECT_EQ(canonical(""), "<bad>");
+}
+
+TEST(PathResolverTest, RefusesSymlinksOutOfTheTree) {
+  char dir[] = "/tmp/path_resolver_XXXXXX";
+  ASSERT_TRUE(mkdtemp(dir));
+  std::string root = dir;
+  std::ofstream(root + "/in.html") << "x";
+  ASSERT_EQ(symlink("/etc/passwd", (root + "/out").c_str()), 0);
+  ASSERT_EQ(symlink("in.html", (root + "/alias").c_str()), 0);
+
+  path_resolver *resolver = path_resolver::instance();
+  resolver->init(root + "/", 64);
+  std::string path;
+  EXPECT_EQ(resolver->resolve("/in.html?v=2", &path), 0);
+  EXPECT_EQ(path, "/in.html");
+  EXPECT_EQ(resolver->resolve("http://host/a/../in.html", &path), 0);
+  EXPECT_EQ(path, "/in.html");
+  EXPECT_EQ(resolver->resolve("/alias", &path), 0);
+  EXPECT_EQ(resolver->resolve("/", &path), 0);
+  EXPECT_EQ(resolver->resolve("/missing", &path), 0);
+  EXPECT_EQ(resolver->resolve("/out", &path), 403);
+  EXPECT_EQ(resolver->resolve("/../in.html", &path), 400);
+
+  // cached until the tree changes
+  unlink((root + "/out").c_str());
+  ASSERT_EQ(symlink("in.html", (root + "/out").c_str()), 0);
+  EXPECT_EQ(resolver->resolve("/out", &path), 403);
+  resolver->clear();
+  EXPECT_EQ(resolver->resolve("/out", &path), 0);
+
+  for (const char *name : {"/in.html", "/out", "/alias"}) {
+    unlink((root + name).c_str());
+  }
+  rmdir(dir);
+  resolver->init("", 0);
+}
@@ -0,0 +1,157 @@
+#include "proxy_exchange.h"
+
+#include <arpa/inet.h>
+#include <gtest/gtest.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <atomic>
+#include <memory>
+#include <string>
+#include <thread>
+
+#include "upstream.h"
+
+namespace {
+
+// a keep-alive backend on a loopback port, one connection at a time
+class stub_backend {
+ public:
+  stub_backend() {
+    listen_fd_ = socket(AF_INET, SOCK_STREAM, 0);
+    sockaddr_in addr = {};
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    bind(listen_fd_, (sockaddr *)&addr, sizeof(addr));
+    socklen_t len = sizeof(addr);
+    getsockname(listen_fd_, (sockaddr *)&addr, &len);
+    port_ = ntohs(addr.sin_port);
+    listen(listen_fd_, 8);
+    thread_ = std::thread([this]() { run_(); });
+  }
+  ~stub_backend() {
+    shutdown(listen_fd_, SHUT_RDWR);
+    close(listen_fd_);
+    thread_.join();
+  }
+
+  std::string address() const {
+    return "127.0.0.1:" + std::to_string(port_);
+  }
+  int accepted() const { return accepted_; }
+
+ private:
+  void run_() {
+    int fd;
+    while ((fd = accept(listen_fd_, nullptr, nullptr)) >= 0) {
+      ++accepted_;
+      std::string in;
+      char chunk[4096];
+      ssize_t len;
+      while ((len = recv(fd, chunk, sizeof(chunk), 0)) > 0) {
+        in.append(chunk, len);
+        size_t end;
+        while ((end = in.find("\r\n\r\n")) != std::string::npos) {
+          std::string response = respond_(in.substr(0, end));
+          in.erase(0, end + 4);
+          send(fd, response.data(), response.size(), MSG_NOSIGNAL);
+        }
+      }
+      close(fd);
+    }
+  }
+
+  static std::string respond_(const std::string &head) {
+    if (head.starts_with("GET /chunked ")) {
+      return "HTTP/1.1 200 OK\r\nTransfer-Encoding: chunked\r\n\r\n"
+             "5\r\nhello\r\n7;ext=1\r\n, world\r\n0\r\nX-Trailer: 1\r\n\r\n";
+    }
+    if (head.starts_with("GET /continue ")) {
+      return "HTTP/1.1 100 Continue\r\n\r\n"
+             "HTTP/1.1 204 No Content\r\nKeep-Alive: timeout=5\r\n\r\n";
+    }
+    return "HTTP/1.1 200 OK\r\nContent-Length: 5\r\n"
+           "Connection: keep-alive\r\n\r\nplain";
+  }
+
+  int listen_fd_;
+  int port_;
+  std::atomic<int> accepted_{0};
+  std::thread thread_;
+};
+
+std::string get(const std::string &path) {
+  return "GET " + path + " HTTP/1.1\r\nhost: test\r\n\r\n";
+}
+
+}  // namespace
+
+TEST(ProxyExchangeTest, FetchesOverOnePooledConnection) {
+  stub_backend backend;
+  auto group = std::make_shared<upstream>();
+  ASSERT_TRUE(group->init(backend.address(), 4));
+
+  buffer out;
+  proxy_exchange plain(group, get("/plain"), true, false);
+  ASSERT_TRUE(plain.fetch(out, true, 2000));
+  std::string response = out.retrieve_all_as_string();
+  EXPECT_EQ(response.rfind("HTTP/1.1 200 OK\r\n", 0), 0u);
+  EXPECT_NE(response.find("Connection: keep-alive\r\n\r\nplain"),
+            std::string::npos);
+  // the backend's own Connection header is not passed on
+  EXPECT_EQ(response.find("Connection: keep-alive\r\nConnection"),
+            std::string::npos);
+
+  // de-chunked, extensions and trailers dropped, and given a length
+  proxy_exchange chunked(group, get("/chunked"), true, false);
+  ASSERT_TRUE(chunked.fetch(out, false, 2000));
+  response = out.retrieve_all_as_string();
+  EXPECT_EQ(response.find("Transfer-Encoding"), std::string::npos);
+  EXPECT_NE(response.find("Content-Length: 12\r\n"), std::string::npos);
+  EXPECT_NE(response.find("Connection: close\r\n\r\nhello, world"),
+            std::string::npos);
+
+  // the interim response is skipped, and a 204 has no body to wait for
+  proxy_exchange empty(group, get("/continue"), true, false);
+  ASSERT_TRUE(empty.fetch(out, true, 2000));
+  response = out.retrieve_all_as_string();
+  EXPECT_EQ(response.rfind("HTTP/1.1 204 No Content\r\n", 0), 0u);
+  EXPECT_EQ(response.find("Keep-Alive"), std::string::npos);
+
+  EXPECT_EQ(backend.accepted(), 1);
+}
+
+TEST(ProxyExchangeTest, BadGatewayWhenNothingListens) {
+  int port;
+  {
+    // a port that was just free
+    stub_backend gone;
+    port = std::stoi(gone.address().substr(10));
+  }
+  auto group = std::make_shared<upstream>();
+  ASSERT_TRUE(group->init("127.0.0.1:" + std::to_string(port), 4));
+  buffer out;
+  proxy_exchange ex(group, get("/"), true, false);
+  EXPECT_FALSE(ex.fetch(out, true, 2000));
+  EXPECT_EQ(ex.error(), 502);
+  EXPECT_EQ(out.readable_bytes(), 0u);
+}
+
+TEST(UpstreamTest, PicksTheLeastBusyHealthyBackend) {
+  auto group = std::make_shared<upstream>();
+  EXPECT_FALSE(group->init("127.0.0.1:80,nowhere:80", 4));
+  group = std::make_shared<upstream>();
+  ASSERT_TRUE(group->init("127.0.0.1:8001,127.0.0.1:8002", 4));
+  upstream::backend *first = group->pick();
+  upstream::backend *second = group->pick();
+  EXPECT_NE(first, second);
+  // first is free again and second still busy
+  group->release(first, -1, false);
+  EXPECT_EQ(group->pick(), first);
+  group->release(first, -1, false);
+  // a backend that is down only gets requests when all are
+  group->mark_down(first);
+  EXPECT_EQ(group->pick(), second);
+  group->mark_down(second);
+  EXPECT_NE(group->pick(), nullptr);
+}
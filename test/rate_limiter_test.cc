@@ -0,0 +1,64 @@
+#include "rate_limiter.h"
+
+#include <arpa/inet.h>
+#include <gtest/gtest.h>
+
+#include <chrono>
+#include <thread>
+
+TEST(RateLimiterTest, BurstThenRefill) {
+  rate_limiter *limiter = rate_limiter::instance();
+  limiter->init(100, 5, 0, 0);
+  in_addr_t ip = inet_addr("10.0.0.1");
+  for (int i = 0; i < 5; ++i) {
+    EXPECT_TRUE(limiter->allow_request(ip));
+  }
+  EXPECT_FALSE(limiter->allow_request(ip));
+  EXPECT_FALSE(limiter->allow_conn(ip));
+  // other clients have buckets of their own
+  EXPECT_TRUE(limiter->allow_request(inet_addr("10.0.0.2")));
+
+  // 100/s puts one back every 10ms
+  std::this_thread::sleep_for(std::chrono::milliseconds(25));
+  EXPECT_TRUE(limiter->allow_conn(ip));
+  EXPECT_TRUE(limiter->allow_request(ip));
+  EXPECT_TRUE(limiter->allow_request(ip));
+  EXPECT_FALSE(limiter->allow_request(ip));
+}
+
+TEST(RateLimiterTest, ByteDebtHoldsOffRequests) {
+  rate_limiter *limiter = rate_limiter::instance();
+  limiter->init(0, 0, 10000, 10000);
+  in_addr_t ip = inet_addr("10.0.1.1");
+  EXPECT_TRUE(limiter->allow_request(ip));
+  limiter->charge_bytes(ip, 15000);
+  EXPECT_FALSE(limiter->allow_request(ip));
+  // 5000 bytes of debt take half a second to pay back
+  std::this_thread::sleep_for(std::chrono::milliseconds(100));
+  EXPECT_FALSE(limiter->allow_request(ip));
+  std::this_thread::sleep_for(std::chrono::milliseconds(500));
+  EXPECT_TRUE(limiter->allow_request(ip));
+}
+
+TEST(RateLimiterTest, EvictsIdleEntries) {
+  rate_limiter *limiter = rate_limiter::instance();
+  limiter->init(1, 1, 0, 0);
+  in_addr_t ip = inet_addr("10.0.2.1");
+  EXPECT_TRUE(limiter->allow_request(ip));
+  EXPECT_FALSE(limiter->allow_request(ip));
+  std::this_thread::sleep_for(std::chrono::milliseconds(2));
+  // enough other clients to push it out of every probe window
+  for (uint32_t i = 0; i < 200000; ++i) {
+    limiter->allow_request(htonl(0x0b000000 + i));
+  }
+  EXPECT_TRUE(limiter->allow_request(ip));
+}
+
+TEST(RateLimiterTest, OffByDefault) {
+  rate_limiter *limiter = rate_limiter::instance();
+  limiter->init(0, 0, 0, 0);
+  in_addr_t ip = inet_addr("10.0.3.1");
+  for (int i = 0; i < 1000; ++i) {
+    EXPECT_TRUE(limiter->allow_request(ip));
+  }
+}
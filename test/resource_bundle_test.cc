@@ -0,0 +1,118 @@
+#include "resource_bundle.h"
+
+#include <gtest/gtest.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <zlib.h>
+
+#include <cstdlib>
+#include <filesystem>
+#include <fstream>
+#include <string>
+
+namespace fs = std::filesystem;
+
+namespace {
+
+class ResourceBundleTest : public ::testing::Test {
+ protected:
+  void SetUp() override {
+    char tmpl[] = "/tmp/bundle_testXXXXXX";
+    dir_ = mkdtemp(tmpl);
+    fs::create_directories(dir_ + "/tree/css");
+    write_("/tree/css/site.css", std::string(20000, 'a') + "body{}");
+    std::string noise;
+    srand(1);
+    for (int i = 0; i < 9000; ++i) {
+      noise.push_back(static_cast<char>(rand()));
+    }
+    write_("/tree/noise.bin", noise);
+    write_("/tree/empty.txt", "");
+  }
+  void TearDown() override { fs::remove_all(dir_); }
+
+  void write_(const std::string &path, const std::string &data) {
+    std::ofstream(dir_ + path, std::ios::binary) << data;
+    chmod((dir_ + path).c_str(), 0644);
+  }
+
+  const resource_bundle::entry *find_(const resource_bundle &bundle,
+                                      std::string_view path) {
+    for (const auto &entry : bundle.entries()) {
+      if (entry.path == path) {
+        return &entry;
+      }
+    }
+    return nullptr;
+  }
+
+  std::string dir_;
+};
+
+std::string gunzip(const resource_bundle::body &body) {
+  z_stream zs = {};
+  inflateInit2(&zs, 15 + 16);
+  std::string out(1 << 16, '\0');
+  zs.next_in = reinterpret_cast<Bytef *>(const_cast<char *>(body.data));
+  zs.avail_in = body.size;
+  zs.next_out = reinterpret_cast<Bytef *>(out.data());
+  zs.avail_out = out.size();
+  inflate(&zs, Z_FINISH);
+  out.resize(zs.total_out);
+  inflateEnd(&zs);
+  return out;
+}
+
+}  // namespace
+
+TEST_F(ResourceBundleTest, PacksAndMapsTheTree) {
+  std::string path = dir_ + "/site.bundle";
+  std::string error;
+  ASSERT_TRUE(resource_bundle::pack(dir_ + "/tree/", path, &error)) << error;
+  EXPECT_FALSE(fs::exists(path + ".tmp"));
+  auto bundle = resource_bundle::open(path);
+  ASSERT_TRUE(bundle);
+  ASSERT_EQ(bundle->entries().size(), 3u);
+
+  const resource_bundle::entry *css = find_(*bundle, "/css/site.css");
+  ASSERT_TRUE(css);
+  EXPECT_EQ(css->type, "text/css");
+  const resource_bundle::body &plain = css->bodies[resource_bundle::IDENTITY];
+  EXPECT_EQ(std::string(plain.data, plain.size),
+            std::string(20000, 'a') + "body{}");
+  // a page or more starts on a page, for sendfile
+  EXPECT_EQ(plain.offset % resource_bundle::ALIGN, 0);
+  EXPECT_NE(plain.head.find("ETag: " + std::string(plain.etag) + "\r\n"),
+            std::string::npos);
+  EXPECT_NE(plain.head.find("Vary: Accept-Encoding\r\n"), std::string::npos);
+
+  const resource_bundle::body &gz = css->bodies[resource_bundle::GZIP];
+  ASSERT_TRUE(gz.data);
+  EXPECT_LT(gz.size, plain.size / 10);
+  EXPECT_EQ(gunzip(gz), std::string(plain.data, plain.size));
+  EXPECT_NE(gz.etag, plain.etag);
+  EXPECT_NE(gz.head.find("Content-Encoding: gzip\r\n"), std::string::npos);
+  EXPECT_TRUE(css->bodies[resource_bundle::BROTLI].data);
+
+  // random bytes don't compress, so only the identity copy is kept
+  const resource_bundle::entry *noise = find_(*bundle, "/noise.bin");
+  ASSERT_TRUE(noise);
+  EXPECT_FALSE(noise->bodies[resource_bundle::GZIP].data);
+  EXPECT_EQ(noise->bodies[resource_bundle::IDENTITY].head.find("Vary"),
+            std::string::npos);
+
+  const resource_bundle::entry *empty = find_(*bundle, "/empty.txt");
+  ASSERT_TRUE(empty);
+  EXPECT_EQ(empty->bodies[resource_bundle::IDENTITY].size, 0u);
+}
+
+TEST_F(ResourceBundleTest, RefusesDamagedFiles) {
+  std::string path = dir_ + "/site.bundle";
+  ASSERT_TRUE(resource_bundle::pack(dir_ + "/tree", path));
+  EXPECT_FALSE(resource_bundle::open(dir_ + "/missing.bundle"));
+  write_("/foreign.bundle", std::string(4096, 'x'));
+  EXPECT_FALSE(resource_bundle::open(dir_ + "/foreign.bundle"));
+  // cut short inside the bodies
+  ASSERT_EQ(truncate(path.c_str(), 6000), 0);
+  EXPECT_FALSE(resource_bundle::open(path));
+}
@@ -0,0 +1,31 @@
+#include "router.h"
+
+#include <gtest/gtest.h>
+
+class named_handler : public http_handler {
+ public:
+  void handle(http_conn &) const override {}
+};
+
+TEST(RouterTest, ExactBeatsLongestPrefix) {
+  router *r = router::instance();
+  auto fallback = std::make_shared<named_handler>();
+  auto root = std::make_shared<named_handler>();
+  auto api = std::make_shared<named_handler>();
+  auto api_v2 = std::make_shared<named_handler>();
+  auto health = std::make_shared<named_handler>();
+  r->set_fallback(fallback);
+  r->add("/", router::MATCH::EXACT, root);
+  r->add("/api/", router::MATCH::PREFIX, api);
+  r->add("/api/v2/", router::MATCH::PREFIX, api_v2);
+  r->add("/api/health", router::MATCH::EXACT, health);
+
+  EXPECT_EQ(r->route("/"), root.get());
+  EXPECT_EQ(r->route("/index.html"), fallback.get());
+  EXPECT_EQ(r->route("/api"), fallback.get());
+  EXPECT_EQ(r->route("/api/users"), api.get());
+  EXPECT_EQ(r->route("/api/v2/users"), api_v2.get());
+  EXPECT_EQ(r->route("/api/v2"), api.get());
+  EXPECT_EQ(r->route("/api/health"), health.get());
+  EXPECT_EQ(r->route("/api/healthz"), api.get());
+}
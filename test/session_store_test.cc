@@ -0,0 +1,44 @@
+#include "session_store.h"
+
+#include <gtest/gtest.h>
+
+#include <chrono>
+#include <string>
+#include <thread>
+
+TEST(SessionStoreTest, CreateFindRemove) {
+  session_store *store = session_store::instance();
+  store->init(60, 1024);
+  std::string token = store->create("alice");
+  ASSERT_EQ(token.size(), session_store::TOKEN_LEN);
+  EXPECT_NE(store->create("alice"), token);
+
+  std::string user;
+  EXPECT_TRUE(store->find(token, &user));
+  EXPECT_EQ(user, "alice");
+  EXPECT_FALSE(store->find("not-a-token"));
+  EXPECT_FALSE(store->find(std::string(session_store::TOKEN_LEN, '0')));
+
+  store->remove(token);
+  EXPECT_FALSE(store->find(token));
+}
+
+TEST(SessionStoreTest, ExpiresAfterTtl) {
+  session_store *store = session_store::instance();
+  store->init(1, 1024);
+  std::string token = store->create("bob");
+  size_t count = store->size();
+  EXPECT_TRUE(store->find(token));
+  std::this_thread::sleep_for(std::chrono::milliseconds(1100));
+  // refused before the sweep, then swept
+  EXPECT_FALSE(store->find(token));
+  EXPECT_EQ(store->expire(), 1u);
+  EXPECT_EQ(store->size(), count - 1);
+}
+
+TEST(SessionStoreTest, TokenFromCookieHeader) {
+  EXPECT_EQ(session_store::token_of("sid=abc"), "abc");
+  EXPECT_EQ(session_store::token_of("theme=dark; sid=abc; lang=en"), "abc");
+  EXPECT_EQ(session_store::token_of("xsid=abc; sid2=def"), "");
+  EXPECT_EQ(session_store::token_of(""), "");
+}
@@ -0,0 +1,54 @@
+#include "socket_options.h"
+
+#include <arpa/inet.h>
+#include <gtest/gtest.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+namespace {
+
+int get_int(int fd, int level, int name) {
+  int value = -1;
+  socklen_t len = sizeof(value);
+  getsockopt(fd, level, name, &value, &len);
+  return value;
+}
+
+}  // namespace
+
+TEST(SocketOptionsTest, AcceptedSocketsInheritTheTuning) {
+  server_config cfg;
+  cfg.defer_accept_s = 1;
+  cfg.sndbuf = 64 * 1024;
+  int listen_fd = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+  ASSERT_GE(listen_fd, 0);
+  socket_options::tune_listener(listen_fd, cfg);
+  sockaddr_in addr = {};
+  addr.sin_family = AF_INET;
+  addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+  socklen_t len = sizeof(addr);
+  ASSERT_EQ(bind(listen_fd, (sockaddr *)&addr, sizeof(addr)), 0);
+  ASSERT_EQ(listen(listen_fd, 4), 0);
+  ASSERT_EQ(getsockname(listen_fd, (sockaddr *)&addr, &len), 0);
+  EXPECT_GT(get_int(listen_fd, IPPROTO_TCP, TCP_DEFER_ACCEPT), 0);
+
+  int client = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+  ASSERT_EQ(connect(client, (sockaddr *)&addr, sizeof(addr)), 0);
+  // deferred: nothing to accept until the client has sent something
+  ASSERT_EQ(send(client, "x", 1, 0), 1);
+  int fd = accept4(listen_fd, nullptr, nullptr, SOCK_CLOEXEC);
+  ASSERT_GE(fd, 0);
+  EXPECT_EQ(get_int(fd, IPPROTO_TCP, TCP_NODELAY), 1);
+  // the kernel doubles the size it is given, for its bookkeeping
+  EXPECT_EQ(get_int(fd, SOL_SOCKET, SO_SNDBUF), 2 * cfg.sndbuf);
+
+  socket_options::cork(fd, true);
+  EXPECT_EQ(get_int(fd, IPPROTO_TCP, TCP_CORK), 1);
+  socket_options::cork(fd, false);
+  EXPECT_EQ(get_int(fd, IPPROTO_TCP, TCP_CORK), 0);
+  close(fd);
+  close(client);
+  close(listen_fd);
+}
@@ -0,0 +1,39 @@
+#include "static_table.hpp"
+
+#include <gtest/gtest.h>
+
+#include <string>
+
+constexpr auto TYPES = make_static_table<std::string_view, std::string_view>({
+    {".html", "text/html"},
+    {".css", "text/css"},
+    {".js", "text/javascript"},
+    {".png", "image/png"},
+});
+
+static_assert(*TYPES.find(".css") == "text/css");
+static_assert(!TYPES.contains(".cs"));
+
+TEST(StaticTableTest, FindsEveryKey) {
+  for (auto &[key, value] : TYPES) {
+    ASSERT_NE(TYPES.find(key), nullptr);
+    EXPECT_EQ(*TYPES.find(key), value);
+  }
+  std::string key = ".png";
+  EXPECT_EQ(TYPES.get(key, "text/plain"), "image/png");
+  EXPECT_EQ(TYPES.get(".gif", "text/plain"), "text/plain");
+  EXPECT_EQ(TYPES.find(""), nullptr);
+}
+
+TEST(StaticTableTest, IntegerKeys) {
+  constexpr auto codes = make_static_table<int, int>({
+      {200, 0}, {206, 1}, {304, 2}, {400, 3}, {403, 4}, {404, 5}, {416, 6},
+  });
+  for (int code = 100; code < 600; ++code) {
+    const int *value = codes.find(code);
+    EXPECT_EQ(value != nullptr, code == 200 || code == 206 || code == 304 ||
+                                    code == 400 || code == 403 ||
+                                    code == 404 || code == 416);
+  }
+  EXPECT_EQ(codes.get(416, -1), 6);
+}
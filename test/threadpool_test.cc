@@ -0,0 +1,56 @@
+#include "threadpool.h"
+
+#include <gtest/gtest.h>
+
+#include <atomic>
+#include <chrono>
+#include <thread>
+
+TEST(ThreadpoolTest, GrowsWhenWorkersBlock) {
+  threadpool pool(2, 1024, 8);
+  std::atomic<bool> release{false};
+  std::atomic<int> running{0};
+  auto blocker = [&]() {
+    ++running;
+    while (!release) {
+      std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+  };
+  for (int i = 0; i < 2; ++i) {
+    pool.add_task(blocker);
+  }
+  // both workers are stuck, so later tasks wait and the pool adds threads
+  for (int i = 0; i < 200 && running < 6; ++i) {
+    pool.add_task(blocker);
+    std::this_thread::sleep_for(std::chrono::milliseconds(5));
+  }
+  EXPECT_GE(running.load(), 6);
+  EXPECT_LE(pool.thread_count(), 8);
+  release = true;
+}
+
+TEST(ThreadpoolTest, StaysFixedWithoutMax) {
+  threadpool pool(2);
+  std::atomic<bool> release{false};
+  for (int i = 0; i < 10; ++i) {
+    pool.add_task([&release]() {
+      while (!release) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+      }
+    });
+    std::this_thread::sleep_for(std::chrono::milliseconds(5));
+  }
+  EXPECT_EQ(pool.thread_count(), 2);
+  release = true;
+}
+
+TEST(ThreadpoolTest, FinishesQueuedTasksOnDestruction) {
+  std::atomic<int> done{0};
+  {
+    threadpool pool(1);
+    for (int i = 0; i < 100; ++i) {
+      pool.add_task([&done]() { ++done; });
+    }
+  }
+  EXPECT_EQ(done.load(), 100);
+}
@@ -0,0 +1,163 @@
+#include "ws_session.h"
+
+#include <gtest/gtest.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "ws_hub.h"
+
+namespace {
+
+// a masked client frame, as a browser would send it
+std::string client_frame(uint8_t first, const std::string &payload) {
+  const uint8_t key[4] = {0x37, 0xfa, 0x21, 0x3d};
+  std::string out(1, static_cast<char>(first));
+  if (payload.size() < 126) {
+    out.push_back(static_cast<char>(0x80 | payload.size()));
+  } else {
+    out.push_back(static_cast<char>(0x80 | 126));
+    out.push_back(static_cast<char>(payload.size() >> 8));
+    out.push_back(static_cast<char>(payload.size()));
+  }
+  out.append(reinterpret_cast<const char *>(key), 4);
+  for (size_t i = 0; i < payload.size(); ++i) {
+    out.push_back(payload[i] ^ key[i % 4]);
+  }
+  return out;
+}
+
+std::string drain(ws_session &session) {
+  buffer out;
+  session.take(out, 1 << 20);
+  return out.retrieve_all_as_string();
+}
+
+class WsSessionTest : public ::testing::Test {
+ protected:
+  void SetUp() override {
+    ws_session::arm = [](int, bool) {};
+  }
+  void TearDown() override { ws_session::arm = nullptr; }
+};
+
+}  // namespace
+
+TEST_F(WsSessionTest, AcceptKeyFromTheRfc) {
+  EXPECT_EQ(ws_session::accept_key("dGhlIHNhbXBsZSBub25jZQ=="),
+            "s3pPLMBiTxaQ9kYGzzhZRbK+xOo=");
+}
+
+TEST_F(WsSessionTest, UnmaskMatchesBytewise) {
+  const uint8_t key[4] = {0x12, 0x34, 0x56, 0x78};
+  for (size_t len : {0, 1, 3, 4, 7, 8, 15, 16, 17, 31, 32, 33, 100, 1000}) {
+    std::string data(len, '\0');
+    for (size_t i = 0; i < len; ++i) {
+      data[i] = static_cast<char>(i * 7);
+    }
+    std::string want = data;
+    for (size_t i = 0; i < len; ++i) {
+      want[i] ^= key[i % 4];
+    }
+    ws_session::unmask(data.data(), len, key);
+    EXPECT_EQ(data, want) << len;
+  }
+}
+
+TEST_F(WsSessionTest, ParsesMessagesAndAnswersPings) {
+  std::vector<std::string> got;
+  ws_session session(-1, [&got](ws_session &, std::string_view data, bool) {
+    got.emplace_back(data);
+  });
+  buffer in;
+  std::string text(300, 'x');
+  in.append(client_frame(0x81, text));
+  // a fragmented message with a ping in between, the last byte late
+  in.append(client_frame(0x01, "frag"));
+  in.append(client_frame(0x89, "hi"));
+  std::string last = client_frame(0x80, "ment");
+  in.append(last.substr(0, last.size() - 1));
+  EXPECT_TRUE(session.on_read(in));
+  ASSERT_EQ(got.size(), 1u);
+  EXPECT_EQ(got[0], text);
+  EXPECT_EQ(drain(session), std::string("\x8a\x02hi", 4));
+
+  in.append(last.substr(last.size() - 1));
+  EXPECT_TRUE(session.on_read(in));
+  ASSERT_EQ(got.size(), 2u);
+  EXPECT_EQ(got[1], "fragment");
+  EXPECT_EQ(in.readable_bytes(), 0u);
+}
+
+TEST_F(WsSessionTest, ClosesOnUnmaskedFrames) {
+  ws_session session(-1, nullptr);
+  buffer in;
+  in.append(std::string("\x81\x02hi", 4));
+  EXPECT_FALSE(session.on_read(in));
+  EXPECT_TRUE(session.is_closing());
+  // 1002, protocol error
+  EXPECT_EQ(drain(session), std::string("\x88\x02\x03\xea", 4));
+  EXPECT_FALSE(session.send_text("late"));
+}
+
+TEST_F(WsSessionTest, PublishReachesEverySubscriber) {
+  int fds[2];
+  ASSERT_EQ(socketpair(AF_UNIX, SOCK_STREAM, 0, fds), 0);
+  std::vector<std::shared_ptr<ws_session>> sessions;
+  for (int i = 0; i < 8; ++i) {
+    sessions.push_back(std::make_shared<ws_session>(fds[0], nullptr));
+    ws_hub::instance()->subscribe("room", sessions.back());
+  }
+  EXPECT_EQ(ws_hub::instance()->publish("room", "hello"), 8u);
+  EXPECT_EQ(ws_hub::instance()->publish("nobody", "hello"), 0u);
+
+  int err = 0;
+  EXPECT_EQ(sessions[0]->write_fd(fds[0], err), 7);
+  EXPECT_EQ(sessions[0]->queued_bytes(), 0u);
+  char out[16];
+  ASSERT_EQ(read(fds[1], out, sizeof(out)), 7);
+  EXPECT_EQ(std::string(out, 7), "\x81\x05hello");
+
+  for (auto &session : sessions) {
+    session->close();
+    ws_hub::instance()->remove(session.get());
+  }
+  EXPECT_EQ(ws_hub::instance()->size(), 0u);
+  close(fds[0]);
+  close(fds[1]);
+}
+
+TEST_F(WsSessionTest, RefusedWithTryAgainLater) {
+  int fds[2];
+  ASSERT_EQ(socketpair(AF_UNIX, SOCK_STREAM, 0, fds), 0);
+  ws_session session(fds[0], nullptr);
+  ASSERT_EQ(write(fds[1], "unread", 6), 6);
+  session.refuse();
+  EXPECT_TRUE(session.is_closing());
+  EXPECT_FALSE(session.send_text("late"));
+  // 1013, try again later
+  char out[16];
+  ASSERT_EQ(read(fds[1], out, sizeof(out)), 4);
+  EXPECT_EQ(std::string(out, 4), "\x88\x02\x03\xf5");
+  close(fds[0]);
+  close(fds[1]);
+}
+
+TEST_F(WsSessionTest, RefusedMidFrameSendsNothing) {
+  int fds[2];
+  ASSERT_EQ(socketpair(AF_UNIX, SOCK_STREAM, 0, fds), 0);
+  ws_session session(fds[0], nullptr);
+  ASSERT_TRUE(session.send_text(std::string(64, 'x')));
+  // half a frame is on the wire, a close now would land inside it
+  buffer out;
+  ASSERT_EQ(session.take(out, 10), 10u);
+  session.refuse();
+  EXPECT_TRUE(session.is_closing());
+  char in[16];
+  EXPECT_EQ(recv(fds[1], in, sizeof(in), MSG_DONTWAIT), -1);
+  close(fds[0]);
+  close(fds[1]);
+}
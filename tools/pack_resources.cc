@@ -0,0 +1,45 @@
+#include <cstdio>
+#include <string>
+
+#include "resource_bundle.h"
+
+// pack_resources DIR BUNDLE: packs the resource tree for the server's
+// bundle setting. the new bundle is renamed over the old one, so this may
+// write straight to the file a running server serves
+int main(int argc, char *argv[]) {
+  if (argc != 3) {
+    fprintf(stderr, "usage: %s DIR BUNDLE\n", argv[0]);
+    return 1;
+  }
+  std::string error;
+  if (!resource_bundle::pack(argv[1], argv[2], &error)) {
+    fprintf(stderr, "pack_resources: %s\n", error.c_str());
+    return 1;
+  }
+  auto bundle = resource_bundle::open(argv[2]);
+  if (!bundle) {
+    fprintf(stderr, "pack_resources: %s doesn't read back\n", argv[2]);
+    return 1;
+  }
+  size_t total[resource_bundle::ENCODINGS] = {0};
+  for (const resource_bundle::entry &entry : bundle->entries()) {
+    printf("%-40.*s", static_cast<int>(entry.path.size()), entry.path.data());
+    for (int e = resource_bundle::IDENTITY; e < resource_bundle::ENCODINGS;
+         ++e) {
+      const resource_bundle::body &body = entry.bodies[e];
+      if (body.data) {
+        printf(" %s:%zu",
+               resource_bundle::encoding_name(resource_bundle::ENCODING(e))
+                   .data(),
+               body.size);
+        total[e] += body.size;
+      }
+    }
+    printf("\n");
+  }
+  printf("%zu files, %zu bytes (gzip %zu, br %zu), bundle %zu bytes\n",
+         bundle->entries().size(), total[resource_bundle::IDENTITY],
+         total[resource_bundle::GZIP], total[resource_bundle::BROTLI],
+         bundle->size());
+  return 0;
+}